@@ -216,8 +216,9 @@ namespace wire {
         constexpr interval get_min_interval() const { return min_interval_; }
         constexpr interval get_max_interval() const { return max_interval_; }
 
-        // set the handler
-        void handler(const stdext::inplace_function<void(const value&), 16>& cb) {
+        // set the handler, which gets the value and the time
+        // it was sampled at in us (0 if unknown)
+        void handler(const stdext::inplace_function<void(const value&, uint64_t), 16>& cb) {
             cb_ = cb;
         }
         void cancel_handler(const stdext::inplace_function<void(), 16>& cb) {
@@ -226,7 +227,7 @@ namespace wire {
     protected:
         interval min_interval_;
         interval max_interval_;
-        stdext::inplace_function<void(const value& val), 16> cb_;
+        stdext::inplace_function<void(const value& val, uint64_t time), 16> cb_;
         // note: may be invoked even after 
         // subscription object has been deleted if
         // the cancel happened by the destructor
@@ -247,7 +248,7 @@ namespace wire {
 
             void handler(const std::function<void(const T&)>& cb) {
                 tcb_ = cb;
-                sub_->handler([this](const void* val) { tcb_((const T&) *val); });
+                sub_->handler([this](const void* val, uint64_t) { tcb_((const T&) *val); });
             }
         };
 
@@ -68,7 +68,8 @@ namespace wire {
                     return promise<>(promise_status::Resolved);
                 }
 
-                void push(const T& v, int32_t now_time) {
+                // sample is when v was taken, in us
+                void push(const T& v, int32_t now_time, uint64_t sample) {
                     // deal (messily) with timestamp wraparound
                     // should happen around 1/mo but let's make sure
                     // all alarms don't stop working just in case
@@ -81,7 +82,7 @@ namespace wire {
 
                         value val(get_type_class<T>());
                         val.set<T>(v);
-                        cb_(val);
+                        cb_(val, sample);
                     } else {
                         // set an alarm
                         delay_alarm_ = last_time_ + min_interval_;
@@ -94,10 +95,10 @@ namespace wire {
                     }
                 }
 
-                void push_delayed(const T& v, uint32_t now_time) {
+                void push_delayed(const T& v, uint32_t now_time, uint64_t sample) {
                     value val(get_type_class<T>());
                     val.set<T>(v);
-                    cb_(val);
+                    cb_(val, sample);
 
                     last_time_ = delay_alarm_;
                     delay_alarm_ = std::numeric_limits<uint32_t>::max();
@@ -105,10 +106,12 @@ namespace wire {
                                                        : last_time_ + max_interval_;
                 }
 
-                void push_resend(const T& v, int32_t now_time) {
+                // a resend is stamped with the time it goes out,
+                // since it says the value still holds
+                void push_resend(const T& v, int32_t now_time, uint64_t stamp) {
                     value val(get_type_class<T>());
                     val.set<T>(v);
-                    cb_(val);
+                    cb_(val, stamp);
 
                     last_time_ = resend_alarm_;
                     resend_alarm_ = max_interval_ == 0 ? std::numeric_limits<uint32_t>::max()
@@ -116,12 +119,12 @@ namespace wire {
                 }
             };
 
-            publisher(Clock* c) : initialized_(false), last_val_(0), 
+            publisher(Clock* c) : initialized_(false), last_val_(0), last_sample_(0),
                     next_alarm_(std::numeric_limits<uint32_t>::max()),
                     subs_(), clock_(c) {}
 
             publisher(Clock* c, variable<T>* var) : 
-                    initialized_(false), last_val_(0), 
+                    initialized_(false), last_val_(0), last_sample_(0),
                     next_alarm_(std::numeric_limits<uint32_t>::max()),
                     subs_(), clock_(c) {
                 var->set_owner(this);
@@ -147,8 +150,9 @@ namespace wire {
                 if (v == last_val_) return;
                 uint32_t now = clock_->millis();
                 last_val_ = v;
+                last_sample_ = util::micros(clock_);
                 initialized_ = true;
-                for (sub_impl* s : subs_) s->push(v, now);
+                for (sub_impl* s : subs_) s->push(v, now, last_sample_);
             }
 
 
@@ -167,9 +171,10 @@ namespace wire {
             void resume() override {
                 uint32_t now = clock_->millis();
                 if (next_alarm_ < now && initialized_) {
+                    uint64_t stamp = util::micros(clock_);
                     for (sub_impl* i : subs_) {
-                        if (i->delay_alarm_ < now) i->push_delayed(last_val_, now);
-                        if (i->resend_alarm_ < now) i->push_resend(last_val_, now);
+                        if (i->delay_alarm_ < now) i->push_delayed(last_val_, now, last_sample_);
+                        if (i->resend_alarm_ < now) i->push_resend(last_val_, now, stamp);
                     }
                     recalculate_next();
                 }
@@ -194,6 +199,7 @@ namespace wire {
         private:
             bool initialized_;
             T last_val_;
+            uint64_t last_sample_; // when last_val_ was set, in us
             uint32_t next_alarm_;
             std::vector<sub_impl*> subs_;
             Clock* clock_;
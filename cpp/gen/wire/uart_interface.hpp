@@ -79,15 +79,95 @@ namespace wire {
                 write_packet(p);
             }
 
-            void push_update(node::id var_id, const value& v) {
+            // sample is when the value was taken in us, 0 if unknown
+            void push_update(node::id var_id, const value& v, uint64_t sample) {
                 telegraph_stream_Packet p =
                     telegraph_stream_Packet_init_default;
                 p.req_id = var_id;
                 p.which_event = telegraph_stream_Packet_update_tag;
                 v.pack(&p.event.update);
+                p.timestamp = sample;
                 write_packet(p);
             }
 
+            // the changes of a change_subs, replied to
+            // with a bitmap once all of them are done
+            struct changes {
+                uint32_t req_id;
+                uint32_t succeeded;
+                uint8_t pending;
+            };
+
+            // for a change_sub c is nullptr and tag is the req_id,
+            // otherwise tag is the index of the change in c
+            void change_done(changes* c, uint32_t tag, bool success) {
+                if (!c) {
+                    notify_success(tag, success);
+                    return;
+                }
+                if (success) c->succeeded |= (1u << tag);
+                if (--c->pending > 0) return;
+                telegraph_stream_Packet p = telegraph_stream_Packet_init_default;
+                p.req_id = c->req_id;
+                p.which_event = telegraph_stream_Packet_changed_subs_tag;
+                p.event.changed_subs = c->succeeded;
+                write_packet(p);
+                delete c;
+            }
+
+            void change_sub(const telegraph_stream_Subscribe& req, changes* c, uint32_t tag) {
+                // extract the info
+                if (req.var_id > std::numeric_limits<node::id>::max() ||
+                        req.var_id >= table_size_) {
+                    change_done(c, tag, false);
+                    return;
+                }
+                node::id var_id = req.var_id;
+                variable_base* v = (variable_base*) lookup_table_[var_id];
+
+                // check for overflows in the intervals
+                if (!v || req.debounce > std::numeric_limits<interval>::max() ||
+                        req.refresh > std::numeric_limits<interval>::max() ||
+                        req.sub_timeout > std::numeric_limits<interval>::max()) {
+                    change_done(c, tag, false);
+                    return;
+                }
+
+                interval min_int = (interval) req.debounce;
+                interval max_int = (interval) req.refresh;
+                interval timeout = (interval) req.sub_timeout;
+
+                // the callback for when the operation is complete
+                // NOTE: the captures have to fit into the promise callbacks,
+                // which is why the req_id and index share tag
+
+                if (subs_.find(var_id) != subs_.end()) {
+                    auto& sub = subs_.at(var_id);
+                    auto p = sub->change(min_int, max_int, timeout);
+                    // on change completion
+                    p.then([this, c, tag] (promise_status s) {
+                        change_done(c, tag, s == promise_status::Resolved);
+                    });
+                } else {
+                    auto p = v->subscribe(min_int, max_int, timeout);
+                    // on subscribe completion
+                    p.then([this, c, tag, var_id] (promise_status s, subscription_ptr&& sub) {
+                        if (s == promise_status::Resolved) {
+                            // put the subscribe in the subs map
+                            // set the handler to push updates
+                            sub->handler([this, var_id] (const value& v, uint64_t sample) {
+                                push_update(var_id, v, sample);
+                            });
+                            sub->cancel_handler([this, var_id] () {
+                                notify_cancelled(var_id);
+                            });
+                            subs_.emplace(var_id, std::move(sub));
+                        }
+                        change_done(c, tag, s == promise_status::Resolved);
+                    });
+                }
+            }
+
             // called by receive() when we get an event
             void received_packet(const telegraph_stream_Packet& packet) {
                 last_time_ = clock_->millis();
@@ -104,59 +184,17 @@ namespace wire {
                     write_packet(p);
                 } break;
                 case telegraph_stream_Packet_change_sub_tag: {
-                    // extract the info
-                    if (packet.event.change_sub.var_id > 
-                            std::numeric_limits<node::id>::max()) return;
-
-                    node::id var_id = packet.event.change_sub.var_id;
-                    if (var_id >= table_size_) return;
-                    variable_base* v = (variable_base*) lookup_table_[var_id];
-                    if (!v) return;
-
-                    // check for overflows in the intervals
-                    if (packet.event.change_sub.debounce > 
-                            std::numeric_limits<interval>::max()) return;
-                    if (packet.event.change_sub.refresh > 
-                            std::numeric_limits<interval>::max()) return;
-                    if (packet.event.change_sub.sub_timeout > 
-                            std::numeric_limits<interval>::max()) return;
-
-                    interval min_int = (interval) packet.event.change_sub.debounce;
-                    interval max_int = (interval) packet.event.change_sub.refresh;
-                    interval timeout = (interval) packet.event.change_sub.sub_timeout;
-
-                    // the callback for when the operation is complete
-                    // NOTE: since we are capturing two variables, requires malloc?
-                    // not in a performance-critical pathway, but might be worth looking
-                    // into how much using a std::function alternative affects mallocs()
-
-                    if (subs_.find(var_id) != subs_.end()) {
-                        auto& s = subs_.at(var_id);
-                        auto p = s->change(min_int, max_int, timeout);
-                        // on change completion
-                        p.then([this, req_id] (promise_status s) {
-                            notify_success(req_id, s == promise_status::Resolved);
-                        });
-                    } else {
-                        if (v) {
-                            auto p = v->subscribe(min_int, max_int, timeout);
-                            // on subscribe completion
-                            p.then([this, req_id, var_id] (promise_status s, subscription_ptr&& sub) {
-                                if (s == promise_status::Resolved) {
-                                    // put the subscribe in the subs map
-                                    // set the handler to push updates
-                                    sub->handler([this, var_id] (const value& v) {
-                                        push_update(var_id, v);
-                                    });
-                                    sub->cancel_handler([this, var_id] () {
-                                        notify_cancelled(var_id);
-                                    });
-                                    subs_.emplace(var_id, std::move(sub));
-                                }
-                                notify_success(req_id, s == promise_status::Resolved);
-                            });
-                        }
+                    change_sub(packet.event.change_sub, nullptr, req_id);
+                } break;
+                case telegraph_stream_Packet_change_subs_tag: {
+                    const telegraph_stream_SubscribeMany& m = packet.event.change_subs;
+                    // one extra so that it isn't replied to
+                    // before all of the changes have been started
+                    changes* c = new changes{req_id, 0, (uint8_t) (m.subs_count + 1)};
+                    for (pb_size_t i = 0; i < m.subs_count; i++) {
+                        change_sub(m.subs[i], c, i);
                     }
+                    change_done(c, 0, false);
                 } break;
                 case telegraph_stream_Packet_cancel_sub_tag: {
                     if (packet.event.cancel_sub.var_id > 
@@ -174,8 +212,12 @@ namespace wire {
                 } break;
                 case telegraph_stream_Packet_ping_tag: {
                     telegraph_stream_Packet p = telegraph_stream_Packet_init_default;
+                    // the host matches the pong to its ping and uses
+                    // our clock to map sample times onto its own
+                    p.req_id = req_id;
                     p.which_event = telegraph_stream_Packet_pong_tag;
                     p.event.pong = subs_.size(); // send back number of active subscriptions
+                    p.timestamp = util::micros(clock_);
                     write_packet(p);
                 } break;
                 default: break;
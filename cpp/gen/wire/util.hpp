@@ -81,6 +81,22 @@ namespace wire {
             return crc ^ ~0U;
         }
 
+        // the time of a clock in us, for timestamping samples.
+        // Uses micros() if the clock has one (ideally 64 bit, a 32 bit
+        // one wraps every ~71 minutes), otherwise millis()
+        template<typename Clock>
+            auto micros(Clock* c, int) -> decltype((uint64_t) c->micros()) {
+                return (uint64_t) c->micros();
+            }
+        template<typename Clock>
+            uint64_t micros(Clock* c, long) {
+                return (uint64_t) c->millis() * 1000;
+            }
+        template<typename Clock>
+            uint64_t micros(Clock* c) {
+                return micros(c, 0);
+            }
+
         // for packing and unpacking values
         // from tuples/variadic template arguments
         // https://stackoverflow.com/questions/687490/how-do-i-
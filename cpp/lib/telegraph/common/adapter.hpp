@@ -21,6 +21,10 @@ namespace telegraph {
         virtual subscription_ptr subscribe(io::yield_ctx& yield, 
                 float debounce, float refresh, float timeout) = 0;
         virtual void update(value v) = 0;
+        // for values that already carry a time, i.e from upstream
+        virtual void update(time_point tp, value v) = 0;
+        // cancels all subscriptions, once the source is gone
+        virtual void close() = 0;
     };
 
     template<typename PollFunc, typename ChangeFunc, typename CancelFunc>
@@ -95,13 +99,13 @@ namespace telegraph {
                 }
             private:
                 void update(time_point tp, value v) {
-                    // check if enough time has expired to send another update
-                    // for this sub or if last_update_ is at epoch (for poll())
-                    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(tp - last_update_);
-                    if (duration.count() > refresh_*1000 ||
+                    // check if the debounce interval has passed since the
+                    // last update for this sub or if last_update_ is at epoch (for poll())
+                    auto duration = std::chrono::duration<float>(tp - last_update_);
+                    if (duration.count() >= debounce_ ||
                             last_update_.time_since_epoch().count() == 0) {
                         last_update_ = tp;
-                        data(v);
+                        data(datapoint{tp, v});
                     }
                 }
             };
@@ -114,6 +118,7 @@ namespace telegraph {
             bool subscribed_;
             float debounce_;
             float refresh_;
+            uint64_t changes_; // successful upstream changes
 
             // if an op is running
             bool running_op_;
@@ -127,17 +132,32 @@ namespace telegraph {
             adapter(io::io_context& ioc, value_type t, 
                     PollFunc poll, ChangeFunc change, CancelFunc cancel) :
                     ioc_(ioc), type_(t), subscribed_(false),
-                    debounce_(0), refresh_(0), 
+                    debounce_(0), refresh_(0), changes_(0),
                     running_op_(false), waiting_ops_(), subs_(),
                     poll_(poll), change_(change), cancel_(cancel) {}
 
             // will push out an update...
             void update(value v) override {
+                update(std::chrono::system_clock::now(), v);
+            }
+
+            void update(time_point tp, value v) override {
                 // push out values...
-                auto tp = std::chrono::system_clock::now();
+                fanout f;
                 for (sub* s : subs_) s->update(tp, v);
             }
 
+            void close() override {
+                std::unordered_set<sub*> subs;
+                std::swap(subs, subs_);
+                subscribed_ = false;
+                for (sub* s : subs) {
+                    // the subs may be destroyed by their listeners
+                    s->cancelled_ = true;
+                    s->cancelled();
+                }
+            }
+
             // will block until the change subscribe
             // request goes through
             subscription_ptr subscribe(io::yield_ctx& yield, 
@@ -150,11 +170,15 @@ namespace telegraph {
                 sub* s = new sub(wp,
                     type_, min_interval, max_interval);
                 subs_.insert(s);
+                uint64_t changes = changes_;
                 if (!change(yield, timeout)) {
                     // create a new subscription object
                     subs_.erase(s);
                     return nullptr;
                 }
+                // joined an existing upstream subscription,
+                // ask for the latest value to be sent again
+                if (changes == changes_) poll_();
                 return std::unique_ptr<subscription>(s);
             }
         private:
@@ -195,6 +219,14 @@ namespace telegraph {
                 running_op_ = true;
 
                 bool s = change_(yield, new_db, new_rf, timeout);
+                if (s) {
+                    // later subscribers with the same intervals
+                    // don't need to go upstream
+                    subscribed_ = true;
+                    debounce_ = new_db;
+                    refresh_ = new_rf;
+                    changes_++;
+                }
 
                 running_op_ = false;
                 // notify next person
@@ -239,8 +271,15 @@ namespace telegraph {
                     if (!subscribed_ || new_db != debounce_ ||
                             new_rf != refresh_) {
                         success = change_(yield, new_db, new_rf, timeout);
+                        if (success) {
+                            subscribed_ = true;
+                            debounce_ = new_db;
+                            refresh_ = new_rf;
+                            changes_++;
+                        }
                     }
                 } else {
+                    subscribed_ = false;
                     success = cancel_(yield, timeout);
                 }
                 running_op_ = false;
@@ -9,8 +9,60 @@
 #include <cinttypes>
 #include <memory>
 #include <chrono>
+#include <vector>
+#include <algorithm>
 
 namespace telegraph {
+    using time_point = std::chrono::time_point<std::chrono::system_clock>;
+
+    /**
+     */
+    class datapoint {
+    private:
+        time_point time_;
+        value val_;
+    public:
+        datapoint(time_point time, value val) : time_(time), val_(val) {}
+        constexpr time_point get_time() const { return time_; }
+        constexpr value get_value() const { return val_; }
+
+        void pack(Datapoint* dp) {
+            auto micro = 
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    time_.time_since_epoch());
+            dp->set_timestamp(micro.count());
+            val_.pack(dp->mutable_value());
+        }
+
+        static time_point now() {
+            return std::chrono::system_clock::now();
+        }
+    };
+
+    /**
+     * Marks one value being handed out to many subscriptions at once, so
+     * their listeners can share work (like encoding the update that goes
+     * out to each remote client). Scopes are per thread and may nest
+     */
+    class fanout {
+    private:
+        static inline thread_local uint64_t counter_ = 0;
+        static inline thread_local uint64_t current_ = 0;
+        uint64_t prev_;
+    public:
+        fanout() : prev_(current_) {
+            current_ = ++counter_;
+        }
+        ~fanout() {
+            current_ = prev_;
+        }
+        fanout(const fanout&) = delete;
+        fanout& operator=(const fanout&) = delete;
+
+        // id of the innermost fanout on this thread, 0 outside of one
+        static uint64_t current() { return current_; }
+    };
+
     class subscription {
     public:
         static constexpr float DISABLED = std::numeric_limits<float>::infinity();
@@ -42,7 +94,9 @@ namespace telegraph {
         virtual void cancel(io::yield_ctx& yield, float timeout) = 0;
         virtual void cancel() = 0; // cancel immediately
 
-        signal<value> data;
+        // carries the time the value was taken, which may be well
+        // before it arrives here
+        signal<const datapoint&> data;
         signal<> cancelled;
     protected:
         bool cancelled_;
@@ -52,34 +106,56 @@ namespace telegraph {
     };
     using subscription_ptr = std::shared_ptr<subscription>;
 
-    using time_point = std::chrono::time_point<std::chrono::system_clock>;
-    /**
-     */
-    class datapoint {
-    private:
-        time_point time_;
-        value val_;
-    public:
-        datapoint(time_point time, value val) : time_(time), val_(val) {}
-        constexpr time_point get_time() const { return time_; }
-        constexpr value get_value() const { return val_; }
+    // how to reduce a range of datapoints
+    // to a target number of points
+    enum class downsample {
+        min_max, // the smallest and largest point per time bucket
+        lttb // largest-triangle-three-buckets, one point per bucket
+    };
 
-        void pack(Datapoint* dp) {
-            auto micro = 
-                std::chrono::duration_cast<std::chrono::microseconds>(
-                    time_.time_since_epoch());
-            dp->set_timestamp(micro.count());
-            val_.pack(dp->mutable_value());
-        }
+    // reads a backlog of datapoints a piece at a time
+    class data_cursor {
+    public:
+        virtual ~data_cursor() {}
+        // appends up to max datapoints to out,
+        // returns false once there are none left
+        virtual bool next(size_t max, std::vector<datapoint>* out) = 0;
+    };
+    using data_cursor_ptr = std::unique_ptr<data_cursor>;
 
-        static time_point now() {
-            return std::chrono::system_clock::now();
+    class vector_cursor : public data_cursor {
+    private:
+        std::vector<datapoint> data_;
+        size_t pos_;
+    public:
+        vector_cursor(std::vector<datapoint>&& d) : data_(std::move(d)), pos_(0) {}
+        bool next(size_t max, std::vector<datapoint>* out) override {
+            if (pos_ >= data_.size()) return false;
+            size_t n = std::min(max, data_.size() - pos_);
+            out->insert(out->end(), data_.begin() + pos_, data_.begin() + pos_ + n);
+            pos_ += n;
+            return true;
         }
     };
 
     class data_query {
     public:
-        virtual const std::vector<datapoint>& get_current() const = 0;
+        // archives may store data in a compressed format
+        // so this decodes a copy of all current datapoints
+        virtual std::vector<datapoint> get_current() const = 0;
+
+        // the datapoints between begin and end (inclusive), reduced
+        // to roughly the given number of points. If points is 0
+        // all datapoints in the range are returned
+        virtual std::vector<datapoint> get_range(time_point begin, time_point end,
+                                        size_t points, downsample d) const = 0;
+
+        // a cursor over the datapoints currently stored, anything
+        // written afterwards is only delivered through the data signal.
+        // The cursor must not outlive the query
+        virtual data_cursor_ptr get_backlog() const {
+            return std::make_unique<vector_cursor>(get_current());
+        }
         signal<const std::vector<datapoint>&> data;
     };
     using data_query_ptr = std::shared_ptr<data_query>;
@@ -0,0 +1,63 @@
+#include "namespace.hpp"
+
+#include "../utils/io.hpp"
+
+#include <boost/asio/deadline_timer.hpp>
+
+namespace telegraph {
+
+    std::vector<subscription_ptr>
+    context::subscribe_many(io::yield_ctx& yield,
+                            const std::vector<const variable*>& variables,
+                            float min_interval, float max_interval, float timeout) {
+        std::vector<subscription_ptr> subs;
+        for (const variable* v : variables) {
+            subscription_ptr s;
+            try {
+                if (v) s = subscribe(yield, v, min_interval, max_interval, timeout);
+            } catch (...) {}
+            subs.push_back(std::move(s));
+        }
+        return subs;
+    }
+
+    std::vector<subscription_ptr>
+    context::subscribe_many(io::yield_ctx& yield,
+                            const std::vector<std::vector<std::string_view>>& variables,
+                            float min_interval, float max_interval, float timeout) {
+        std::vector<subscription_ptr> subs;
+        for (const auto& path : variables) {
+            subscription_ptr s;
+            try {
+                s = subscribe(yield, path, min_interval, max_interval, timeout);
+            } catch (...) {}
+            subs.push_back(std::move(s));
+        }
+        return subs;
+    }
+
+    std::vector<subscription_ptr>
+    context::subscribe_concurrently(io::yield_ctx& yield, size_t n,
+            const std::function<subscription_ptr(io::yield_ctx&, size_t)>& subscribe_one) {
+        std::vector<subscription_ptr> subs(n);
+        size_t pending = n;
+        io::deadline_timer done{ioc_, boost::posix_time::ptime(boost::posix_time::pos_infin)};
+        for (size_t i = 0; i < n; i++) {
+            // we wait for all of them below, so they can
+            // safely refer to everything on our stack
+            io::spawn(ioc_, [&, i] (io::yield_context y) {
+                io::yield_ctx c(y);
+                try {
+                    subs[i] = subscribe_one(c, i);
+                } catch (...) {}
+                if (--pending == 0) done.cancel();
+            });
+        }
+        // those that didn't need to wait may have finished already
+        while (pending > 0) {
+            boost::system::error_code ec;
+            done.async_wait(yield.ctx[ec]);
+        }
+        return subs;
+    }
+}
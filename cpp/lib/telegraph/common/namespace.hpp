@@ -9,10 +9,12 @@
 #include "../utils/uuid.hpp"
 #include "../utils/io_fwd.hpp"
 
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
 
 namespace telegraph {
     class namespace_;
@@ -83,6 +85,18 @@ namespace telegraph {
                                 float min_interval, float max_interval,
                                 float timeout) = 0;
 
+        // subscribes to many variables at once, which some contexts can
+        // do much faster than one subscribe() after the other. The result
+        // lines up with the input and has nullptr wherever one failed
+        virtual std::vector<subscription_ptr> subscribe_many(io::yield_ctx& ctx,
+                                const std::vector<const variable*>& variables,
+                                float min_interval, float max_interval,
+                                float timeout);
+        virtual std::vector<subscription_ptr> subscribe_many(io::yield_ctx& ctx,
+                                const std::vector<std::vector<std::string_view>>& variables,
+                                float min_interval, float max_interval,
+                                float timeout);
+
         virtual value call(io::yield_ctx& ctx, action* a, value v, float timeout) = 0;
         virtual value call(io::yield_ctx& ctx, const std::vector<std::string_view>& a, 
                                     value v, float timeout) = 0;
@@ -98,6 +112,11 @@ namespace telegraph {
         virtual void destroy(io::yield_ctx& yield) = 0;
         signal<io::yield_ctx&> destroyed;
     protected:
+        // runs subscribe_one(yield, i) for every i < n in its own
+        // coroutine, so that their round trips overlap, and waits for all
+        std::vector<subscription_ptr> subscribe_concurrently(io::yield_ctx& yield, size_t n,
+                const std::function<subscription_ptr(io::yield_ctx&, size_t)>& subscribe_one);
+
         io::io_context& ioc_;
         const uuid uuid_;
         const bool headless_;
@@ -74,20 +74,21 @@ namespace telegraph {
                 if (ec != boost::asio::error::operation_aborted &&
                         last_value_.is_valid()) {
                     auto p = publisher_.lock();
+                    // a refresh says the value still holds now
                     if (p) {
-                        data(p->value_);
+                        data(datapoint{std::chrono::system_clock::now(), p->value_});
                     }
                 }
             }
 
             void update(time_point tp, value v) {
-                auto d = std::chrono::duration_cast<
-                    std::chrono::milliseconds>(tp - last_update_);
-                if (d.count() > 1000*debounce_ || !last_value_.is_valid()) {
+                // in seconds, a debounce of 0 passes every update
+                auto d = std::chrono::duration<float>(tp - last_update_);
+                if (d.count() >= debounce_ || !last_value_.is_valid()) {
                     last_update_ = tp;
                     last_value_ = v;
                     reset_refresh_timer();
-                    data(v);
+                    data(datapoint{tp, v});
                 }
             }
         };
@@ -117,11 +118,14 @@ namespace telegraph {
         void update(value v) {
             value_ = v;
             auto tp = std::chrono::system_clock::now();
+            fanout f;
             for (auto ws : subs_) {
                 auto s = ws.second.lock();
                 if (s) s->update(tp, v);
             }
         }
+        size_t subscribers() const { return subs_.size(); }
+
         publisher& operator<<(value v) {
             update(v);
             return *this;
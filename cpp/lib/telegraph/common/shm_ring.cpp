@@ -0,0 +1,191 @@
+#include "shm_ring.hpp"
+
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace telegraph {
+
+    static size_t
+    segment_size(size_t capacity) {
+        return sizeof(shm_header) + (capacity + shm_header::TABLE_SIZE) * sizeof(shm_slot);
+    }
+
+    static uint64_t
+    box_bits(const value::box& b) {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &b, sizeof(b));
+        return bits;
+    }
+
+    static void
+    load_slot(const shm_slot& slot, shm_sample* s) {
+        uint64_t meta = slot.meta.load(std::memory_order_relaxed);
+        s->var_id = (uint16_t) (meta >> 8);
+        s->type = (value_type::type_class) (meta & 0xff);
+        s->time = slot.time.load(std::memory_order_relaxed);
+        uint64_t bits = slot.bits.load(std::memory_order_relaxed);
+        std::memcpy(&s->box, &bits, sizeof(s->box));
+    }
+
+    static void
+    store_slot(shm_slot& slot, uint16_t var_id, int64_t time, const value& v) {
+        slot.meta.store(((uint64_t) var_id << 8) | (uint64_t) v.get_type_class(),
+                        std::memory_order_relaxed);
+        slot.time.store(time, std::memory_order_relaxed);
+        slot.bits.store(box_bits(v.get_box()), std::memory_order_relaxed);
+    }
+
+#ifndef _WIN32
+    shm_writer::shm_writer(const std::string& name, size_t capacity, bool replace)
+            : name_(name), mem_(nullptr), size_(0),
+              header_(nullptr), ring_(nullptr), table_(nullptr) {
+        size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+
+        // a segment that is already there may have live readers,
+        // only throw it away when told to
+        if (replace) shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) return;
+        size_t size = segment_size(cap);
+        if (ftruncate(fd, (off_t) size) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            return;
+        }
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            return;
+        }
+        // the segment starts out zeroed
+        mem_ = mem;
+        size_ = size;
+        header_ = reinterpret_cast<shm_header*>(mem);
+        ring_ = reinterpret_cast<shm_slot*>(header_ + 1);
+        table_ = ring_ + cap;
+        header_->version = shm_header::VERSION;
+        header_->capacity = cap;
+        // readers check the magic last
+        std::atomic_thread_fence(std::memory_order_release);
+        header_->magic = shm_header::MAGIC;
+    }
+
+    shm_writer::~shm_writer() {
+        if (!mem_) return;
+        munmap(mem_, size_);
+        shm_unlink(name_.c_str());
+    }
+
+    shm_reader::shm_reader(const std::string& name)
+            : mem_(nullptr), size_(0), header_(nullptr),
+              ring_(nullptr), table_(nullptr), next_(0), dropped_(0) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(shm_header)) {
+            close(fd);
+            return;
+        }
+        size_t size = (size_t) st.st_size;
+        void* mem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED) return;
+        mem_ = mem;
+        size_ = size;
+
+        auto header = reinterpret_cast<const shm_header*>(mem);
+        if (header->magic != shm_header::MAGIC) return;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t cap = header->capacity;
+        if (header->version != shm_header::VERSION || cap == 0 ||
+                (cap & (cap - 1)) != 0 || segment_size(cap) > size) return;
+        header_ = header;
+        ring_ = reinterpret_cast<const shm_slot*>(header_ + 1);
+        table_ = ring_ + cap;
+        next_ = header_->head.load(std::memory_order_acquire);
+    }
+
+    shm_reader::~shm_reader() {
+        if (mem_) munmap(mem_, size_);
+    }
+#else
+    // no POSIX shared memory, never valid
+    shm_writer::shm_writer(const std::string& name, size_t capacity, bool replace)
+            : name_(name), mem_(nullptr), size_(0),
+              header_(nullptr), ring_(nullptr), table_(nullptr) {}
+    shm_writer::~shm_writer() {}
+
+    shm_reader::shm_reader(const std::string& name)
+            : mem_(nullptr), size_(0), header_(nullptr),
+              ring_(nullptr), table_(nullptr), next_(0), dropped_(0) {}
+    shm_reader::~shm_reader() {}
+#endif
+
+    void
+    shm_writer::write(uint16_t var_id, int64_t time, const value& v) {
+        if (!header_) return;
+        uint64_t n = header_->head.load(std::memory_order_relaxed);
+        shm_slot& slot = ring_[n & (header_->capacity - 1)];
+        slot.seq.store(2*n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        store_slot(slot, var_id, time, v);
+        slot.seq.store(2*n + 2, std::memory_order_release);
+        header_->head.store(n + 1, std::memory_order_release);
+
+        shm_slot& latest = table_[var_id];
+        uint64_t s = latest.seq.load(std::memory_order_relaxed);
+        latest.seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        store_slot(latest, var_id, time, v);
+        latest.seq.store(s + 2, std::memory_order_release);
+    }
+
+    bool
+    shm_reader::next(shm_sample* s) {
+        if (!header_) return false;
+        uint64_t cap = header_->capacity;
+        while (true) {
+            uint64_t head = header_->head.load(std::memory_order_acquire);
+            if (next_ >= head) return false;
+            if (head - next_ > cap) {
+                dropped_ += head - next_ - cap;
+                next_ = head - cap;
+            }
+            const shm_slot& slot = ring_[next_ & (cap - 1)];
+            uint64_t want = 2*next_ + 2;
+            if (slot.seq.load(std::memory_order_acquire) == want) {
+                load_slot(slot, s);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) == want) {
+                    next_++;
+                    return true;
+                }
+            }
+            // overwritten while we were reading it
+            dropped_++;
+            next_++;
+        }
+    }
+
+    bool
+    shm_reader::latest(uint16_t var_id, shm_sample* s) const {
+        if (!header_) return false;
+        const shm_slot& slot = table_[var_id];
+        while (true) {
+            uint64_t s1 = slot.seq.load(std::memory_order_acquire);
+            if (s1 == 0) return false;
+            if (s1 & 1) continue; // being written
+            load_slot(slot, s);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == s1) return true;
+        }
+    }
+}
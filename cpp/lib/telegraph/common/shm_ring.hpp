@@ -0,0 +1,114 @@
+#ifndef __TELEGRAPH_COMMON_SHM_RING_HPP__
+#define __TELEGRAPH_COMMON_SHM_RING_HPP__
+
+#include "value.hpp"
+
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+
+namespace telegraph {
+
+    /**
+     * Layout of a shared memory segment with live values, written by a
+     * single process and read by any number of others on the same machine.
+     *
+     * The segment starts with a shm_header, followed by a ring of capacity
+     * records (the latest updates in order) and a table of the latest
+     * value of every node id. Each slot is guarded by a sequence
+     * lock, so readers never block the writer and never make syscalls.
+     * Readers that fall more than capacity records behind lose records.
+     */
+    struct shm_slot {
+        // ring: 2n + 2 once record n is complete, odd while being written.
+        // table: incremented before and after every write
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> meta; // var_id << 8 | type class
+        std::atomic<int64_t> time; // us since epoch
+        std::atomic<uint64_t> bits; // the value box
+    };
+
+    struct shm_header {
+        static constexpr uint32_t MAGIC = 0x52474c54; // "TLGR"
+        static constexpr uint32_t VERSION = 1;
+        // node ids are 16 bit
+        static constexpr size_t TABLE_SIZE = 65536;
+
+        uint32_t magic;
+        uint32_t version;
+        uint64_t capacity; // a power of two
+        // records written so far, on a cache line of its own
+        alignas(64) std::atomic<uint64_t> head;
+        char pad_[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                  "shared memory slots need lock-free 64 bit atomics");
+
+    struct shm_sample {
+        uint16_t var_id;
+        value_type::type_class type;
+        int64_t time; // us since epoch
+        value::box box;
+
+        value get_value() const { return value{type, box}; }
+    };
+
+    /**
+     * Creates the segment and writes to it. If one of that name exists
+     * already the writer is invalid, unless replace is set (say to clean
+     * up after a crashed run). The segment is removed on destruction
+     */
+    class shm_writer {
+    private:
+        std::string name_;
+        void* mem_;
+        size_t size_;
+        shm_header* header_;
+        shm_slot* ring_;
+        shm_slot* table_;
+    public:
+        // name is a POSIX shared memory name like "/telegraph"
+        shm_writer(const std::string& name, size_t capacity, bool replace=false);
+        ~shm_writer();
+        shm_writer(const shm_writer&) = delete;
+        shm_writer& operator=(const shm_writer&) = delete;
+
+        bool valid() const { return header_ != nullptr; }
+        const std::string& get_name() const { return name_; }
+
+        void write(uint16_t var_id, int64_t time, const value& v);
+    };
+
+    class shm_reader {
+    private:
+        void* mem_;
+        size_t size_;
+        const shm_header* header_;
+        const shm_slot* ring_;
+        const shm_slot* table_;
+        uint64_t next_; // the next record to read
+        uint64_t dropped_;
+    public:
+        // starts reading at the newest record
+        explicit shm_reader(const std::string& name);
+        ~shm_reader();
+        shm_reader(const shm_reader&) = delete;
+        shm_reader& operator=(const shm_reader&) = delete;
+
+        bool valid() const { return header_ != nullptr; }
+
+        // reads the next record, returns false if there is none yet.
+        // If the writer has lapped us, skips ahead to the oldest
+        // record still in the ring and counts the ones missed
+        bool next(shm_sample* s);
+        // records lost by falling behind
+        uint64_t dropped() const { return dropped_; }
+
+        // the latest value of a variable, false if there has been none
+        bool latest(uint16_t var_id, shm_sample* s) const;
+    };
+}
+
+#endif
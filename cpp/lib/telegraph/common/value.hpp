@@ -47,6 +47,7 @@ namespace telegraph {
         constexpr value(double v) : type_(value_type::Double), value_() { value_.d = v; }
 
         constexpr value(value_type::type_class t, uint8_t v) : type_(t), value_() { value_.uint8 = v; }
+        constexpr value(value_type::type_class t, const box& b) : type_(t), value_(b) {}
 
         value(const Value& v) :type_(value_type::Invalid), value_() {
             switch(v.type_case()) {
@@ -0,0 +1,113 @@
+#include "aggregate.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace telegraph {
+
+    // the reductions below keep this many independent accumulators,
+    // which breaks the dependency chain between iterations and lets
+    // the compiler use packed instructions
+    static constexpr size_t lanes = 4;
+
+    static void min_max_sum(const double* v, size_t n,
+                            double* min, double* max, double* sum) {
+        double mn[lanes], mx[lanes], s[lanes];
+        for (size_t k = 0; k < lanes; k++) {
+            mn[k] = v[0];
+            mx[k] = v[0];
+            s[k] = 0;
+        }
+        size_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            for (size_t k = 0; k < lanes; k++) {
+                double x = v[i + k];
+                mn[k] = x < mn[k] ? x : mn[k];
+                mx[k] = x > mx[k] ? x : mx[k];
+                s[k] += x;
+            }
+        }
+        for (; i < n; i++) {
+            double x = v[i];
+            mn[0] = x < mn[0] ? x : mn[0];
+            mx[0] = x > mx[0] ? x : mx[0];
+            s[0] += x;
+        }
+        *min = *std::min_element(mn, mn + lanes);
+        *max = *std::max_element(mx, mx + lanes);
+        *sum = (s[0] + s[1]) + (s[2] + s[3]);
+    }
+
+    // sum of squared deviations from the mean, done as a second
+    // pass since sum(x^2) - n*mean^2 cancels badly for large offsets
+    static double sum_sq_dev(const double* v, size_t n, double mean) {
+        double s[lanes] = {0, 0, 0, 0};
+        size_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            for (size_t k = 0; k < lanes; k++) {
+                double d = v[i + k] - mean;
+                s[k] += d * d;
+            }
+        }
+        for (; i < n; i++) {
+            double d = v[i] - mean;
+            s[0] += d * d;
+        }
+        return (s[0] + s[1]) + (s[2] + s[3]);
+    }
+
+    // p-th percentile of v, reorders v
+    static double percentile(double* v, size_t n, float p) {
+        double rank = std::clamp(p / 100.0, 0.0, 1.0) * (double) (n - 1);
+        size_t lo = (size_t) rank;
+        std::nth_element(v, v + lo, v + n);
+        double a = v[lo];
+        if (lo + 1 >= n) return a;
+        // everything after lo is >= a, the smallest of which is next
+        double b = *std::min_element(v + lo + 1, v + n);
+        return a + (b - a) * (rank - (double) lo);
+    }
+
+    window_stats
+    aggregate(const std::vector<int64_t>& times,
+              const std::vector<double>& values,
+              int64_t begin, int64_t width,
+              const std::vector<float>& percentiles) {
+        window_stats r;
+        r.percentiles.resize(percentiles.size());
+        std::vector<double> scratch;
+        size_t n = times.size();
+        size_t i = std::lower_bound(times.begin(), times.end(), begin) - times.begin();
+        while (i < n) {
+            int64_t w = width > 0 ? (times[i] - begin) / width : 0;
+            int64_t start = begin + w * width;
+            size_t j = n;
+            if (width > 0) {
+                j = std::lower_bound(times.begin() + i, times.end(), start + width)
+                        - times.begin();
+            }
+            const double* v = values.data() + i;
+            size_t count = j - i;
+
+            double min, max, sum;
+            min_max_sum(v, count, &min, &max, &sum);
+            double mean = sum / (double) count;
+            r.start.push_back(start);
+            r.count.push_back(count);
+            r.min.push_back(min);
+            r.max.push_back(max);
+            r.mean.push_back(mean);
+            r.stddev.push_back(std::sqrt(sum_sq_dev(v, count, mean) / (double) count));
+
+            if (!percentiles.empty()) {
+                scratch.assign(v, v + count);
+                for (size_t k = 0; k < percentiles.size(); k++) {
+                    r.percentiles[k].push_back(
+                        percentile(scratch.data(), count, percentiles[k]));
+                }
+            }
+            i = j;
+        }
+        return r;
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef __TELEGRAPH_LOCAL_AGGREGATE_HPP__
+#define __TELEGRAPH_LOCAL_AGGREGATE_HPP__
+
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+namespace telegraph {
+
+    /**
+     * Statistics of a variable over fixed time windows, in columns
+     * (one entry per non-empty window).
+     */
+    struct window_stats {
+        std::vector<int64_t> start; // us since epoch
+        std::vector<size_t> count;
+        std::vector<double> min;
+        std::vector<double> max;
+        std::vector<double> mean;
+        std::vector<double> stddev;
+        // percentiles[i][w] is the i-th requested percentile of window w
+        std::vector<std::vector<double>> percentiles;
+    };
+
+    // computes per-window statistics of a time (us)/value column pair,
+    // which has to be sorted by time (as series::columns() returns it).
+    // Windows are [begin + k*width, begin + (k+1)*width), a width of 0
+    // puts everything into a single window starting at begin. Percentiles
+    // are in [0, 100] and interpolated between the closest ranks
+    window_stats aggregate(const std::vector<int64_t>& times,
+                           const std::vector<double>& values,
+                           int64_t begin, int64_t width,
+                           const std::vector<float>& percentiles);
+}
+
+#endif
@@ -0,0 +1,90 @@
+#include "align.hpp"
+
+#include <cmath>
+#include <limits>
+
+namespace telegraph {
+
+    aligner::cursor::cursor(const series::columns_snapshot* s)
+        : has_last(false), last_time(0), last_value(0),
+          snap_(s), piece_(0), pos_(0), times_(), values_() {}
+
+    bool
+    aligner::cursor::peek(int64_t* t) {
+        while (pos_ >= times_.size()) {
+            if (piece_ >= snap_->pieces()) return false;
+            times_.clear();
+            values_.clear();
+            pos_ = 0;
+            snap_->decode(piece_++, &times_, &values_);
+        }
+        *t = times_[pos_];
+        return true;
+    }
+
+    void
+    aligner::cursor::pop() {
+        has_last = true;
+        last_time = times_[pos_];
+        last_value = values_[pos_];
+        pos_++;
+    }
+
+    void
+    aligner::cursor::advance(int64_t t) {
+        // skip whole chunks when the next one also starts before t
+        while (pos_ >= times_.size() && piece_ + 1 < snap_->pieces() &&
+                snap_->piece_begin(piece_ + 1) <= t) {
+            piece_++;
+        }
+        int64_t n;
+        while (peek(&n) && n <= t) pop();
+    }
+
+    aligner::aligner(std::vector<series::columns_snapshot>&& inputs,
+                     int64_t begin, int64_t end, int64_t step, int64_t tolerance)
+            : inputs_(std::move(inputs)), cursors_(), clocked_(false), clock_(),
+              next_(begin), end_(end), step_(step), tolerance_(tolerance) {
+        // the cursors point into inputs_, which isn't resized
+        for (const auto& s : inputs_) cursors_.emplace_back(&s);
+    }
+
+    aligner::aligner(std::vector<series::columns_snapshot>&& inputs, size_t clock,
+                     int64_t begin, int64_t end, int64_t tolerance)
+            : inputs_(std::move(inputs)), cursors_(), clocked_(true), clock_(),
+              next_(begin), end_(end), step_(0), tolerance_(tolerance) {
+        for (const auto& s : inputs_) cursors_.emplace_back(&s);
+        clock_.emplace_back(&inputs_.at(clock));
+        // the inputs may reach back before begin
+        if (begin > std::numeric_limits<int64_t>::min()) clock_[0].advance(begin - 1);
+    }
+
+    bool
+    aligner::next(size_t max, std::vector<int64_t>* times,
+                  std::vector<std::vector<double>>* columns) {
+        columns->resize(cursors_.size());
+        for (size_t rows = 0; rows < max; rows++) {
+            int64_t t;
+            if (clocked_) {
+                if (!clock_[0].peek(&t) || t > end_) return false;
+                clock_[0].pop();
+                // several samples at the same time make one row
+                int64_t n;
+                while (clock_[0].peek(&n) && n == t) clock_[0].pop();
+            } else {
+                if (step_ <= 0 || next_ > end_) return false;
+                t = next_;
+                next_ += step_;
+            }
+            times->push_back(t);
+            for (size_t i = 0; i < cursors_.size(); i++) {
+                cursor& c = cursors_[i];
+                c.advance(t);
+                bool stale = tolerance_ > 0 && t - c.last_time > tolerance_;
+                (*columns)[i].push_back(c.has_last && !stale ? c.last_value :
+                                std::numeric_limits<double>::quiet_NaN());
+            }
+        }
+        return true;
+    }
+}
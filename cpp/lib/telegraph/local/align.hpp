@@ -0,0 +1,71 @@
+#ifndef __TELEGRAPH_LOCAL_ALIGN_HPP__
+#define __TELEGRAPH_LOCAL_ALIGN_HPP__
+
+#include "series.hpp"
+
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+namespace telegraph {
+
+    /**
+     * As-of join of several series onto a common timeline: each row has,
+     * for every input, the latest value at or before the time of the row
+     * (NaN if there is none, or if it is more than tolerance us older).
+     * The timeline is either a fixed grid or the samples of one of
+     * the inputs (the clock).
+     *
+     * The inputs are merged a chunk at a time, so memory use doesn't
+     * depend on the length of the range. Times within a series are
+     * assumed to be increasing.
+     */
+    class aligner {
+    public:
+        // rows every step us in [begin, end]
+        aligner(std::vector<series::columns_snapshot>&& inputs,
+                int64_t begin, int64_t end, int64_t step, int64_t tolerance);
+        // rows at the times of the samples of inputs[clock] in [begin, end]
+        aligner(std::vector<series::columns_snapshot>&& inputs, size_t clock,
+                int64_t begin, int64_t end, int64_t tolerance);
+
+        // appends up to max rows (columns has one entry per input),
+        // returns false once the timeline is exhausted
+        bool next(size_t max, std::vector<int64_t>* times,
+                  std::vector<std::vector<double>>* columns);
+    private:
+        // reads one series a chunk at a time
+        class cursor {
+        public:
+            cursor(const series::columns_snapshot* s);
+            // the time of the next sample, false if there is none
+            bool peek(int64_t* t);
+            void pop();
+            // moves past all samples at or before t
+            void advance(int64_t t);
+
+            bool has_last;
+            int64_t last_time;
+            double last_value;
+        private:
+            const series::columns_snapshot* snap_;
+            size_t piece_;
+            size_t pos_;
+            std::vector<int64_t> times_;
+            std::vector<double> values_;
+        };
+
+        std::vector<series::columns_snapshot> inputs_;
+        std::vector<cursor> cursors_;
+        // drives the timeline when clocked by an input
+        bool clocked_;
+        std::vector<cursor> clock_;
+
+        int64_t next_; // next grid time
+        int64_t end_;
+        int64_t step_;
+        int64_t tolerance_;
+    };
+}
+
+#endif
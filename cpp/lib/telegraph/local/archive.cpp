@@ -0,0 +1,333 @@
+#include "archive.hpp"
+#include "series.hpp"
+
+#include "../common/nodes.hpp"
+#include "../common/data.hpp"
+
+#include <string_view>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <cstdio>
+
+#include <boost/uuid/uuid_io.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace fs = std::filesystem;
+
+namespace telegraph {
+
+    static int64_t to_micros(time_point t) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                    t.time_since_epoch()).count();
+    }
+
+    static time_point from_micros(int64_t t) {
+        return time_point{std::chrono::duration_cast<time_point::duration>(
+                    std::chrono::microseconds{t})};
+    }
+
+    std::vector<datapoint>
+    archive_data::get_current() const {
+        auto a = archive_.lock();
+        if (!a) return std::vector<datapoint>{};
+        return a->read(var_, std::numeric_limits<int64_t>::min(),
+                             std::numeric_limits<int64_t>::max());
+    }
+
+    std::vector<datapoint>
+    archive_data::get_range(time_point begin, time_point end,
+                            size_t points, downsample d) const {
+        auto a = archive_.lock();
+        if (!a) return std::vector<datapoint>{};
+        std::vector<datapoint> raw = a->read(var_, to_micros(begin), to_micros(end));
+        if (points == 0 || raw.size() <= points) return raw;
+        // reuse the series downsampling
+        series s{var_->get_type().get_class()};
+        s.append(raw);
+        return s.query(begin, end, points, d);
+    }
+
+    archive::archive(io::io_context& ioc, const std::string_view& name,
+                     std::unique_ptr<node>&& tree, const fs::path& dir,
+                     size_t segment_size, size_t batch_size, float flush_interval)
+            : local_context(ioc, name, "archive", params{}, std::move(tree)),
+              dir_(dir), segment_size_(segment_size), batch_size_(batch_size),
+              flush_interval_(flush_interval), segments_(), next_segment_(0),
+              flush_timer_(ioc), flush_scheduled_(false),
+              data_(), recordings_(), recordings_queries_() {}
+
+    archive::~archive() {
+        flush_timer_.cancel();
+        for (auto i : recordings_) i.second->data.remove(this);
+        for (auto i : recordings_queries_) {
+            auto r = i.second.lock();
+            if (r) {
+                r->destroyed.remove(this);
+                r->close();
+            }
+        }
+        try {
+            if (!segments_.empty()) segments_.back()->seal();
+        } catch (io_error& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    void
+    archive::open() {
+        fs::create_directories(dir_);
+        std::vector<fs::path> files;
+        for (const auto& e : fs::directory_iterator{dir_}) {
+            if (e.is_regular_file() && e.path().extension() == ".seg")
+                files.push_back(e.path());
+        }
+        std::sort(files.begin(), files.end());
+        for (const fs::path& p : files) {
+            auto s = segment::open(p);
+            if (!s) continue;
+            segments_.push_back(std::move(s));
+            try {
+                unsigned n = std::stoul(p.stem().string());
+                next_segment_ = std::max(next_segment_, n + 1);
+            } catch (std::exception&) {}
+        }
+        start_segment();
+    }
+
+    void
+    archive::start_segment() {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%08u.seg", next_segment_++);
+        auto s = segment::create(dir_ / name, to_micros(datapoint::now()), segment_size_);
+        // every segment describes the tree it holds data for
+        s->add(to_micros(datapoint::now()), tree_.get());
+        segments_.push_back(std::move(s));
+    }
+
+    void
+    archive::append(const variable* v, const std::vector<datapoint>& d) {
+        if (!v || d.empty()) return;
+        segment* s = segments_.back().get();
+        for (const datapoint& p : d) {
+            s->add(to_micros(p.get_time()), v->get_id(), p.get_value());
+        }
+        if (s->pending() >= batch_size_ || s->full()) flush();
+        else schedule_flush();
+
+        auto it = data_.find(v);
+        if (it != data_.end()) {
+            auto q = it->second.lock();
+            if (q) q->data(d);
+            else data_.erase(it);
+        }
+    }
+
+    void
+    archive::flush() {
+        segment* s = segments_.back().get();
+        s->flush();
+        if (s->full()) {
+            s->seal();
+            start_segment();
+        }
+    }
+
+    void
+    archive::schedule_flush() {
+        if (flush_scheduled_) return;
+        flush_scheduled_ = true;
+        flush_timer_.expires_from_now(
+            boost::posix_time::milliseconds((long) (flush_interval_ * 1000)));
+        std::weak_ptr<archive> w =
+            std::static_pointer_cast<archive>(shared_from_this());
+        flush_timer_.async_wait([w](const boost::system::error_code& ec) {
+            if (ec) return;
+            auto sp = w.lock();
+            if (!sp) return;
+            sp->flush_scheduled_ = false;
+            try {
+                sp->flush();
+            } catch (io_error& e) {
+                std::cerr << e.what() << std::endl;
+            }
+        });
+    }
+
+    std::vector<datapoint>
+    archive::read(const variable* v, int64_t begin, int64_t end) const {
+        std::vector<datapoint> points;
+        for (const auto& s : segments_) {
+            s->read(v->get_id(), begin, end, [&points](int64_t t, const value& val) {
+                points.emplace_back(from_micros(t), val);
+            });
+        }
+        // written data may be out of order
+        auto cmp = [](const datapoint& a, const datapoint& b) {
+            return a.get_time() < b.get_time();
+        };
+        if (!std::is_sorted(points.begin(), points.end(), cmp))
+            std::stable_sort(points.begin(), points.end(), cmp);
+        return points;
+    }
+
+    data_query_ptr
+    archive::query_data(io::yield_ctx& yield, const variable* v) {
+        auto it = data_.find(v);
+        if (it != data_.end()) {
+            auto q = it->second.lock();
+            if (q) return q;
+        }
+        std::weak_ptr<archive> w =
+            std::static_pointer_cast<archive>(shared_from_this());
+        auto q = std::make_shared<archive_data>(w, v);
+        data_[v] = q;
+        return q;
+    }
+
+    data_query_ptr
+    archive::query_data(io::yield_ctx& yield,
+                        const std::vector<std::string_view>& path) {
+        auto v = dynamic_cast<variable*>(tree_->from_path(path));
+        if (!v) return nullptr;
+        return query_data(yield, v);
+    }
+
+    void
+    archive::record(variable* v, subscription_ptr s) {
+        if (!v) return;
+        recordings_[v] = s;
+        s->data.add(this, [this, v](const datapoint& dp) {
+            append(v, std::vector<datapoint>{dp});
+        });
+
+        params obj = params::object();
+        obj["event"] = "record";
+        obj["path"] = params{v->path()};
+        for (auto rq : recordings_queries_) {
+            auto sp = rq.second.lock();
+            if (sp) sp->write(params{obj});
+        }
+    }
+
+    void
+    archive::record_stop(variable* v) {
+        if (!v) return;
+        auto it = recordings_.find(v);
+        if (it == recordings_.end()) return;
+        it->second->data.remove(this);
+        recordings_.erase(it);
+
+        params obj = params::object();
+        obj["event"] = "record_stop";
+        obj["path"] = params{v->path()};
+        for (auto rq : recordings_queries_) {
+            auto sp = rq.second.lock();
+            if (sp) sp->write(params{obj});
+        }
+    }
+
+    params_stream_ptr
+    archive::request(io::yield_ctx& yield, const params& p) {
+        if (!p.is_object()) return nullptr;
+        const std::string& s = p.at("type").get<std::string>();
+        if (s == "record" || s == "record_stop") {
+            std::vector<std::string_view> path;
+            const std::vector<params>& ppath = p.at("var").get<std::vector<params>>();
+            for (const params& p : ppath) {
+                path.push_back(p.get<std::string>());
+            }
+            auto v = dynamic_cast<variable*>(tree_->from_path(path));
+            if (!v) return nullptr;
+
+            if (s == "record") {
+                const std::string& uuids = p.at("uuid").get<std::string>();
+                uuid ctx_u = boost::lexical_cast<uuid>(uuids);
+                auto ns = ns_.lock();
+                if (!ns) return nullptr;
+                auto ctx = ns->contexts->get(ctx_u);
+                if (!ctx) return nullptr;
+                float min_interval = p.at("min_interval").get<float>();
+                float max_interval = p.at("max_interval").get<float>();
+                auto sub = ctx->subscribe(yield, path, min_interval, max_interval, 1);
+                if (!sub) return nullptr;
+                record(v, sub);
+            } else {
+                record_stop(v);
+            }
+
+            params_stream_ptr res = std::make_shared<params_stream>();
+            res->write(params{true});
+            res->close();
+            return res;
+        } else if (s == "flush") {
+            flush();
+            params_stream_ptr res = std::make_shared<params_stream>();
+            res->write(params{true});
+            res->close();
+            return res;
+        } else if (s == "recordings") {
+            params_stream_ptr res = std::make_shared<params_stream>();
+            params_stream* raw = res.get();
+
+            std::weak_ptr<archive> wp =
+                std::static_pointer_cast<archive>(shared_from_this());
+            res->destroyed.add(this, [wp, raw]() {
+                auto sp = wp.lock();
+                if (sp) sp->recordings_queries_.erase(raw);
+            });
+            recordings_queries_.emplace(raw, res);
+            for (auto i : recordings_) {
+                params obj = params::object();
+                obj["event"] = "recording";
+                obj["path"] = params{i.first->path()};
+                res->write(std::move(obj));
+            }
+            return res;
+        }
+        return nullptr;
+    }
+
+    local_context_ptr
+    archive::create(io::yield_ctx& yield, io::io_context& ioc,
+        const std::string_view& name, const std::string_view& type,
+        const params& p) {
+        auto args = p.to_map();
+        auto sit = args.find("src");
+        auto pit = args.find("path");
+        if (sit == args.end() || pit == args.end()) return nullptr;
+        auto& v = sit->second;
+        std::unique_ptr<node> n;
+        if (v.is_ctx()) {
+            auto ctx = v.to_ctx();
+            auto s = ctx->fetch(yield);
+            if (!s) return nullptr;
+            n = s->clone();
+        } else if (v.is_tree()) {
+            const std::shared_ptr<node>& mn = v.to_tree();
+            n = mn->clone();
+        }
+        if (!n) return nullptr;
+
+        size_t segment_size = 64*1024*1024;
+        size_t batch_size = 4096;
+        float flush_interval = 0.1f;
+        auto it = args.find("segment_size");
+        if (it != args.end()) segment_size = (size_t) it->second.get<float>();
+        it = args.find("batch_size");
+        if (it != args.end()) batch_size = (size_t) it->second.get<float>();
+        it = args.find("flush_interval");
+        if (it != args.end()) flush_interval = it->second.get<float>();
+
+        auto a = std::make_shared<archive>(ioc, name, std::move(n),
+                    fs::path{pit->second.get<std::string>()},
+                    segment_size, batch_size, flush_interval);
+        try {
+            a->open();
+        } catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return nullptr;
+        }
+        return a;
+    }
+}
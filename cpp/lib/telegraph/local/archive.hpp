@@ -0,0 +1,127 @@
+#ifndef __TELEGRAPH_LOCAL_ARCHIVE_HPP__
+#define __TELEGRAPH_LOCAL_ARCHIVE_HPP__
+
+#include "../common/data.hpp"
+#include "../common/nodes.hpp"
+
+#include "namespace.hpp"
+#include "segment.hpp"
+
+#include <filesystem>
+#include <unordered_map>
+
+#include <boost/asio/deadline_timer.hpp>
+
+namespace telegraph {
+    class archive;
+
+    class archive_data : public data_query {
+    private:
+        std::weak_ptr<archive> archive_;
+        const variable* var_;
+    public:
+        archive_data(const std::weak_ptr<archive>& a, const variable* v)
+            : archive_(a), var_(v) {}
+
+        std::vector<datapoint> get_current() const override;
+        std::vector<datapoint> get_range(time_point begin, time_point end,
+                            size_t points, downsample d) const override;
+    };
+
+    /**
+     * A durable archive. Written and recorded data is appended
+     * to segment files in a directory, see segment.hpp for the format.
+     * Updates are buffered and written in batches, either every batch_size
+     * updates or every flush_interval seconds, whichever comes first.
+     * Once a segment reaches segment_size bytes it is sealed and a new
+     * one is started. On startup the sealed segments are reopened
+     * using their footers, so nothing needs to be replayed.
+     */
+    class archive : public local_context {
+    private:
+        std::filesystem::path dir_;
+        size_t segment_size_;
+        size_t batch_size_;
+        float flush_interval_;
+
+        // the last segment is the one being written
+        std::vector<std::unique_ptr<segment>> segments_;
+        unsigned next_segment_;
+
+        io::deadline_timer flush_timer_;
+        bool flush_scheduled_;
+
+        std::unordered_map<const variable*, std::weak_ptr<archive_data>> data_;
+        std::unordered_map<const variable*, subscription_ptr> recordings_;
+        std::unordered_map<params_stream*,
+            std::weak_ptr<params_stream>> recordings_queries_;
+    public:
+        archive(io::io_context& ioc, const std::string_view& name,
+                std::unique_ptr<node>&& tree, const std::filesystem::path& dir,
+                size_t segment_size, size_t batch_size, float flush_interval);
+        ~archive();
+
+        // opens the existing segments and starts a new one
+        void open();
+
+        void append(const variable* v, const std::vector<datapoint>& d);
+        // writes out all pending updates
+        void flush();
+
+        std::vector<datapoint> read(const variable* v, int64_t begin, int64_t end) const;
+
+        params_stream_ptr request(io::yield_ctx&, const params& p) override;
+
+        void record(variable* v, subscription_ptr s);
+        void record_stop(variable* v);
+
+        bool write_data(io::yield_ctx& yield, variable* v,
+                        const std::vector<datapoint>& data) override {
+            append(v, data);
+            return true;
+        }
+        bool write_data(io::yield_ctx& yield,
+                        const std::vector<std::string_view>& v,
+                        const std::vector<datapoint>& data) override {
+            auto var = dynamic_cast<variable*>(tree_->from_path(v));
+            if (!var) return false;
+            return write_data(yield, var, data);
+        }
+
+        data_query_ptr query_data(io::yield_ctx& ctx,
+                                  const variable* v) override;
+        data_query_ptr query_data(io::yield_ctx& ctx,
+                                  const std::vector<std::string_view>& v) override;
+
+        subscription_ptr subscribe(io::yield_ctx& ctx,
+                const variable* v,
+                float min_interval, float max_interval,
+                float timeout) override {
+            return nullptr;
+        }
+        subscription_ptr subscribe(io::yield_ctx& yield,
+                const std::vector<std::string_view>& path,
+                float min_interval, float max_interval,
+                float timeout) override {
+            return nullptr;
+        }
+
+        value call(io::yield_ctx& yield, action* a, value v, float timeout) override {
+            return value::invalid();
+        }
+        value call(io::yield_ctx& yield,
+                    const std::vector<std::string_view>& path,
+                    value v, float timeout) override {
+            return value::invalid();
+        }
+
+        static local_context_ptr create(io::yield_ctx&, io::io_context& ioc,
+                const std::string_view& name, const std::string_view& type,
+                const params& p);
+    private:
+        void start_segment();
+        void schedule_flush();
+    };
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include "clock_sync.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace telegraph {
+
+    static int64_t
+    to_micros(time_point t) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                    t.time_since_epoch()).count();
+    }
+
+    clock_sync::clock_sync(size_t window)
+        : window_(std::max<size_t>(window, 1)), samples_(),
+          host_mean_(0), device_mean_(0), rate_(1) {}
+
+    void
+    clock_sync::reset() {
+        samples_.clear();
+        host_mean_ = 0;
+        device_mean_ = 0;
+        rate_ = 1;
+    }
+
+    void
+    clock_sync::sample(time_point sent, time_point received, uint64_t device) {
+        int64_t s = to_micros(sent), r = to_micros(received);
+        if (r < s) return;
+        // the device clock went backwards, so it restarted
+        // and nothing we know about it holds anymore
+        if (!samples_.empty() && (int64_t) device < samples_.back().device) reset();
+        samples_.push_back(exchange{s + (r - s)/2, (int64_t) device, r - s});
+        while (samples_.size() > window_) samples_.pop_front();
+        fit();
+    }
+
+    void
+    clock_sync::fit() {
+        // the faster half of the round trips, the slow ones
+        // have sat in a queue on one side or the other
+        std::vector<exchange> best(samples_.begin(), samples_.end());
+        std::sort(best.begin(), best.end(),
+            [](const exchange& a, const exchange& b) { return a.rtt < b.rtt; });
+        best.resize((best.size() + 1)/2);
+
+        // center first, us since the epoch squared don't fit in a double
+        int64_t h0 = best.front().host, d0 = best.front().device;
+        double hm = 0, dm = 0;
+        for (const auto& e : best) {
+            hm += (double) (e.host - h0);
+            dm += (double) (e.device - d0);
+        }
+        hm /= best.size();
+        dm /= best.size();
+        host_mean_ = h0 + (int64_t) std::llround(hm);
+        device_mean_ = d0 + (int64_t) std::llround(dm);
+
+        double sdd = 0, sdh = 0;
+        double dmin = 0, dmax = 0;
+        for (const auto& e : best) {
+            double d = (double) (e.device - device_mean_);
+            double h = (double) (e.host - host_mean_);
+            sdd += d*d;
+            sdh += d*h;
+            dmin = std::min(dmin, d);
+            dmax = std::max(dmax, d);
+        }
+        // drift only shows over longer spans, over short ones
+        // the fit would mostly follow the round trip jitter
+        rate_ = 1;
+        if (dmax - dmin >= 1e6 && sdd > 0) {
+            double r = sdh / sdd;
+            // no crystal is off by more than this, it's a bad fit
+            if (std::abs(r - 1) < 1e-3) rate_ = r;
+        }
+    }
+
+    time_point
+    clock_sync::to_host(uint64_t device) const {
+        double d = (double) ((int64_t) device - device_mean_);
+        int64_t host = host_mean_ + (int64_t) std::llround(rate_ * d);
+        return time_point(std::chrono::duration_cast<time_point::duration>(
+                    std::chrono::microseconds(host)));
+    }
+
+    double
+    clock_sync::offset() const {
+        if (samples_.empty()) return 0;
+        uint64_t device = (uint64_t) samples_.back().device;
+        return (double) (to_micros(to_host(device)) - (int64_t) device);
+    }
+
+    int64_t
+    clock_sync::min_rtt() const {
+        if (samples_.empty()) return 0;
+        return std::min_element(samples_.begin(), samples_.end(),
+            [](const exchange& a, const exchange& b) { return a.rtt < b.rtt; })->rtt;
+    }
+}
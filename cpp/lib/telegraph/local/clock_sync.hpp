@@ -0,0 +1,62 @@
+#ifndef __TELEGRAPH_LOCAL_CLOCK_SYNC_HPP__
+#define __TELEGRAPH_LOCAL_CLOCK_SYNC_HPP__
+
+#include "../common/data.hpp"
+
+#include <cinttypes>
+#include <cstddef>
+#include <deque>
+
+namespace telegraph {
+
+    /**
+     * Maps a device clock (in us) onto the host clock, from ping/pong
+     * exchanges where the device puts its time into the pong.
+     *
+     * Every exchange gives the device time at (roughly) the midpoint of
+     * the round trip. The exchanges with the shortest round trips of
+     * the last few are the least disturbed by queueing, and a line
+     * fit through them gives both the offset and the drift between
+     * the two clocks.
+     */
+    class clock_sync {
+    public:
+        // window is how many of the latest exchanges are kept
+        clock_sync(size_t window=16);
+
+        // a ping sent at sent, with a pong stamped device (us on the
+        // device clock) that arrived at received
+        void sample(time_point sent, time_point received, uint64_t device);
+
+        // whether there is anything to map with yet
+        bool valid() const { return !samples_.empty(); }
+
+        // the host time of a device time, only meaningful when valid()
+        time_point to_host(uint64_t device) const;
+
+        // host time minus device time (us) right now
+        double offset() const;
+        // how much faster the device clock runs, in parts per million
+        double drift_ppm() const { return (1/rate_ - 1)*1e6; }
+        // the shortest round trip in the window, in us
+        int64_t min_rtt() const;
+
+        void reset();
+    private:
+        struct exchange {
+            int64_t host; // midpoint of the round trip, us since epoch
+            int64_t device;
+            int64_t rtt;
+        };
+        void fit();
+
+        size_t window_;
+        std::deque<exchange> samples_;
+        // host = host_mean_ + rate_*(device - device_mean_)
+        int64_t host_mean_;
+        int64_t device_mean_;
+        double rate_;
+    };
+}
+
+#endif
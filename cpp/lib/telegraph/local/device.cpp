@@ -89,6 +89,11 @@ namespace telegraph {
         }
     };
 
+    static int64_t now_micros() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                    datapoint::now().time_since_epoch()).count();
+    }
+
     static params make_device_params(const std::string& port, int baud) {
         std::map<std::string, params, std::less<>> i;
         i["port"] = port;
@@ -102,7 +107,10 @@ namespace telegraph {
               one_start_(false), decoding_(false),
               decode_buf_(),
               req_id_(0), reqs_(), adapters_(),
-              port_(ioc) {
+              changes_(), flush_scheduled_(false),
+              batch_changes_(true), batch_answered_(false),
+              clock_(), pings_(), last_times_(),
+              logger_(), port_(ioc) {
         boost::system::error_code ec;
         port_.open(port, ec);
         if (ec) throw io_error("unable to open port: " + port);
@@ -219,6 +227,7 @@ namespace telegraph {
                         stream::Packet p;
                         p.set_req_id(req_id);
                         p.set_ping(0);
+                        sthis->sent_ping(req_id);
                         sthis->write_packet(std::move(p));
                     });
 
@@ -239,12 +248,20 @@ namespace telegraph {
                         stream::Packet p;
                         p.set_req_id(req_id);
                         p.set_ping(0);
+                        sthis->sent_ping(req_id);
                         sthis->write_packet(std::move(p));
                     });
             return true;
         }
     }
 
+    void
+    device::sent_ping(uint32_t req_id) {
+        pings_[req_id] = datapoint::now();
+        // pongs that never came
+        while (pings_.size() > 8) pings_.erase(pings_.begin());
+    }
+
     node*
     device::fetch_node(io::yield_ctx& yield, node::id id) {
         auto sthis = shared_device_this();
@@ -293,38 +310,7 @@ namespace telegraph {
                 // has been destroyed
                 auto sthis = wp.lock();
                 if (!sthis) return false;
-
-                io::deadline_timer timer(sthis->ioc_,
-                    boost::posix_time::milliseconds(1000));
-                uint32_t req_id = sthis->req_id_++;
-                stream::Packet res;
-
-                sthis->reqs_.emplace(req_id, req(&timer, &res));
-
-                // put in the request
-                io::dispatch(sthis->port_.get_executor(),
-                        [sthis, req_id, id, debounce, refresh, timeout] () {
-                            stream::Packet p;
-                            p.set_req_id(req_id);
-                            stream::Subscribe* s = p.mutable_change_sub();
-                            s->set_var_id(id);
-                            s->set_sub_timeout((uint32_t) (1000*timeout));
-                            s->set_debounce((uint32_t) (1000*debounce));
-                            s->set_refresh((uint32_t) (1000*refresh));
-                            sthis->write_packet(std::move(p));
-                        });
-                // wait for response
-                boost::system::error_code ec;
-                timer.async_wait(yield.ctx[ec]);
-                sthis->reqs_.erase(req_id);
-                if (ec != io::error::operation_aborted) {
-                    // timed out!
-                    return false;
-                }
-                if (!res.success()) {
-                    return false;
-                }
-                return true;
+                return sthis->change_sub(yield, id, debounce, refresh, timeout);
             };
             auto poll = [wp]() {
                 auto sthis = wp.lock();
@@ -389,14 +375,189 @@ namespace telegraph {
                     min_interval, max_interval, timeout);
     }
 
+    // the most changes in a change_subs, see stream.options
+    static constexpr size_t max_changes = 16;
+    // and the most bytes they can take up, the firmware
+    // decodes frames into 255 bytes (crc and req_id included)
+    static constexpr size_t max_changes_size = 232;
+
+    bool
+    device::change_sub(io::yield_ctx& yield, node::id var_id,
+                        float debounce, float refresh, float timeout) {
+        bool success = false;
+        io::deadline_timer done(ioc_, boost::posix_time::ptime(boost::posix_time::pos_infin));
+        changes_.push_back(change{var_id, debounce, refresh, timeout, &done, &success});
+        if (!flush_scheduled_) {
+            flush_scheduled_ = true;
+            // posted so that the changes started along with
+            // this one (say by subscribe_many()) are queued first
+            auto sthis = shared_device_this();
+            io::post(ioc_, [sthis] () { sthis->flush_changes(); });
+        }
+        // flush_changes() always answers
+        boost::system::error_code ec;
+        done.async_wait(yield.ctx[ec]);
+        return success;
+    }
+
+    void
+    device::flush_changes() {
+        flush_scheduled_ = false;
+        std::vector<change> pending;
+        std::swap(pending, changes_);
+        auto sthis = shared_device_this();
+        if (pending.size() == 1 || !batch_changes_) {
+            for (const change& c : pending) {
+                io::spawn(ioc_, [sthis, c] (io::yield_context yield) {
+                    io::yield_ctx ctx(yield);
+                    sthis->send_change(ctx, c);
+                });
+            }
+            return;
+        }
+        std::vector<change> chunk;
+        size_t size = 0;
+        for (const change& c : pending) {
+            stream::Subscribe s;
+            s.set_var_id(c.var_id);
+            s.set_sub_timeout((uint32_t) (1000*c.timeout));
+            s.set_debounce((uint32_t) (1000*c.debounce));
+            s.set_refresh((uint32_t) (1000*c.refresh));
+            // plus the field tag and length
+            size_t n = s.ByteSizeLong() + 2;
+            if (chunk.size() == max_changes || size + n > max_changes_size) {
+                io::spawn(ioc_, [sthis, chunk] (io::yield_context yield) {
+                    io::yield_ctx ctx(yield);
+                    sthis->send_changes(ctx, chunk);
+                });
+                chunk.clear();
+                size = 0;
+            }
+            chunk.push_back(c);
+            size += n;
+        }
+        io::spawn(ioc_, [sthis, chunk] (io::yield_context yield) {
+            io::yield_ctx ctx(yield);
+            sthis->send_changes(ctx, chunk);
+        });
+    }
+
+    void
+    device::send_change(io::yield_ctx& yield, const change& c) {
+        auto sthis = shared_device_this();
+        io::deadline_timer timer(ioc_,
+            boost::posix_time::milliseconds(1000));
+        uint32_t req_id = req_id_++;
+        stream::Packet res;
+
+        reqs_.emplace(req_id, req(&timer, &res));
+
+        // put in the request
+        io::dispatch(port_.get_executor(),
+                [sthis, req_id, c] () {
+                    stream::Packet p;
+                    p.set_req_id(req_id);
+                    stream::Subscribe* s = p.mutable_change_sub();
+                    s->set_var_id(c.var_id);
+                    s->set_sub_timeout((uint32_t) (1000*c.timeout));
+                    s->set_debounce((uint32_t) (1000*c.debounce));
+                    s->set_refresh((uint32_t) (1000*c.refresh));
+                    sthis->write_packet(std::move(p));
+                });
+        // wait for response
+        boost::system::error_code ec;
+        timer.async_wait(yield.ctx[ec]);
+        reqs_.erase(req_id);
+        // false if timed out
+        *c.success = ec == io::error::operation_aborted && res.success();
+        c.done->cancel();
+    }
+
+    void
+    device::send_changes(io::yield_ctx& yield, const std::vector<change>& changes) {
+        auto sthis = shared_device_this();
+        io::deadline_timer timer(ioc_,
+            boost::posix_time::milliseconds(1000));
+        uint32_t req_id = req_id_++;
+        stream::Packet res;
+
+        reqs_.emplace(req_id, req(&timer, &res));
+
+        stream::Packet p;
+        p.set_req_id(req_id);
+        stream::SubscribeMany* m = p.mutable_change_subs();
+        for (const change& c : changes) {
+            stream::Subscribe* s = m->add_subs();
+            s->set_var_id(c.var_id);
+            s->set_sub_timeout((uint32_t) (1000*c.timeout));
+            s->set_debounce((uint32_t) (1000*c.debounce));
+            s->set_refresh((uint32_t) (1000*c.refresh));
+        }
+        io::dispatch(port_.get_executor(),
+                [sthis, p] () mutable { sthis->write_packet(std::move(p)); });
+
+        boost::system::error_code ec;
+        timer.async_wait(yield.ctx[ec]);
+        reqs_.erase(req_id);
+        if (ec != io::error::operation_aborted || !res.has_changed_subs()) {
+            if (!batch_answered_) {
+                // the device doesn't know change_subs,
+                // so from now on it gets them one by one
+                batch_changes_ = false;
+                for (const change& c : changes) {
+                    io::spawn(ioc_, [sthis, c] (io::yield_context yield) {
+                        io::yield_ctx ctx(yield);
+                        sthis->send_change(ctx, c);
+                    });
+                }
+                return;
+            }
+            for (const change& c : changes) {
+                *c.success = false;
+                c.done->cancel();
+            }
+            return;
+        }
+        batch_answered_ = true;
+        uint32_t succeeded = res.changed_subs();
+        for (size_t i = 0; i < changes.size(); i++) {
+            *changes[i].success = (succeeded >> i) & 1;
+            changes[i].done->cancel();
+        }
+    }
+
+    std::vector<subscription_ptr>
+    device::subscribe_many(io::yield_ctx& yield, const std::vector<const variable*>& variables,
+                        float min_interval, float max_interval, float timeout) {
+        return subscribe_concurrently(yield, variables.size(),
+            [&] (io::yield_ctx& c, size_t i) -> subscription_ptr {
+                if (!variables[i]) return nullptr;
+                return subscribe(c, variables[i], min_interval, max_interval, timeout);
+            });
+    }
+
     value
     device::call(io::yield_ctx& yield, action* a, value arg, float timeout) {
+        auto sthis = shared_device_this();
         io::deadline_timer timer(ioc_,
             boost::posix_time::milliseconds(1000));
         uint32_t req_id = req_id_++;
         stream::Packet res;
         reqs_.emplace(req_id, req(&timer, &res));
 
+        if (logger_) logger_->call(now_micros(), req_id, a->get_id(), arg);
+        node::id action_id = a->get_id();
+        io::dispatch(port_.get_executor(),
+                [sthis, req_id, action_id, arg] () {
+                    stream::Packet p;
+                    p.set_req_id(req_id);
+                    auto c = p.mutable_call_action();
+                    c->set_action_id(action_id);
+                    value v = arg;
+                    v.pack(c->mutable_arg());
+                    sthis->write_packet(std::move(p));
+                });
+
         boost::system::error_code ec;
         timer.async_wait(yield.ctx[ec]);
         reqs_.erase(req_id);
@@ -406,7 +567,47 @@ namespace telegraph {
         if (res.event_case() != stream::Packet::kCallCompleted) {
             return value::invalid();
         }
-        return value::unpack(res.call_completed());
+        value ret = value::unpack(res.call_completed());
+        if (logger_) logger_->call_finished(now_micros(), req_id, ret);
+        return ret;
+    }
+
+    void
+    device::log_to(const std::shared_ptr<session_logger>& l) {
+        logger_ = l;
+        if (logger_ && tree_) logger_->root(now_micros(), tree_.get());
+    }
+
+    params_stream_ptr
+    device::request(io::yield_ctx& yield, const params& p) {
+        if (!p.is_object()) return nullptr;
+        const std::string& type = p.at("type").get<std::string>();
+        if (type == "log") {
+            const std::string& path = p.at("path").get<std::string>();
+            try {
+                log_to(std::make_shared<session_logger>(path, now_micros()));
+            } catch (io_error& e) {
+                return nullptr;
+            }
+        } else if (type == "log_stop") {
+            log_to(nullptr);
+        } else if (type == "clock") {
+            // how the device clock maps onto ours
+            params status = params::object();
+            status["synced"] = clock_.valid();
+            status["drift_ppm"] = (float) clock_.drift_ppm();
+            status["rtt"] = (float) clock_.min_rtt();
+            params_stream_ptr res = std::make_shared<params_stream>();
+            res->write(std::move(status));
+            res->close();
+            return res;
+        } else {
+            return nullptr;
+        }
+        params_stream_ptr res = std::make_shared<params_stream>();
+        res->write(params{true});
+        res->close();
+        return res;
     }
 
     void
@@ -433,67 +634,76 @@ namespace telegraph {
     void
     device::on_read(const boost::system::error_code& ec, size_t transferred) {
         if (ec) return; // on error cancel the reading loop
-        if (!decoding_) {
-            // consume bytes from the input sequence until we hit two 'S's
-            int c = 0;
-            do {
-                c = read_buf_.sbumpc();
-                if (c == 'S' && !one_start_)  {
-                    one_start_ = true;
-                } else if (c == 'S' && one_start_) {
-                    one_start_ = false;
-                    decoding_ = true;
-                    break;
-                } else {
-                    one_start_ = false;
-                }
-            } while (c != EOF);
-        }
-        if (decoding_) {
+        // taken once, as close to the bytes arriving as we can get, and
+        // shared by everything decoded from them. Stamping later would
+        // fold our own decode and fanout time into the data
+        time_point received = datapoint::now();
+        // a read can hold several frames, the replies to a change_subs
+        // come back to back, so decode all that are complete
+        while (read_buf_.size() > 0) {
+            if (!decoding_) {
+                // consume bytes from the input sequence until we hit two 'S's
+                int c = 0;
+                do {
+                    c = read_buf_.sbumpc();
+                    if (c == 'S' && !one_start_)  {
+                        one_start_ = true;
+                    } else if (c == 'S' && one_start_) {
+                        one_start_ = false;
+                        decoding_ = true;
+                        break;
+                    } else {
+                        one_start_ = false;
+                    }
+                } while (c != EOF);
+            }
+            // no start yet
+            if (!decoding_) break;
+
             // we hit a message and are decoding the payload
             decodebuf db(&read_buf_);
             // read from db into the write buffer
             std::ostream os(&decode_buf_);
             os << &db;
-            if (db.finished()) {
-                decoding_ = false;
-                if (decode_buf_.size() < 4) {
-                    std::cout << "bad length" << std::endl;
-                    decode_buf_.consume(decode_buf_.size());
-                    do_reading(0);
-                    return;
-                }
+            // the rest of it hasn't arrived yet
+            if (!db.finished()) break;
+            decoding_ = false;
+            if (decode_buf_.size() < 4) {
+                std::cout << "bad length" << std::endl;
+                decode_buf_.consume(decode_buf_.size());
+                continue;
+            }
 
-                // get the crc from the decoded buffer
-                auto buf = decode_buf_.data();
-                auto payload_start = io::buffers_begin(buf);
-                auto payload_end = io::buffers_begin(buf) + decode_buf_.size() - 4;
-                uint32_t crc_expected = crc::crc32_buffers(payload_start, payload_end);
-                uint32_t crc_actual = 0;
-                crc_actual |= (uint32_t) ((uint8_t) *(payload_end));       payload_end++;
-                crc_actual |= (uint32_t) ((uint8_t) *(payload_end)) << 8;  payload_end++;
-                crc_actual |= (uint32_t) ((uint8_t) *(payload_end)) << 16; payload_end++;
-                crc_actual |= (uint32_t) ((uint8_t) *(payload_end)) << 24; payload_end++;
-                if (crc_actual != crc_expected) {
-                    std::cout << "bad crc" << std::endl;
-                    decode_buf_.consume(decode_buf_.size());
-                    do_reading(0);
-                    return;
-                }
+            // get the crc from the decoded buffer
+            auto buf = decode_buf_.data();
+            auto payload_start = io::buffers_begin(buf);
+            auto payload_end = io::buffers_begin(buf) + decode_buf_.size() - 4;
+            uint32_t crc_expected = crc::crc32_buffers(payload_start, payload_end);
+            uint32_t crc_actual = 0;
+            crc_actual |= (uint32_t) ((uint8_t) *(payload_end));       payload_end++;
+            crc_actual |= (uint32_t) ((uint8_t) *(payload_end)) << 8;  payload_end++;
+            crc_actual |= (uint32_t) ((uint8_t) *(payload_end)) << 16; payload_end++;
+            crc_actual |= (uint32_t) ((uint8_t) *(payload_end)) << 24; payload_end++;
+            if (crc_actual != crc_expected) {
+                std::cout << "bad crc" << std::endl;
+                decode_buf_.consume(decode_buf_.size());
+                continue;
+            }
 
-                // decode the payload
-                std::istream input_stream(&decode_buf_);
-                google::protobuf::io::IstreamInputStream iss{&input_stream};
-                google::protobuf::io::CodedInputStream input{&iss};
-                input.PushLimit(decode_buf_.size() - 4);
+            // decode the payload, the coded stream already
+            // reads from decode_buf_ when it is constructed
+            size_t payload_size = decode_buf_.size() - 4;
+            std::istream input_stream(&decode_buf_);
+            google::protobuf::io::IstreamInputStream iss{&input_stream};
+            google::protobuf::io::CodedInputStream input{&iss};
+            input.PushLimit(payload_size);
 
-                stream::Packet packet;
-                packet.ParseFromCodedStream(&input);
-                on_read(std::move(packet));
+            stream::Packet packet;
+            packet.ParseFromCodedStream(&input);
+            on_read(received, std::move(packet));
 
-                // consume any leftover bytes
-                decode_buf_.consume(decode_buf_.size());
-            }
+            // consume any leftover bytes
+            decode_buf_.consume(decode_buf_.size());
         }
         // read some more
         do_reading(0);
@@ -562,20 +772,43 @@ namespace telegraph {
     void
     device::write_packet(stream::Packet&& p) {
         write_queue_.emplace_back(std::move(p));
-        // if there is a write chain active
-        if (write_queue_.size() > 1) return;
+        // if there is a write chain active, do_write_next() pops
+        // the packet it writes so the queue alone doesn't tell
+        if (write_buf_.size() > 0) return;
         do_write_next();
     }
 
     void
-    device::on_read(stream::Packet&& p) {
+    device::on_read(time_point received, stream::Packet&& p) {
         if (p.has_update()) {
             // updates have var_id in the req_id
             node::id var_id = (node::id) p.req_id();
+            value v = value::unpack(p.update());
+            // when the device sampled it, if it says so. Firmware may
+            // hold on to samples and send them in bursts
+            time_point t = received;
+            if (p.timestamp() && clock_.valid()) {
+                // it can't have been taken after it got here
+                t = std::min(clock_.to_host(p.timestamp()), received);
+            }
+            time_point& last = last_times_[var_id];
+            t = std::max(t, last);
+            last = t;
+            if (logger_) {
+                logger_->update(std::chrono::duration_cast<std::chrono::microseconds>(
+                            t.time_since_epoch()).count(), var_id, v);
+            }
             auto it = adapters_.find(var_id);
             if (it == adapters_.end()) return;
-            else it->second->update(value::unpack(p.update()));
+            else it->second->update(t, v);
         } else {
+            if (p.has_pong()) {
+                auto it = pings_.find(p.req_id());
+                if (it != pings_.end()) {
+                    if (p.timestamp()) clock_.sample(it->second, received, p.timestamp());
+                    pings_.erase(it);
+                }
+            }
             // look at the req_id
             uint32_t req_id = p.req_id();
             if (reqs_.find(req_id) != reqs_.end()) {
@@ -594,6 +827,12 @@ namespace telegraph {
         const std::string& port = p.at("port").get<std::string>();
         auto s = std::make_shared<device>(ioc, std::string{name}, port, baud);
         s->init(yield, 500);
+        // optionally log the whole session
+        auto it = p.to_map().find("log");
+        if (it != p.to_map().end()) {
+            s->log_to(std::make_shared<session_logger>(
+                        it->second.get<std::string>(), now_micros()));
+        }
         return s;
     }
 
@@ -2,6 +2,8 @@
 #define __TELEGRAPH_LOCAL_DEVICE_HPP__
 
 #include "namespace.hpp"
+#include "session_logger.hpp"
+#include "clock_sync.hpp"
 
 #include "../common/params.hpp"
 #include "../common/adapter.hpp"
@@ -12,6 +14,7 @@
 #include <string>
 #include <memory>
 #include <unordered_map>
+#include <map>
 #include <deque>
 #include <iostream>
 
@@ -46,6 +49,36 @@ namespace telegraph {
         // subscription adapters
         std::unordered_map<node::id, std::shared_ptr<adapter_base>> adapters_;
 
+        // subscription changes waiting to go out, the ones
+        // started together share change_subs frames
+        struct change {
+            node::id var_id;
+            float debounce;
+            float refresh;
+            float timeout;
+            io::deadline_timer* done; // cancelled once it has been answered
+            bool* success;
+        };
+        std::vector<change> changes_;
+        bool flush_scheduled_;
+        // cleared if the device ignores change_subs (older firmware),
+        // set once it has answered one
+        bool batch_changes_;
+        bool batch_answered_;
+
+        // maps the sample times the device puts on updates onto our
+        // clock, kept up to date by the pings
+        clock_sync clock_;
+        // when each ping still waiting for a pong went out
+        std::map<uint32_t, time_point> pings_;
+        // time of the last update of each variable. A refit of clock_
+        // can map a later sample before an earlier one, updates are
+        // held at this so time never goes backwards for a variable
+        std::unordered_map<node::id, time_point> last_times_;
+
+        // lossless capture of everything the device sends, if enabled
+        std::shared_ptr<session_logger> logger_;
+
         io::serial_port port_;
     public:
         device(io::io_context& ioc, const std::string& name, const std::string& port, int baud);
@@ -58,12 +91,21 @@ namespace telegraph {
         bool ping(io::yield_ctx&, bool wait=true, int millisec_timeout=50);
         node* fetch_node(io::yield_ctx&, node::id id);
 
-        // no querying
-        params_stream_ptr request(io::yield_ctx&, const params& p) { return nullptr; }
+        // start/stop logging the session to a file
+        void log_to(const std::shared_ptr<session_logger>& l);
+
+        // supports {type: "log", path: ...}, {type: "log_stop"} and
+        // {type: "clock"}, which replies with {synced, drift_ppm, rtt (us)}
+        params_stream_ptr request(io::yield_ctx&, const params& p) override;
 
         subscription_ptr subscribe(io::yield_ctx& ctx, const variable* v,
                                 float min_interval, float max_interval, 
                                 float timeout) override;
+        // the change_sub round trips of all the variables overlap
+        std::vector<subscription_ptr> subscribe_many(io::yield_ctx& ctx,
+                                const std::vector<const variable*>& variables,
+                                float min_interval, float max_interval,
+                                float timeout) override;
         value call(io::yield_ctx& ctx, action* a, value v, float timeout);
 
         void destroy(io::yield_ctx& ctx) override;
@@ -78,6 +120,15 @@ namespace telegraph {
             if (!v) return nullptr;
             return subscribe(ctx, v, min_interval, max_interval, timeout);
         }
+        std::vector<subscription_ptr> subscribe_many(io::yield_ctx& ctx,
+                                const std::vector<std::vector<std::string_view>>& paths,
+                                float min_interval, float max_interval,
+                                float timeout) override {
+            std::vector<const variable*> vars;
+            for (const auto& p : paths)
+                vars.push_back(dynamic_cast<variable*>(tree_->from_path(p)));
+            return subscribe_many(ctx, vars, min_interval, max_interval, timeout);
+        }
 
         value call(io::yield_ctx& ctx, 
                         const std::vector<std::string_view>& path, 
@@ -118,7 +169,15 @@ namespace telegraph {
 
         void do_write_next();
         void write_packet(stream::Packet&& p);
-        void on_read(stream::Packet&& p);
+        void on_read(time_point received, stream::Packet&& p);
+        void sent_ping(uint32_t req_id);
+
+        // queues a subscription change and waits for its answer
+        bool change_sub(io::yield_ctx& yield, node::id var_id,
+                        float debounce, float refresh, float timeout);
+        void flush_changes();
+        void send_change(io::yield_ctx& yield, const change& c);
+        void send_changes(io::yield_ctx& yield, const std::vector<change>& c);
     };
 
     class device_scanner : public local_component {
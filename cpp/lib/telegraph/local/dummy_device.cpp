@@ -6,9 +6,10 @@
 
 namespace telegraph {
     dummy_device::dummy_device(io::io_context& ioc, const std::string_view& name, 
-                                std::unique_ptr<node>&& tree)
-                           : local_context(ioc, name, "dummy_device", 
-                                    params{}, std::move(tree))  {}
+                                std::unique_ptr<node>&& tree,
+                                const std::string_view& type, const params& p)
+                           : local_context(ioc, name, type, 
+                                    p, std::move(tree))  {}
 
     dummy_device::~dummy_device() {}
     void
@@ -16,7 +16,8 @@ namespace telegraph {
         std::unordered_map<const action*, handler> handlers_;
     public:
         dummy_device(io::io_context& ioc, const std::string_view& name,
-                    std::unique_ptr<node>&& s);
+                    std::unique_ptr<node>&& s,
+                    const std::string_view& type="dummy_device", const params& p=params{});
         ~dummy_device();
 
         void add_publisher(const variable* v, const publisher_ptr& p);
@@ -0,0 +1,123 @@
+#include "load_device.hpp"
+
+#include "../common/nodes.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <string>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+namespace telegraph {
+
+    // resident set size of this process in bytes, 0 if unknown
+    static uint64_t
+    resident_bytes() {
+#ifdef __linux__
+        std::ifstream statm("/proc/self/statm");
+        uint64_t size = 0, resident = 0;
+        if (!(statm >> size >> resident)) return 0;
+        return resident * (uint64_t) sysconf(_SC_PAGESIZE);
+#else
+        return 0;
+#endif
+    }
+
+    static std::unique_ptr<node>
+    make_tree(const std::string_view& name, size_t variables) {
+        std::vector<node*> children;
+        for (size_t i = 0; i < variables; i++) {
+            std::string n = "v" + std::to_string(i);
+            children.push_back(new variable((node::id) (i + 1), n, n, "", value_type::Uint64));
+        }
+        return std::make_unique<group>(0, name, name, "", "", 1, std::move(children));
+    }
+
+    load_device::load_device(io::io_context& ioc, const std::string_view& name,
+                             const params& p, size_t variables, float rate)
+            : dummy_device(ioc, name, make_tree(name, variables), "load_device", p),
+              pubs_(),
+              period_(boost::posix_time::microseconds((int64_t) (1000000 / rate))),
+              timer_(ioc), published_(0) {
+        for (node* n : tree_->nodes()) {
+            auto v = dynamic_cast<variable*>(n);
+            if (!v) continue;
+            pubs_.push_back(std::make_shared<publisher>(ioc, v->get_type()));
+            add_publisher(v, pubs_.back());
+        }
+    }
+
+    void
+    load_device::start() {
+        timer_.expires_from_now(period_);
+        auto wp = std::weak_ptr<load_device>(
+                std::static_pointer_cast<load_device>(shared_from_this()));
+        timer_.async_wait([wp] (const boost::system::error_code& ec) {
+            auto sthis = wp.lock();
+            if (sthis) sthis->tick(ec);
+        });
+    }
+
+    void
+    load_device::tick(const boost::system::error_code& ec) {
+        if (ec) return;
+        uint64_t now = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        for (auto& p : pubs_) p->update(value{now});
+        published_ += pubs_.size();
+
+        // from the last deadline, so the rate doesn't drift
+        timer_.expires_at(timer_.expires_at() + period_);
+        auto wp = std::weak_ptr<load_device>(
+                std::static_pointer_cast<load_device>(shared_from_this()));
+        timer_.async_wait([wp] (const boost::system::error_code& ec) {
+            auto sthis = wp.lock();
+            if (sthis) sthis->tick(ec);
+        });
+    }
+
+    params_stream_ptr
+    load_device::request(io::yield_ctx&, const params& p) {
+        if (!p.is_object()) return nullptr;
+        const std::string& type = p.at("type").get<std::string>();
+        if (type != "stats") return nullptr;
+        params stats = params::object();
+        // params only have floats, precise enough for these
+        stats["rss"] = (float) resident_bytes();
+        stats["published"] = (float) published_;
+        params_stream_ptr res = std::make_shared<params_stream>();
+        res->write(std::move(stats));
+        res->close();
+        return res;
+    }
+
+    void
+    load_device::destroy(io::yield_ctx& yield) {
+        timer_.cancel();
+        local_context::destroy(yield);
+    }
+
+    local_context_ptr
+    load_device::create(io::yield_ctx&, io::io_context& ioc,
+            const std::string_view& name, const std::string_view& type,
+            const params& p) {
+        auto args = p.to_map();
+        float variables = 64;
+        float rate = 100;
+        auto it = args.find("variables");
+        if (it != args.end()) variables = it->second.get<float>();
+        it = args.find("rate");
+        if (it != args.end()) rate = it->second.get<float>();
+        // ids 1..variables have to fit in a node::id (the root is 0), and
+        // the period is in whole microseconds, so it can't be shorter than one
+        if (!(variables >= 1 && variables <= std::numeric_limits<node::id>::max()))
+            return nullptr;
+        if (!(rate > 0 && rate <= 1000000)) return nullptr;
+        auto dev = std::make_shared<load_device>(ioc, name, p, (size_t) variables, rate);
+        dev->start();
+        return dev;
+    }
+}
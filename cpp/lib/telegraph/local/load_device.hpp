@@ -0,0 +1,48 @@
+#ifndef __TELEGRAPH_LOCAL_LOAD_DEVICE_HPP__
+#define __TELEGRAPH_LOCAL_LOAD_DEVICE_HPP__
+
+#include "dummy_device.hpp"
+
+#include <memory>
+#include <vector>
+
+#include <boost/asio/deadline_timer.hpp>
+
+namespace telegraph {
+
+    /**
+     * A device that only exists to put load on the server (see
+     * main/load.cpp). Has variables v0, v1, ... of type uint64 which are
+     * all set to the current time, in microseconds since the epoch, rate
+     * times a second. Whoever receives an update can tell its end-to-end
+     * latency by comparing the value against their own clock.
+     *
+     * Created with {variables: 64 (at most 65535), rate: 100 (at most 1e6)}.
+     * Supports {type: "stats"}, which replies with {rss: resident bytes of
+     * the server, published: updates so far}.
+     */
+    class load_device : public dummy_device {
+    private:
+        std::vector<publisher_ptr> pubs_;
+        boost::posix_time::time_duration period_;
+        io::deadline_timer timer_;
+        uint64_t published_;
+    public:
+        load_device(io::io_context& ioc, const std::string_view& name,
+                    const params& p, size_t variables, float rate);
+
+        params_stream_ptr request(io::yield_ctx&, const params& p) override;
+        void destroy(io::yield_ctx& yield) override;
+
+        // starts publishing
+        void start();
+
+        static local_context_ptr create(io::yield_ctx&, io::io_context& ioc,
+                const std::string_view& name, const std::string_view& type,
+                const params& p);
+    private:
+        void tick(const boost::system::error_code& ec);
+    };
+}
+
+#endif
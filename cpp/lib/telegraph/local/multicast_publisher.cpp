@@ -0,0 +1,314 @@
+#include "multicast_publisher.hpp"
+
+#include "../common/nodes.hpp"
+#include "../utils/errors.hpp"
+
+#include <iostream>
+
+#include <boost/asio/ip/multicast.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <google/protobuf/io/coded_stream.h>
+
+namespace net = boost::asio;
+using udp = boost::asio::ip::udp;
+using coded = google::protobuf::io::CodedOutputStream;
+
+namespace telegraph {
+
+    multicast_publisher::multicast_publisher(io::io_context& ioc, const std::string_view& name,
+                const params& p, udp::socket&& socket, const udp::endpoint& group,
+                size_t max_datagram, float flush_interval, float heartbeat_interval)
+            : local_component(ioc, name, "multicast_publisher", p),
+              socket_(std::move(socket)), group_(group),
+              source_(boost::lexical_cast<std::string>(get_uuid())),
+              max_datagram_(max_datagram), flush_interval_(flush_interval),
+              heartbeat_interval_(heartbeat_interval),
+              channels_(), next_channel_(1), seq_(0),
+              pending_(), pending_size_(0), send_buf_(), sent_recently_(false),
+              flush_timer_(ioc), flush_scheduled_(false), heartbeat_timer_(ioc),
+              recv_buf_(), requester_() {
+        pending_.set_kind(api::McastDatagram::UPDATES);
+        pending_.set_source(source_);
+        // the size without any updates, with room for the largest seq
+        pending_.set_seq(~(uint64_t) 0);
+        pending_size_ = pending_.ByteSizeLong();
+    }
+
+    multicast_publisher::~multicast_publisher() {
+        flush_timer_.cancel();
+        heartbeat_timer_.cancel();
+        for (auto& c : channels_) c.second.sub->data.remove(this);
+        boost::system::error_code ec;
+        socket_.close(ec);
+    }
+
+    void
+    multicast_publisher::start() {
+        receive_next();
+        schedule_heartbeat();
+    }
+
+    void
+    multicast_publisher::send(const api::McastDatagram& d, const udp::endpoint& to) {
+        d.SerializeToString(&send_buf_);
+        // the socket is non-blocking, if the kernel buffer is
+        // full the datagram is lost and receivers catch up
+        boost::system::error_code ec;
+        socket_.send_to(net::buffer(send_buf_), to, 0, ec);
+        if (ec && ec != net::error::would_block) {
+            std::cerr << "multicast send failed: " << ec.message() << std::endl;
+        }
+    }
+
+    void
+    multicast_publisher::add_update(uint32_t channel, datapoint dp) {
+        api::McastUpdate u;
+        u.set_channel(channel);
+        dp.pack(u.mutable_dp());
+        size_t size = u.ByteSizeLong();
+        size_t encoded = 1 + coded::VarintSize32((uint32_t) size) + size;
+        if (pending_.updates_size() > 0 && pending_size_ + encoded > max_datagram_) flush();
+        pending_.add_updates()->Swap(&u);
+        pending_size_ += encoded;
+        if (pending_size_ >= max_datagram_) flush();
+        else schedule_flush();
+    }
+
+    void
+    multicast_publisher::flush() {
+        if (pending_.updates_size() == 0) return;
+        pending_.set_seq(++seq_);
+        send(pending_, group_);
+        sent_recently_ = true;
+        pending_.clear_updates();
+        pending_.set_seq(~(uint64_t) 0);
+        pending_size_ = pending_.ByteSizeLong();
+    }
+
+    void
+    multicast_publisher::schedule_flush() {
+        if (flush_scheduled_) return;
+        flush_scheduled_ = true;
+        flush_timer_.expires_from_now(
+            boost::posix_time::microseconds((long) (flush_interval_ * 1000000)));
+        std::weak_ptr<multicast_publisher> w =
+            std::static_pointer_cast<multicast_publisher>(shared_from_this());
+        flush_timer_.async_wait([w](const boost::system::error_code& ec) {
+            if (ec) return;
+            auto sp = w.lock();
+            if (!sp) return;
+            sp->flush_scheduled_ = false;
+            sp->flush();
+        });
+    }
+
+    void
+    multicast_publisher::schedule_heartbeat() {
+        heartbeat_timer_.expires_from_now(
+            boost::posix_time::microseconds((long) (heartbeat_interval_ * 1000000)));
+        std::weak_ptr<multicast_publisher> w =
+            std::static_pointer_cast<multicast_publisher>(shared_from_this());
+        heartbeat_timer_.async_wait([w](const boost::system::error_code& ec) {
+            if (ec) return;
+            auto sp = w.lock();
+            if (!sp) return;
+            if (!sp->sent_recently_) {
+                api::McastDatagram d;
+                d.set_kind(api::McastDatagram::HEARTBEAT);
+                d.set_source(sp->source_);
+                d.set_seq(sp->seq_);
+                sp->send(d, sp->group_);
+            }
+            sp->sent_recently_ = false;
+            sp->schedule_heartbeat();
+        });
+    }
+
+    void
+    multicast_publisher::receive_next() {
+        std::weak_ptr<multicast_publisher> w =
+            std::static_pointer_cast<multicast_publisher>(shared_from_this());
+        socket_.async_receive_from(net::buffer(recv_buf_), requester_,
+            [w] (const boost::system::error_code& ec, size_t transferred) {
+                if (ec == net::error::operation_aborted) return;
+                auto sp = w.lock();
+                if (!sp) return;
+                api::McastDatagram req;
+                if (!ec && req.ParseFromArray(sp->recv_buf_.data(), (int) transferred) &&
+                        req.kind() == api::McastDatagram::SNAPSHOT_REQUEST) {
+                    sp->send_snapshot(sp->requester_);
+                }
+                sp->receive_next();
+            });
+    }
+
+    void
+    multicast_publisher::send_snapshot(const udp::endpoint& to) {
+        // split into parts of at most max_datagram bytes
+        std::vector<api::McastDatagram> parts;
+        size_t size = 0;
+        for (auto& c : channels_) {
+            api::McastChannel mc;
+            mc.set_channel(c.first);
+            mc.set_uuid(c.second.uuid);
+            for (const auto& s : c.second.path) mc.add_variable(s);
+            api::McastUpdate u;
+            if (c.second.has_latest) {
+                u.set_channel(c.first);
+                c.second.latest.pack(u.mutable_dp());
+            }
+            size_t entry = mc.ByteSizeLong() + u.ByteSizeLong() + 8;
+            if (parts.empty() || size + entry > max_datagram_) {
+                parts.emplace_back();
+                parts.back().set_kind(api::McastDatagram::SNAPSHOT);
+                parts.back().set_source(source_);
+                parts.back().set_seq(seq_);
+                size = parts.back().ByteSizeLong() + 12;
+            }
+            parts.back().add_channels()->Swap(&mc);
+            if (c.second.has_latest) parts.back().add_updates()->Swap(&u);
+            size += entry;
+        }
+        if (parts.empty()) {
+            parts.emplace_back();
+            parts.back().set_kind(api::McastDatagram::SNAPSHOT);
+            parts.back().set_source(source_);
+            parts.back().set_seq(seq_);
+        }
+        for (size_t i = 0; i < parts.size(); i++) {
+            parts[i].set_part((uint32_t) i);
+            parts[i].set_parts((uint32_t) parts.size());
+            send(parts[i], to);
+        }
+    }
+
+    void
+    multicast_publisher::unpublish(uint32_t channel) {
+        auto it = channels_.find(channel);
+        if (it == channels_.end()) return;
+        it->second.sub->data.remove(this);
+        channels_.erase(it);
+    }
+
+    params_stream_ptr
+    multicast_publisher::request(io::yield_ctx& yield, const params& p) {
+        if (!p.is_object()) return nullptr;
+        const std::string& type = p.at("type").get<std::string>();
+        params_stream_ptr res = std::make_shared<params_stream>();
+        if (type == "published") {
+            params list = params::array();
+            for (const auto& c : channels_) {
+                params entry = params::object();
+                entry["channel"] = (float) c.first;
+                entry["uuid"] = params{c.second.uuid};
+                entry["var"] = params{c.second.path};
+                list.push(std::move(entry));
+            }
+            res->write(std::move(list));
+            res->close();
+            return res;
+        }
+        if (type != "publish" && type != "unpublish") return nullptr;
+
+        std::vector<std::string> spath;
+        std::vector<std::string_view> path;
+        for (const params& s : p.at("var").get<std::vector<params>>()) {
+            spath.push_back(s.get<std::string>());
+        }
+        for (const auto& s : spath) path.push_back(s);
+        const std::string& uuids = p.at("uuid").get<std::string>();
+
+        // channel numbers are never reused, so receivers
+        // with a stale channel list can't mix variables up
+        uint32_t existing = 0;
+        for (const auto& c : channels_) {
+            if (c.second.uuid == uuids && c.second.path == spath) existing = c.first;
+        }
+        if (type == "unpublish") {
+            unpublish(existing);
+            res->write(params{true});
+            res->close();
+            return res;
+        }
+
+        auto ns = ns_.lock();
+        if (!ns) return nullptr;
+        auto ctx = ns->contexts->get(boost::lexical_cast<uuid>(uuids));
+        if (!ctx) throw missing_error("no such context");
+        auto tree = ctx->fetch(yield);
+        auto v = tree ? dynamic_cast<variable*>(tree->from_path(path)) : nullptr;
+        if (!v) throw missing_error("no such variable");
+
+        float min_interval = p.at("min_interval").get<float>();
+        float max_interval = p.at("max_interval").get<float>();
+        auto sub = ctx->subscribe(yield, v, min_interval, max_interval, 1);
+        if (!sub) throw remote_error("unable to subscribe");
+        unpublish(existing);
+
+        uint32_t id = next_channel_++;
+        sub->data.add(this, [this, id] (const datapoint& dp) {
+            auto it = channels_.find(id);
+            if (it == channels_.end()) return;
+            it->second.has_latest = true;
+            it->second.latest = dp;
+            add_update(id, dp);
+        });
+        channels_.emplace(id, channel{uuids, std::move(spath), std::move(sub),
+                                      false, datapoint{time_point(), value()}});
+        res->write(params{true});
+        res->close();
+        return res;
+    }
+
+    local_component_ptr
+    multicast_publisher::create(io::yield_ctx&, io::io_context& ioc,
+            const std::string_view& name, const std::string_view& type,
+            const params& p) {
+        auto args = p.to_map();
+        std::string group = "239.255.70.1";
+        unsigned short port = 5007;
+        std::string iface;
+        int ttl = 1;
+        size_t max_datagram = 1400;
+        float flush_interval = 0.01f;
+        float heartbeat_interval = 1;
+        auto it = args.find("group");
+        if (it != args.end()) group = it->second.get<std::string>();
+        it = args.find("port");
+        if (it != args.end()) port = (unsigned short) it->second.get<float>();
+        it = args.find("interface");
+        if (it != args.end()) iface = it->second.get<std::string>();
+        it = args.find("ttl");
+        if (it != args.end()) ttl = (int) it->second.get<float>();
+        it = args.find("max_datagram");
+        if (it != args.end()) max_datagram = (size_t) it->second.get<float>();
+        it = args.find("flush_interval");
+        if (it != args.end()) flush_interval = it->second.get<float>();
+        it = args.find("heartbeat_interval");
+        if (it != args.end()) heartbeat_interval = it->second.get<float>();
+
+        boost::system::error_code ec;
+        auto addr = net::ip::make_address(group, ec);
+        if (ec || !addr.is_multicast()) return nullptr;
+        udp::socket socket{ioc};
+        socket.open(addr.is_v4() ? udp::v4() : udp::v6(), ec);
+        if (ec) return nullptr;
+        if (!iface.empty()) {
+            auto iaddr = net::ip::make_address(iface, ec);
+            if (ec || !iaddr.is_v4()) return nullptr;
+            socket.set_option(net::ip::multicast::outbound_interface(iaddr.to_v4()), ec);
+        }
+        socket.set_option(net::ip::multicast::hops(ttl), ec);
+        // so viewers on this machine see it too
+        socket.set_option(net::ip::multicast::enable_loopback(true), ec);
+        socket.non_blocking(true, ec);
+        if (ec) return nullptr;
+
+        auto pub = std::make_shared<multicast_publisher>(ioc, name, p, std::move(socket),
+                udp::endpoint{addr, port}, max_datagram, flush_interval, heartbeat_interval);
+        pub->start();
+        return pub;
+    }
+}
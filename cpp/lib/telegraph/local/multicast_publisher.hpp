@@ -0,0 +1,102 @@
+#ifndef __TELEGRAPH_LOCAL_MULTICAST_PUBLISHER_HPP__
+#define __TELEGRAPH_LOCAL_MULTICAST_PUBLISHER_HPP__
+
+#include "namespace.hpp"
+
+#include "../common/data.hpp"
+#include "../common/nodes.hpp"
+
+#include "api.pb.h"
+
+#include <array>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/deadline_timer.hpp>
+
+namespace telegraph {
+
+    /**
+     * Broadcasts selected subscriptions to a UDP multicast group, so any
+     * number of passive viewers on the LAN cost the same as one.
+     *
+     * Updates are batched into sequence numbered api::McastDatagram's of
+     * at most max_datagram bytes, sent once full or flush_interval seconds
+     * after the first update in them. When idle a heartbeat carrying the
+     * last sequence number goes out every heartbeat_interval seconds, so
+     * receivers also notice losses at the end of a burst. Receivers that
+     * miss datagrams (or just joined) send a SNAPSHOT_REQUEST to the
+     * address the datagrams came from and get the channel list and latest
+     * values back, unicast. See multicast_receiver.hpp.
+     *
+     * Created with {group: "239.255.70.1", port: 5007, interface: address to
+     * send from, ttl: 1, max_datagram: 1400, flush_interval: 0.01,
+     * heartbeat_interval: 1}, all optional.
+     * Supports {type: "publish", uuid: context, var: path, min_interval, max_interval},
+     * {type: "unpublish", uuid, var} and {type: "published"}
+     */
+    class multicast_publisher : public local_component {
+    private:
+        boost::asio::ip::udp::socket socket_;
+        boost::asio::ip::udp::endpoint group_;
+        std::string source_;
+        size_t max_datagram_;
+        float flush_interval_;
+        float heartbeat_interval_;
+
+        struct channel {
+            std::string uuid; // of the context
+            std::vector<std::string> path;
+            subscription_ptr sub;
+            bool has_latest;
+            datapoint latest;
+        };
+        std::map<uint32_t, channel> channels_;
+        uint32_t next_channel_;
+
+        uint64_t seq_; // of the last updates datagram sent
+        api::McastDatagram pending_;
+        size_t pending_size_;
+        std::string send_buf_;
+        bool sent_recently_; // since the last heartbeat
+
+        io::deadline_timer flush_timer_;
+        bool flush_scheduled_;
+        io::deadline_timer heartbeat_timer_;
+
+        std::array<uint8_t, 2048> recv_buf_;
+        boost::asio::ip::udp::endpoint requester_;
+    public:
+        multicast_publisher(io::io_context& ioc, const std::string_view& name,
+                const params& p, boost::asio::ip::udp::socket&& socket,
+                const boost::asio::ip::udp::endpoint& group,
+                size_t max_datagram, float flush_interval, float heartbeat_interval);
+        ~multicast_publisher();
+
+        // listens for snapshot requests and starts the heartbeat
+        void start();
+
+        // sends the updates batched so far
+        void flush();
+
+        params_stream_ptr request(io::yield_ctx&, const params& p) override;
+
+        static local_component_ptr create(io::yield_ctx&, io::io_context& ioc,
+                const std::string_view& name, const std::string_view& type,
+                const params& p);
+    private:
+        void add_update(uint32_t channel, datapoint dp);
+        void send(const api::McastDatagram& d, const boost::asio::ip::udp::endpoint& to);
+        void send_snapshot(const boost::asio::ip::udp::endpoint& to);
+        void schedule_flush();
+        void schedule_heartbeat();
+        void receive_next();
+        void unpublish(uint32_t channel);
+    };
+}
+
+#endif
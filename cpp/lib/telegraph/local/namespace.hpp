@@ -55,7 +55,7 @@ namespace telegraph {
         std::shared_ptr<namespace_> get_namespace() override { return ns_.lock(); }
         std::shared_ptr<const namespace_> get_namespace() const override { return ns_.lock(); }
 
-        void reg(io::yield_ctx& yield, const std::shared_ptr<local_namespace>& ns);
+        virtual void reg(io::yield_ctx& yield, const std::shared_ptr<local_namespace>& ns);
         void destroy(io::yield_ctx& yield) override;
 
         inline std::shared_ptr<node> fetch(io::yield_ctx&) override {  return tree_; }
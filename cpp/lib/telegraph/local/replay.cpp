@@ -0,0 +1,209 @@
+#include "replay.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include "../utils/io.hpp"
+
+namespace telegraph {
+
+    // publish at most this many packets before letting
+    // other handlers on the io context run
+    static constexpr size_t max_burst = 256;
+
+    replay::replay(io::io_context& ioc, const std::string_view& name,
+                   std::unique_ptr<node>&& tree, std::unique_ptr<session_reader>&& reader,
+                   float speed, bool loop)
+            : local_context(ioc, name, "replay", params{}, std::move(tree)),
+              reader_(std::move(reader)), publishers_(),
+              speed_(speed), loop_(loop), paused_(false), seeked_(false),
+              anchor_log_(reader_->begin_time()), anchor_wall_(),
+              position_(reader_->begin_time()), published_(0), timer_(nullptr) {
+        for (node* n : tree_->nodes()) {
+            auto v = dynamic_cast<variable*>(n);
+            if (v) publishers_.emplace(v->get_id(),
+                    std::make_shared<publisher>(ioc, v->get_type()));
+        }
+        reanchor();
+    }
+
+    replay::~replay() {
+        if (timer_) timer_->cancel();
+    }
+
+    void
+    replay::start() {
+        std::weak_ptr<replay> w = std::static_pointer_cast<replay>(shared_from_this());
+        io::spawn(ioc_, [w, &ioc = ioc_](io::yield_context yield) {
+            io::deadline_timer timer{ioc};
+            { auto s = w.lock(); if (!s) return; s->timer_ = &timer; }
+            // spawn may run us inline, so give whoever
+            // created us a chance to subscribe first
+            boost::system::error_code ec;
+            timer.expires_from_now(boost::posix_time::microseconds(0));
+            timer.async_wait(yield[ec]);
+            { auto s = w.lock(); if (!s) return; s->reanchor(); }
+
+            int64_t time = 0;
+            log::LogPacket packet;
+            bool have = false;
+            size_t burst = 0;
+            while (true) {
+                boost::posix_time::time_duration wait = boost::posix_time::hours(1);
+                {
+                    auto s = w.lock();
+                    if (!s) return;
+                    if (s->seeked_) {
+                        have = false;
+                        s->seeked_ = false;
+                    }
+                    if (!s->paused_) {
+                        if (!have) have = s->reader_->next(&time, &packet);
+                        if (!have) {
+                            // the end of the log
+                            if (s->loop_) s->seek(s->reader_->begin_time());
+                            else s->paused_ = true;
+                            continue;
+                        }
+                        auto now = std::chrono::steady_clock::now();
+                        auto due = s->anchor_wall_;
+                        if (s->speed_ > 0) {
+                            due += std::chrono::microseconds{
+                                (int64_t) ((time - s->anchor_log_) / s->speed_)};
+                        }
+                        if (s->speed_ > 0 && due > now) {
+                            wait = boost::posix_time::microseconds(
+                                std::chrono::duration_cast<std::chrono::microseconds>(
+                                    due - now).count());
+                            burst = 0;
+                        } else {
+                            s->publish(time, packet);
+                            have = false;
+                            if (++burst < max_burst) continue;
+                            wait = boost::posix_time::microseconds(0);
+                            burst = 0;
+                        }
+                    }
+                }
+                timer.expires_from_now(wait);
+                timer.async_wait(yield[ec]);
+            }
+        });
+    }
+
+    void
+    replay::publish(int64_t time, const log::LogPacket& packet) {
+        position_ = time;
+        for (const log::LogEvent& e : packet.events()) {
+            if (!e.has_update()) continue;
+            auto it = publishers_.find((node::id) e.update().var_id());
+            if (it == publishers_.end()) continue;
+            it->second->update(value::unpack(e.update().val()));
+            published_++;
+        }
+    }
+
+    void
+    replay::reanchor() {
+        anchor_log_ = position_;
+        anchor_wall_ = std::chrono::steady_clock::now();
+    }
+
+    void
+    replay::wake() {
+        if (timer_) timer_->cancel();
+    }
+
+    void
+    replay::play() {
+        paused_ = false;
+        reanchor();
+        wake();
+    }
+
+    void
+    replay::pause() {
+        paused_ = true;
+        wake();
+    }
+
+    void
+    replay::set_speed(float speed) {
+        speed_ = speed;
+        reanchor();
+        wake();
+    }
+
+    void
+    replay::seek(int64_t time) {
+        reader_->seek(time);
+        seeked_ = true;
+        position_ = time;
+        reanchor();
+        wake();
+    }
+
+    params_stream_ptr
+    replay::request(io::yield_ctx&, const params& p) {
+        if (!p.is_object()) return nullptr;
+        const std::string& type = p.at("type").get<std::string>();
+        if (type == "play") {
+            play();
+        } else if (type == "pause") {
+            pause();
+        } else if (type == "speed") {
+            set_speed(p.at("speed").get<float>());
+        } else if (type == "seek") {
+            float secs = p.at("time").get<float>();
+            seek(reader_->begin_time() + (int64_t) (secs * 1e6));
+        } else if (type != "status") {
+            return nullptr;
+        }
+        params obj = params::object();
+        obj["position"] = (float) ((position_ - reader_->begin_time()) / 1e6);
+        obj["duration"] = (float) ((reader_->end_time() - reader_->begin_time()) / 1e6);
+        obj["speed"] = speed_;
+        obj["paused"] = paused_;
+        obj["published"] = (float) published_;
+
+        params_stream_ptr res = std::make_shared<params_stream>();
+        res->write(std::move(obj));
+        res->close();
+        return res;
+    }
+
+    subscription_ptr
+    replay::subscribe(io::yield_ctx&, const variable* v,
+                      float min_interval, float max_interval,
+                      float timeout) {
+        auto it = publishers_.find(v->get_id());
+        if (it == publishers_.end()) return nullptr;
+        return it->second->subscribe(min_interval, max_interval);
+    }
+
+    local_context_ptr
+    replay::create(io::yield_ctx&, io::io_context& ioc,
+            const std::string_view& name, const std::string_view& type,
+            const params& p) {
+        auto args = p.to_map();
+        auto pit = args.find("path");
+        if (pit == args.end()) return nullptr;
+        auto reader = std::make_unique<session_reader>(pit->second.get<std::string>());
+        if (!reader->valid() || !reader->root()) return nullptr;
+        std::unique_ptr<node> tree{node::unpack(*reader->root())};
+        if (!tree) return nullptr;
+
+        float speed = 1;
+        bool loop = false;
+        auto it = args.find("speed");
+        if (it != args.end()) speed = it->second.get<float>();
+        it = args.find("loop");
+        if (it != args.end()) loop = it->second.get<bool>();
+
+        auto r = std::make_shared<replay>(ioc, name, std::move(tree),
+                                          std::move(reader), speed, loop);
+        r->start();
+        return r;
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef __TELEGRAPH_LOCAL_REPLAY_HPP__
+#define __TELEGRAPH_LOCAL_REPLAY_HPP__
+
+#include "namespace.hpp"
+#include "session_logger.hpp"
+
+#include "../common/publisher.hpp"
+#include "../common/nodes.hpp"
+
+#include <string_view>
+#include <unordered_map>
+
+#include <boost/asio/deadline_timer.hpp>
+
+namespace telegraph {
+
+    /**
+     * Plays back a session log (see session_logger) as if the
+     * device were connected. Updates are republished through publishers,
+     * so subscriptions behave like they would for a live device.
+     *
+     * speed is a multiple of real time, 0 replays as fast as possible.
+     * Supports {type: "play"}, {type: "pause"}, {type: "speed", speed: x},
+     * {type: "seek", time: seconds since the start of the log} and {type: "status"}
+     */
+    class replay : public local_context {
+    private:
+        std::unique_ptr<session_reader> reader_;
+        std::unordered_map<node::id, publisher_ptr> publishers_;
+
+        float speed_;
+        bool loop_;
+        bool paused_;
+        bool seeked_; // the packet held by the playback task is stale
+
+        // playback is timed relative to this
+        // (log time, wall time) anchor, reset on seek/speed changes
+        int64_t anchor_log_;
+        std::chrono::steady_clock::time_point anchor_wall_;
+        int64_t position_;
+        size_t published_;
+
+        // timer of the playback task, cancelled to wake it up
+        io::deadline_timer* timer_;
+    public:
+        replay(io::io_context& ioc, const std::string_view& name,
+               std::unique_ptr<node>&& tree, std::unique_ptr<session_reader>&& reader,
+               float speed, bool loop);
+        ~replay();
+
+        // starts the playback task
+        void start();
+
+        void play();
+        void pause();
+        void set_speed(float speed);
+        void seek(int64_t time);
+
+        params_stream_ptr request(io::yield_ctx&, const params& p) override;
+
+        subscription_ptr subscribe(io::yield_ctx& ctx,
+                const variable* v,
+                float min_interval, float max_interval,
+                float timeout) override;
+        subscription_ptr subscribe(io::yield_ctx& yield,
+                const std::vector<std::string_view>& path,
+                float min_interval, float max_interval,
+                float timeout) override {
+            auto v = dynamic_cast<variable*>(tree_->from_path(path));
+            if (!v) return nullptr;
+            return subscribe(yield, v, min_interval, max_interval, timeout);
+        }
+
+        // calls are not replayed
+        value call(io::yield_ctx& yield, action* a, value v, float timeout) override {
+            return value::invalid();
+        }
+        value call(io::yield_ctx& yield,
+                    const std::vector<std::string_view>& path,
+                    value v, float timeout) override {
+            return value::invalid();
+        }
+
+        bool write_data(io::yield_ctx& yield,
+                variable* v,
+                const std::vector<datapoint>& data) override {
+            return false;
+        }
+        bool write_data(io::yield_ctx& yield,
+                const std::vector<std::string_view>&,
+                const std::vector<datapoint>& data) override {
+            return false;
+        }
+
+        data_query_ptr query_data(io::yield_ctx& yield,
+                                    const variable* v) override {
+            return nullptr;
+        }
+        data_query_ptr query_data(io::yield_ctx& yield,
+                const std::vector<std::string_view>& v) override {
+            return nullptr;
+        }
+
+        static local_context_ptr create(io::yield_ctx&, io::io_context& ioc,
+                const std::string_view& name, const std::string_view& type,
+                const params& p);
+    private:
+        void reanchor();
+        void wake();
+        void publish(int64_t time, const log::LogPacket& packet);
+    };
+}
+
+#endif
@@ -0,0 +1,294 @@
+#include "segment.hpp"
+
+#include "../common/nodes.hpp"
+#include "../utils/errors.hpp"
+#include "../utils/log_block.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace telegraph {
+
+    static constexpr char segment_magic[8] = {'T','L','G','S','E','G','0','1'};
+    static constexpr char index_magic[8] = {'T','L','G','I','D','X','0','1'};
+
+    segment::segment(const std::filesystem::path& p, int fd)
+        : path_(p), fd_(fd), sealed_(false), capacity_(0),
+          map_(nullptr), map_size_(0), vars_(),
+          pending_(), pending_root_(), pending_root_time_(0),
+          write_buf_(), packet_() {}
+
+    segment::~segment() {
+        unmap();
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    std::unique_ptr<segment>
+    segment::create(const std::filesystem::path& p, int64_t start, size_t capacity) {
+        int fd = ::open(p.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw io_error("unable to create archive segment " + p.string());
+        std::unique_ptr<segment> s{new segment(p, fd)};
+
+        uint8_t header[header_size];
+        std::memcpy(header, segment_magic, 8);
+        log_block::put_u64(header + 8, (uint64_t) start);
+        log_block::write_all(fd, header, header_size, 0, "failed to write archive segment");
+        // preallocate so the mapping doesn't
+        // need to grow while we append
+        if (::ftruncate(fd, std::max(capacity, header_size)) != 0)
+            throw io_error("unable to allocate archive segment " + p.string());
+
+        s->capacity_ = capacity;
+        s->index_.set_start_time(start);
+        s->index_.set_data_end(header_size);
+        s->map(std::max(capacity, header_size));
+        return s;
+    }
+
+    std::unique_ptr<segment>
+    segment::open(const std::filesystem::path& p) {
+        int fd = ::open(p.c_str(), O_RDWR);
+        if (fd < 0) throw io_error("unable to open archive segment " + p.string());
+        std::unique_ptr<segment> s{new segment(p, fd)};
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0) throw io_error("unable to stat " + p.string());
+        size_t file_size = (size_t) st.st_size;
+
+        uint8_t header[header_size];
+        if (file_size < header_size ||
+                ::pread(fd, header, header_size, 0) != (ssize_t) header_size ||
+                std::memcmp(header, segment_magic, 8) != 0) {
+            return nullptr;
+        }
+
+        // try the footer
+        uint8_t footer[16];
+        if (file_size >= header_size + 16 &&
+                ::pread(fd, footer, 16, file_size - 16) == 16 &&
+                std::memcmp(footer + 8, index_magic, 8) == 0) {
+            uint64_t len = log_block::get_u64(footer);
+            if (len <= file_size - header_size - 16) {
+                std::string buf(len, '\0');
+                if (::pread(fd, buf.data(), len, file_size - 16 - len) == (ssize_t) len &&
+                        s->index_.ParseFromString(buf)) {
+                    for (int i = 0; i < s->index_.variables_size(); i++)
+                        s->vars_[s->index_.variables(i).var_id()] = i;
+                    s->sealed_ = true;
+                    s->capacity_ = s->index_.data_end();
+                    s->map(file_size);
+                    return s;
+                }
+            }
+        }
+        // not sealed, scan what made it to disk
+        s->index_.set_start_time((int64_t) log_block::get_u64(header + 8));
+        s->map(file_size);
+        s->recover(file_size);
+        s->capacity_ = s->index_.data_end();
+        s->seal();
+        return s;
+    }
+
+    size_t
+    segment::size() const {
+        // pending updates are roughly 16 bytes each once encoded
+        return index_.data_end() + pending_.size() * 16;
+    }
+
+    size_t
+    segment::count(int32_t var) const {
+        auto it = vars_.find(var);
+        if (it == vars_.end()) return 0;
+        return index_.variables(it->second).count();
+    }
+
+    void
+    segment::add(int64_t time, int32_t var, const value& v) {
+        pending_.push_back(update{time, var, v});
+        track(var, time, 1);
+    }
+
+    void
+    segment::add(int64_t time, const node* root) {
+        pending_root_ = std::make_unique<Node>();
+        pending_root_time_ = time;
+        root->pack(pending_root_.get());
+    }
+
+    void
+    segment::track(int32_t var, int64_t time, size_t n) {
+        auto it = vars_.find(var);
+        if (it == vars_.end()) {
+            it = vars_.emplace(var, index_.variables_size()).first;
+            auto v = index_.add_variables();
+            v->set_var_id(var);
+            v->set_begin(time);
+            v->set_end(time);
+        }
+        auto v = index_.mutable_variables(it->second);
+        v->set_count(v->count() + n);
+        if (time < v->begin()) v->set_begin(time);
+        if (time > v->end()) v->set_end(time);
+    }
+
+    void
+    segment::flush() {
+        if (pending_.empty() && !pending_root_) return;
+        if (sealed_) throw io_error("cannot write to a sealed segment");
+
+        int64_t begin = pending_root_ ? pending_root_time_ : pending_.front().time;
+        int64_t end = begin;
+        for (const update& u : pending_) {
+            begin = std::min(begin, u.time);
+            end = std::max(end, u.time);
+        }
+
+        log_block::begin(&write_buf_);
+        auto write_packet = [this]() { log_block::append(&write_buf_, packet_); };
+
+        if (pending_root_) {
+            packet_.Clear();
+            packet_.set_time_delta(pending_root_time_ - begin);
+            packet_.add_events()->set_allocated_root(pending_root_.release());
+            write_packet();
+        }
+        // updates at the same time share a packet
+        for (size_t i = 0; i < pending_.size();) {
+            packet_.Clear();
+            int64_t t = pending_[i].time;
+            packet_.set_time_delta(t - begin);
+            for (; i < pending_.size() && pending_[i].time == t; i++) {
+                auto u = packet_.add_events()->mutable_update();
+                u->set_var_id(pending_[i].var);
+                pending_[i].val.pack(u->mutable_val());
+            }
+            write_packet();
+        }
+
+        log_block::finish(&write_buf_, begin);
+
+        size_t offset = index_.data_end();
+        // a single write for the whole batch
+        log_block::write_all(fd_, (const uint8_t*) write_buf_.data(), write_buf_.size(),
+                             offset, "failed to write archive segment");
+
+        auto b = index_.add_batches();
+        b->set_offset(offset);
+        b->set_begin(begin);
+        b->set_end(end);
+        index_.set_data_end(offset + write_buf_.size());
+        pending_.clear();
+
+        if (index_.data_end() > map_size_) {
+            map(std::max((size_t) index_.data_end(), 2*map_size_));
+        }
+    }
+
+    void
+    segment::seal() {
+        if (sealed_) return;
+        flush();
+        std::string footer = index_.SerializeAsString();
+        size_t len = footer.size();
+        footer.resize(len + 16);
+        log_block::put_u64((uint8_t*) &footer[len], len);
+        std::memcpy(&footer[len + 8], index_magic, 8);
+
+        size_t end = index_.data_end();
+        if (::ftruncate(fd_, end) != 0)
+            throw io_error("unable to truncate " + path_.string());
+        log_block::write_all(fd_, (const uint8_t*) footer.data(), footer.size(),
+                             end, "failed to write archive segment");
+        ::fsync(fd_);
+        sealed_ = true;
+        map(end + footer.size());
+    }
+
+    void
+    segment::map(size_t len) {
+        unmap();
+        void* m = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd_, 0);
+        if (m == MAP_FAILED) throw io_error("unable to map " + path_.string());
+        map_ = (const uint8_t*) m;
+        map_size_ = len;
+    }
+
+    void
+    segment::unmap() {
+        if (map_) ::munmap((void*) map_, map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
+    }
+
+    bool
+    segment::recover(size_t file_size) {
+        size_t offset = header_size;
+        while (uint32_t len = log_block::length(map_ + offset, file_size - offset)) {
+            const uint8_t* b = map_ + offset;
+            if (!log_block::valid(b)) break;
+
+            int64_t begin = log_block::base(b);
+            int64_t end = begin;
+            read_batch(offset, [this, &end](int64_t t, const log::LogPacket& p) {
+                end = std::max(end, t);
+                for (const log::LogEvent& e : p.events()) {
+                    if (e.has_update()) track(e.update().var_id(), t, 1);
+                }
+            });
+            auto ib = index_.add_batches();
+            ib->set_offset(offset);
+            ib->set_begin(begin);
+            ib->set_end(end);
+            offset += 8 + len;
+        }
+        index_.set_data_end(offset);
+        return offset > header_size;
+    }
+
+    void
+    segment::read_batch(size_t offset,
+            const std::function<void(int64_t, const log::LogPacket&)>& f) const {
+        const uint8_t* b = map_ + offset;
+        int64_t base = log_block::base(b);
+        log::LogPacket packet;
+        size_t pos = 0;
+        while (log_block::next(b, &pos, &packet)) {
+            f(base + (int64_t) packet.time_delta(), packet);
+        }
+    }
+
+    void
+    segment::read(int32_t var, int64_t begin, int64_t end,
+                  const std::function<void(int64_t, const value&)>& f) const {
+        auto it = vars_.find(var);
+        if (it == vars_.end()) return;
+        const auto& vi = index_.variables(it->second);
+        if (vi.end() < begin || vi.begin() > end) return;
+
+        for (const auto& b : index_.batches()) {
+            if (b.end() < begin || b.begin() > end) continue;
+            read_batch(b.offset(), [&](int64_t t, const log::LogPacket& p) {
+                if (t < begin || t > end) return;
+                for (const log::LogEvent& e : p.events()) {
+                    if (e.has_update() && e.update().var_id() == var)
+                        f(t, value::unpack(e.update().val()));
+                }
+            });
+        }
+        for (const update& u : pending_) {
+            if (u.var == var && u.time >= begin && u.time <= end) f(u.time, u.val);
+        }
+    }
+
+    void
+    segment::read(const std::function<void(int64_t, const log::LogPacket&)>& f) const {
+        for (const auto& b : index_.batches()) read_batch(b.offset(), f);
+    }
+}
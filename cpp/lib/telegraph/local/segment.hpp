@@ -0,0 +1,112 @@
+#ifndef __TELEGRAPH_LOCAL_SEGMENT_HPP__
+#define __TELEGRAPH_LOCAL_SEGMENT_HPP__
+
+#include "../common/value.hpp"
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <filesystem>
+
+#include "log.pb.h"
+
+namespace telegraph {
+    class node;
+
+    /**
+     * A single append-only file of an archive.
+     *
+     * Layout:
+     *   header: "TLGSEG01", start time (u64 LE, us since epoch)
+     *   batches: blocks as in utils/log_block.hpp, the time_delta
+     *            of each packet is relative to the base time.
+     *   footer: log::SegmentIndex, u64 index length, "TLGIDX01"
+     *
+     * The footer is only present once the segment is sealed.
+     * An unsealed segment (i.e. after a crash) is recovered
+     * by scanning batches until the first bad crc.
+     *
+     * Updates are buffered and written as one batch
+     * with a single write() on flush(). The file is memory mapped
+     * for reading, so queries never copy the file contents.
+     */
+    class segment {
+    public:
+        static constexpr size_t header_size = 16;
+
+        ~segment();
+
+        // creates a new segment, preallocating capacity bytes
+        static std::unique_ptr<segment> create(const std::filesystem::path& p,
+                                               int64_t start, size_t capacity);
+        // opens an existing segment, recovering and sealing
+        // it if it was not sealed. Returns nullptr if this is
+        // not a segment file
+        static std::unique_ptr<segment> open(const std::filesystem::path& p);
+
+        constexpr bool is_sealed() const { return sealed_; }
+        const std::filesystem::path& get_path() const { return path_; }
+        int64_t get_start() const { return index_.start_time(); }
+
+        // bytes written to disk + pending bytes (approximate)
+        size_t size() const;
+        // whether the segment should be rotated
+        bool full() const { return size() >= capacity_; }
+
+        // the number of updates (written and pending) for a variable
+        size_t count(int32_t var) const;
+
+        // buffer an update/the tree
+        void add(int64_t time, int32_t var, const value& v);
+        void add(int64_t time, const node* root);
+        size_t pending() const { return pending_.size(); }
+
+        // write all pending updates as a single batch
+        void flush();
+        // flush, write the footer and truncate
+        void seal();
+
+        // calls f on all updates to var with begin <= time <= end
+        void read(int32_t var, int64_t begin, int64_t end,
+                  const std::function<void(int64_t, const value&)>& f) const;
+        // calls f on every (written) packet, with the absolute time
+        void read(const std::function<void(int64_t, const log::LogPacket&)>& f) const;
+    private:
+        struct update {
+            int64_t time;
+            int32_t var;
+            value val;
+        };
+
+        segment(const std::filesystem::path& p, int fd);
+
+        void map(size_t len);
+        void unmap();
+        bool recover(size_t file_size);
+        void track(int32_t var, int64_t time, size_t n);
+        void read_batch(size_t offset,
+            const std::function<void(int64_t, const log::LogPacket&)>& f) const;
+
+        std::filesystem::path path_;
+        int fd_;
+        bool sealed_;
+        size_t capacity_;
+
+        const uint8_t* map_;
+        size_t map_size_;
+
+        log::SegmentIndex index_;
+        std::unordered_map<int32_t, int> vars_; // var id -> index_.variables
+
+        std::vector<update> pending_;
+        std::unique_ptr<Node> pending_root_;
+        int64_t pending_root_time_;
+        std::string write_buf_;
+        log::LogPacket packet_; // reused when encoding
+    };
+}
+
+#endif
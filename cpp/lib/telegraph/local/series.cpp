@@ -0,0 +1,778 @@
+#include "series.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+namespace telegraph {
+
+    // the largest encoding of a single sample in either column
+    // is a 64 bit payload plus a 16 bit header, varints
+    // take at most 10 bytes
+    static constexpr size_t max_sample_bits = 80;
+
+    static inline uint64_t zigzag(int64_t v) {
+        return (((uint64_t) v) << 1) ^ (uint64_t) (v >> 63);
+    }
+    static inline int64_t unzigzag(uint64_t v) {
+        return (int64_t) (v >> 1) ^ -((int64_t) (v & 1));
+    }
+
+    static inline int leading_zeros(uint64_t v) {
+        if (v == 0) return 64;
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_clzll(v);
+#else
+        int n = 0;
+        while (!(v & (1ull << 63))) { v <<= 1; n++; }
+        return n;
+#endif
+    }
+    static inline int trailing_zeros(uint64_t v) {
+        if (v == 0) return 64;
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(v);
+#else
+        int n = 0;
+        while (!(v & 1)) { v >>= 1; n++; }
+        return n;
+#endif
+    }
+
+    static constexpr bool is_floating(value_type::type_class t) {
+        return t == value_type::Float || t == value_type::Double;
+    }
+    static constexpr int float_width(value_type::type_class t) {
+        return t == value_type::Float ? 32 : 64;
+    }
+
+    static int64_t as_int(const value& v) {
+        const auto& b = v.get_box();
+        switch (v.get_type_class()) {
+        case value_type::Bool: return b.b ? 1 : 0;
+        case value_type::Enum: return b.uint8;
+        case value_type::Uint8: return b.uint8;
+        case value_type::Uint16: return b.uint16;
+        case value_type::Uint32: return b.uint32;
+        case value_type::Uint64: return (int64_t) b.uint64;
+        case value_type::Int8: return b.int8;
+        case value_type::Int16: return b.int16;
+        case value_type::Int32: return b.int32;
+        case value_type::Int64: return b.int64;
+        case value_type::Float: return (int64_t) b.f;
+        case value_type::Double: return (int64_t) b.d;
+        default: return 0;
+        }
+    }
+
+    static double as_double(const value& v) {
+        switch (v.get_type_class()) {
+        case value_type::Float: return v.get<float>();
+        case value_type::Double: return v.get<double>();
+        case value_type::Uint64: return (double) v.get<uint64_t>();
+        default: return (double) as_int(v);
+        }
+    }
+
+    static inline int64_t to_micros(time_point tp) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                    tp.time_since_epoch()).count();
+    }
+    static inline time_point from_micros(int64_t micros) {
+        return time_point{std::chrono::microseconds{micros}};
+    }
+
+    static value from_int(value_type::type_class t, int64_t i) {
+        switch (t) {
+        case value_type::Bool: return value{i != 0};
+        case value_type::Enum: return value{value_type::Enum, (uint8_t) i};
+        case value_type::Uint8: return value{(uint8_t) i};
+        case value_type::Uint16: return value{(uint16_t) i};
+        case value_type::Uint32: return value{(uint32_t) i};
+        case value_type::Uint64: return value{(uint64_t) i};
+        case value_type::Int8: return value{(int8_t) i};
+        case value_type::Int16: return value{(int16_t) i};
+        case value_type::Int32: return value{(int32_t) i};
+        case value_type::Int64: return value{(int64_t) i};
+        case value_type::None: return value::none();
+        default: return value::invalid();
+        }
+    }
+
+    static uint64_t float_bits(value_type::type_class t, const value& v) {
+        if (t == value_type::Float) {
+            float f = v.get_type_class() == value_type::Float ?
+                            v.get<float>() : (float) as_double(v);
+            uint32_t b;
+            std::memcpy(&b, &f, sizeof(b));
+            return b;
+        } else {
+            double d = as_double(v);
+            uint64_t b;
+            std::memcpy(&b, &d, sizeof(b));
+            return b;
+        }
+    }
+
+    static value from_float_bits(value_type::type_class t, uint64_t bits) {
+        if (t == value_type::Float) {
+            uint32_t b = (uint32_t) bits;
+            float f;
+            std::memcpy(&f, &b, sizeof(f));
+            return value{f};
+        } else {
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            return value{d};
+        }
+    }
+
+    // the numeric value of the raw column bits, as in as_double()
+    static double bits_to_double(value_type::type_class t, uint64_t bits) {
+        if (t == value_type::Float) {
+            uint32_t b = (uint32_t) bits;
+            float f;
+            std::memcpy(&f, &b, sizeof(f));
+            return f;
+        } else if (t == value_type::Double) {
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            return d;
+        } else if (t == value_type::Uint64) {
+            return (double) bits;
+        } else if (t == value_type::None || t == value_type::Invalid) {
+            return 0;
+        }
+        return (double) as_int(from_int(t, (int64_t) bits));
+    }
+
+    void
+    series::chunk::bit_writer::write(uint64_t bits, int n) {
+        // msb first
+        while (n > 0) {
+            size_t byte = bit_ >> 3;
+            int offset = bit_ & 7;
+            int space = 8 - offset;
+            int take = n < space ? n : space;
+            uint8_t part = (uint8_t) ((bits >> (n - take)) & ((1u << take) - 1));
+            if (offset == 0) buf_[byte] = 0;
+            buf_[byte] |= part << (space - take);
+            bit_ += take;
+            n -= take;
+        }
+    }
+
+    uint64_t
+    series::chunk::bit_reader::read(int n) {
+        uint64_t v = 0;
+        while (n > 0) {
+            size_t byte = bit_ >> 3;
+            int offset = bit_ & 7;
+            int space = 8 - offset;
+            int take = n < space ? n : space;
+            uint8_t part = (buf_[byte] >> (space - take)) & ((1u << take) - 1);
+            v = (v << take) | part;
+            bit_ += take;
+            n -= take;
+        }
+        return v;
+    }
+
+    series::chunk::chunk(value_type::type_class t)
+        : type_(t), count_(0),
+          min_(time_point{}, value::invalid()),
+          max_(time_point{}, value::invalid()),
+          min_key_(0), max_key_(0),
+          begin_time_(0), last_time_(0), last_delta_(0),
+          last_bits_(0), last_leading_(-1), last_trailing_(0),
+          times_out_(&times_[0]), values_out_(&values_[0]) {}
+
+    bool
+    series::chunk::append(int64_t micros, const value& v) {
+        if (times_out_.bits() + max_sample_bits > 8*column_size ||
+                values_out_.bits() + max_sample_bits > 8*column_size) {
+            return false;
+        }
+        encode_time(micros);
+        encode_value(v);
+
+        double key = as_double(v);
+        if (count_ == 0 || key < min_key_) {
+            min_ = datapoint{from_micros(micros), v};
+            min_key_ = key;
+        }
+        if (count_ == 0 || key > max_key_) {
+            max_ = datapoint{from_micros(micros), v};
+            max_key_ = key;
+        }
+        count_++;
+        return true;
+    }
+
+    void
+    series::chunk::encode_time(int64_t micros) {
+        if (count_ == 0) {
+            times_out_.write((uint64_t) micros, 64);
+            begin_time_ = micros;
+            last_time_ = micros;
+            last_delta_ = 0;
+            return;
+        }
+        int64_t delta = micros - last_time_;
+        uint64_t dod = zigzag(delta - last_delta_);
+        last_delta_ = delta;
+        last_time_ = micros;
+
+        // variable-length prefix code, regular
+        // sample rates only take a single bit
+        if (dod == 0) {
+            times_out_.write(0b0, 1);
+        } else if (dod < (1ull << 7)) {
+            times_out_.write(0b10, 2);
+            times_out_.write(dod, 7);
+        } else if (dod < (1ull << 12)) {
+            times_out_.write(0b110, 3);
+            times_out_.write(dod, 12);
+        } else if (dod < (1ull << 20)) {
+            times_out_.write(0b1110, 4);
+            times_out_.write(dod, 20);
+        } else if (dod < (1ull << 32)) {
+            times_out_.write(0b11110, 5);
+            times_out_.write(dod, 32);
+        } else {
+            times_out_.write(0b11111, 5);
+            times_out_.write(dod, 64);
+        }
+    }
+
+    void
+    series::chunk::encode_value(const value& v) {
+        if (is_floating(type_)) {
+            int width = float_width(type_);
+            uint64_t bits = float_bits(type_, v);
+            if (count_ == 0) {
+                values_out_.write(bits, width);
+                last_bits_ = bits;
+                return;
+            }
+            uint64_t x = bits ^ last_bits_;
+            last_bits_ = bits;
+            if (x == 0) {
+                values_out_.write(0b0, 1);
+                return;
+            }
+            int leading = leading_zeros(x) - (64 - width);
+            int trailing = trailing_zeros(x);
+            if (leading > 31) leading = 31;
+            if (last_leading_ >= 0 && leading >= last_leading_ &&
+                    trailing >= last_trailing_) {
+                // fits in the previous window
+                int significant = width - last_leading_ - last_trailing_;
+                values_out_.write(0b10, 2);
+                values_out_.write(x >> last_trailing_, significant);
+            } else {
+                int significant = width - leading - trailing;
+                values_out_.write(0b11, 2);
+                values_out_.write((uint64_t) leading, 5);
+                // significant is in [1, 64], store as [0, 63]
+                values_out_.write((uint64_t) (significant - 1), 6);
+                values_out_.write(x >> trailing, significant);
+                last_leading_ = leading;
+                last_trailing_ = trailing;
+            }
+        } else if (type_ != value_type::None &&
+                    type_ != value_type::Invalid) {
+            // zig-zag varint of the difference to the previous value,
+            // the subtraction is done unsigned so 64 bit values wrap
+            uint64_t i = (uint64_t) as_int(v);
+            uint64_t z = zigzag((int64_t) (i - last_bits_));
+            last_bits_ = i;
+            do {
+                uint64_t byte = z & 0x7f;
+                z >>= 7;
+                if (z) byte |= 0x80;
+                values_out_.write(byte, 8);
+            } while (z);
+        }
+    }
+
+    template<typename F>
+    void
+    series::chunk::each(F&& f) const {
+        bit_reader times(times_);
+        bit_reader values(values_);
+
+        int64_t t = 0;
+        int64_t delta = 0;
+        uint64_t bits = 0;
+        int leading = 0;
+        int trailing = 0;
+        int width = float_width(type_);
+
+        for (size_t i = 0; i < count_; i++) {
+            if (i == 0) {
+                t = (int64_t) times.read(64);
+            } else {
+                uint64_t dod = 0;
+                if (times.read(1) == 0) dod = 0;
+                else if (times.read(1) == 0) dod = times.read(7);
+                else if (times.read(1) == 0) dod = times.read(12);
+                else if (times.read(1) == 0) dod = times.read(20);
+                else if (times.read(1) == 0) dod = times.read(32);
+                else dod = times.read(64);
+                delta += unzigzag(dod);
+                t += delta;
+            }
+
+            if (is_floating(type_)) {
+                if (i == 0) {
+                    bits = values.read(width);
+                } else if (values.read(1) == 1) {
+                    if (values.read(1) == 1) {
+                        leading = (int) values.read(5);
+                        int significant = (int) values.read(6) + 1;
+                        trailing = width - leading - significant;
+                    }
+                    int significant = width - leading - trailing;
+                    bits ^= values.read(significant) << trailing;
+                }
+            } else if (type_ != value_type::None &&
+                        type_ != value_type::Invalid) {
+                uint64_t z = 0;
+                int shift = 0;
+                uint64_t byte = 0;
+                do {
+                    byte = values.read(8);
+                    z |= (byte & 0x7f) << shift;
+                    shift += 7;
+                } while (byte & 0x80);
+                bits += (uint64_t) unzigzag(z);
+            }
+            f(t, bits);
+        }
+    }
+
+    void
+    series::chunk::decode(std::vector<datapoint>* out) const {
+        bool floating = is_floating(type_);
+        each([this, out, floating](int64_t t, uint64_t bits) {
+            out->emplace_back(from_micros(t), floating ?
+                from_float_bits(type_, bits) : from_int(type_, (int64_t) bits));
+        });
+    }
+
+    void
+    series::chunk::decode(std::vector<int64_t>* times, std::vector<double>* values) const {
+        each([this, times, values](int64_t t, uint64_t bits) {
+            times->push_back(t);
+            values->push_back(bits_to_double(type_, bits));
+        });
+    }
+
+    series::series(value_type::type_class t)
+        : type_(t), count_(0), evicted_(0), chunks_() {}
+
+    void
+    series::append(const datapoint& d) {
+        int64_t micros = to_micros(d.get_time());
+        if (!chunks_.empty() && micros < chunks_.back()->end_time()) {
+            merge(std::vector<datapoint>{d});
+            return;
+        }
+        push(micros, d.get_value());
+    }
+
+    void
+    series::append(const std::vector<datapoint>& d) {
+        for (size_t i = 0; i < d.size(); i++) {
+            int64_t micros = to_micros(d[i].get_time());
+            if (!chunks_.empty() && micros < chunks_.back()->end_time()) {
+                merge(std::vector<datapoint>(d.begin() + i, d.end()));
+                return;
+            }
+            push(micros, d[i].get_value());
+        }
+    }
+
+    void
+    series::push(int64_t micros, const value& v) {
+        if (chunks_.empty() || !chunks_.back()->append(micros, v)) {
+            chunks_.emplace_back(std::make_shared<chunk>(type_));
+            chunks_.back()->append(micros, v);
+        }
+        count_++;
+    }
+
+    void
+    series::merge(std::vector<datapoint> d) {
+        auto by_time = [](const datapoint& a, const datapoint& b) {
+            return a.get_time() < b.get_time();
+        };
+        std::stable_sort(d.begin(), d.end(), by_time);
+        // chunks are in time order, so only the ones
+        // ending after the oldest new datapoint are re-encoded
+        int64_t first = to_micros(d.front().get_time());
+        size_t keep = chunks_.size();
+        while (keep > 0 && chunks_[keep - 1]->end_time() > first) keep--;
+
+        std::vector<datapoint> tail;
+        for (size_t i = keep; i < chunks_.size(); i++) chunks_[i]->decode(&tail);
+        count_ -= tail.size();
+        chunks_.erase(chunks_.begin() + keep, chunks_.end());
+
+        std::vector<datapoint> merged;
+        merged.reserve(tail.size() + d.size());
+        std::merge(tail.begin(), tail.end(), d.begin(), d.end(),
+                   std::back_inserter(merged), by_time);
+        for (const datapoint& p : merged) push(to_micros(p.get_time()), p.get_value());
+    }
+
+    size_t
+    series::memory() const {
+        return sizeof(series) + chunks_.size() *
+                    (sizeof(chunk) + sizeof(std::shared_ptr<chunk>));
+    }
+
+    std::vector<datapoint>
+    series::decode() const {
+        std::vector<datapoint> out;
+        out.reserve(count_);
+        for (const auto& c : chunks_) c->decode(&out);
+        return out;
+    }
+
+    size_t
+    series::retain(const retention& r) {
+        size_t dropped = 0;
+        int64_t newest = chunks_.empty() ? 0 : chunks_.back()->end_time();
+        int64_t max_age = (int64_t) (r.max_age * 1e6);
+        while (chunks_.size() > 1) {
+            const chunk& c = *chunks_.front();
+            bool evict = (r.max_samples > 0 && count_ - c.size() >= r.max_samples) ||
+                         (r.max_bytes > 0 && memory() > r.max_bytes) ||
+                         (max_age > 0 && c.end_time() < newest - max_age);
+            if (!evict) break;
+            count_ -= c.size();
+            evicted_ += c.size();
+            dropped += c.size();
+            chunks_.pop_front();
+        }
+        return dropped;
+    }
+
+    size_t
+    series::read(size_t from, size_t max, std::vector<datapoint>* out) const {
+        from = std::max(from, evicted_);
+        size_t to = std::min(from + max, end_index());
+        size_t idx = evicted_; // index of the first datapoint in c
+        std::vector<datapoint> scratch;
+        for (const auto& c : chunks_) {
+            if (idx >= to) break;
+            size_t next = idx + c->size();
+            if (next > from) {
+                scratch.clear();
+                c->decode(&scratch);
+                size_t b = std::max(from, idx) - idx;
+                size_t e = std::min(to, next) - idx;
+                out->insert(out->end(), scratch.begin() + b, scratch.begin() + e);
+            }
+            idx = next;
+        }
+        return std::max(from, to);
+    }
+
+    bool
+    series::cursor::next(size_t max, std::vector<datapoint>* out) {
+        // skip anything evicted since the cursor was made
+        next_ = std::max(next_, series_->first_index());
+        if (next_ >= end_) return false;
+        next_ = series_->read(next_, std::min(max, end_ - next_), out);
+        return true;
+    }
+
+    void
+    series::range(time_point begin, time_point end,
+                  const std::function<void(const datapoint&)>& f) const {
+        int64_t b = to_micros(begin);
+        int64_t e = to_micros(end);
+        std::vector<datapoint> scratch;
+        for (const auto& c : chunks_) {
+            if (c->end_time() < b) continue;
+            if (c->begin_time() > e) break;
+            scratch.clear();
+            c->decode(&scratch);
+            for (const datapoint& d : scratch) {
+                int64_t t = to_micros(d.get_time());
+                if (t >= b && t <= e) f(d);
+            }
+        }
+    }
+
+    series::columns_snapshot
+    series::snapshot_columns(int64_t b, int64_t e) const {
+        columns_snapshot snap;
+        snap.begin_ = b;
+        snap.end_ = e;
+        for (size_t i = 0; i < chunks_.size(); i++) {
+            const auto& c = chunks_[i];
+            if (c->end_time() < b) continue;
+            if (c->begin_time() > e) break;
+            // only the newest chunk is still appended to
+            if (i + 1 < chunks_.size()) snap.chunks_.push_back(c);
+            else c->decode(&snap.tail_times_, &snap.tail_values_);
+        }
+        return snap;
+    }
+
+    // drops everything from index start on outside of [b, e]
+    static void trim(std::vector<int64_t>* times, std::vector<double>* values,
+                     size_t start, int64_t b, int64_t e) {
+        size_t keep = start;
+        for (size_t i = start; i < times->size(); i++) {
+            int64_t t = (*times)[i];
+            if (t < b || t > e) continue;
+            (*times)[keep] = t;
+            (*values)[keep] = (*values)[i];
+            keep++;
+        }
+        times->resize(keep);
+        values->resize(keep);
+    }
+
+    void
+    series::columns_snapshot::decode(std::vector<int64_t>* times,
+                                     std::vector<double>* values) const {
+        size_t start = times->size();
+        size_t n = tail_times_.size();
+        for (const auto& c : chunks_) n += c->size();
+        times->reserve(start + n);
+        values->reserve(start + n);
+        for (const auto& c : chunks_) c->decode(times, values);
+        times->insert(times->end(), tail_times_.begin(), tail_times_.end());
+        values->insert(values->end(), tail_values_.begin(), tail_values_.end());
+        // trim the partially overlapping chunks at either end
+        trim(times, values, start, begin_, end_);
+    }
+
+    void
+    series::columns_snapshot::decode(size_t piece, std::vector<int64_t>* times,
+                                     std::vector<double>* values) const {
+        size_t start = times->size();
+        if (piece < chunks_.size()) {
+            chunks_[piece]->decode(times, values);
+        } else {
+            times->insert(times->end(), tail_times_.begin(), tail_times_.end());
+            values->insert(values->end(), tail_values_.begin(), tail_values_.end());
+        }
+        trim(times, values, start, begin_, end_);
+    }
+
+    int64_t
+    series::columns_snapshot::piece_begin(size_t piece) const {
+        if (piece < chunks_.size()) return chunks_[piece]->begin_time();
+        return tail_times_.empty() ? std::numeric_limits<int64_t>::max() : tail_times_.front();
+    }
+
+    void
+    series::columns(int64_t b, int64_t e,
+                    std::vector<int64_t>* times, std::vector<double>* values) const {
+        snapshot_columns(b, e).decode(times, values);
+    }
+
+    std::vector<datapoint>
+    series::query(time_point begin, time_point end,
+                  size_t points, downsample d) const {
+        int64_t b = to_micros(begin);
+        int64_t e = to_micros(end);
+        if (e < b) return std::vector<datapoint>{};
+        if (points == 0) {
+            std::vector<datapoint> out;
+            range(begin, end, [&out](const datapoint& p) { out.push_back(p); });
+            return out;
+        }
+        // too few for a bucket between the first and last point
+        if (points == 1 || (points == 2 && d == downsample::lttb)) {
+            return ends(b, e, points);
+        }
+        if (d == downsample::min_max) {
+            // two points per bucket
+            return min_max(b, e, points / 2);
+        } else {
+            // first and last point are always included
+            return lttb(b, e, points - 2);
+        }
+    }
+
+    std::vector<datapoint>
+    series::ends(int64_t begin, int64_t end, size_t points) const {
+        std::vector<datapoint> out;
+        datapoint last{time_point{}, value::invalid()};
+        size_t seen = 0;
+        range(from_micros(begin), from_micros(end),
+            [&](const datapoint& d) {
+                if (seen++ == 0) out.push_back(d);
+                else last = d;
+            });
+        if (points > 1 && seen > 1) out.push_back(last);
+        return out;
+    }
+
+    // maps a timestamp in [begin, end] to a bucket index
+    static inline size_t bucket_of(int64_t t, int64_t begin,
+                                   int64_t end, size_t buckets) {
+        double span = (double) (end - begin) + 1;
+        size_t i = (size_t) ((double) (t - begin) / span * buckets);
+        return i < buckets ? i : buckets - 1;
+    }
+
+    std::vector<datapoint>
+    series::min_max(int64_t begin, int64_t end, size_t buckets) const {
+        struct bucket {
+            bool set = false;
+            datapoint min{time_point{}, value::invalid()};
+            datapoint max{time_point{}, value::invalid()};
+            double min_key = 0;
+            double max_key = 0;
+
+            void add(const datapoint& lo, const datapoint& hi) {
+                double lk = as_double(lo.get_value());
+                double hk = as_double(hi.get_value());
+                if (!set || lk < min_key) { min = lo; min_key = lk; }
+                if (!set || hk > max_key) { max = hi; max_key = hk; }
+                set = true;
+            }
+        };
+        std::vector<bucket> bs(buckets);
+
+        std::vector<datapoint> scratch;
+        for (const auto& c : chunks_) {
+            if (c->end_time() < begin) continue;
+            if (c->begin_time() > end) break;
+            // if the whole chunk falls within a single bucket
+            // we can use the precomputed extremes without decoding
+            if (c->begin_time() >= begin && c->end_time() <= end) {
+                size_t first = bucket_of(c->begin_time(), begin, end, buckets);
+                size_t last = bucket_of(c->end_time(), begin, end, buckets);
+                if (first == last) {
+                    bs[first].add(c->min(), c->max());
+                    continue;
+                }
+            }
+            scratch.clear();
+            c->decode(&scratch);
+            for (const datapoint& d : scratch) {
+                int64_t t = to_micros(d.get_time());
+                if (t < begin || t > end) continue;
+                bs[bucket_of(t, begin, end, buckets)].add(d, d);
+            }
+        }
+
+        std::vector<datapoint> out;
+        out.reserve(2*buckets);
+        for (const bucket& b : bs) {
+            if (!b.set) continue;
+            if (b.min.get_time() == b.max.get_time()) {
+                out.push_back(b.min);
+            } else if (b.min.get_time() < b.max.get_time()) {
+                out.push_back(b.min);
+                out.push_back(b.max);
+            } else {
+                out.push_back(b.max);
+                out.push_back(b.min);
+            }
+        }
+        return out;
+    }
+
+    std::vector<datapoint>
+    series::lttb(int64_t begin, int64_t end, size_t buckets) const {
+        // first pass: the average point of every bucket
+        // (with time relative to begin to keep the precision)
+        struct average {
+            double t = 0;
+            double v = 0;
+            size_t n = 0;
+        };
+        std::vector<average> avgs(buckets);
+        size_t total = 0;
+        double last_t = 0, last_v = 0;
+        range(from_micros(begin), from_micros(end),
+            [&](const datapoint& d) {
+                average& a = avgs[bucket_of(to_micros(d.get_time()), begin, end, buckets)];
+                last_t = (double) (to_micros(d.get_time()) - begin);
+                last_v = as_double(d.get_value());
+                a.t += last_t;
+                a.v += last_v;
+                a.n++;
+                total++;
+            });
+        // nothing to reduce
+        if (total <= buckets + 2) {
+            return query(from_micros(begin), from_micros(end), 0, downsample::lttb);
+        }
+        for (average& a : avgs) {
+            if (a.n) { a.t /= a.n; a.v /= a.n; }
+        }
+        // the average of the next non-empty bucket
+        std::vector<size_t> next(buckets, buckets);
+        for (size_t i = buckets - 1; i > 0; i--) {
+            next[i - 1] = avgs[i].n ? i : next[i];
+        }
+
+        // second pass: in every bucket pick the point forming
+        // the largest triangle with the previously selected point
+        // and the average of the next bucket
+        std::vector<datapoint> out;
+        out.reserve(buckets + 2);
+
+        size_t seen = 0;
+        size_t current = buckets;
+        double at = 0, av = 0; // previously selected point
+        double best_area = -1;
+        datapoint best{time_point{}, value::invalid()};
+        datapoint last{time_point{}, value::invalid()};
+
+        range(from_micros(begin), from_micros(end),
+            [&](const datapoint& d) {
+                seen++;
+                double t = (double) (to_micros(d.get_time()) - begin);
+                double v = as_double(d.get_value());
+                if (seen == 1) {
+                    out.push_back(d);
+                    at = t; av = v;
+                    return;
+                }
+                if (seen == total) {
+                    last = d;
+                    return;
+                }
+                size_t i = bucket_of(to_micros(d.get_time()), begin, end, buckets);
+                if (i != current) {
+                    if (best_area >= 0) {
+                        out.push_back(best);
+                        at = (double) (to_micros(best.get_time()) - begin);
+                        av = as_double(best.get_value());
+                    }
+                    current = i;
+                    best_area = -1;
+                }
+                // the last bucket is anchored on the last point
+                double ct = last_t;
+                double cv = last_v;
+                if (next[i] < buckets) {
+                    ct = avgs[next[i]].t;
+                    cv = avgs[next[i]].v;
+                }
+                double area = std::abs((at - ct) * (v - av) - (at - t) * (cv - av));
+                if (area > best_area) {
+                    best_area = area;
+                    best = d;
+                }
+            });
+        if (best_area >= 0) out.push_back(best);
+        out.push_back(last);
+        return out;
+    }
+}
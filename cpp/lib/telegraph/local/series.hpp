@@ -0,0 +1,231 @@
+#ifndef __TELEGRAPH_LOCAL_SERIES_HPP__
+#define __TELEGRAPH_LOCAL_SERIES_HPP__
+
+#include "../common/data.hpp"
+#include "../common/type.hpp"
+#include "../common/value.hpp"
+
+#include <cinttypes>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <functional>
+
+namespace telegraph {
+
+    /**
+     * Columnar, compressed storage for the datapoints of
+     * a single variable.
+     *
+     * Datapoints are stored in fixed-size chunks, each of which has
+     * a timestamp column (delta-of-delta encoded microseconds) and a
+     * value column (XOR encoded for float/double, zig-zag varint
+     * deltas for everything else). Chunks are never resized,
+     * so appending never moves existing data around.
+     *
+     * Datapoints are kept in time order, queries rely on it. Appending
+     * one older than the newest re-encodes the chunks it falls into and
+     * everything after, which shifts the absolute indices of those.
+     */
+    class series {
+    public:
+        class chunk {
+        public:
+            // bytes per column
+            static constexpr size_t column_size = 2048;
+
+            chunk(value_type::type_class t);
+            // the writers point into the chunk's own columns
+            chunk(const chunk&) = delete;
+            chunk(chunk&&) = delete;
+            chunk& operator=(const chunk&) = delete;
+            chunk& operator=(chunk&&) = delete;
+
+            // returns false if the chunk is full
+            bool append(int64_t micros, const value& v);
+
+            constexpr size_t size() const { return count_; }
+            constexpr int64_t begin_time() const { return begin_time_; }
+            constexpr int64_t end_time() const { return last_time_; }
+
+            // the smallest/largest datapoints in this chunk
+            const datapoint& min() const { return min_; }
+            const datapoint& max() const { return max_; }
+
+            // decodes the datapoints in this chunk
+            // into the back of the vector
+            void decode(std::vector<datapoint>* out) const;
+            // same, but into separate time (us) and value columns
+            void decode(std::vector<int64_t>* times, std::vector<double>* values) const;
+        private:
+            // calls f(micros, raw value bits) for every datapoint
+            template<typename F>
+                void each(F&& f) const;
+
+            class bit_writer {
+            public:
+                bit_writer(uint8_t* buf) : buf_(buf), bit_(0) {}
+                void write(uint64_t bits, int n);
+                constexpr size_t bits() const { return bit_; }
+            private:
+                uint8_t* buf_;
+                size_t bit_;
+            };
+            class bit_reader {
+            public:
+                bit_reader(const uint8_t* buf) : buf_(buf), bit_(0) {}
+                uint64_t read(int n);
+            private:
+                const uint8_t* buf_;
+                size_t bit_;
+            };
+
+            void encode_time(int64_t micros);
+            void encode_value(const value& v);
+
+            value_type::type_class type_;
+            size_t count_;
+
+            datapoint min_;
+            datapoint max_;
+            double min_key_;
+            double max_key_;
+
+            // timestamp column state
+            int64_t begin_time_;
+            int64_t last_time_;
+            int64_t last_delta_;
+
+            // value column state
+            uint64_t last_bits_;
+            int last_leading_;
+            int last_trailing_;
+
+            uint8_t times_[column_size];
+            uint8_t values_[column_size];
+            bit_writer times_out_;
+            bit_writer values_out_;
+        };
+
+        // limits on how much a series keeps, 0 is unlimited
+        struct retention {
+            size_t max_samples;
+            float max_age; // in seconds
+            size_t max_bytes;
+        };
+
+        // reads datapoints by absolute index, where the first
+        // datapoint ever appended has index 0. Indices of datapoints
+        // don't change when older ones are evicted
+        class cursor : public data_cursor {
+        public:
+            cursor(const series* s, size_t begin, size_t end)
+                : series_(s), next_(begin), end_(end) {}
+            bool next(size_t max, std::vector<datapoint>* out) override;
+        private:
+            const series* series_;
+            size_t next_;
+            size_t end_;
+        };
+
+        // a range of a series that can be decoded on any thread.
+        // Holds on to the full chunks, which are never modified again,
+        // and has the newest one already decoded
+        class columns_snapshot {
+        public:
+            columns_snapshot() : begin_(0), end_(0), chunks_(),
+                                 tail_times_(), tail_values_() {}
+            void decode(std::vector<int64_t>* times, std::vector<double>* values) const;
+
+            // the snapshot can also be decoded a chunk (piece) at a time
+            size_t pieces() const { return chunks_.size() + 1; }
+            void decode(size_t piece, std::vector<int64_t>* times,
+                        std::vector<double>* values) const;
+            // the time of the first datapoint of a piece, before trimming
+            int64_t piece_begin(size_t piece) const;
+        private:
+            friend class series;
+            int64_t begin_;
+            int64_t end_;
+            std::vector<std::shared_ptr<const chunk>> chunks_;
+            std::vector<int64_t> tail_times_;
+            std::vector<double> tail_values_;
+        };
+
+        series(value_type::type_class t);
+
+        void append(const datapoint& d);
+        void append(const std::vector<datapoint>& d);
+
+        constexpr value_type::type_class get_type() const { return type_; }
+        constexpr size_t size() const { return count_; }
+        // the absolute index of the oldest datapoint held
+        constexpr size_t first_index() const { return evicted_; }
+        constexpr size_t end_index() const { return evicted_ + count_; }
+
+        // appends up to max datapoints starting at absolute index from to out.
+        // Returns the index after the last one read, which is past
+        // from + max if from had already been evicted
+        size_t read(size_t from, size_t max, std::vector<datapoint>* out) const;
+        // a cursor over everything currently held
+        std::unique_ptr<cursor> snapshot() const {
+            return std::make_unique<cursor>(this, first_index(), end_index());
+        }
+
+        // time (us since epoch) of the oldest datapoint held, 0 if empty
+        int64_t begin_time() const {
+            return chunks_.empty() ? 0 : chunks_.front()->begin_time();
+        }
+        // and of the newest
+        int64_t end_time() const {
+            return chunks_.empty() ? 0 : chunks_.back()->end_time();
+        }
+
+        // approximate number of bytes used by this series
+        size_t memory() const;
+
+        // drops the oldest chunks until r is satisfied. Whole chunks
+        // are evicted without touching the rest, so at most one chunk more
+        // than r asks for is kept (and the newest chunk always is).
+        // Returns the number of datapoints dropped
+        size_t retain(const retention& r);
+
+        // decode all datapoints
+        std::vector<datapoint> decode() const;
+
+        // calls f on every datapoint with begin <= t <= end,
+        // only decoding chunks that overlap the range
+        void range(time_point begin, time_point end,
+                   const std::function<void(const datapoint&)>& f) const;
+
+        // appends the times and numeric values of the datapoints
+        // with begin <= t <= end (us since epoch) to the columns
+        void columns(int64_t begin, int64_t end,
+                     std::vector<int64_t>* times, std::vector<double>* values) const;
+        // the same, but split so that the bulk of the decoding can happen
+        // on another thread while the series keeps being appended to
+        columns_snapshot snapshot_columns(int64_t begin, int64_t end) const;
+
+        // downsampled query, see data_query::get_range()
+        std::vector<datapoint> query(time_point begin, time_point end,
+                                     size_t points, downsample d) const;
+    private:
+        // appends in order, without any checks
+        void push(int64_t micros, const value& v);
+        // merges d into the chunks that overlap it
+        void merge(std::vector<datapoint> d);
+
+        // the first point, and the last one if points > 1
+        std::vector<datapoint> ends(int64_t begin, int64_t end, size_t points) const;
+        std::vector<datapoint> min_max(int64_t begin, int64_t end, size_t buckets) const;
+        std::vector<datapoint> lttb(int64_t begin, int64_t end, size_t buckets) const;
+
+        value_type::type_class type_;
+        size_t count_;
+        size_t evicted_;
+        // shared so columns_snapshot can hold on to them
+        std::deque<std::shared_ptr<chunk>> chunks_;
+    };
+}
+
+#endif
@@ -0,0 +1,292 @@
+#include "session_logger.hpp"
+
+#include "../common/nodes.hpp"
+#include "../utils/errors.hpp"
+#include "../utils/log_block.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include <limits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace telegraph {
+
+    static constexpr char session_magic[8] = {'T','L','G','L','O','G','0','1'};
+
+    session_logger::session_logger(const std::filesystem::path& p, int64_t start,
+                                   size_t block_size, float flush_interval, bool sync)
+            : fd_(-1), block_size_(block_size), flush_interval_(flush_interval),
+              sync_(sync), last_time_(start), roots_(), block_(), packet_(),
+              mutex_(), wake_(), flushed_(), front_(), back_(), pending_roots_(),
+              written_(0), generation_(0), completed_(0),
+              flush_requested_(false), stop_(false), writer_() {
+        fd_ = ::open(p.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) throw io_error("unable to create session log " + p.string());
+        uint8_t header[16];
+        std::memcpy(header, session_magic, 8);
+        log_block::put_u64(header + 8, (uint64_t) start);
+        log_block::write_all(fd_, header, sizeof(header), "failed to write session log");
+
+        front_.reserve(block_size_);
+        back_.reserve(block_size_);
+        writer_ = std::thread([this]() { run(); });
+    }
+
+    session_logger::~session_logger() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        writer_.join();
+        ::close(fd_);
+    }
+
+    void
+    session_logger::push(const event& e) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        front_.push_back(e);
+        if (front_.size() == block_size_) wake_.notify_one();
+    }
+
+    void
+    session_logger::root(int64_t time, const node* n) {
+        auto proto = std::make_unique<Node>();
+        n->pack(proto.get());
+        std::lock_guard<std::mutex> lock(mutex_);
+        front_.push_back(event{time, Root, (int32_t) pending_roots_.size(), 0, value::none()});
+        pending_roots_.push_back(std::move(proto));
+    }
+
+    void
+    session_logger::update(int64_t time, int32_t var_id, const value& v) {
+        push(event{time, Update, var_id, 0, v});
+    }
+
+    void
+    session_logger::call(int64_t time, int32_t call_id, int32_t action_id, const value& arg) {
+        push(event{time, Call, call_id, action_id, arg});
+    }
+
+    void
+    session_logger::call_finished(int64_t time, int32_t call_id, const value& ret) {
+        push(event{time, CallFinished, call_id, 0, ret});
+    }
+
+    void
+    session_logger::flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // the next swap contains everything logged so far
+        uint64_t target = generation_ + 1;
+        flush_requested_ = true;
+        wake_.notify_one();
+        flushed_.wait(lock, [this, target]() { return completed_ >= target; });
+    }
+
+    size_t
+    session_logger::written() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return written_;
+    }
+
+    void
+    session_logger::run() {
+        auto interval = std::chrono::microseconds{(int64_t) (flush_interval_ * 1e6)};
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            wake_.wait_for(lock, interval, [this]() {
+                return stop_ || flush_requested_ || front_.size() >= block_size_;
+            });
+            bool stop = stop_;
+            std::swap(front_, back_);
+            std::swap(pending_roots_, roots_);
+            flush_requested_ = false;
+            uint64_t gen = ++generation_;
+            lock.unlock();
+
+            size_t n = back_.size();
+            if (n > 0) {
+                try {
+                    write_block(back_);
+                } catch (io_error& e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+            back_.clear();
+            roots_.clear();
+
+            lock.lock();
+            written_ += n;
+            completed_ = gen;
+            flushed_.notify_all();
+            if (stop) break;
+        }
+    }
+
+    void
+    session_logger::write_block(const std::vector<event>& events) {
+        log_block::begin(&block_);
+        int64_t base = last_time_;
+        for (size_t i = 0; i < events.size();) {
+            packet_.Clear();
+            int64_t t = events[i].time;
+            // the clock may have stepped backwards, the
+            // event order in the file is what matters
+            int64_t delta = t > last_time_ ? t - last_time_ : 0;
+            last_time_ += delta;
+            packet_.set_time_delta((uint64_t) delta);
+            for (; i < events.size() && events[i].time == t; i++) {
+                const event& e = events[i];
+                log::LogEvent* le = packet_.add_events();
+                value v = e.val;
+                switch (e.type) {
+                case Root: le->set_allocated_root(roots_[e.id].release()); break;
+                case Update: {
+                    auto u = le->mutable_update();
+                    u->set_var_id(e.id);
+                    v.pack(u->mutable_val());
+                } break;
+                case Call: {
+                    auto c = le->mutable_call();
+                    c->set_call_id(e.id);
+                    c->set_action_id(e.action_id);
+                    v.pack(c->mutable_arg());
+                } break;
+                case CallFinished: {
+                    auto c = le->mutable_call_finished();
+                    c->set_call_id(e.id);
+                    v.pack(c->mutable_ret());
+                } break;
+                }
+            }
+            log_block::append(&block_, packet_);
+        }
+        log_block::finish(&block_, base);
+        log_block::write_all(fd_, (const uint8_t*) block_.data(), block_.size(),
+                             "failed to write session log");
+        if (sync_) ::fsync(fd_);
+    }
+
+    bool
+    session_logger::read(const std::filesystem::path& p,
+                         const std::function<void(int64_t, const log::LogPacket&)>& f) {
+        session_reader reader{p};
+        if (!reader.valid()) return false;
+        int64_t time;
+        log::LogPacket packet;
+        while (reader.next(&time, &packet)) f(time, packet);
+        return true;
+    }
+
+    session_reader::session_reader(const std::filesystem::path& p)
+            : fd_(-1), map_(nullptr), map_size_(0), start_(0), end_(0),
+              blocks_(), root_(), block_(0), pos_(0), time_(0), skip_until_(0) {
+        fd_ = ::open(p.c_str(), O_RDONLY);
+        if (fd_ < 0) return;
+        struct stat st;
+        if (::fstat(fd_, &st) != 0 || st.st_size < 16) return;
+        void* m = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+        if (m == MAP_FAILED) return;
+        map_ = (const uint8_t*) m;
+        map_size_ = st.st_size;
+        if (std::memcmp(map_, session_magic, 8) != 0) {
+            ::munmap(m, map_size_);
+            map_ = nullptr;
+            return;
+        }
+        start_ = (int64_t) log_block::get_u64(map_ + 8);
+
+        // index the blocks by their headers, crcs
+        // are checked as the blocks are read
+        size_t offset = 16;
+        while (uint32_t len = log_block::length(map_ + offset, map_size_ - offset)) {
+            blocks_.push_back(block{offset, len, log_block::base(map_ + offset)});
+            offset += 8 + len;
+        }
+
+        int64_t t;
+        log::LogPacket packet;
+        // the tree is logged first
+        if (load_block(0)) {
+            while (next(&t, &packet) && block_ == 0) {
+                if (packet.events_size() > 0 && packet.events(0).has_root()) {
+                    root_ = std::make_unique<Node>(packet.events(0).root());
+                    break;
+                }
+            }
+        }
+        // and the end time is in the last block. A bad
+        // one is dropped by load_block(), so try the one before
+        end_ = start_;
+        while (!blocks_.empty()) {
+            if (!load_block(blocks_.size() - 1)) continue;
+            end_ = blocks_.back().base;
+            while (next(&t, &packet)) end_ = t;
+            break;
+        }
+        seek(start_);
+    }
+
+    session_reader::~session_reader() {
+        if (map_) ::munmap((void*) map_, map_size_);
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    int64_t
+    session_reader::begin_time() const {
+        return start_;
+    }
+
+    int64_t
+    session_reader::end_time() const {
+        return end_;
+    }
+
+    bool
+    session_reader::load_block(size_t idx) {
+        block_ = idx;
+        pos_ = 0;
+        if (idx >= blocks_.size()) return false;
+        const block& b = blocks_[idx];
+        if (!log_block::valid(map_ + b.offset)) {
+            // everything from a bad block on is lost
+            blocks_.resize(idx);
+            return false;
+        }
+        time_ = b.base;
+        return true;
+    }
+
+    void
+    session_reader::seek(int64_t time) {
+        // the last block starting before time
+        auto it = std::lower_bound(blocks_.begin(), blocks_.end(), time,
+                    [](const block& b, int64_t t) { return b.base < t; });
+        size_t idx = it == blocks_.begin() ? 0 : (it - blocks_.begin()) - 1;
+        load_block(idx);
+        skip_until_ = time;
+    }
+
+    bool
+    session_reader::next(int64_t* time, log::LogPacket* packet) {
+        while (block_ < blocks_.size()) {
+            if (!log_block::next(map_ + blocks_[block_].offset, &pos_, packet)) {
+                load_block(block_ + 1);
+                continue;
+            }
+            time_ += (int64_t) packet->time_delta();
+            if (time_ < skip_until_) continue;
+            skip_until_ = std::numeric_limits<int64_t>::min();
+            *time = time_;
+            return true;
+        }
+        return false;
+    }
+}
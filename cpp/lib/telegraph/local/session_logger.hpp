@@ -0,0 +1,148 @@
+#ifndef __TELEGRAPH_LOCAL_SESSION_LOGGER_HPP__
+#define __TELEGRAPH_LOCAL_SESSION_LOGGER_HPP__
+
+#include "../common/value.hpp"
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <filesystem>
+
+#include "log.pb.h"
+
+namespace telegraph {
+    class node;
+
+    /**
+     * Streams the packets of a session log (see session_logger for the
+     * layout) from a memory mapping, so only the block index is kept in memory.
+     */
+    class session_reader {
+    public:
+        session_reader(const std::filesystem::path& p);
+        ~session_reader();
+
+        session_reader(const session_reader&) = delete;
+        void operator=(const session_reader&) = delete;
+
+        // false if the file isn't a session log
+        constexpr bool valid() const { return map_ != nullptr; }
+        int64_t begin_time() const;
+        int64_t end_time() const;
+
+        // the first tree logged, or nullptr
+        const Node* root() const { return root_.get(); }
+
+        // position the reader at the first packet at or after time
+        void seek(int64_t time);
+        // the next packet, false at the end of the log
+        bool next(int64_t* time, log::LogPacket* packet);
+    private:
+        struct block {
+            size_t offset;
+            size_t length;
+            int64_t base;
+        };
+        bool load_block(size_t idx);
+
+        int fd_;
+        const uint8_t* map_;
+        size_t map_size_;
+        int64_t start_;
+        int64_t end_;
+        std::vector<block> blocks_;
+        std::unique_ptr<Node> root_;
+
+        // cursor
+        size_t block_;
+        size_t pos_; // within the block payload
+        int64_t time_;
+        int64_t skip_until_;
+    };
+
+    /**
+     * Lossless capture of everything a device sends (and every call made to it).
+     *
+     * Events are appended to an in-memory block, which a background thread
+     * swaps out (double buffering) and writes to disk, so the calling thread
+     * never encodes protobufs or touches the file.
+     *
+     * File layout:
+     *   header: "TLGLOG01", start time (u64 LE, us since epoch)
+     *   blocks: as in utils/log_block.hpp
+     * Events with the same timestamp share a packet and the time_delta of
+     * each packet is relative to the previous one (the first to the base time
+     * of its block, which is the time of the last packet before it).
+     * Every block is a single write(), so after a crash the file is valid up
+     * to the last complete block.
+     */
+    class session_logger {
+    public:
+        // block_size is the number of events after which the writer is woken,
+        // flush_interval (in seconds) the longest an event stays in memory
+        session_logger(const std::filesystem::path& p, int64_t start,
+                       size_t block_size=4096, float flush_interval=0.1f, bool sync=false);
+        ~session_logger();
+
+        // these may be called from any thread
+        void root(int64_t time, const node* n);
+        void update(int64_t time, int32_t var_id, const value& v);
+        void call(int64_t time, int32_t call_id, int32_t action_id, const value& arg);
+        void call_finished(int64_t time, int32_t call_id, const value& ret);
+
+        // blocks until everything logged so far is on disk
+        void flush();
+
+        // number of events written to disk
+        size_t written() const;
+
+        // calls f on every packet of a session log with the absolute time,
+        // stopping at the first incomplete block. Returns false if p is not a session log
+        static bool read(const std::filesystem::path& p,
+                         const std::function<void(int64_t, const log::LogPacket&)>& f);
+    private:
+        enum kind : uint8_t { Root, Update, Call, CallFinished };
+        struct event {
+            int64_t time;
+            kind type;
+            int32_t id; // var_id or call_id
+            int32_t action_id;
+            value val;
+        };
+
+        void push(const event& e);
+        void run();
+        void write_block(const std::vector<event>& events);
+
+        int fd_;
+        size_t block_size_;
+        float flush_interval_;
+        bool sync_;
+
+        // encoder state, only touched by the writer thread
+        int64_t last_time_;
+        std::vector<std::unique_ptr<Node>> roots_;
+        std::string block_;
+        log::LogPacket packet_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable flushed_;
+        std::vector<event> front_; // being filled
+        std::vector<event> back_; // being written
+        std::vector<std::unique_ptr<Node>> pending_roots_;
+        size_t written_;
+        uint64_t generation_; // number of swaps
+        uint64_t completed_; // last swap written out
+        bool flush_requested_;
+        bool stop_;
+
+        std::thread writer_;
+    };
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include "shm_publisher.hpp"
+
+#include "../common/nodes.hpp"
+#include "../utils/errors.hpp"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+namespace telegraph {
+
+    shm_publisher::shm_publisher(io::io_context& ioc, const std::string_view& name,
+                                 const params& p, std::unique_ptr<shm_writer>&& writer)
+            : local_component(ioc, name, "shm_publisher", p),
+              writer_(std::move(writer)), published_() {}
+
+    shm_publisher::~shm_publisher() {
+        for (auto& p : published_) p.second.sub->data.remove(this);
+    }
+
+    void
+    shm_publisher::unpublish(node::id id) {
+        auto it = published_.find(id);
+        if (it == published_.end()) return;
+        it->second.sub->data.remove(this);
+        published_.erase(it);
+    }
+
+    params_stream_ptr
+    shm_publisher::request(io::yield_ctx& yield, const params& p) {
+        if (!p.is_object()) return nullptr;
+        const std::string& type = p.at("type").get<std::string>();
+        params_stream_ptr res = std::make_shared<params_stream>();
+        if (type == "published") {
+            params list = params::array();
+            for (const auto& i : published_) {
+                params entry = params::object();
+                entry["id"] = (float) i.first;
+                entry["uuid"] = params{i.second.uuid};
+                entry["var"] = params{i.second.path};
+                list.push(std::move(entry));
+            }
+            res->write(std::move(list));
+            res->close();
+            return res;
+        }
+        if (type != "publish" && type != "unpublish") return nullptr;
+
+        std::vector<std::string> spath;
+        std::vector<std::string_view> path;
+        for (const params& s : p.at("var").get<std::vector<params>>()) {
+            spath.push_back(s.get<std::string>());
+        }
+        for (const auto& s : spath) path.push_back(s);
+        const std::string& uuids = p.at("uuid").get<std::string>();
+
+        auto ns = ns_.lock();
+        if (!ns) return nullptr;
+        auto ctx = ns->contexts->get(boost::lexical_cast<uuid>(uuids));
+        if (!ctx) throw missing_error("no such context");
+        auto tree = ctx->fetch(yield);
+        auto v = tree ? dynamic_cast<variable*>(tree->from_path(path)) : nullptr;
+        if (!v) throw missing_error("no such variable");
+        node::id id = v->get_id();
+
+        // records only carry the id, so variables of two contexts
+        // with the same id would overwrite each other's slot
+        auto existing = published_.find(id);
+        if (existing != published_.end() && existing->second.uuid != uuids) {
+            throw tree_error("id " + std::to_string(id) +
+                    " is already published from context " + existing->second.uuid);
+        }
+
+        if (type == "unpublish") {
+            unpublish(id);
+        } else {
+            float min_interval = p.at("min_interval").get<float>();
+            float max_interval = p.at("max_interval").get<float>();
+            auto sub = ctx->subscribe(yield, v, min_interval, max_interval, 1);
+            if (!sub) throw remote_error("unable to subscribe");
+            unpublish(id);
+            sub->data.add(this, [this, id] (const datapoint& dp) {
+                auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                            dp.get_time().time_since_epoch());
+                writer_->write(id, us.count(), dp.get_value());
+            });
+            published_.emplace(id, published{uuids, std::move(spath), std::move(sub)});
+        }
+        res->write(params{true});
+        res->close();
+        return res;
+    }
+
+    local_component_ptr
+    shm_publisher::create(io::yield_ctx&, io::io_context& ioc,
+            const std::string_view& name, const std::string_view& type,
+            const params& p) {
+        auto args = p.to_map();
+        std::string shm_name = "/telegraph";
+        size_t capacity = 65536;
+        auto it = args.find("name");
+        if (it != args.end()) shm_name = it->second.get<std::string>();
+        it = args.find("capacity");
+        if (it != args.end()) capacity = (size_t) it->second.get<float>();
+        bool replace = false;
+        it = args.find("replace");
+        if (it != args.end() && it->second.is_bool()) replace = it->second.get<bool>();
+
+        auto writer = std::make_unique<shm_writer>(shm_name, capacity, replace);
+        if (!writer->valid()) return nullptr;
+        return std::make_shared<shm_publisher>(ioc, name, p, std::move(writer));
+    }
+}
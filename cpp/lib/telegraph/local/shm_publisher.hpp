@@ -0,0 +1,52 @@
+#ifndef __TELEGRAPH_LOCAL_SHM_PUBLISHER_HPP__
+#define __TELEGRAPH_LOCAL_SHM_PUBLISHER_HPP__
+
+#include "namespace.hpp"
+
+#include "../common/shm_ring.hpp"
+#include "../common/data.hpp"
+#include "../common/nodes.hpp"
+
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
+namespace telegraph {
+
+    /**
+     * Publishes selected subscriptions into a shared memory segment
+     * (see shm_ring.hpp), so processes on the same machine can read live
+     * values without sockets or decoding. Records are keyed by the node id
+     * of the variable in its own tree, so publishing a variable whose id
+     * is already published from another context fails.
+     *
+     * Created with {name: "/telegraph", capacity: records in the ring,
+     * replace: take over an existing segment of that name}.
+     * Supports {type: "publish", uuid: context, var: path, min_interval, max_interval},
+     * {type: "unpublish", uuid, var} and {type: "published"}
+     */
+    class shm_publisher : public local_component {
+    private:
+        std::unique_ptr<shm_writer> writer_;
+        struct published {
+            std::string uuid; // of the context
+            std::vector<std::string> path;
+            subscription_ptr sub;
+        };
+        std::unordered_map<node::id, published> published_;
+    public:
+        shm_publisher(io::io_context& ioc, const std::string_view& name,
+                      const params& p, std::unique_ptr<shm_writer>&& writer);
+        ~shm_publisher();
+
+        params_stream_ptr request(io::yield_ctx&, const params& p) override;
+
+        static local_component_ptr create(io::yield_ctx&, io::io_context& ioc,
+                const std::string_view& name, const std::string_view& type,
+                const params& p);
+    private:
+        void unpublish(node::id id);
+    };
+}
+
+#endif
@@ -1,21 +1,126 @@
 #include "tmp_archive.hpp"
+#include "aggregate.hpp"
+#include "align.hpp"
 
 #include "../common/nodes.hpp"
 #include "../common/data.hpp"
+#include "../utils/io.hpp"
 
 #include <string_view>
+#include <string>
+#include <limits>
+#include <thread>
+#include <algorithm>
+#include <cmath>
 
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/executor_work_guard.hpp>
 
 namespace telegraph {
 
+    // reads max_samples/max_age/max_bytes from p where present
+    static series::retention parse_retention(const params& p,
+                                    const series::retention& defaults) {
+        series::retention r = defaults;
+        if (!p.is_object()) return r;
+        const auto& m = p.to_map();
+        auto it = m.find("max_samples");
+        if (it != m.end() && it->second.is_num()) r.max_samples = (size_t) it->second.get<float>();
+        it = m.find("max_age");
+        if (it != m.end() && it->second.is_num()) r.max_age = it->second.get<float>();
+        it = m.find("max_bytes");
+        if (it != m.end() && it->second.is_num()) r.max_bytes = (size_t) it->second.get<float>();
+        return r;
+    }
+
+    static params pack_retention(const series::retention& r) {
+        params obj = params::object();
+        obj["max_samples"] = (float) r.max_samples;
+        obj["max_age"] = r.max_age;
+        obj["max_bytes"] = (float) r.max_bytes;
+        return obj;
+    }
+
+    static std::vector<std::string_view> unpack_path(const params& p) {
+        std::vector<std::string_view> path;
+        for (const params& c : p.get<std::vector<params>>()) {
+            path.push_back(c.get<std::string>());
+        }
+        return path;
+    }
+
+    template<typename T>
+        static params pack_column(const std::vector<T>& c) {
+            std::vector<params> col;
+            col.reserve(c.size());
+            for (const T& x : c) col.emplace_back((float) x);
+            return params{std::move(col)};
+        }
+
+    // window start times are sent in seconds since origin
+    static params pack_stats(std::vector<std::string>&& path, int64_t origin,
+                        const window_stats& s, const std::vector<float>& percentiles) {
+        std::vector<params> starts;
+        starts.reserve(s.start.size());
+        for (int64_t t : s.start) starts.emplace_back((float) ((t - origin) / 1e6));
+
+        std::vector<params> pcts;
+        for (size_t i = 0; i < percentiles.size(); i++) {
+            params pobj = params::object();
+            pobj["percentile"] = percentiles[i];
+            pobj["values"] = pack_column(s.percentiles[i]);
+            pcts.push_back(std::move(pobj));
+        }
+
+        params obj = params::object();
+        obj["path"] = params{std::move(path)};
+        obj["origin"] = std::to_string(origin / 1000);
+        obj["start"] = params{std::move(starts)};
+        obj["count"] = pack_column(s.count);
+        obj["min"] = pack_column(s.min);
+        obj["max"] = pack_column(s.max);
+        obj["mean"] = pack_column(s.mean);
+        obj["stddev"] = pack_column(s.stddev);
+        obj["percentiles"] = params{std::move(pcts)};
+        return obj;
+    }
+
+    // rows per message of an align request
+    static constexpr size_t align_batch = 1024;
+
+    static params pack_rows(const std::vector<int64_t>& times,
+                            const std::vector<std::vector<double>>& columns, int64_t origin) {
+        std::vector<params> ptimes;
+        ptimes.reserve(times.size());
+        for (int64_t t : times) ptimes.emplace_back((float) ((t - origin) / 1e6));
+        std::vector<params> pcols;
+        for (const auto& c : columns) {
+            std::vector<params> col;
+            col.reserve(c.size());
+            // missing values are null
+            for (double x : c) col.push_back(std::isnan(x) ? params{} : params{(float) x});
+            pcols.emplace_back(std::move(col));
+        }
+        params obj = params::object();
+        obj["time"] = params{std::move(ptimes)};
+        obj["values"] = params{std::move(pcols)};
+        return obj;
+    }
+
     tmp_archive::tmp_archive(io::io_context& ioc, const std::string_view& name,
-                            std::unique_ptr<node>&& src)
-            : local_context(ioc, name, "tmp_archive", params{}, std::move(src)) {}
+                            std::unique_ptr<node>&& src, const series::retention& r)
+            : local_context(ioc, name, "tmp_archive", params{}, std::move(src)),
+              retention_(r), data_(), recordings_(), recordings_queries_(),
+              usage_timer_(ioc), usage_scheduled_(false), workers_() {}
 
     tmp_archive::~tmp_archive() {
-        for (auto i : recordings_) i.second->cancelled.remove(this);
+        usage_timer_.cancel();
+        // waits for running aggregates, which only
+        // hold on to the stream and their own columns
+        if (workers_) workers_->join();
+        for (auto i : recordings_) i.second->data.remove(this);
         for (auto i : recordings_queries_) {
             auto r = i.second.lock();
             if (r) {
@@ -25,14 +130,180 @@ namespace telegraph {
         }
     }
 
+    const std::shared_ptr<tmp_data>&
+    tmp_archive::get_data(const variable* v) {
+        auto it = data_.find(v);
+        if (it == data_.end()) {
+            auto s = std::make_shared<tmp_data>(v->get_type().get_class(), retention_);
+            it = data_.emplace(v, s).first;
+        }
+        return it->second;
+    }
+
+    params
+    tmp_archive::usage() const {
+        size_t total_bytes = 0;
+        size_t total_samples = 0;
+        std::vector<params> vars;
+        for (const auto& i : data_) {
+            const series& s = i.second->get_series();
+            total_bytes += s.memory();
+            total_samples += s.size();
+
+            params obj = params::object();
+            obj["path"] = params{i.first->path()};
+            obj["samples"] = (float) s.size();
+            obj["bytes"] = (float) s.memory();
+            obj["retention"] = pack_retention(i.second->get_retention());
+            vars.push_back(std::move(obj));
+        }
+        params obj = params::object();
+        obj["event"] = "usage";
+        obj["samples"] = (float) total_samples;
+        obj["bytes"] = (float) total_bytes;
+        obj["variables"] = params{std::move(vars)};
+        return obj;
+    }
+
     void
-    tmp_archive::record(variable* v, subscription_ptr s) {
+    tmp_archive::schedule_usage() {
+        if (usage_scheduled_ || recordings_queries_.empty()) return;
+        usage_scheduled_ = true;
+        std::weak_ptr<tmp_archive> w =
+            std::static_pointer_cast<tmp_archive>(shared_from_this());
+        usage_timer_.expires_from_now(boost::posix_time::seconds(1));
+        usage_timer_.async_wait([w](const boost::system::error_code& ec) {
+            if (ec) return;
+            auto sp = w.lock();
+            if (!sp) return;
+            sp->usage_scheduled_ = false;
+            params u = sp->usage();
+            for (auto rq : sp->recordings_queries_) {
+                auto q = rq.second.lock();
+                if (q) q->write(params{u});
+            }
+            sp->schedule_usage();
+        });
+    }
+
+    params_stream_ptr
+    tmp_archive::aggregate(const std::vector<const variable*>& vars,
+                           int64_t origin, int64_t begin, int64_t end,
+                           int64_t width, const std::vector<float>& percentiles) {
+        if (!workers_) {
+            unsigned n = std::max(1u, std::thread::hardware_concurrency());
+            workers_ = std::make_unique<boost::asio::thread_pool>(n);
+        }
+        params_stream_ptr res = std::make_shared<params_stream>();
+        if (vars.empty()) {
+            res->close();
+            return res;
+        }
+        auto remaining = std::make_shared<size_t>(vars.size());
+        for (const variable* v : vars) {
+            // the series is appended to from this thread,
+            // so the workers get a snapshot to decode
+            series::columns_snapshot snap;
+            auto it = data_.find(v);
+            if (it != data_.end()) snap = it->second->get_series().snapshot_columns(begin, end);
+            // the guard keeps the io context running until the result is back
+            boost::asio::post(*workers_,
+                [&ioc = ioc_, work = boost::asio::make_work_guard(ioc_),
+                    res, remaining, snap = std::move(snap), path = v->path(),
+                    origin, begin, width, percentiles] () mutable {
+                std::vector<int64_t> times;
+                std::vector<double> values;
+                snap.decode(&times, &values);
+                window_stats s = telegraph::aggregate(times, values,
+                                            begin, width, percentiles);
+                params obj = pack_stats(std::move(path), origin, s, percentiles);
+                boost::asio::post(ioc, [res, remaining, obj = std::move(obj)] () mutable {
+                    res->write(std::move(obj));
+                    if (--(*remaining) == 0) res->close();
+                });
+                work.reset();
+            });
+        }
+        return res;
+    }
+
+    params_stream_ptr
+    tmp_archive::align(std::vector<const variable*> vars, const variable* clock,
+                       int64_t origin, int64_t begin, int64_t end,
+                       int64_t step, int64_t tolerance) {
+        size_t clock_idx = 0;
+        if (clock) {
+            auto it = std::find(vars.begin(), vars.end(), clock);
+            clock_idx = it - vars.begin();
+            if (it == vars.end()) vars.push_back(clock);
+        }
+        // the values at begin may be from before it
+        int64_t from = tolerance > 0 ? begin - tolerance : std::numeric_limits<int64_t>::min();
+        std::vector<series::columns_snapshot> inputs;
+        std::vector<params> paths;
+        for (const variable* v : vars) {
+            auto it = data_.find(v);
+            if (it != data_.end()) {
+                const series& s = it->second->get_series();
+                inputs.push_back(s.snapshot_columns(clock && v == clock ? begin : from, end));
+            } else {
+                inputs.emplace_back();
+            }
+            paths.emplace_back(v->path());
+        }
+        auto al = clock ?
+            std::make_shared<aligner>(std::move(inputs), clock_idx, begin, end, tolerance) :
+            std::make_shared<aligner>(std::move(inputs), begin, end, step, tolerance);
+
+        params_stream_ptr res = std::make_shared<params_stream>();
+        params header = params::object();
+        header["origin"] = std::to_string(origin / 1000);
+        header["paths"] = params{std::move(paths)};
+        res->write(std::move(header));
+
+        // rows are produced a batch at a time so a long
+        // range doesn't hold up everything else
+        std::weak_ptr<params_stream> wres{res};
+        io::spawn(ioc_, [al, wres, origin, &ioc = ioc_] (io::yield_context yield) {
+            io::deadline_timer timer{ioc};
+            boost::system::error_code ec;
+            std::vector<int64_t> times;
+            std::vector<std::vector<double>> columns;
+            bool more = true;
+            while (more) {
+                // also lets the requester set up the stream first
+                timer.expires_from_now(boost::posix_time::microseconds(0));
+                timer.async_wait(yield[ec]);
+                auto res = wres.lock();
+                if (!res || res->is_closed()) return;
+                times.clear();
+                columns.clear();
+                more = al->next(align_batch, &times, &columns);
+                if (!times.empty()) res->write(pack_rows(times, columns, origin));
+                if (!more) res->close();
+            }
+        });
+        return res;
+    }
+
+    void
+    tmp_archive::record(variable* v, subscription_ptr s, const series::retention& r) {
         if (!v) return;
+        record_stop(v);
         recordings_[v] = s;
+        std::shared_ptr<tmp_data> d = get_data(v);
+        d->set_retention(r);
+        // weak so the subscription doesn't keep the data alive
+        std::weak_ptr<tmp_data> wd{d};
+        s->data.add(this, [wd](const datapoint& dp) {
+            auto d = wd.lock();
+            if (d) d->write(std::vector<datapoint>{dp});
+        });
 
         params obj = params::object();
         obj["event"] = "record";
         obj["path"] = params{v->path()};
+        obj["retention"] = pack_retention(r);
         for (auto rq : recordings_queries_) {
             auto sp = rq.second.lock();
             if (sp) sp->write(params{obj});
@@ -43,7 +314,10 @@ namespace telegraph {
     void
     tmp_archive::record_stop(variable* v) {
         if (!v) return;
-        recordings_.erase(v);
+        auto it = recordings_.find(v);
+        if (it == recordings_.end()) return;
+        it->second->data.remove(this);
+        recordings_.erase(it);
 
         params obj = params::object();
         obj["event"] = "record_stop";
@@ -54,6 +328,14 @@ namespace telegraph {
         }
     }
 
+    data_query_ptr
+    tmp_archive::query_data(io::yield_ctx& yield,
+                            const std::vector<std::string_view>& path) {
+        auto v = dynamic_cast<variable*>(tree_->from_path(path));
+        if (!v) return nullptr;
+        return query_data(yield, v);
+    }
+
     params_stream_ptr
     tmp_archive::request(io::yield_ctx& yield,
                         const params& p) {
@@ -79,7 +361,7 @@ namespace telegraph {
                 // do the subscribe
                 auto s = ctx->subscribe(yield, path, min_interval, max_interval, 1);
                 if (!s) return nullptr;
-                record(v, s);
+                record(v, s, parse_retention(p, retention_));
 
                 params_stream_ptr p = std::make_shared<params_stream>();
                 p->write(params{true});
@@ -99,6 +381,72 @@ namespace telegraph {
                 p->write(params{true});
                 p->close();
                 return p;
+            } else if (s == "aggregate" || s == "align") {
+                std::vector<const variable*> vars;
+                for (const params& pv : p.at("vars").get<std::vector<params>>()) {
+                    auto v = dynamic_cast<variable*>(tree_->from_path(unpack_path(pv)));
+                    if (!v) return nullptr;
+                    vars.push_back(v);
+                }
+                const auto& m = p.to_map();
+                const variable* clock = nullptr;
+                auto it = m.find("clock");
+                if (it != m.end() && !it->second.is_none()) {
+                    clock = dynamic_cast<variable*>(tree_->from_path(unpack_path(it->second)));
+                    if (!clock) return nullptr;
+                }
+                // times are in seconds since the origin, which is given in
+                // ms since epoch as a string (too large for params numbers),
+                // by default the oldest datapoint of the variables
+                int64_t origin = std::numeric_limits<int64_t>::max();
+                int64_t last = std::numeric_limits<int64_t>::min();
+                for (const variable* v : vars) {
+                    auto d = data_.find(v);
+                    if (d == data_.end() || d->second->get_series().size() == 0) continue;
+                    origin = std::min(origin, d->second->get_series().begin_time());
+                    last = std::max(last, d->second->get_series().end_time());
+                }
+                if (origin == std::numeric_limits<int64_t>::max()) origin = 0;
+                it = m.find("origin");
+                if (it != m.end() && it->second.is_str()) {
+                    origin = std::stoll(it->second.get<std::string>()) * 1000;
+                }
+                int64_t begin = origin;
+                int64_t end = std::numeric_limits<int64_t>::max();
+                it = m.find("start");
+                if (it != m.end() && it->second.is_num())
+                    begin = origin + (int64_t) (it->second.get<float>() * 1e6);
+                it = m.find("end");
+                if (it != m.end() && it->second.is_num())
+                    end = origin + (int64_t) (it->second.get<float>() * 1e6);
+
+                if (s == "align") {
+                    // a grid stops at the newest datapoint
+                    if (!clock) end = std::min(end, last);
+                    int64_t step = 0;
+                    int64_t tolerance = 0;
+                    it = m.find("step");
+                    if (it != m.end() && it->second.is_num())
+                        step = (int64_t) (it->second.get<float>() * 1e6);
+                    it = m.find("tolerance");
+                    if (it != m.end() && it->second.is_num())
+                        tolerance = (int64_t) (it->second.get<float>() * 1e6);
+                    if (!clock && step <= 0) return nullptr;
+                    return align(vars, clock, origin, begin, end, step, tolerance);
+                }
+
+                int64_t width = 0;
+                it = m.find("window");
+                if (it != m.end() && it->second.is_num())
+                    width = (int64_t) (it->second.get<float>() * 1e6);
+                std::vector<float> percentiles;
+                it = m.find("percentiles");
+                if (it != m.end()) {
+                    for (const params& pc : it->second.get<std::vector<params>>()) {
+                        percentiles.push_back(pc.get<float>());
+                    }
+                }
+                return aggregate(vars, origin, begin, end, width, percentiles);
             } else if (s == "recordings") {
                 params_stream_ptr p = std::make_shared<params_stream>();
                 params_stream* raw = p.get();
@@ -116,8 +464,12 @@ namespace telegraph {
                     params obj = params::object();
                     obj["event"] = "recording";
                     obj["path"] = params{path};
+                    obj["retention"] = pack_retention(get_data(i.first)->get_retention());
                     p->write(std::move(obj));
                 }
+                // and the memory usage, which is then sent periodically
+                p->write(usage());
+                schedule_usage();
                 return p;
             }
         }
@@ -143,6 +495,7 @@ namespace telegraph {
             n = mn->clone();
         }
         if (!n) return nullptr;
-        return std::make_shared<tmp_archive>(ioc, name, std::move(n));
+        return std::make_shared<tmp_archive>(ioc, name, std::move(n),
+                    parse_retention(p, series::retention{0, 0, 0}));
     }
 }
\ No newline at end of file
@@ -5,46 +5,88 @@
 #include "../common/nodes.hpp"
 
 #include "namespace.hpp"
+#include "series.hpp"
+
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/thread_pool.hpp>
 
 namespace telegraph {
 
     class tmp_data : public data_query {
     private:
-        std::vector<datapoint> current_;
+        series current_;
+        series::retention retention_;
     public:
-        const std::vector<datapoint>& get_current() const override { return current_; }
+        tmp_data(value_type::type_class t, const series::retention& r)
+            : current_(t), retention_(r) {}
+
+        std::vector<datapoint> get_current() const override { return current_.decode(); }
+        std::vector<datapoint> get_range(time_point begin, time_point end,
+                            size_t points, downsample d) const override {
+            return current_.query(begin, end, points, d);
+        }
+        data_cursor_ptr get_backlog() const override { return current_.snapshot(); }
+        const series& get_series() const { return current_; }
+
+        const series::retention& get_retention() const { return retention_; }
+        void set_retention(const series::retention& r) {
+            retention_ = r;
+            current_.retain(r);
+        }
+
         void write(const std::vector<datapoint>& d) {
-            current_.insert(current_.end(), d.begin(), d.end());
+            current_.append(d);
+            current_.retain(retention_);
             data(d);
         }
     };
     // for the request recording info
     class tmp_archive : public local_context {
     private:
+        // applied to variables recorded/written without their own policy
+        series::retention retention_;
         std::unordered_map<const variable*, std::shared_ptr<tmp_data>> data_;
         std::unordered_map<const variable*, subscription_ptr> recordings_;
         std::unordered_map<params_stream*, 
             std::weak_ptr<params_stream>> recordings_queries_;
+        // reports usage to the recordings queries
+        io::deadline_timer usage_timer_;
+        bool usage_scheduled_;
+        // aggregates are computed here, created on first use
+        std::unique_ptr<boost::asio::thread_pool> workers_;
     public:
         tmp_archive(io::io_context& ioc, const std::string_view& name,
-                    std::unique_ptr<node>&& s);
+                    std::unique_ptr<node>&& s, const series::retention& r);
         ~tmp_archive();
 
         params_stream_ptr request(io::yield_ctx&, const params& p) override;
 
-        void record(variable* v, subscription_ptr s);
+        void record(variable* v, subscription_ptr s, const series::retention& r);
         void record_stop(variable* v);
 
+        // the stored data for a variable, created if necessary
+        const std::shared_ptr<tmp_data>& get_data(const variable* v);
+
+        // archive-wide and per-variable memory usage
+        params usage() const;
+
+        // statistics of each variable over windows of width us in [begin, end],
+        // see telegraph::aggregate(). The variables are processed in parallel
+        // and a result is written to the stream as each one finishes
+        params_stream_ptr aggregate(const std::vector<const variable*>& vars,
+                                    int64_t origin, int64_t begin, int64_t end,
+                                    int64_t width, const std::vector<float>& percentiles);
+
+        // as-of join of the variables onto a grid every step us, or onto the
+        // samples of clock if given (see aligner). The first message on the
+        // stream names the columns, which are then sent in batches of rows
+        params_stream_ptr align(std::vector<const variable*> vars, const variable* clock,
+                                int64_t origin, int64_t begin, int64_t end,
+                                int64_t step, int64_t tolerance);
+
         bool write_data(io::yield_ctx& yield, variable* v,
                         const std::vector<datapoint>& data) override {
-            auto it = data_.find(v);
-            if (it == data_.end()) {
-                auto s = std::make_shared<tmp_data>();
-                data_[v] = s;
-                s->write(data);
-            } else {
-                it->second->write(data);
-            }
+            get_data(v)->write(data);
             return true;
         }
         bool write_data(io::yield_ctx& yield, 
@@ -58,13 +100,7 @@ namespace telegraph {
 
         data_query_ptr query_data(io::yield_ctx& ctx,
                                   const variable* v) override {
-            auto it = data_.find(v);
-            if (it == data_.end()) {
-                auto s = std::make_shared<tmp_data>();
-                data_[v] = s;
-                return s;
-            }
-            return it->second;
+            return get_data(v);
         }
         
         data_query_ptr query_data(io::yield_ctx& ctx,
@@ -96,6 +132,8 @@ namespace telegraph {
         static local_context_ptr create(io::yield_ctx&, io::io_context& ioc, 
                 const std::string_view& name, const std::string_view& type,
                 const params& p);
+    private:
+        void schedule_usage();
     };
 }
 
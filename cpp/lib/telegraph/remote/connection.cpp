@@ -6,16 +6,36 @@
 #include <iostream>
 
 namespace telegraph {
-    connection::connection(io::io_context& ioc, bool count_down) : 
+    shared_update::shared_update(const datapoint& dp) : dp_(dp), field_() {
+        // without a req_id a packet is just its payload field
+        api::Packet p;
+        datapoint(dp).pack(p.mutable_sub_update());
+        p.SerializeToString(&field_);
+    }
+
+    connection::connection(io::io_context& ioc, bool count_down,
+                           size_t max_concurrent) : 
         ioc_(ioc),
         count_down_(count_down),
         counter_(0),
-        open_requests_() {}
+        open_requests_(),
+        writable_waiters_(),
+        alive_(std::make_shared<bool>(true)),
+        dispatched_(),
+        max_concurrent_(max_concurrent),
+        outstanding_(0),
+        dispatch_waiters_() {}
     connection::~connection() {
+        *alive_ = false;
+        on_written();
     }
 
     void
     connection::received(io::yield_ctx& yield, const api::Packet& p) {
+        if (p.payload_case() == api::Packet::kBatch) {
+            for (const api::Packet& bp : p.batch().packets()) received(yield, bp);
+            return;
+        }
         if (open_requests_.find(p.req_id()) != open_requests_.end()) {
             response& r = open_requests_.at(p.req_id());
             r.packet = p;
@@ -36,12 +56,64 @@ namespace telegraph {
         }
     }
 
+    void
+    connection::dispatch(io::yield_ctx& yield, api::Packet&& p,
+                         const std::shared_ptr<void>& owner) {
+        if (p.payload_case() == api::Packet::kBatch) {
+            for (api::Packet& bp : *p.mutable_batch()->mutable_packets())
+                dispatch(yield, std::move(bp), owner);
+            return;
+        }
+        // replies to our own requests just wake up the requester
+        if (open_requests_.find(p.req_id()) != open_requests_.end()) {
+            received(yield, p);
+            return;
+        }
+        while (outstanding_ >= max_concurrent_) {
+            io::deadline_timer timer(ioc_, boost::posix_time::ptime(boost::posix_time::pos_infin));
+            dispatch_waiters_.push_back(&timer);
+            boost::system::error_code error;
+            timer.async_wait(yield.ctx[error]);
+        }
+        outstanding_++;
+
+        int32_t req_id = p.req_id();
+        auto it = dispatched_.find(req_id);
+        if (it != dispatched_.end()) {
+            // the task handling this req_id will get to it
+            it->second.push_back(std::move(p));
+            return;
+        }
+        dispatched_[req_id].push_back(std::move(p));
+        io::spawn(ioc_, [this, req_id, owner] (io::yield_context y) {
+            io::yield_ctx c(y);
+            while (true) {
+                auto& queue = dispatched_.at(req_id);
+                if (queue.empty()) break;
+                api::Packet packet = std::move(queue.front());
+                queue.pop_front();
+                try {
+                    received(c, packet);
+                } catch (const std::exception& e) {
+                    std::cerr << "error handling request " << req_id 
+                              << ": " << e.what() << std::endl;
+                }
+                outstanding_--;
+                std::vector<io::deadline_timer*> waiters;
+                std::swap(waiters, dispatch_waiters_);
+                for (auto t : waiters) t->cancel();
+            }
+            dispatched_.erase(req_id);
+        });
+    }
+
     api::Packet
-    connection::request_response(io::yield_ctx& yield, api::Packet&& req) {
-        int32_t id = counter_++;
+    connection::request_response(io::yield_ctx& yield, api::Packet&& req, float timeout_secs) {
+        int32_t id = count_down_ ? counter_-- : counter_++;
         req.set_req_id(id);
 
-        io::deadline_timer timeout(ioc_, boost::posix_time::seconds(1));
+        io::deadline_timer timeout(ioc_,
+                boost::posix_time::milliseconds((long) (timeout_secs * 1000)));
         api::Packet res;
 
         response res_handler(timeout, res);
@@ -52,6 +124,9 @@ namespace telegraph {
         boost::system::error_code error;
         timeout.async_wait(yield.ctx[error]);
         if (error != io::error::operation_aborted) {
+            // a late reply must not find the timer and packet,
+            // which go away with this frame
+            open_requests_.erase(id);
             throw io_error("request timed out");
         }
 
@@ -59,11 +134,14 @@ namespace telegraph {
     }
 
     api::Packet
-    connection::request_stream(io::yield_ctx& yield, api::Packet&& req, const handler& h) {
-        int32_t id = counter_++;
+    connection::request_stream(io::yield_ctx& yield, api::Packet&& req, const handler& h,
+                               float timeout_secs, int32_t* req_id) {
+        int32_t id = count_down_ ? counter_-- : counter_++;
         req.set_req_id(id);
+        if (req_id) *req_id = id;
 
-        io::deadline_timer timeout(ioc_, boost::posix_time::seconds(1));
+        io::deadline_timer timeout(ioc_,
+                boost::posix_time::milliseconds((long) (timeout_secs * 1000)));
         api::Packet res;
 
         response res_handler(timeout, res);
@@ -75,6 +153,8 @@ namespace telegraph {
         boost::system::error_code error;
         timeout.async_wait(yield.ctx[error]);
         if (error != io::error::operation_aborted) {
+            open_requests_.erase(id);
+            open_streams_.erase(id);
             throw io_error("request timed out");
         }
 
@@ -91,6 +171,13 @@ namespace telegraph {
         open_streams_.emplace(std::make_pair(req_id, cb));
     }
 
+    void
+    connection::send_update(int32_t req_id, const shared_update_ptr& u) {
+        api::Packet p;
+        datapoint(u->get_datapoint()).pack(p.mutable_sub_update());
+        write_back(req_id, std::move(p));
+    }
+
     void 
     connection::write_back(int32_t req_id, api::Packet&& p) {
         p.set_req_id(req_id);
@@ -101,4 +188,25 @@ namespace telegraph {
     connection::close_stream(int32_t stream_id) {
         open_streams_.erase(stream_id);
     }
+
+    bool
+    connection::wait_writable(io::yield_ctx& yield, size_t max) {
+        std::shared_ptr<bool> alive = alive_;
+        while (queued() > max) {
+            io::deadline_timer timer(ioc_, boost::posix_time::ptime(boost::posix_time::pos_infin));
+            writable_waiters_.push_back(&timer);
+            boost::system::error_code error;
+            timer.async_wait(yield.ctx[error]);
+            // on_written() has removed the timer
+            if (!*alive) return false;
+        }
+        return true;
+    }
+
+    void
+    connection::on_written() {
+        std::vector<io::deadline_timer*> waiters;
+        std::swap(waiters, writable_waiters_);
+        for (auto t : waiters) t->cancel();
+    }
 }
@@ -5,8 +5,14 @@
 
 #include "api.pb.h"
 
+#include "../common/data.hpp"
+
 #include <unordered_map>
 #include <functional>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <string>
 
 #include <boost/asio/deadline_timer.hpp>
 
@@ -15,6 +21,23 @@ namespace telegraph {
         class Packet;
     }
 
+    /**
+     * A sub_update encoded once and shared by every client it goes out
+     * to, which only differ in their req_id. Immutable, so it can be handed
+     * to other threads
+     */
+    class shared_update {
+    private:
+        datapoint dp_;
+        std::string field_; // the encoded sub_update field of a Packet
+    public:
+        explicit shared_update(const datapoint& dp);
+
+        const datapoint& get_datapoint() const { return dp_; }
+        const std::string& field() const { return field_; }
+    };
+    using shared_update_ptr = std::shared_ptr<const shared_update>;
+
     class connection {
     private:
         using handler = std::function<void(io::yield_ctx&, const api::Packet& p)>;
@@ -34,9 +57,23 @@ namespace telegraph {
         std::unordered_map<int32_t, response> open_requests_;
         std::unordered_map<int32_t, handler> open_streams_;
         std::unordered_map<api::Packet::PayloadCase, handler> handlers_;
+
+        // timers of coroutines in wait_writable()
+        std::vector<io::deadline_timer*> writable_waiters_;
+        // set to false on destruction so waiters don't touch us
+        std::shared_ptr<bool> alive_;
+
+        // packets waiting to be handled by dispatch(), by req_id.
+        // There is an entry for every req_id with a handling task
+        std::unordered_map<int32_t, std::deque<api::Packet>> dispatched_;
+        size_t max_concurrent_;
+        size_t outstanding_; // dispatched but not yet handled
+        // timers of dispatch() calls waiting for outstanding_ to drop
+        std::vector<io::deadline_timer*> dispatch_waiters_;
     public:
-        connection(io::io_context& ioc, bool count_down);
-        ~connection();
+        connection(io::io_context& ioc, bool count_down,
+                   size_t max_concurrent=128);
+        virtual ~connection();
 
 		// both send/received should be non-blocking
 
@@ -44,11 +81,42 @@ namespace telegraph {
         // processed. that way request order is preserved
         void received(io::yield_ctx& yield, const api::Packet& p);
 
-        virtual void send(api::Packet&& p) = 0;
+        // handles the packet in its own task so that a slow request does
+        // not hold up the ones after it. Packets with the same req_id are
+        // still handled in the order they arrive. Suspends while
+        // max_concurrent packets are outstanding. owner is kept alive until
+        // the packet has been handled. p is moved from, not copied
+        void dispatch(io::yield_ctx& yield, api::Packet&& p,
+                      const std::shared_ptr<void>& owner);
 
-        // request-response pair
-        api::Packet request_response(io::yield_ctx& yield, api::Packet&& req);
-        api::Packet request_stream(io::yield_ctx& yield, api::Packet&& req, const handler& cb);
+        virtual void send(api::Packet&& p) = 0;
+        // sends u as a sub_update for req_id. Connections that can splice
+        // the encoded field straight into their frames should override this
+        virtual void send_update(int32_t req_id, const shared_update_ptr& u);
+
+        // number of packets waiting to be written out
+        virtual size_t queued() const { return 0; }
+
+        // suspends until at most max packets are queued,
+        // returns false if the connection was closed in the meantime
+        bool wait_writable(io::yield_ctx& yield, size_t max);
+
+        io::io_context& get_io_context() { return ioc_; }
+
+        // expires with the connection, for tasks that
+        // outlive the call that started them
+        std::weak_ptr<bool> lifetime() const { return alive_; }
+
+        // request-response pair, throw io_error if there is
+        // no response within timeout seconds
+        api::Packet request_response(io::yield_ctx& yield, api::Packet&& req,
+                                     float timeout=1);
+        // the response has the req_id of the stream. If req_id is given
+        // it is set before sending, so that a stream whose
+        // request timed out can still be cancelled
+        api::Packet request_stream(io::yield_ctx& yield, api::Packet&& req,
+                                   const handler& cb, float timeout=1,
+                                   int32_t* req_id=nullptr);
 
         void set_handler(api::Packet::PayloadCase c, const handler& h);
         void set_stream_cb(int32_t req_id, const handler& h);
@@ -56,6 +124,10 @@ namespace telegraph {
         void write_back(int32_t req_id, api::Packet&& p);
 
         void close_stream(int32_t req_id);
+    protected:
+        // to be called by implementations whenever
+        // a packet has been written out
+        void on_written();
     };
 }
 
@@ -4,23 +4,34 @@
 #include "../common/namespace.hpp"
 #include "../common/nodes.hpp"
 
+#include "../utils/io.hpp"
+
 #include "api.pb.h"
 
 #include "api.pb.h"
 #include <boost/uuid/uuid_io.hpp>
 #include <boost/lexical_cast.hpp>
 #include <string_view>
+#include <algorithm>
+#include <unordered_set>
 
 namespace telegraph {
 
+    // handles per connection, to bound what a client can make us hold
+    static constexpr size_t max_handles = 1 << 20;
+
     forwarder::forwarder(connection& conn, const std::shared_ptr<namespace_>& ns)
-        : conn_(conn), ns_(ns) {
+        : conn_(conn), ns_(ns), subs_(), streams_(), queries_(),
+          live_pending_(), alive_(std::make_shared<bool>(true)),
+          handles_(), handle_keys_() {
         if (!ns_) return;
         // set the handlers
         conn_.set_handler(api::Packet::kQueryNs, 
                 [this] (io::yield_ctx& c, const api::Packet& p) { handle_query_ns(c, p); });
         conn_.set_handler(api::Packet::kRequest,
                 [this] (io::yield_ctx& c, const api::Packet& p) { handle_request(c, p); });
+        conn_.set_handler(api::Packet::kResolve,
+                [this] (io::yield_ctx& c, const api::Packet& p) { handle_resolve(c, p); });
         conn_.set_handler(api::Packet::kFetchTree, 
                 [this] (io::yield_ctx& c, const api::Packet& p) { handle_fetch_tree(c, p); });
         conn_.set_handler(api::Packet::kCreate,
@@ -29,6 +40,8 @@ namespace telegraph {
                 [this] (io::yield_ctx& c, const api::Packet& p) { handle_destroy(c, p); });
         conn_.set_handler(api::Packet::kSubChange,
                 [this] (io::yield_ctx& c, const api::Packet& p) { handle_sub_change(c, p); });
+        conn_.set_handler(api::Packet::kSubChangeBatch,
+                [this] (io::yield_ctx& c, const api::Packet& p) { handle_sub_change_batch(c, p); });
         conn_.set_handler(api::Packet::kCallAction,
                 [this] (io::yield_ctx& c, const api::Packet& p) { handle_call_action(c, p); });
         conn_.set_handler(api::Packet::kDataWrite,
@@ -39,6 +52,7 @@ namespace telegraph {
     }
 
     forwarder::~forwarder() {
+        *alive_ = false;
         // unset the handlers for context added/removed
         if (!ns_) return;
 
@@ -63,6 +77,22 @@ namespace telegraph {
         }
     }
 
+    // the update encoded during the latest fanout on this thread,
+    // reused by the forwarders of all the other clients
+    static thread_local uint64_t last_fanout = 0;
+    static thread_local shared_update_ptr last_update;
+
+    static shared_update_ptr
+    encode_update(const datapoint& dp) {
+        uint64_t f = fanout::current();
+        if (f == 0) return std::make_shared<shared_update>(dp);
+        if (f != last_fanout || !last_update) {
+            last_fanout = f;
+            last_update = std::make_shared<shared_update>(dp);
+        }
+        return last_update;
+    }
+
     void
     forwarder::reply_error(const api::Packet& p, const std::exception& e) {
         api::Packet res;
@@ -113,6 +143,59 @@ namespace telegraph {
         });
     }
 
+    void
+    forwarder::handle_resolve(io::yield_ctx& yield, const api::Packet& p) {
+        try {
+            const auto& req = p.resolve();
+            std::string key = req.uuid();
+            for (const auto& s : req.path()) {
+                key.push_back('\0');
+                key.append(s);
+            }
+            uint32_t handle = 0;
+            auto it = handle_keys_.find(key);
+            // the context may have been replaced since
+            if (it != handle_keys_.end() && !handles_[it->second - 1].ctx.expired()) {
+                handle = it->second;
+            } else {
+                auto ctx = ns_->contexts->get(boost::lexical_cast<uuid>(req.uuid()));
+                if (!ctx) throw missing_error("no such context");
+                resolved r{ctx, nullptr, nullptr};
+                if (req.path_size() > 0) {
+                    std::vector<std::string_view> path;
+                    for (const auto& s : req.path()) path.push_back(s);
+                    r.tree = ctx->fetch(yield);
+                    r.n = r.tree ? r.tree->from_path(path) : nullptr;
+                    if (!r.n) throw missing_error("no such node");
+                }
+                if (it != handle_keys_.end()) {
+                    handle = it->second;
+                    handles_[handle - 1] = std::move(r);
+                } else {
+                    if (handles_.size() >= max_handles) throw remote_error("too many handles");
+                    handles_.push_back(std::move(r));
+                    handle = (uint32_t) handles_.size();
+                    handle_keys_.emplace(std::move(key), handle);
+                }
+            }
+            api::Packet res;
+            res.set_resolved(handle);
+            conn_.write_back(p.req_id(), std::move(res));
+        } catch (const std::exception& e) {
+            reply_error(p, e);
+        }
+    }
+
+    context_ptr
+    forwarder::lookup(uint32_t handle, node** n) {
+        if (handle == 0 || handle > handles_.size()) throw missing_error("no such handle");
+        const resolved& r = handles_[handle - 1];
+        auto ctx = r.ctx.lock();
+        if (!ctx) throw missing_error("no such context");
+        *n = r.n;
+        return ctx;
+    }
+
     void
     forwarder::handle_fetch_tree(io::yield_ctx& yield, const api::Packet& p) {
         try {
@@ -140,7 +223,6 @@ namespace telegraph {
             int32_t req_id = p.req_id();
             const auto& cs = p.sub_change();
 
-            uuid ctx_uuid = boost::lexical_cast<uuid>(cs.uuid());
             float db = cs.debounce();
             float rf = cs.refresh();
             float timeout = cs.timeout();
@@ -149,61 +231,34 @@ namespace telegraph {
 
             if (it == subs_.end()) {
                 // new subscription!
-                std::vector<std::string_view> path;
-                for (const auto& s : cs.variable()) {
-                    path.push_back(s);
+                subscription_ptr sub;
+                if (cs.handle() != 0) {
+                    node* n = nullptr;
+                    auto ctx = lookup(cs.handle(), &n);
+                    auto v = dynamic_cast<variable*>(n);
+                    if (!v) throw missing_error("not a variable");
+                    sub = ctx->subscribe(c, v, db, rf, timeout);
+                } else {
+                    std::vector<std::string_view> path;
+                    for (const auto& s : cs.variable()) {
+                        path.push_back(s);
+                    }
+                    auto ctx = ns_->contexts->get(boost::lexical_cast<uuid>(cs.uuid()));
+                    if (!ctx) throw missing_error("no such context");
+                    sub = ctx->subscribe(c, path, db, rf, timeout);
                 }
-                auto ctx = ns_->contexts->get(ctx_uuid);
-                if (!ctx) throw missing_error("no such context");
-                auto sub = ctx->subscribe(c, path, db, rf, timeout);
                 if (!sub) {
                     api::Packet r;
                     r.set_success(false);
                     conn_.write_back(req_id, std::move(r));
                     return;
                 }
-                sub->data.add(this, [this, req_id](value v) {
-                    // write the data back
-                    api::Packet p;
-                    datapoint dp{datapoint::now(), v};
-                    dp.pack(p.mutable_sub_update());
-                    conn_.write_back(req_id, std::move(p));
-                });
-                sub->cancelled.add(this, [this, req_id]() {
-                    subs_.erase(req_id);
-                    api::Packet p;
-                    p.set_cancel(0);
-                    conn_.write_back(req_id, std::move(p));
-                    conn_.close_stream(req_id); 
-                });
-                // handle getting a cancel() message
-                conn_.set_stream_cb(req_id, 
-                    [this](io::yield_ctx& yield, const api::Packet& p) {
-                        if (p.payload_case() == api::Packet::kSubChange) {
-                            const api::Subscription& s = p.sub_change();
-                            bool success = false;
-                            try {
-                                subs_.at(p.req_id())->change(yield,
-                                        s.debounce(), s.refresh(),
-                                        s.timeout());
-                                success = true;
-                            } catch (...) {}
-                            api::Packet r;
-                            r.set_success(success);
-                            conn_.write_back(p.req_id(), std::move(r));
-                        } else if (p.payload_case() == api::Packet::kSubPoll) {
-                            subs_.at(p.req_id())->poll();
-                        } else if (p.payload_case() == api::Packet::kCancel) {
-                            subs_.erase(p.req_id()); // will erase the sub and should trigger cancelled()
-                        }
-                    });
                 // reply with the sub type
                 api::Packet reply;
                 sub->get_type().pack(reply.mutable_sub_type());
                 conn_.write_back(req_id, std::move(reply));
 
-                // put in subs map
-                subs_.emplace(std::make_pair(req_id, std::move(sub)));
+                start_sub(req_id, std::move(sub));
             } else {
                 const auto& sub = it->second;
                 sub->change(c, db, rf, timeout);
@@ -213,22 +268,163 @@ namespace telegraph {
         }
     }
 
+    void
+    forwarder::start_sub(int32_t req_id, subscription_ptr sub) {
+        sub->data.add(this, [this, req_id](const datapoint& dp) {
+            // write the data back
+            conn_.send_update(req_id, encode_update(dp));
+        });
+        sub->cancelled.add(this, [this, req_id]() {
+            subs_.erase(req_id);
+            api::Packet p;
+            p.set_cancel(0);
+            conn_.write_back(req_id, std::move(p));
+            conn_.close_stream(req_id); 
+        });
+        // handle getting a cancel() message
+        conn_.set_stream_cb(req_id, 
+            [this](io::yield_ctx& yield, const api::Packet& p) {
+                if (p.payload_case() == api::Packet::kSubChange) {
+                    const api::Subscription& s = p.sub_change();
+                    bool success = false;
+                    try {
+                        subs_.at(p.req_id())->change(yield,
+                                s.debounce(), s.refresh(),
+                                s.timeout());
+                        success = true;
+                    } catch (...) {}
+                    api::Packet r;
+                    r.set_success(success);
+                    conn_.write_back(p.req_id(), std::move(r));
+                } else if (p.payload_case() == api::Packet::kSubPoll) {
+                    subs_.at(p.req_id())->poll();
+                } else if (p.payload_case() == api::Packet::kCancel) {
+                    subs_.erase(p.req_id()); // will erase the sub and should trigger cancelled()
+                }
+            });
+        // put in subs map
+        subs_.emplace(std::make_pair(req_id, std::move(sub)));
+    }
+
+    void
+    forwarder::handle_sub_change_batch(io::yield_ctx& c, const api::Packet& p) {
+        try {
+            const auto& batch = p.sub_change_batch();
+            if (batch.streams_size() != batch.subs_size())
+                throw remote_error("need one stream per subscription");
+            size_t n = (size_t) batch.subs_size();
+            std::vector<subscription_ptr> subs(n);
+
+            // one subscribe_many() per context, with the
+            // resolved variables and the paths separately
+            struct group {
+                context_ptr ctx;
+                std::vector<size_t> var_idx;
+                std::vector<const variable*> vars;
+                std::vector<size_t> path_idx;
+                std::vector<std::vector<std::string_view>> paths;
+                float debounce, refresh, timeout;
+            };
+            std::vector<group> groups;
+            // a stream id repeated within the batch only gets its first entry
+            std::unordered_set<int32_t> seen;
+            for (size_t i = 0; i < n; i++) {
+                const auto& cs = batch.subs((int) i);
+                int32_t req_id = batch.streams((int) i);
+                if (subs_.find(req_id) != subs_.end()) continue;
+                if (!seen.insert(req_id).second) continue;
+                context_ptr ctx;
+                const variable* v = nullptr;
+                try {
+                    if (cs.handle() != 0) {
+                        node* found = nullptr;
+                        ctx = lookup(cs.handle(), &found);
+                        v = dynamic_cast<variable*>(found);
+                        if (!v) continue;
+                    } else {
+                        ctx = ns_->contexts->get(boost::lexical_cast<uuid>(cs.uuid()));
+                        if (!ctx) continue;
+                    }
+                } catch (const std::exception&) { continue; }
+                // entries may differ in their intervals, those
+                // are grouped apart even on the same context
+                auto g = std::find_if(groups.begin(), groups.end(), [&] (const group& g) {
+                    return g.ctx == ctx && g.debounce == cs.debounce() &&
+                            g.refresh == cs.refresh() && g.timeout == cs.timeout();
+                });
+                if (g == groups.end()) {
+                    groups.push_back(group{ctx, {}, {}, {}, {},
+                                    cs.debounce(), cs.refresh(), cs.timeout()});
+                    g = groups.end() - 1;
+                }
+                if (v) {
+                    g->var_idx.push_back(i);
+                    g->vars.push_back(v);
+                } else {
+                    g->path_idx.push_back(i);
+                    g->paths.emplace_back(cs.variable().begin(), cs.variable().end());
+                }
+            }
+            for (auto& g : groups) {
+                if (!g.vars.empty()) {
+                    auto s = g.ctx->subscribe_many(c, g.vars, g.debounce, g.refresh, g.timeout);
+                    for (size_t j = 0; j < s.size() && j < g.var_idx.size(); j++)
+                        subs[g.var_idx[j]] = std::move(s[j]);
+                }
+                if (!g.paths.empty()) {
+                    auto s = g.ctx->subscribe_many(c, g.paths, g.debounce, g.refresh, g.timeout);
+                    for (size_t j = 0; j < s.size() && j < g.path_idx.size(); j++)
+                        subs[g.path_idx[j]] = std::move(s[j]);
+                }
+            }
+
+            // all the types in one reply, the streams
+            // only start after it so the types come first
+            api::Packet reply;
+            auto types = reply.mutable_sub_types();
+            for (size_t i = 0; i < n; i++) {
+                int32_t req_id = batch.streams((int) i);
+                if (subs[i] && subs_.find(req_id) == subs_.end()) {
+                    subs[i]->get_type().pack(types->add_types());
+                } else {
+                    subs[i] = nullptr;
+                    types->add_types(); // INVALID
+                }
+            }
+            conn_.write_back(p.req_id(), std::move(reply));
+            for (size_t i = 0; i < n; i++) {
+                if (subs[i]) start_sub(batch.streams((int) i), std::move(subs[i]));
+            }
+        } catch (const std::exception& e) {
+            reply_error(p, e);
+        }
+    }
+
     void
     forwarder::handle_call_action(io::yield_ctx& c, const api::Packet& p) {
         try {
             int32_t req_id = p.req_id();
             const auto& req = p.call_action();
-            // get the argument/context parameters
-            uuid u = boost::lexical_cast<uuid>(req.uuid());
-            std::vector<std::string_view> path;
-            for (const auto& s : req.action()) {
-                path.push_back(s);
-            }
             value v{req.value()};
-            // make the call
-            auto ctx = ns_->contexts->get(u);
-            if (!ctx) throw missing_error("no such context");
-            value ret = ctx->call(c, path, v, req.timeout());
+            value ret;
+            if (req.handle() != 0) {
+                node* n = nullptr;
+                auto ctx = lookup(req.handle(), &n);
+                auto a = dynamic_cast<action*>(n);
+                if (!a) throw missing_error("not an action");
+                ret = ctx->call(c, a, v, req.timeout());
+            } else {
+                // get the argument/context parameters
+                uuid u = boost::lexical_cast<uuid>(req.uuid());
+                std::vector<std::string_view> path;
+                for (const auto& s : req.action()) {
+                    path.push_back(s);
+                }
+                // make the call
+                auto ctx = ns_->contexts->get(u);
+                if (!ctx) throw missing_error("no such context");
+                ret = ctx->call(c, path, v, req.timeout());
+            }
             datapoint dp{datapoint::now(), ret};
             // reply with the result
             api::Packet res;
@@ -245,7 +441,6 @@ namespace telegraph {
             int32_t req_id = p.req_id();
             const auto& req = p.data_write();
 
-            uuid u = boost::lexical_cast<uuid>(req.uuid());
             std::vector<datapoint> data;
             for (const Datapoint& v : req.data()) {
                 uint64_t millisecs = v.timestamp();
@@ -254,13 +449,23 @@ namespace telegraph {
                 data.push_back(datapoint{tp,
                                value{v.value()}});
             }
-            std::vector<std::string_view> path;
-            for (const auto& s : req.path()) {
-                path.push_back(s);
+            bool status;
+            if (req.handle() != 0) {
+                node* n = nullptr;
+                auto ctx = lookup(req.handle(), &n);
+                auto v = dynamic_cast<variable*>(n);
+                if (!v) throw missing_error("not a variable");
+                status = ctx->write_data(c, v, data);
+            } else {
+                uuid u = boost::lexical_cast<uuid>(req.uuid());
+                std::vector<std::string_view> path;
+                for (const auto& s : req.path()) {
+                    path.push_back(s);
+                }
+                auto ctx = ns_->contexts->get(u);
+                if (!ctx) throw missing_error("no such context");
+                status = ctx->write_data(c, path, data);
             }
-            auto ctx = ns_->contexts->get(u);
-            if (!ctx) throw missing_error("no such context");
-            bool status = ctx->write_data(c, path, data);
             // send response
             api::Packet res;
             res.set_success(status);
@@ -270,43 +475,166 @@ namespace telegraph {
         }
     }
 
+    // archive datapoints are sent with millisecond timestamps
+    static void pack_archive(const std::vector<datapoint>& data, 
+                                api::DataPacket* pack) {
+        for (const datapoint& dp : data) {
+            Datapoint* d = pack->add_data();
+            auto dur = dp.get_time().time_since_epoch();
+            uint64_t ts = (uint64_t) std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
+            d->set_timestamp(ts);
+            dp.get_value().pack(d->mutable_value());
+        }
+    }
+
+    // fetch the range requested in a data_query (if any)
+    static void pack_range(const data_query_ptr& q, 
+                    const api::DataQuery& req, api::DataPacket* pack) {
+        if (req.end() <= req.start()) return;
+        time_point start{std::chrono::milliseconds{req.start()}};
+        time_point end{std::chrono::milliseconds{req.end()}};
+        downsample d = req.downsample() == api::DataQuery::LTTB ?
+                            downsample::lttb : downsample::min_max;
+        pack_archive(q->get_range(start, end, req.points(), d), pack);
+    }
+
     void
     forwarder::handle_data_query(io::yield_ctx& c, const api::Packet& p) {
         try {
             int32_t req_id = p.req_id();
             const auto& req = p.data_query();
-            uuid u = boost::lexical_cast<uuid>(req.uuid());
-            std::vector<std::string_view> path;
-            for (const auto& s : req.path()) {
-                path.push_back(s);
+            data_query_ptr q;
+            if (req.handle() != 0) {
+                node* n = nullptr;
+                auto ctx = lookup(req.handle(), &n);
+                auto v = dynamic_cast<variable*>(n);
+                if (!v) throw missing_error("not a variable");
+                q = ctx->query_data(c, v);
+            } else {
+                uuid u = boost::lexical_cast<uuid>(req.uuid());
+                std::vector<std::string_view> path;
+                for (const auto& s : req.path()) {
+                    path.push_back(s);
+                }
+                auto ctx = ns_->contexts->get(u);
+                if (!ctx) throw missing_error("no such context");
+                q = ctx->query_data(c, path);
+            }
+            if (!q) {
+                api::Packet res;
+                res.set_success(false);
+                conn_.write_back(req_id, std::move(res));
+                return;
             }
-            auto ctx = ns_->contexts->get(u);
-            if (!ctx) throw missing_error("no such context");
-            auto q = ctx->query_data(c, path);
             q->data.add(this, [this, req_id](const std::vector<datapoint>& data) {
-                api::Packet p;
-                api::DataPacket* pack = p.mutable_archive_update();
-                for (const datapoint& dp : data) {
-                    Datapoint* d = pack->add_data();
-                    auto dur = dp.get_time().time_since_epoch();
-                    uint64_t ts = (uint64_t) std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
-                    d->set_timestamp(ts);
-                    dp.get_value().pack(d->mutable_value());
+                // keep live data behind the backlog
+                auto it = live_pending_.find(req_id);
+                if (it != live_pending_.end()) {
+                    it->second.insert(it->second.end(), data.begin(), data.end());
+                    return;
                 }
+                api::Packet p;
+                pack_archive(data, p.mutable_archive_update());
                 conn_.write_back(req_id, std::move(p));
             });
             conn_.set_stream_cb(req_id,
                 [this](io::yield_ctx& yield, const api::Packet& p) {
                     if (p.payload_case() == api::Packet::kCancel) {
+                        auto it = queries_.find(p.req_id());
+                        if (it != queries_.end()) it->second->data.remove(this);
                         queries_.erase(p.req_id());
+                        live_pending_.erase(p.req_id());
+                        conn_.close_stream(p.req_id());
+                    } else if (p.payload_case() == api::Packet::kDataQuery) {
+                        // a new range on an existing query,
+                        // only the (downsampled) range is sent back
+                        auto it = queries_.find(p.req_id());
+                        if (it == queries_.end()) return;
+                        api::Packet res;
+                        pack_range(it->second, p.data_query(), res.mutable_archive_data());
+                        conn_.write_back(p.req_id(), std::move(res));
                     }
                 });
             queries_.emplace(req_id, q);
+
+            // reply with the initial range
+            api::Packet res;
+            pack_range(q, req, res.mutable_archive_data());
+            conn_.write_back(req_id, std::move(res));
+
+            // without a range everything stored is sent
+            if (req.end() <= req.start()) stream_backlog(req_id, q);
         } catch (const std::exception& e) {
             reply_error(p, e);
         }
     }
 
+    // datapoints per archive_update while streaming a backlog
+    static constexpr size_t backlog_chunk = 4096;
+    // only queue another chunk once the connection has
+    // written out all but this many packets, so other
+    // traffic isn't stuck behind the whole backlog
+    static constexpr size_t backlog_queue = 2;
+
+    void
+    forwarder::stream_backlog(int32_t req_id, const data_query_ptr& q) {
+        // the cursor is made before we yield, so data
+        // after it ends up in live_pending_
+        std::shared_ptr<data_cursor> cursor = q->get_backlog();
+        live_pending_[req_id];
+
+        // neither we nor conn_ are kept alive by the task,
+        // so both have to be checked before touching either
+        std::weak_ptr<bool> alive = alive_;
+        std::weak_ptr<bool> conn_alive = conn_.lifetime();
+        io::spawn(conn_.get_io_context(),
+            [this, alive, conn_alive, req_id, q, cursor] (io::yield_context yield) {
+                io::yield_ctx c(yield);
+                // false if we, the connection or the query are gone
+                auto open = [this, &alive, &conn_alive, req_id, &q]() {
+                    auto a = alive.lock();
+                    auto ca = conn_alive.lock();
+                    if (!a || !*a || !ca || !*ca) return false;
+                    auto it = queries_.find(req_id);
+                    return it != queries_.end() && it->second == q;
+                };
+                // wait_writable() returns false without touching
+                // the connection if it goes away while waiting
+                auto writable = [this, &c, &open]() {
+                    return open() && conn_.wait_writable(c, backlog_queue) && open();
+                };
+                std::vector<datapoint> chunk;
+                bool more = true;
+                while (more) {
+                    if (!writable()) return;
+                    chunk.clear();
+                    more = cursor->next(backlog_chunk, &chunk);
+                    if (chunk.empty()) continue;
+                    api::Packet p;
+                    pack_archive(chunk, p.mutable_archive_update());
+                    conn_.write_back(req_id, std::move(p));
+                }
+                // drain the live data that came in meanwhile,
+                // after which it is forwarded directly
+                while (true) {
+                    if (!writable()) return;
+                    auto it = live_pending_.find(req_id);
+                    if (it == live_pending_.end()) return;
+                    std::vector<datapoint>& pending = it->second;
+                    if (pending.empty()) {
+                        live_pending_.erase(it);
+                        return;
+                    }
+                    size_t n = std::min(backlog_chunk, pending.size());
+                    chunk.assign(pending.begin(), pending.begin() + n);
+                    pending.erase(pending.begin(), pending.begin() + n);
+                    api::Packet p;
+                    pack_archive(chunk, p.mutable_archive_update());
+                    conn_.write_back(req_id, std::move(p));
+                }
+            });
+    }
+
     void
     forwarder::handle_request(io::yield_ctx& c, const api::Packet& p) {
         try {
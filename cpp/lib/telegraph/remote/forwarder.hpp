@@ -13,6 +13,8 @@
 #include "../common/namespace.hpp"
 
 #include <unordered_map>
+#include <string>
+#include <vector>
 
 namespace telegraph {
     class connection;
@@ -29,6 +31,20 @@ namespace telegraph {
         // active component query streams
         std::unordered_map<int32_t, params_stream_ptr> streams_;
         std::unordered_map<int32_t, data_query_ptr> queries_;
+        // live data held back while the backlog of a query is streamed
+        std::unordered_map<int32_t, std::vector<datapoint>> live_pending_;
+        // lets the backlog streaming tasks know we are gone
+        std::shared_ptr<bool> alive_;
+
+        // what a resolve looked up, handle n is at n - 1
+        struct resolved {
+            std::weak_ptr<context> ctx;
+            std::shared_ptr<node> tree; // keeps n alive
+            node* n; // nullptr for the context itself
+        };
+        std::vector<resolved> handles_;
+        // uuid and path, joined by '\0'
+        std::unordered_map<std::string, uint32_t> handle_keys_;
     public:
         // will register handlers
         forwarder(connection& conn, 
@@ -39,15 +55,27 @@ namespace telegraph {
 
         void handle_query_ns(io::yield_ctx&, const api::Packet& p);
 
+        void handle_resolve(io::yield_ctx&, const api::Packet& p);
+        // throws missing_error if the handle is unknown or its context is gone
+        context_ptr lookup(uint32_t handle, node** n);
+
         void handle_request(io::yield_ctx&, const api::Packet& p);
 
         void handle_fetch_tree(io::yield_ctx&, const api::Packet& p);
 
         void handle_sub_change(io::yield_ctx&, const api::Packet& p);
+        // subscribes to everything in the batch with one subscribe_many()
+        // per context, replying with all the types at once
+        void handle_sub_change_batch(io::yield_ctx&, const api::Packet& p);
+        // forwards the updates of sub on the stream req_id
+        void start_sub(int32_t req_id, subscription_ptr sub);
         void handle_call_action(io::yield_ctx&, const api::Packet& p);
 
         void handle_data_write(io::yield_ctx&, const api::Packet& p);
         void handle_data_query(io::yield_ctx&, const api::Packet& p);
+        // sends everything stored for a query in chunks, followed
+        // by the live data received in the meantime
+        void stream_backlog(int32_t req_id, const data_query_ptr& q);
 
         void handle_create(io::yield_ctx&, const api::Packet& p);
         void handle_destroy(io::yield_ctx&, const api::Packet& p);
@@ -0,0 +1,214 @@
+#include "multicast_receiver.hpp"
+
+#include "../utils/errors.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+#include <boost/asio/ip/multicast.hpp>
+
+namespace net = boost::asio;
+using udp = boost::asio::ip::udp;
+
+namespace telegraph {
+    // how long to wait for a snapshot before asking again
+    static constexpr long snapshot_retry_ms = 250;
+    static constexpr size_t max_datagram_size = 65536;
+
+    static time_point
+    from_micros(uint64_t t) {
+        return time_point(std::chrono::duration_cast<time_point::duration>(
+                    std::chrono::microseconds(t)));
+    }
+
+    multicast_receiver::multicast_receiver(io::io_context& ioc,
+                const udp::endpoint& group, const net::ip::address& interface)
+            : ioc_(ioc), group_(group), interface_(interface),
+              mcast_socket_(ioc), socket_(ioc), publisher_(),
+              source_(), expected_(0), channels_(),
+              need_snapshot_(false), snapshot_seq_(0),
+              snapshot_parts_(), snapshot_channels_(),
+              retry_timer_(ioc), retry_scheduled_(false),
+              drop_(0), received_(0), gaps_(0), missed_(0), snapshots_(0) {}
+
+    void
+    multicast_receiver::start() {
+        boost::system::error_code ec;
+        auto protocol = group_.address().is_v4() ? udp::v4() : udp::v6();
+        mcast_socket_.open(protocol, ec);
+        if (ec) throw io_error("failed to open multicast socket");
+        // several receivers can share a machine
+        mcast_socket_.set_option(net::socket_base::reuse_address(true), ec);
+        mcast_socket_.bind(udp::endpoint{protocol, group_.port()}, ec);
+        if (ec) throw io_error("failed to bind multicast socket");
+        if (group_.address().is_v4() && interface_.is_v4()) {
+            mcast_socket_.set_option(net::ip::multicast::join_group(
+                        group_.address().to_v4(), interface_.to_v4()), ec);
+        } else {
+            mcast_socket_.set_option(net::ip::multicast::join_group(group_.address()), ec);
+        }
+        if (ec) throw io_error("failed to join multicast group");
+
+        socket_.open(protocol, ec);
+        if (!ec) socket_.bind(udp::endpoint{protocol, 0}, ec);
+        if (ec) throw io_error("failed to open snapshot socket");
+
+        auto s = shared_from_this();
+        for (udp::socket* sock : {&mcast_socket_, &socket_}) {
+            io::spawn(ioc_, [s, sock] (io::yield_context yield) {
+                std::vector<uint8_t> buf(max_datagram_size);
+                udp::endpoint from;
+                api::McastDatagram d;
+                while (true) {
+                    boost::system::error_code ec;
+                    size_t n = sock->async_receive_from(net::buffer(buf), from, yield[ec]);
+                    if (ec == net::error::operation_aborted || !sock->is_open()) break;
+                    if (ec) continue;
+                    if (s->drop_ > 0) {
+                        s->drop_--;
+                        continue;
+                    }
+                    if (!d.ParseFromArray(buf.data(), (int) n)) continue;
+                    s->received_++;
+                    s->handle(d, from);
+                }
+            });
+        }
+    }
+
+    void
+    multicast_receiver::stop() {
+        boost::system::error_code ec;
+        retry_timer_.cancel();
+        mcast_socket_.close(ec);
+        socket_.close(ec);
+    }
+
+    const multicast_receiver::channel*
+    multicast_receiver::find(const std::string& uuid,
+                             const std::vector<std::string>& variable) const {
+        for (const auto& c : channels_) {
+            if (c.second.uuid == uuid && c.second.variable == variable) return &c.second;
+        }
+        return nullptr;
+    }
+
+    void
+    multicast_receiver::handle(const api::McastDatagram& d, const udp::endpoint& from) {
+        if (d.kind() == api::McastDatagram::SNAPSHOT_REQUEST) return;
+        publisher_ = from;
+        uint64_t seq = d.seq();
+        if (d.source() != source_) {
+            // a new publisher (or a restarted one), start over
+            source_ = d.source();
+            channels_.clear();
+            expected_ = d.kind() == api::McastDatagram::UPDATES ? seq : seq + 1;
+            snapshot_parts_.clear();
+            need_snapshot_ = true;
+            request_snapshot();
+        }
+        switch (d.kind()) {
+        case api::McastDatagram::UPDATES:
+            if (seq > expected_) {
+                gaps_++;
+                missed_ += seq - expected_;
+                need_snapshot_ = true;
+                request_snapshot();
+            }
+            expected_ = std::max(expected_, seq + 1);
+            // late ones are still applied, unless already outdated
+            for (const auto& u : d.updates()) apply(u);
+            break;
+        case api::McastDatagram::HEARTBEAT:
+            if (seq >= expected_) {
+                gaps_++;
+                missed_ += seq + 1 - expected_;
+                expected_ = seq + 1;
+                need_snapshot_ = true;
+                request_snapshot();
+            }
+            break;
+        case api::McastDatagram::SNAPSHOT:
+            handle_snapshot(d);
+            break;
+        default: break;
+        }
+    }
+
+    void
+    multicast_receiver::handle_snapshot(const api::McastDatagram& d) {
+        if (!need_snapshot_) return;
+        if (d.seq() != snapshot_seq_ || snapshot_parts_.empty()) {
+            snapshot_seq_ = d.seq();
+            snapshot_parts_.clear();
+            snapshot_channels_.clear();
+        }
+        if (!snapshot_parts_.insert(d.part()).second) return;
+        for (const auto& mc : d.channels()) {
+            snapshot_channels_.insert(mc.channel());
+            auto it = channels_.find(mc.channel());
+            if (it != channels_.end()) continue;
+            channel c{mc.channel(), mc.uuid(),
+                      std::vector<std::string>(mc.variable().begin(), mc.variable().end()),
+                      false, datapoint{time_point(), value()}};
+            channels_.emplace(mc.channel(), std::move(c));
+        }
+        for (const auto& u : d.updates()) apply(u);
+        if (snapshot_parts_.size() < d.parts()) return;
+
+        // complete, forget unpublished channels
+        for (auto it = channels_.begin(); it != channels_.end();) {
+            if (snapshot_channels_.count(it->first)) ++it;
+            else it = channels_.erase(it);
+        }
+        snapshot_parts_.clear();
+        snapshot_channels_.clear();
+        need_snapshot_ = false;
+        expected_ = std::max(expected_, d.seq() + 1);
+        snapshots_++;
+    }
+
+    void
+    multicast_receiver::apply(const api::McastUpdate& u) {
+        auto it = channels_.find(u.channel());
+        if (it == channels_.end()) {
+            // published after our channel list
+            need_snapshot_ = true;
+            request_snapshot();
+            return;
+        }
+        channel& c = it->second;
+        datapoint dp{from_micros(u.dp().timestamp()), value::unpack(u.dp().value())};
+        if (c.has_latest && dp.get_time() < c.latest.get_time()) return;
+        c.has_latest = true;
+        c.latest = dp;
+        update(c);
+    }
+
+    void
+    multicast_receiver::request_snapshot() {
+        // the retry will ask again
+        if (retry_scheduled_ || !socket_.is_open()) return;
+        api::McastDatagram req;
+        req.set_kind(api::McastDatagram::SNAPSHOT_REQUEST);
+        std::string buf = req.SerializeAsString();
+        boost::system::error_code ec;
+        socket_.send_to(net::buffer(buf), publisher_, 0, ec);
+        if (ec) std::cerr << "snapshot request failed: " << ec.message() << std::endl;
+        schedule_retry();
+    }
+
+    void
+    multicast_receiver::schedule_retry() {
+        retry_scheduled_ = true;
+        retry_timer_.expires_from_now(boost::posix_time::milliseconds(snapshot_retry_ms));
+        std::weak_ptr<multicast_receiver> w = shared_from_this();
+        retry_timer_.async_wait([w] (const boost::system::error_code& ec) {
+            if (ec) return;
+            auto s = w.lock();
+            if (!s) return;
+            s->retry_scheduled_ = false;
+            if (s->need_snapshot_) s->request_snapshot();
+        });
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef __TELEGRAPH_MULTICAST_RECEIVER_HPP__
+#define __TELEGRAPH_MULTICAST_RECEIVER_HPP__
+
+#include "../utils/io.hpp"
+#include "../utils/signal.hpp"
+#include "../common/data.hpp"
+
+#include "api.pb.h"
+
+#include <array>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/deadline_timer.hpp>
+
+namespace telegraph {
+    /**
+     * Receives the updates a multicast_publisher broadcasts.
+     *
+     * Datagrams are sequence numbered. When one goes missing (or the
+     * channel list is unknown, i.e after joining) a snapshot of the
+     * channels and their latest values is requested from the publisher
+     * and retried until it arrives, while later updates keep being applied.
+     * Values older than the one already held are never applied, so a
+     * snapshot racing newer updates can't move a channel backwards.
+     */
+    class multicast_receiver :
+            public std::enable_shared_from_this<multicast_receiver> {
+    public:
+        struct channel {
+            uint32_t id;
+            std::string uuid; // context uuid
+            std::vector<std::string> variable;
+            bool has_latest;
+            datapoint latest;
+        };
+    private:
+        io::io_context& ioc_;
+        boost::asio::ip::udp::endpoint group_;
+        boost::asio::ip::address interface_;
+        boost::asio::ip::udp::socket mcast_socket_;
+        // snapshots are requested from and come back to this
+        boost::asio::ip::udp::socket socket_;
+        boost::asio::ip::udp::endpoint publisher_;
+
+        std::string source_;
+        uint64_t expected_; // the next seq
+        std::map<uint32_t, channel> channels_;
+
+        bool need_snapshot_;
+        // of the snapshot being put together
+        uint64_t snapshot_seq_;
+        std::set<uint32_t> snapshot_parts_;
+        std::set<uint32_t> snapshot_channels_;
+        io::deadline_timer retry_timer_;
+        bool retry_scheduled_;
+
+        size_t drop_; // for testing
+        uint64_t received_;
+        uint64_t gaps_;
+        uint64_t missed_;
+        uint64_t snapshots_;
+    public:
+        // the interface to join the group on, unspecified for the default
+        multicast_receiver(io::io_context& ioc,
+                const boost::asio::ip::udp::endpoint& group,
+                const boost::asio::ip::address& interface = boost::asio::ip::address());
+
+        // joins the group, throws io_error if it can't
+        void start();
+        void stop();
+
+        // fired for every value applied, from updates and snapshots
+        signal<const channel&> update;
+
+        const std::map<uint32_t, channel>& get_channels() const { return channels_; }
+        const channel* find(const std::string& uuid,
+                            const std::vector<std::string>& variable) const;
+        // false until the first complete snapshot
+        bool synced() const { return !source_.empty() && !need_snapshot_; }
+
+        uint64_t received() const { return received_; } // datagrams
+        uint64_t gaps() const { return gaps_; }
+        uint64_t missed() const { return missed_; } // datagrams lost
+        uint64_t snapshots() const { return snapshots_; } // completed
+
+        // discards the next n datagrams, to test recovery
+        void drop_next(size_t n) { drop_ = n; }
+    private:
+        void handle(const api::McastDatagram& d, const boost::asio::ip::udp::endpoint& from);
+        void handle_snapshot(const api::McastDatagram& d);
+        void apply(const api::McastUpdate& u);
+        void request_snapshot();
+        void schedule_retry();
+    };
+    using multicast_receiver_ptr = std::shared_ptr<multicast_receiver>;
+}
+
+#endif
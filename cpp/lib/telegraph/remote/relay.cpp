@@ -0,0 +1,117 @@
+#include "relay.hpp"
+
+#include "../utils/errors.hpp"
+
+#include <iostream>
+
+#include <boost/asio/ip/address.hpp>
+
+namespace net = boost::asio;
+using tcp = boost::asio::ip::tcp;
+
+namespace telegraph {
+    relay::relay(io::io_context& ioc, const std::string_view& name, const params& p,
+                 const stream_connection_ptr& conn, const remote_namespace_ptr& remote)
+            : local_component(ioc, name, "relay", p),
+              conn_(conn), remote_(remote) {
+        // unmounts everything through the removed signal
+        conn_->closed.add(this, [this] () { remote_->close(); });
+    }
+
+    relay::~relay() {
+        conn_->closed.remove(this);
+        unmount();
+        conn_->close();
+    }
+
+    void
+    relay::reg(io::yield_ctx& yield, const std::shared_ptr<local_namespace>& ns) {
+        local_context::reg(yield, ns);
+        std::weak_ptr<local_namespace> wns = ns;
+        for (const auto& c : *remote_->contexts) ns->contexts->add_(c.second);
+        remote_->contexts->added.add(this, [wns] (const context_ptr& c) {
+            auto ns = wns.lock();
+            if (ns) ns->contexts->add_(c);
+        });
+        remote_->contexts->removed.add(this, [wns] (const context_ptr& c) {
+            auto ns = wns.lock();
+            if (ns) ns->contexts->remove_by_key_(c->get_uuid());
+        });
+    }
+
+    void
+    relay::unmount() {
+        remote_->contexts->added.remove(this);
+        remote_->contexts->removed.remove(this);
+        auto ns = ns_.lock();
+        if (!ns) return;
+        for (const auto& c : *remote_->contexts) {
+            // only if it is still the one we mounted
+            if (ns->contexts->get(c.first) == c.second)
+                ns->contexts->remove_by_key_(c.first);
+        }
+    }
+
+    void
+    relay::destroy(io::yield_ctx& yield) {
+        unmount();
+        conn_->closed.remove(this);
+        remote_->close();
+        conn_->close();
+        local_context::destroy(yield);
+    }
+
+    params_stream_ptr
+    relay::request(io::yield_ctx& yield, const params& p) {
+        if (!p.is_object()) return nullptr;
+        const std::string& type = p.at("type").get<std::string>();
+        if (type != "status") return nullptr;
+        params status = params::object();
+        status["connected"] = !remote_->is_closed();
+        status["contexts"] = (float) remote_->contexts->size();
+        params_stream_ptr res = std::make_shared<params_stream>();
+        res->write(std::move(status));
+        res->close();
+        return res;
+    }
+
+    local_component_ptr
+    relay::create(io::yield_ctx& yield, io::io_context& ioc,
+            const std::string_view& name, const std::string_view& type,
+            const params& p) {
+        auto args = p.to_map();
+        std::string host = "127.0.0.1";
+        unsigned short port = 8082;
+        std::string path;
+        auto it = args.find("host");
+        if (it != args.end()) host = it->second.get<std::string>();
+        it = args.find("port");
+        if (it != args.end()) port = (unsigned short) it->second.get<float>();
+        it = args.find("path");
+        if (it != args.end()) path = it->second.get<std::string>();
+
+        stream_connection_ptr conn;
+        try {
+            if (!path.empty()) {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+                conn = stream_connection::connect(yield, ioc, path);
+#else
+                return nullptr;
+#endif
+            } else {
+                boost::system::error_code ec;
+                auto addr = net::ip::make_address(host, ec);
+                if (ec) return nullptr;
+                conn = stream_connection::connect(yield, ioc, tcp::endpoint{addr, port});
+            }
+            conn->start();
+            auto remote = std::make_shared<remote_namespace>(ioc, conn);
+            remote->start(yield);
+            return std::make_shared<relay>(ioc, name, p, conn, remote);
+        } catch (const error& e) {
+            std::cerr << "relay: " << e.what() << std::endl;
+            if (conn) conn->close();
+            return nullptr;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef __TELEGRAPH_RELAY_HPP__
+#define __TELEGRAPH_RELAY_HPP__
+
+#include "../local/namespace.hpp"
+
+#include "stream_connection.hpp"
+#include "remote_namespace.hpp"
+
+#include <memory>
+#include <string_view>
+
+namespace telegraph {
+
+    /**
+     * Mounts the contexts of another server into the local namespace, so
+     * that i.e a garage server can serve what a trackside server sees.
+     * Connects to the stream_server of the other side, the contexts are
+     * remote_context's so every variable is only subscribed to once
+     * upstream however many clients subscribe here.
+     *
+     * Created with {host: "127.0.0.1", port: 8082} or {path: unix socket}.
+     * Supports {type: "status"}. Once the connection is lost the contexts
+     * are unmounted, the relay has to be created again to reconnect.
+     */
+    class relay : public local_component {
+    private:
+        stream_connection_ptr conn_;
+        remote_namespace_ptr remote_;
+    public:
+        relay(io::io_context& ioc, const std::string_view& name, const params& p,
+              const stream_connection_ptr& conn, const remote_namespace_ptr& remote);
+        ~relay();
+
+        // also mounts the remote contexts
+        void reg(io::yield_ctx& yield, const std::shared_ptr<local_namespace>& ns) override;
+        void destroy(io::yield_ctx& yield) override;
+
+        params_stream_ptr request(io::yield_ctx&, const params& p) override;
+
+        static local_component_ptr create(io::yield_ctx&, io::io_context& ioc,
+                const std::string_view& name, const std::string_view& type,
+                const params& p);
+    private:
+        void unmount();
+    };
+}
+
+#endif
@@ -0,0 +1,537 @@
+#include "remote_namespace.hpp"
+
+#include "connection.hpp"
+
+#include "../common/nodes.hpp"
+#include "../utils/errors.hpp"
+#include "../utils/io.hpp"
+
+#include <boost/uuid/uuid_io.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/asio/deadline_timer.hpp>
+
+#include <chrono>
+
+namespace telegraph {
+
+    static void
+    check_error(const api::Packet& res) {
+        if (res.payload_case() == api::Packet::kError)
+            throw remote_error(res.error());
+    }
+
+    // the path of a node as sent over the wire,
+    // which doesn't include the root
+    static std::vector<std::string>
+    wire_path(const node* n) {
+        std::vector<std::string> p = n->path();
+        p.erase(p.begin());
+        return p;
+    }
+
+    static std::string
+    join_path(const std::vector<std::string>& path) {
+        std::string key;
+        for (const auto& s : path) {
+            if (!key.empty()) key.push_back('/');
+            key.append(s);
+        }
+        return key;
+    }
+
+    remote_namespace::remote_namespace(io::io_context& ioc,
+                                       const std::shared_ptr<connection>& conn)
+        : namespace_(), ioc_(ioc), conn_(conn),
+          ns_stream_(0), streaming_(false), closed_(false) {}
+
+    remote_namespace::~remote_namespace() {
+        if (streaming_) conn_->close_stream(ns_stream_);
+    }
+
+    void
+    remote_namespace::start(io::yield_ctx& yield) {
+        if (streaming_ || closed_) return;
+        std::weak_ptr<remote_namespace> wp = shared_from_this();
+        api::Packet req;
+        req.mutable_query_ns();
+        api::Packet res = conn_->request_stream(yield, std::move(req),
+            [wp] (io::yield_ctx&, const api::Packet& p) {
+                auto sthis = wp.lock();
+                if (!sthis || sthis->closed_) return;
+                if (p.payload_case() == api::Packet::kAdded) {
+                    sthis->add(p.added());
+                } else if (p.payload_case() == api::Packet::kRemoved) {
+                    sthis->remove(boost::lexical_cast<uuid>(p.removed()));
+                }
+            });
+        ns_stream_ = res.req_id();
+        streaming_ = true;
+        check_error(res);
+        if (!res.has_ns()) throw remote_error("malformed response");
+        for (const auto& c : res.ns().contexts()) add(c);
+    }
+
+    void
+    remote_namespace::close() {
+        if (closed_) return;
+        closed_ = true;
+        if (streaming_) conn_->close_stream(ns_stream_);
+        streaming_ = false;
+        std::vector<uuid> uuids;
+        for (const auto& c : *contexts) uuids.push_back(c.first);
+        for (const auto& u : uuids) remove(u);
+    }
+
+    void
+    remote_namespace::add(const api::Context& c) {
+        uuid u = boost::lexical_cast<uuid>(c.uuid());
+        if (contexts->has(u)) return;
+        params p = params::unpack(c.params(), this);
+        contexts->add_(std::make_shared<remote_context>(ioc_, shared_from_this(),
+                        u, c.name(), c.type(), p, c.headless()));
+    }
+
+    void
+    remote_namespace::remove(const uuid& u) {
+        auto c = std::static_pointer_cast<remote_context>(contexts->get(u));
+        if (!c) return;
+        c->close();
+        contexts->remove_by_key_(u);
+    }
+
+    context_ptr
+    remote_namespace::create(io::yield_ctx& yield,
+                const std::string_view& name, const std::string_view& type,
+                const params& p) {
+        if (closed_) throw io_error("not connected");
+        api::Packet req;
+        api::Create* c = req.mutable_create();
+        c->set_name(std::string{name});
+        c->set_type(std::string{type});
+        p.pack(c->mutable_params());
+        api::Packet res = conn_->request_response(yield, std::move(req));
+        check_error(res);
+        if (res.payload_case() != api::Packet::kCreated) return nullptr;
+        uuid u = boost::lexical_cast<uuid>(res.created());
+
+        // the added packet is on another stream
+        // and may not have been handled yet
+        context_ptr ctx = contexts->get(u);
+        if (!ctx) {
+            io::deadline_timer timer(ioc_, boost::posix_time::seconds(1));
+            contexts->added.add(&timer, [&timer, &u] (const context_ptr& c) {
+                if (c->get_uuid() == u) timer.cancel();
+            });
+            boost::system::error_code ec;
+            timer.async_wait(yield.ctx[ec]);
+            contexts->added.remove(&timer);
+            ctx = contexts->get(u);
+        }
+        return ctx;
+    }
+
+    void
+    remote_namespace::destroy(io::yield_ctx& yield, const uuid& u) {
+        if (closed_) throw io_error("not connected");
+        api::Packet req;
+        req.set_destroy(boost::lexical_cast<std::string>(u));
+        api::Packet res = conn_->request_response(yield, std::move(req));
+        check_error(res);
+        if (!res.success()) throw remote_error("failed to destroy context");
+    }
+
+    remote_data_query::remote_data_query(const std::shared_ptr<connection>& conn,
+                                         int32_t req_id, value_type::type_class t)
+        : conn_(conn), req_id_(req_id), data_(t) {}
+
+    remote_data_query::~remote_data_query() {
+        auto c = conn_.lock();
+        if (!c) return;
+        api::Packet p;
+        p.set_cancel(0);
+        c->write_back(req_id_, std::move(p));
+        c->close_stream(req_id_);
+    }
+
+    void
+    remote_data_query::received(const api::DataPacket& p) {
+        if (p.data_size() == 0) return;
+        std::vector<datapoint> d;
+        d.reserve(p.data_size());
+        // archive timestamps are in milliseconds
+        for (const Datapoint& dp : p.data()) {
+            time_point t{std::chrono::milliseconds{dp.timestamp()}};
+            d.push_back(datapoint{t, value::unpack(dp.value())});
+        }
+        data_.append(d);
+        data(d);
+    }
+
+    remote_context::remote_context(io::io_context& ioc,
+                const std::shared_ptr<remote_namespace>& ns,
+                const uuid& u, const std::string_view& name,
+                const std::string_view& type, const params& p, bool headless)
+        : context(ioc, u, name, type, p, headless),
+          ns_(ns), tree_(), adapters_(), queries_() {}
+
+    std::shared_ptr<connection>
+    remote_context::conn() {
+        auto ns = ns_.lock();
+        if (!ns || ns->closed_) throw io_error("not connected");
+        return ns->conn_;
+    }
+
+    void
+    remote_context::close() {
+        std::unordered_map<std::string, std::shared_ptr<adapter_base>> adapters;
+        std::swap(adapters, adapters_);
+        for (auto& a : adapters) a.second->close();
+    }
+
+    std::shared_ptr<node>
+    remote_context::fetch(io::yield_ctx& yield) {
+        if (tree_) return tree_;
+        api::Packet req;
+        req.set_fetch_tree(boost::lexical_cast<std::string>(uuid_));
+        api::Packet res = conn()->request_response(yield, std::move(req));
+        check_error(res);
+        if (!res.has_fetched_tree()) return nullptr;
+        // someone else may have fetched it in the meantime
+        if (!tree_) {
+            tree_ = std::shared_ptr<node>(node::unpack(res.fetched_tree()));
+            tree_->set_owner(weak_from_this());
+        }
+        return tree_;
+    }
+
+    node*
+    remote_context::lookup(io::yield_ctx& yield, const std::vector<std::string_view>& path) {
+        auto tree = fetch(yield);
+        return tree ? tree->from_path(path) : nullptr;
+    }
+
+    subscription_ptr
+    remote_context::subscribe(io::yield_ctx& yield,
+                const std::vector<std::string_view>& path,
+                float min_interval, float max_interval, float timeout) {
+        auto v = dynamic_cast<variable*>(lookup(yield, path));
+        if (!v) return nullptr;
+        return subscribe(yield, v, min_interval, max_interval, timeout);
+    }
+
+    subscription_ptr
+    remote_context::subscribe(io::yield_ctx& yield, const variable* v,
+                float min_interval, float max_interval, float timeout) {
+        std::vector<std::string> path = wire_path(v);
+        std::string key = join_path(path);
+        auto it = adapters_.find(key);
+        if (it == adapters_.end()) {
+            // the upstream subscription stream
+            struct upstream {
+                bool open;
+                int32_t req_id;
+                // waiting for the reply to a change
+                io::deadline_timer* waiting;
+                bool success;
+            };
+            auto st = std::make_shared<upstream>(upstream{false, 0, nullptr, false});
+            auto wp = std::weak_ptr<remote_context>(
+                    std::static_pointer_cast<remote_context>(shared_from_this()));
+
+            auto received = [wp, st, key] (io::yield_ctx&, const api::Packet& p) {
+                if (!st->open || p.req_id() != st->req_id) return;
+                auto sthis = wp.lock();
+                if (!sthis) return;
+                switch (p.payload_case()) {
+                case api::Packet::kSubUpdate: {
+                    auto it = sthis->adapters_.find(key);
+                    if (it == sthis->adapters_.end()) return;
+                    // keep the time the value was sent with upstream
+                    time_point t{std::chrono::microseconds{p.sub_update().timestamp()}};
+                    it->second->update(t, value::unpack(p.sub_update().value()));
+                } break;
+                case api::Packet::kSuccess:
+                case api::Packet::kError:
+                    if (st->waiting) {
+                        st->success = p.payload_case() == api::Packet::kSuccess && p.success();
+                        st->waiting->cancel();
+                    }
+                    break;
+                case api::Packet::kCancel: {
+                    // cancelled upstream, so are all of ours
+                    st->open = false;
+                    auto ns = sthis->ns_.lock();
+                    if (ns) ns->conn_->close_stream(p.req_id());
+                    auto it = sthis->adapters_.find(key);
+                    if (it == sthis->adapters_.end()) return;
+                    auto a = it->second;
+                    sthis->adapters_.erase(it);
+                    a->close();
+                } break;
+                default: break;
+                }
+            };
+            auto change = [wp, st, path, received](io::yield_ctx& yield, float debounce,
+                            float refresh, float timeout) -> bool {
+                auto sthis = wp.lock();
+                if (!sthis) return false;
+                std::shared_ptr<connection> c;
+                try {
+                    c = sthis->conn();
+                } catch (const io_error&) {
+                    return false;
+                }
+                api::Packet req;
+                api::Subscription* s = req.mutable_sub_change();
+                s->set_debounce(debounce);
+                s->set_refresh(refresh);
+                s->set_timeout(timeout);
+                if (!st->open) {
+                    s->set_uuid(boost::lexical_cast<std::string>(sthis->get_uuid()));
+                    for (const auto& p : path) s->add_variable(p);
+                    api::Packet res;
+                    int32_t req_id = 0;
+                    try {
+                        res = c->request_stream(yield, std::move(req), received,
+                                                timeout + 1, &req_id);
+                    } catch (const io_error&) {
+                        // the subscription may still open upstream
+                        // after we gave up on it, so take it down
+                        api::Packet cancel;
+                        cancel.set_cancel(0);
+                        c->write_back(req_id, std::move(cancel));
+                        return false;
+                    }
+                    if (res.payload_case() != api::Packet::kSubType) {
+                        c->close_stream(res.req_id());
+                        return false;
+                    }
+                    st->open = true;
+                    st->req_id = res.req_id();
+                    return true;
+                }
+                // changes on an open stream are answered with success
+                io::deadline_timer timer(sthis->ioc_,
+                    boost::posix_time::milliseconds((long) (1000*(timeout + 1))));
+                st->waiting = &timer;
+                st->success = false;
+                c->write_back(st->req_id, std::move(req));
+                boost::system::error_code ec;
+                timer.async_wait(yield.ctx[ec]);
+                st->waiting = nullptr;
+                return ec == io::error::operation_aborted && st->success;
+            };
+            auto poll = [wp, st]() {
+                if (!st->open) return;
+                auto sthis = wp.lock();
+                if (!sthis) return;
+                auto ns = sthis->ns_.lock();
+                if (!ns || ns->closed_) return;
+                api::Packet p;
+                p.mutable_sub_poll();
+                ns->conn_->write_back(st->req_id, std::move(p));
+            };
+            auto cancel = [wp, st, key](io::yield_ctx& yield, float timeout) -> bool {
+                auto sthis = wp.lock();
+                if (!sthis) return false;
+                // keep the adapter alive for the duration of this
+                auto it = sthis->adapters_.find(key);
+                std::shared_ptr<adapter_base> a;
+                if (it != sthis->adapters_.end()) {
+                    a = it->second;
+                    sthis->adapters_.erase(it);
+                }
+                if (!st->open) return true;
+                st->open = false;
+                auto ns = sthis->ns_.lock();
+                if (!ns || ns->closed_) return true;
+                api::Packet p;
+                p.set_cancel(timeout);
+                ns->conn_->write_back(st->req_id, std::move(p));
+                ns->conn_->close_stream(st->req_id);
+                return true;
+            };
+            auto a = std::make_shared<adapter<decltype(poll), decltype(change), decltype(cancel)>>(
+                                ioc_, v->get_type(), poll, change, cancel);
+            it = adapters_.emplace(key, a).first;
+        }
+        // hold on to it, a failed subscribe may remove it from the map
+        auto a = it->second;
+        return a->subscribe(yield, min_interval, max_interval, timeout);
+    }
+
+    std::vector<subscription_ptr>
+    remote_context::subscribe_many(io::yield_ctx& yield,
+                const std::vector<std::vector<std::string_view>>& variables,
+                float min_interval, float max_interval, float timeout) {
+        return subscribe_concurrently(yield, variables.size(),
+            [&] (io::yield_ctx& c, size_t i) {
+                return subscribe(c, variables[i], min_interval, max_interval, timeout);
+            });
+    }
+
+    std::vector<subscription_ptr>
+    remote_context::subscribe_many(io::yield_ctx& yield,
+                const std::vector<const variable*>& variables,
+                float min_interval, float max_interval, float timeout) {
+        return subscribe_concurrently(yield, variables.size(),
+            [&] (io::yield_ctx& c, size_t i) -> subscription_ptr {
+                if (!variables[i]) return nullptr;
+                return subscribe(c, variables[i], min_interval, max_interval, timeout);
+            });
+    }
+
+    value
+    remote_context::call(io::yield_ctx& yield, action* a, value v, float timeout) {
+        std::vector<std::string> path = wire_path(a);
+        std::vector<std::string_view> p;
+        for (const auto& s : path) p.push_back(s);
+        return call(yield, p, v, timeout);
+    }
+
+    value
+    remote_context::call(io::yield_ctx& yield, const std::vector<std::string_view>& a,
+                         value v, float timeout) {
+        api::Packet req;
+        api::Call* c = req.mutable_call_action();
+        c->set_uuid(boost::lexical_cast<std::string>(uuid_));
+        for (const auto& s : a) c->add_action(std::string{s});
+        v.pack(c->mutable_value());
+        c->set_timeout(timeout);
+        api::Packet res = conn()->request_response(yield, std::move(req), timeout + 1);
+        check_error(res);
+        if (res.payload_case() != api::Packet::kCallReturn) return value::invalid();
+        return value::unpack(res.call_return().value());
+    }
+
+    bool
+    remote_context::write_data(io::yield_ctx& yield, variable* v,
+                               const std::vector<datapoint>& data) {
+        std::vector<std::string> path = wire_path(v);
+        std::vector<std::string_view> p;
+        for (const auto& s : path) p.push_back(s);
+        return write_data(yield, p, data);
+    }
+
+    bool
+    remote_context::write_data(io::yield_ctx& yield, const std::vector<std::string_view>& var,
+                               const std::vector<datapoint>& data) {
+        api::Packet req;
+        api::DataWrite* w = req.mutable_data_write();
+        w->set_uuid(boost::lexical_cast<std::string>(uuid_));
+        for (const auto& s : var) w->add_path(std::string{s});
+        for (const datapoint& dp : data) {
+            Datapoint* d = w->add_data();
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        dp.get_time().time_since_epoch());
+            d->set_timestamp((uint64_t) ms.count());
+            dp.get_value().pack(d->mutable_value());
+        }
+        api::Packet res = conn()->request_response(yield, std::move(req));
+        check_error(res);
+        return res.success();
+    }
+
+    data_query_ptr
+    remote_context::query_data(io::yield_ctx& yield, const std::vector<std::string_view>& path) {
+        auto v = dynamic_cast<variable*>(lookup(yield, path));
+        if (!v) return nullptr;
+        return query_data(yield, v);
+    }
+
+    data_query_ptr
+    remote_context::query_data(io::yield_ctx& yield, const variable* v) {
+        std::vector<std::string> path = wire_path(v);
+        std::string key = join_path(path);
+        auto it = queries_.find(key);
+        if (it != queries_.end()) {
+            auto q = it->second.lock();
+            if (q) return q;
+            queries_.erase(it);
+        }
+        auto c = conn();
+        api::Packet req;
+        api::DataQuery* dq = req.mutable_data_query();
+        dq->set_uuid(boost::lexical_cast<std::string>(uuid_));
+        for (const auto& s : path) dq->add_path(s);
+
+        // without a range everything stored is streamed
+        // back, followed by the live data
+        auto holder = std::make_shared<std::weak_ptr<remote_data_query>>();
+        std::weak_ptr<connection> wc = c;
+        api::Packet res = c->request_stream(yield, std::move(req),
+            [holder, wc] (io::yield_ctx&, const api::Packet& p) {
+                if (p.payload_case() == api::Packet::kArchiveUpdate) {
+                    auto q = holder->lock();
+                    if (q) q->received(p.archive_update());
+                } else if (p.payload_case() == api::Packet::kCancel) {
+                    auto c = wc.lock();
+                    if (c) c->close_stream(p.req_id());
+                }
+            });
+        if (res.payload_case() != api::Packet::kArchiveData) {
+            c->close_stream(res.req_id());
+            check_error(res);
+            return nullptr;
+        }
+        auto q = std::make_shared<remote_data_query>(c, res.req_id(),
+                                    v->get_type().get_class());
+        q->received(res.archive_data());
+        *holder = q;
+        // the query may have been made by someone else in the meantime,
+        // in which case this one is just dropped
+        queries_[key] = q;
+        return q;
+    }
+
+    params_stream_ptr
+    remote_context::request(io::yield_ctx& yield, const params& p) {
+        auto c = conn();
+        api::Packet req;
+        api::Request* r = req.mutable_request();
+        r->set_uuid(boost::lexical_cast<std::string>(uuid_));
+        p.pack(r->mutable_params());
+
+        auto holder = std::make_shared<std::weak_ptr<params_stream>>();
+        std::weak_ptr<connection> wc = c;
+        std::weak_ptr<remote_namespace> wns = ns_;
+        api::Packet res = c->request_stream(yield, std::move(req),
+            [holder, wc, wns] (io::yield_ctx&, const api::Packet& p) {
+                if (p.payload_case() == api::Packet::kRequestUpdate) {
+                    auto s = holder->lock();
+                    auto ns = wns.lock();
+                    if (s) s->write(params::unpack(p.request_update(), ns.get()));
+                } else if (p.payload_case() == api::Packet::kCancel) {
+                    auto c = wc.lock();
+                    if (c) c->close_stream(p.req_id());
+                    auto s = holder->lock();
+                    if (s) s->close();
+                }
+            });
+        int32_t req_id = res.req_id();
+        if (res.payload_case() != api::Packet::kSuccess || !res.success()) {
+            c->close_stream(req_id);
+            check_error(res);
+            return nullptr;
+        }
+        auto s = std::make_shared<params_stream>();
+        *holder = s;
+        // let upstream know once nobody is listening
+        s->destroyed.add(s.get(), [wc, req_id] () {
+            auto c = wc.lock();
+            if (!c) return;
+            api::Packet cancel;
+            cancel.set_cancel(0);
+            c->write_back(req_id, std::move(cancel));
+            c->close_stream(req_id);
+        });
+        return s;
+    }
+
+    void
+    remote_context::destroy(io::yield_ctx& yield) {
+        auto ns = ns_.lock();
+        if (!ns) return;
+        ns->destroy(yield, uuid_);
+    }
+}
@@ -0,0 +1,152 @@
+#ifndef __TELEGRAPH_REMOTE_NAMESPACE_HPP__
+#define __TELEGRAPH_REMOTE_NAMESPACE_HPP__
+
+#include "../utils/io_fwd.hpp"
+#include "../common/namespace.hpp"
+#include "../common/adapter.hpp"
+#include "../local/series.hpp"
+
+#include "api.pb.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace telegraph {
+    class connection;
+    class remote_context;
+    using remote_context_ptr = std::shared_ptr<remote_context>;
+
+    /**
+     * The contexts of another server, over a connection to it
+     * (see stream_connection::connect()). Kept up to date with the
+     * contexts added and removed there until close() is called.
+     */
+    class remote_namespace :
+            public std::enable_shared_from_this<remote_namespace>,
+            public namespace_ {
+        friend class remote_context;
+    private:
+        io::io_context& ioc_;
+        std::shared_ptr<connection> conn_;
+        int32_t ns_stream_; // the added/removed contexts
+        bool streaming_;
+        bool closed_;
+    public:
+        remote_namespace(io::io_context& ioc, const std::shared_ptr<connection>& conn);
+        ~remote_namespace();
+
+        // queries the contexts, throws io_error or remote_error on failure
+        void start(io::yield_ctx& yield);
+        // removes all contexts and cancels their subscriptions,
+        // i.e once the connection has closed
+        void close();
+        bool is_closed() const { return closed_; }
+
+        const std::shared_ptr<connection>& get_connection() const { return conn_; }
+
+        context_ptr create(io::yield_ctx& yield,
+                    const std::string_view& name, const std::string_view& type,
+                    const params& p) override;
+
+        void destroy(io::yield_ctx& yield, const uuid& u) override;
+    private:
+        void add(const api::Context& c);
+        void remove(const uuid& u);
+    };
+    using remote_namespace_ptr = std::shared_ptr<remote_namespace>;
+
+    // the data of a remote query, kept locally so
+    // ranges can be downsampled without going upstream
+    class remote_data_query : public data_query {
+    private:
+        std::weak_ptr<connection> conn_;
+        int32_t req_id_;
+        series data_;
+    public:
+        remote_data_query(const std::shared_ptr<connection>& conn,
+                          int32_t req_id, value_type::type_class t);
+        ~remote_data_query();
+
+        std::vector<datapoint> get_current() const override { return data_.decode(); }
+        std::vector<datapoint> get_range(time_point begin, time_point end,
+                            size_t points, downsample d) const override {
+            return data_.query(begin, end, points, d);
+        }
+        data_cursor_ptr get_backlog() const override { return data_.snapshot(); }
+
+        void received(const api::DataPacket& p);
+    };
+
+    /**
+     * A context of a remote_namespace. Subscriptions to the same variable
+     * share a single upstream subscription at the smallest requested
+     * intervals, and data queries of the same variable share one
+     * upstream query while any of them is alive, so a relay with many
+     * viewers only costs the upstream link one of each.
+     */
+    class remote_context : public context {
+        friend class remote_namespace;
+    private:
+        std::weak_ptr<remote_namespace> ns_;
+        std::shared_ptr<node> tree_;
+        // by path, joined with '/'
+        std::unordered_map<std::string, std::shared_ptr<adapter_base>> adapters_;
+        std::unordered_map<std::string, std::weak_ptr<remote_data_query>> queries_;
+    public:
+        remote_context(io::io_context& ioc, const std::shared_ptr<remote_namespace>& ns,
+                       const uuid& u, const std::string_view& name,
+                       const std::string_view& type, const params& p, bool headless);
+
+        std::shared_ptr<namespace_> get_namespace() override { return ns_.lock(); }
+        std::shared_ptr<const namespace_> get_namespace() const override { return ns_.lock(); }
+
+        params_stream_ptr request(io::yield_ctx&, const params& p) override;
+
+        // fetched once, then cached
+        std::shared_ptr<node> fetch(io::yield_ctx& yield) override;
+
+        subscription_ptr subscribe(io::yield_ctx& yield,
+                                const std::vector<std::string_view>& variable,
+                                float min_interval, float max_interval,
+                                float timeout) override;
+        subscription_ptr subscribe(io::yield_ctx& yield,
+                                const variable* v,
+                                float min_interval, float max_interval,
+                                float timeout) override;
+        // the upstream requests are all in flight at once
+        std::vector<subscription_ptr> subscribe_many(io::yield_ctx& yield,
+                                const std::vector<std::vector<std::string_view>>& variables,
+                                float min_interval, float max_interval,
+                                float timeout) override;
+        std::vector<subscription_ptr> subscribe_many(io::yield_ctx& yield,
+                                const std::vector<const variable*>& variables,
+                                float min_interval, float max_interval,
+                                float timeout) override;
+
+        value call(io::yield_ctx& yield, action* a, value v, float timeout) override;
+        value call(io::yield_ctx& yield, const std::vector<std::string_view>& a,
+                                    value v, float timeout) override;
+
+        bool write_data(io::yield_ctx& yield, variable* v,
+                                    const std::vector<datapoint>& data) override;
+        bool write_data(io::yield_ctx& yield, const std::vector<std::string_view>& var,
+                                    const std::vector<datapoint>& data) override;
+
+        data_query_ptr query_data(io::yield_ctx& yield, const variable* v) override;
+        data_query_ptr query_data(io::yield_ctx& yield, const std::vector<std::string_view>& v) override;
+
+        void destroy(io::yield_ctx& yield) override;
+    private:
+        // throws io_error if the namespace is closed
+        std::shared_ptr<connection> conn();
+        // the node at path in the fetched tree, nullptr if there is none
+        node* lookup(io::yield_ctx& yield, const std::vector<std::string_view>& path);
+        // cancels all subscriptions
+        void close();
+    };
+}
+
+#endif
@@ -2,6 +2,14 @@
 
 #include "../utils/errors.hpp"
 
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
 #include <boost/asio/strand.hpp>
 #include <boost/asio/dispatch.hpp>
 
@@ -10,12 +18,41 @@ namespace net = boost::asio;
 namespace beast = boost::beast;
 namespace http = beast::http;
 namespace websocket = beast::websocket;
+using wire = google::protobuf::internal::WireFormatLite;
+using coded = google::protobuf::io::CodedOutputStream;
 
 namespace telegraph {
+    // a frame is closed once it holds this many bytes
+    static constexpr size_t max_frame_size = 256*1024;
+    // seconds between per-client write stats
+    static constexpr long stats_interval = 10;
+    // capacities of the queues between a shard and the server's context,
+    // which start out small and only grow as far as a client needs.
+    // A client whose outbox fills up is treated like any other slow client
+    static constexpr size_t outbox_size = 16384;
+    static constexpr size_t inbox_size = 1024;
+
+    // frames are encoded by hand, see do_write_next()
+    static const uint32_t req_id_tag = wire::MakeTag(
+            api::Packet::kReqIdFieldNumber, wire::WIRETYPE_VARINT);
+    static const uint32_t batch_tag = wire::MakeTag(
+            api::Packet::kBatchFieldNumber, wire::WIRETYPE_LENGTH_DELIMITED);
+    static const uint32_t packets_tag = wire::MakeTag(
+            api::Batch::kPacketsFieldNumber, wire::WIRETYPE_LENGTH_DELIMITED);
+
     server::server(io::io_context& ioc, tcp::endpoint ep, 
-            const std::shared_ptr<namespace_>& local) 
+            const std::shared_ptr<namespace_>& local,
+            float max_lag, size_t max_queue, size_t max_concurrent,
+            bool log_stats) 
         : ioc_(ioc), ep_(ep),
-          local_(local) {}
+          local_(local), max_lag_(max_lag), max_queue_(max_queue),
+          max_concurrent_(max_concurrent), log_stats_(log_stats),
+          shards_{&ioc}, next_shard_(0) {}
+
+    void
+    server::add_shard(io::io_context& shard) {
+        shards_.push_back(&shard);
+    }
 
     void
     server::run(io::yield_ctx& cyield) {
@@ -38,27 +75,170 @@ namespace telegraph {
         if (ec) throw io_error("failed to listen to server socket");
 
         while (true) {
+            io::io_context& shard = *shards_[next_shard_];
             // create a socket with its own strand
-            tcp::socket socket(net::make_strand(ioc_));
+            tcp::socket socket(net::make_strand(shard));
             acceptor.async_accept(socket, yield[ec]);
+            if (ec) continue;
+            next_shard_ = (next_shard_ + 1) % shards_.size();
             // we have a socket!
             // create a connection
-            std::shared_ptr<remote> conn = std::make_shared<remote>(ioc_, std::move(socket), local_);
-            conn->do_accept(); // will start the connection handling
+            std::shared_ptr<remote> conn;
+            if (&shard == &ioc_) {
+                conn = std::make_shared<remote>(ioc_, shard, std::move(socket), local_,
+                                                max_lag_, max_queue_, max_concurrent_,
+                                                log_stats_);
+            } else {
+                // the forwarder has to be torn down on our thread
+                conn = std::shared_ptr<remote>(
+                    new remote(ioc_, shard, std::move(socket), local_,
+                               max_lag_, max_queue_, max_concurrent_, log_stats_),
+                    [&ioc = ioc_] (remote* r) { net::post(ioc, [r] () { delete r; }); });
+            }
+            // will start the connection handling
+            net::post(shard, [conn] () { conn->do_accept(); });
         }
     }
 
-    server::remote::remote(io::io_context& ioc,
+    server::remote::remote(io::io_context& ioc, io::io_context& shard,
             tcp::socket&& socket, 
-            const std::shared_ptr<namespace_>& local) 
-        : connection(ioc, true), local_fwd_(*this, local),
-          ws_(std::move(socket)) {}
+            const std::shared_ptr<namespace_>& local,
+            float max_lag, size_t max_queue, size_t max_concurrent,
+            bool log_stats) 
+        : connection(ioc, true, max_concurrent), local_fwd_(*this, local),
+          shard_(shard), sharded_(&ioc != &shard),
+          outbox_(sharded_ ? outbox_size : 1), inbox_(sharded_ ? inbox_size : 1),
+          outbox_posted_(false), inbox_posted_(false), reading_(true),
+          overflowed_(false), write_queued_(0), inbox_timer_(ioc),
+          ws_(std::move(socket)), write_queue_(), queue_base_(0),
+          pending_updates_(), write_buf_(), frame_sizes_(), writing_(false),
+          frame_time_(), max_lag_(max_lag), max_queue_(max_queue), closed_(false),
+          log_stats_(log_stats), frames_(0), packets_(0), bytes_(0), conflated_(0), worst_lag_(0),
+          stats_timer_(shard) {}
+
+    size_t
+    server::remote::queued_packet::encoded_size() const {
+        if (!update) return packet.ByteSizeLong();
+        size_t size = update->field().size();
+        if (packet.req_id() != 0) {
+            size += coded::VarintSize32(req_id_tag) +
+                    coded::VarintSize32(wire::ZigZagEncode32(packet.req_id()));
+        }
+        return size;
+    }
+
+    uint8_t*
+    server::remote::queued_packet::encode(uint8_t* out) const {
+        // relies on the sizes cached by encoded_size()
+        if (!update) return packet.SerializeWithCachedSizesToArray(out);
+        if (packet.req_id() != 0) {
+            out = coded::WriteVarint32ToArray(req_id_tag, out);
+            out = coded::WriteVarint32ToArray(wire::ZigZagEncode32(packet.req_id()), out);
+        }
+        const std::string& f = update->field();
+        std::memcpy(out, f.data(), f.size());
+        return out + f.size();
+    }
 
     void
     server::remote::send(api::Packet&& p) {
-        write_queue_.emplace_back(std::move(p));
-        if (write_queue_.size() > 1) return;
+        post(queued_packet{std::move(p), nullptr, clock::time_point()});
+    }
+
+    void
+    server::remote::send_update(int32_t req_id, const shared_update_ptr& u) {
+        queued_packet q{api::Packet(), u, clock::time_point()};
+        q.packet.set_req_id(req_id);
+        post(std::move(q));
+    }
+
+    void
+    server::remote::post(queued_packet&& q) {
+        if (!sharded_) {
+            enqueue(std::move(q));
+            return;
+        }
+        if (!outbox_.push(std::move(q))) overflowed_ = true;
+        if (!outbox_posted_.exchange(true)) {
+            net::post(shard_, [s = shared_from_this()] () { s->drain_outbox(); });
+        }
+    }
+
+    void
+    server::remote::drain_outbox() {
+        // anything pushed after this will post again
+        outbox_posted_ = false;
+        queued_packet q;
+        while (outbox_.pop(q)) enqueue(std::move(q));
+        if (overflowed_ && !closed_) {
+            std::cerr << "disconnecting slow client: outbox overflowed" << std::endl;
+            disconnect();
+        }
+    }
+
+    void
+    server::remote::update_queued() {
+        write_queued_ = write_queue_.size() + (writing_ ? 1 : 0);
+    }
+
+    void
+    server::remote::enqueue(queued_packet&& q) {
+        if (!check_lag()) return;
+        if (q.is_update()) {
+            int32_t req_id = q.packet.req_id();
+            // only the latest value of a subscription is worth sending
+            auto it = pending_updates_.find(req_id);
+            if (it != pending_updates_.end()) {
+                // keeps the time it was first queued
+                queued_packet& queued = write_queue_[it->second - queue_base_];
+                queued.packet = std::move(q.packet);
+                queued.update = std::move(q.update);
+                conflated_++;
+                return;
+            }
+            pending_updates_.emplace(req_id, queue_base_ + write_queue_.size());
+        }
+        q.time = clock::now();
+        write_queue_.push_back(std::move(q));
         do_write_next();
+        update_queued();
+    }
+
+    float
+    server::remote::lag() const {
+        clock::time_point oldest;
+        if (writing_) oldest = frame_time_;
+        else if (!write_queue_.empty()) oldest = write_queue_.front().time;
+        else return 0;
+        return std::chrono::duration<float>(clock::now() - oldest).count();
+    }
+
+    bool
+    server::remote::check_lag() {
+        if (closed_) return false;
+        float l = lag();
+        worst_lag_ = std::max(worst_lag_, l);
+        if ((max_lag_ > 0 && l > max_lag_) ||
+                (max_queue_ > 0 && write_queue_.size() > max_queue_)) {
+            beast::error_code ec;
+            auto ep = beast::get_lowest_layer(ws_).socket().remote_endpoint(ec);
+            std::cerr << "disconnecting slow client " << ep << ": "
+                      << l << "s behind, " << write_queue_.size() << " packets queued" << std::endl;
+            disconnect();
+            return false;
+        }
+        return true;
+    }
+
+    void
+    server::remote::disconnect() {
+        closed_ = true;
+        write_queue_.clear();
+        pending_updates_.clear();
+        update_queued();
+        stats_timer_.cancel();
+        // fails the pending read/write, which ends the connection
+        beast::get_lowest_layer(ws_).close();
     }
 
     void
@@ -83,7 +263,9 @@ namespace telegraph {
         if (ec) {
             std::cerr << "error accepting client connection" << std::endl;
         } else {
+            if (sharded_) start_dispatching();
             start_reading();
+            schedule_stats();
         }
     }
 
@@ -93,12 +275,13 @@ namespace telegraph {
         io::spawn(ws_.get_executor(), [s] (io::yield_context yield) {
             io::yield_ctx cyield(yield);
 
-            io::streambuf read_buf;
+            // frames are parsed straight out of the contiguous buffer. The
+            // packet is reused, so its strings and repeated fields keep
+            // their allocations from one message to the next
+            beast::flat_buffer read_buf;
             api::Packet read_packet;
 
-            int i = 0;
             while (true) {
-                i++;
                 beast::error_code ec;
                 s->ws_.async_read(read_buf, yield[ec]);
 
@@ -108,36 +291,160 @@ namespace telegraph {
                     std::cerr << "error: " << ec.message() << " " << ec << std::endl;
                 }
                 if (ec) break;
-                {
-                    std::istream input_stream(&read_buf);
-                    read_packet.ParseFromIstream(&input_stream);
-                }
-                // should be no bytes left but just in case
+                bool parsed = read_packet.ParseFromArray(
+                        read_buf.data().data(), (int) read_buf.size());
                 read_buf.consume(read_buf.size());
-                // handle the packets synchronously
-                // for now (TODO: Switch to parallel handling)
-                s->received(cyield, read_packet);
+                if (!parsed) {
+                    std::cerr << "malformed packet from client" << std::endl;
+                    continue;
+                }
+                if (!s->sharded_) {
+                    // each request is handled in its own task, this only
+                    // blocks once too many are in progress
+                    s->dispatch(cyield, std::move(read_packet), s);
+                    continue;
+                }
+                // hand it over to the connection's context,
+                // backing off while that is behind
+                while (!s->inbox_.push(std::move(read_packet))) {
+                    s->notify_inbox();
+                    io::deadline_timer backoff(s->shard_, boost::posix_time::milliseconds(1));
+                    backoff.async_wait(yield[ec]);
+                }
+                s->notify_inbox();
+            }
+            s->reading_ = false;
+            s->notify_inbox();
+        });
+    }
+
+    void
+    server::remote::notify_inbox() {
+        if (inbox_posted_.exchange(true)) return;
+        net::post(get_io_context(), [s = shared_from_this()] () { s->inbox_timer_.cancel(); });
+    }
+
+    void
+    server::remote::start_dispatching() {
+        auto s = shared_from_this();
+        io::spawn(get_io_context(), [s] (io::yield_context yield) {
+            io::yield_ctx cyield(yield);
+            api::Packet p;
+            while (true) {
+                s->inbox_posted_ = false;
+                // everything pushed before the reader finished is in the queue
+                bool done = !s->reading_;
+                bool any = false;
+                while (s->inbox_.pop(p)) {
+                    s->dispatch(cyield, std::move(p), s);
+                    any = true;
+                }
+                if (done) break;
+                // dispatch() may have suspended, so a notification could
+                // have been swallowed. Only sleep after a pass that didn't
+                if (any) continue;
+                boost::system::error_code ec;
+                s->inbox_timer_.expires_at(boost::posix_time::ptime(boost::posix_time::pos_infin));
+                s->inbox_timer_.async_wait(yield[ec]);
             }
         });
     }
 
     void
     server::remote::do_write_next() {
-        if (write_queue_.size() == 0) return;
-        auto p = std::move(write_queue_.front());
-        {
-            std::ostream output_stream(&write_buf_);
-            p.SerializeToOstream(&output_stream);
-            output_stream.flush();
+        if (writing_ || write_queue_.size() == 0) return;
+        // everything queued up goes out as a single
+        // frame, up to max_frame_size
+        size_t n = 0;
+        size_t size = 0;
+        frame_time_ = write_queue_.front().time;
+        if (write_queue_.size() == 1) {
+            n = 1;
+            size = write_queue_.front().encoded_size();
+            write_buf_.resize(size);
+            write_queue_.front().encode(write_buf_.data());
+        } else {
+            // a Packet with a Batch of all of them, written out by
+            // hand so that shared updates can be copied in as they are
+            frame_sizes_.clear();
+            size_t batch_size = 0;
+            for (; n < write_queue_.size() && (n == 0 || batch_size < max_frame_size); n++) {
+                size_t s = write_queue_[n].encoded_size();
+                frame_sizes_.push_back(s);
+                batch_size += coded::VarintSize32(packets_tag) +
+                              coded::VarintSize32((uint32_t) s) + s;
+            }
+            size = coded::VarintSize32(batch_tag) +
+                   coded::VarintSize32((uint32_t) batch_size) + batch_size;
+            write_buf_.resize(size);
+            uint8_t* out = write_buf_.data();
+            out = coded::WriteVarint32ToArray(batch_tag, out);
+            out = coded::WriteVarint32ToArray((uint32_t) batch_size, out);
+            for (size_t i = 0; i < n; i++) {
+                out = coded::WriteVarint32ToArray(packets_tag, out);
+                out = coded::WriteVarint32ToArray((uint32_t) frame_sizes_[i], out);
+                out = write_queue_[i].encode(out);
+            }
         }
+        // updates in this frame can't be replaced anymore
+        for (auto it = pending_updates_.begin(); it != pending_updates_.end();) {
+            if (it->second < queue_base_ + n) it = pending_updates_.erase(it);
+            else it++;
+        }
+        write_queue_.erase(write_queue_.begin(), write_queue_.begin() + n);
+        queue_base_ += n;
+        writing_ = true;
+        update_queued();
+        frames_++;
+        packets_ += n;
+        bytes_ += size;
 
         auto shared = shared_from_this();
-        ws_.async_write(write_buf_.data(),
+        ws_.async_write(net::buffer(write_buf_),
                 [shared] (const boost::system::error_code& ec, size_t transferred) {
-                    shared->write_buf_.consume(transferred);
-                    shared->write_queue_.pop_front();
-                    if (ec) return;
-                    shared->do_write_next();
+                    shared->worst_lag_ = std::max(shared->worst_lag_, std::chrono::duration<float>(
+                                            clock::now() - shared->frame_time_).count());
+                    shared->writing_ = false;
+                    if (!ec) shared->do_write_next();
+                    shared->update_queued();
+                    if (shared->sharded_) {
+                        net::post(shared->get_io_context(), [shared] () { shared->on_written(); });
+                    } else {
+                        shared->on_written();
+                    }
                 });
     }
+
+    void
+    server::remote::schedule_stats() {
+        stats_timer_.expires_from_now(boost::posix_time::seconds(stats_interval));
+        std::weak_ptr<remote> w = shared_from_this();
+        stats_timer_.async_wait([w] (const boost::system::error_code& ec) {
+            if (ec) return;
+            auto s = w.lock();
+            if (!s) return;
+            // also catches clients that stopped reading altogether
+            if (!s->check_lag()) return;
+            if (s->log_stats_ && (s->frames_ > 0 || s->queued() > 0)) {
+                beast::error_code eec;
+                auto ep = beast::get_lowest_layer(s->ws_).socket().remote_endpoint(eec);
+                // built up front so lines from different shards don't interleave
+                std::ostringstream line;
+                line << "client " << ep << ": "
+                     << (float) s->frames_ / stats_interval << " frames/s, "
+                     << (float) s->packets_ / stats_interval << " packets/s, "
+                     << (float) s->bytes_ / stats_interval / 1024 << " kB/s, "
+                     << s->conflated_ << " updates conflated, "
+                     << s->queued() << " queued, "
+                     << "lag " << s->worst_lag_ * 1000 << " ms max\n";
+                std::cout << line.str() << std::flush;
+            }
+            s->frames_ = 0;
+            s->packets_ = 0;
+            s->bytes_ = 0;
+            s->conflated_ = 0;
+            s->worst_lag_ = 0;
+            s->schedule_stats();
+        });
+    }
 }
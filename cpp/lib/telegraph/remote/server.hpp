@@ -8,12 +8,16 @@
 #include "connection.hpp"
 #include "forwarder.hpp"
 #include "../common/namespace.hpp"
+#include "../utils/spsc_queue.hpp"
 
 #include <unordered_map>
 #include <memory>
 #include <deque>
+#include <vector>
+#include <chrono>
+#include <atomic>
 
-#include <boost/asio/streambuf.hpp>
+#include <boost/asio/deadline_timer.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 
@@ -24,35 +28,143 @@ namespace telegraph {
         io::io_context& ioc_;
         boost::asio::ip::tcp::endpoint ep_;
         std::shared_ptr<namespace_> local_;
+        float max_lag_;
+        size_t max_queue_;
+        size_t max_concurrent_;
+        bool log_stats_;
+        // contexts clients are handed out to, round robin
+        std::vector<io::io_context*> shards_;
+        size_t next_shard_;
     public:
+        /**
+         * A websocket client. The connection and forwarder belong to the
+         * server's context (which owns the namespace), while the socket may
+         * be run by a different shard context on another thread. Packets then
+         * cross between the two through lock-free queues.
+         */
         class remote : 
             public std::enable_shared_from_this<remote>,
             public connection {
         private:
             forwarder local_fwd_;
+            io::io_context& shard_;
+            bool sharded_; // shard_ is not the connection's context
+
+            using clock = std::chrono::steady_clock;
+            struct queued_packet {
+                // for a shared update only the req_id is set
+                api::Packet packet;
+                shared_update_ptr update;
+                clock::time_point time; // when it was queued
+
+                bool is_update() const {
+                    return update || packet.payload_case() == api::Packet::kSubUpdate;
+                }
+                // encoded as a Packet, encode() has to come after
+                // encoded_size() and returns the end of what it wrote
+                size_t encoded_size() const;
+                uint8_t* encode(uint8_t* out) const;
+            };
+
+            // packets to be written, pushed by the connection's thread
+            spsc_queue<queued_packet> outbox_;
+            // packets read, pushed by the shard
+            spsc_queue<api::Packet> inbox_;
+            // whether a handler to drain the queue has been posted already
+            std::atomic<bool> outbox_posted_;
+            std::atomic<bool> inbox_posted_;
+            std::atomic<bool> reading_;
+            std::atomic<bool> overflowed_; // outbox_ was full
+            // packets queued on the shard, for queued()
+            std::atomic<size_t> write_queued_;
+            // wakes up the task dispatching inbox_
+            io::deadline_timer inbox_timer_;
+
             boost::beast::websocket::stream<
                 boost::beast::tcp_stream> ws_;
 
-            std::deque<api::Packet> write_queue_;
-            io::streambuf write_buf_;
+            std::deque<queued_packet> write_queue_;
+            // sequence number of write_queue_.front()
+            uint64_t queue_base_;
+            // sequence numbers of the sub_updates still in the queue, by req_id.
+            // A newer update for the same subscription replaces the queued one
+            std::unordered_map<int32_t, uint64_t> pending_updates_;
+
+            // the frame being written, reused between writes
+            std::vector<uint8_t> write_buf_;
+            std::vector<size_t> frame_sizes_; // of the packets in it
+            bool writing_;
+            clock::time_point frame_time_; // of the oldest packet in the frame
+
+            // slow consumer policy: disconnect once the oldest unwritten
+            // packet is older than max_lag_ seconds (0 to never disconnect)
+            // or more than max_queue_ packets are waiting
+            float max_lag_;
+            size_t max_queue_;
+            bool closed_;
+
+            // totals since the last stats report, which
+            // is only printed if log_stats_ is set
+            bool log_stats_;
+            size_t frames_;
+            size_t packets_;
+            size_t bytes_;
+            size_t conflated_;
+            float worst_lag_;
+            io::deadline_timer stats_timer_;
         public:
-            remote(io::io_context& ioc,
+            // the socket has to belong to shard
+            remote(io::io_context& ioc, io::io_context& shard,
                    boost::asio::ip::tcp::socket&& socket, 
-                   const std::shared_ptr<namespace_>& local);
+                   const std::shared_ptr<namespace_>& local,
+                   float max_lag, size_t max_queue, size_t max_concurrent,
+                   bool log_stats);
 
+            // to be called from the connection's context
             void send(api::Packet&& p) override;
+            // splices the shared encoding into the frame
+            void send_update(int32_t req_id, const shared_update_ptr& u) override;
+            // the frame in flight counts as one
+            size_t queued() const override { return outbox_.size() + write_queued_; }
+
+            // age in seconds of the oldest packet not yet written out
+            float lag() const;
 
             void do_accept();
         private:
             void on_accept(boost::beast::error_code ec);
 
             void start_reading();
+            void start_dispatching();
+            void notify_inbox();
+
+            // hands the packet to the shard
+            void post(queued_packet&& q);
+            // shard side of send()
+            void enqueue(queued_packet&& q);
+            void drain_outbox();
+            void update_queued();
             void do_write_next();
+            void schedule_stats();
+            // drops the client if it can't keep up
+            bool check_lag();
+            void disconnect();
         };
 
+        // clients lagging more than max_lag seconds or with more than
+        // max_queue packets waiting to be written are disconnected.
+        // Each client can have max_concurrent requests in progress.
+        // With log_stats the write rates of every client are printed periodically
         server(io::io_context& ioc, 
             boost::asio::ip::tcp::endpoint ep,
-            const std::shared_ptr<namespace_>& local);
+            const std::shared_ptr<namespace_>& local,
+            float max_lag=30, size_t max_queue=65536,
+            size_t max_concurrent=128, bool log_stats=false);
+
+        // clients are spread over the shards (plus ioc), which should
+        // each be run on a thread of their own. The namespace and its
+        // contexts stay on ioc. Must be called before run()
+        void add_shard(io::io_context& shard);
 
         // will handle exceptions
         void run(io::yield_ctx& yield);
@@ -0,0 +1,220 @@
+#include "stream_connection.hpp"
+
+#include "../utils/errors.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/asio/write.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+namespace net = boost::asio;
+using tcp = boost::asio::ip::tcp;
+using wire = google::protobuf::internal::WireFormatLite;
+using coded = google::protobuf::io::CodedOutputStream;
+
+namespace telegraph {
+    // kernel buffer sizes, large so bulk transfers don't stall
+    static constexpr int socket_buffer_size = 4*1024*1024;
+    // anything larger is considered garbage and drops the connection
+    static constexpr uint32_t max_packet_size = 64*1024*1024;
+    // connections with more than this waiting to be written are dropped
+    static constexpr size_t max_pending = 64*1024*1024;
+    static constexpr size_t read_size = 64*1024;
+
+    static const uint32_t req_id_tag = wire::MakeTag(
+            api::Packet::kReqIdFieldNumber, wire::WIRETYPE_VARINT);
+
+    // returns the number of bytes the varint took up,
+    // 0 if it isn't complete yet
+    static size_t
+    read_varint(const uint8_t* data, size_t size, uint32_t* v) {
+        uint32_t result = 0;
+        for (size_t i = 0; i < size && i < 5; i++) {
+            result |= (uint32_t) (data[i] & 0x7f) << (7*i);
+            if (!(data[i] & 0x80)) {
+                *v = result;
+                return i + 1;
+            }
+        }
+        // more than 5 bytes can't be a 32 bit length
+        if (size >= 5) {
+            *v = max_packet_size + 1;
+            return 5;
+        }
+        return 0;
+    }
+
+    stream_connection::stream_connection(io::io_context& ioc, protocol::socket&& socket,
+                                         bool count_down)
+        : connection(ioc, count_down),
+          socket_(std::move(socket)), pending_(), pending_packets_(0),
+          write_buf_(), writing_(false), closed_(false) {}
+
+    void
+    stream_connection::configure(protocol::socket& socket, bool tcp) {
+        boost::system::error_code ec;
+        if (tcp) socket.set_option(tcp::no_delay(true), ec);
+        socket.set_option(net::socket_base::send_buffer_size(socket_buffer_size), ec);
+        socket.set_option(net::socket_base::receive_buffer_size(socket_buffer_size), ec);
+    }
+
+    stream_connection_ptr
+    stream_connection::connect(io::yield_ctx& yield, io::io_context& ioc,
+                               const tcp::endpoint& ep) {
+        boost::system::error_code ec;
+        tcp::socket socket(ioc);
+        socket.async_connect(ep, yield.ctx[ec]);
+        if (ec) throw io_error("failed to connect: " + ec.message());
+        // hand the connected socket over to the generic protocol
+        protocol::socket s(ioc, protocol(ep.protocol().family(), ep.protocol().type()),
+                           socket.release());
+        configure(s, true);
+        return std::make_shared<stream_connection>(ioc, std::move(s), false);
+    }
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    stream_connection_ptr
+    stream_connection::connect(io::yield_ctx& yield, io::io_context& ioc,
+                               const std::string& path) {
+        boost::system::error_code ec;
+        protocol::socket s(ioc);
+        s.async_connect(net::local::stream_protocol::endpoint(path), yield.ctx[ec]);
+        if (ec) throw io_error("failed to connect: " + ec.message());
+        configure(s, false);
+        return std::make_shared<stream_connection>(ioc, std::move(s), false);
+    }
+#endif
+
+    uint8_t*
+    stream_connection::append(size_t size) {
+        size_t start = pending_.size();
+        size_t prefix = coded::VarintSize32((uint32_t) size);
+        pending_.resize(start + prefix + size);
+        coded::WriteVarint32ToArray((uint32_t) size, pending_.data() + start);
+        pending_packets_++;
+        return pending_.data() + start + prefix;
+    }
+
+    void
+    stream_connection::send(api::Packet&& p) {
+        if (closed_) return;
+        size_t size = p.ByteSizeLong();
+        p.SerializeWithCachedSizesToArray(append(size));
+        do_write_next();
+    }
+
+    void
+    stream_connection::send_update(int32_t req_id, const shared_update_ptr& u) {
+        if (closed_) return;
+        // the req_id followed by the shared encoding
+        const std::string& field = u->field();
+        uint32_t id = wire::ZigZagEncode32(req_id);
+        size_t size = field.size();
+        if (req_id != 0) size += coded::VarintSize32(req_id_tag) + coded::VarintSize32(id);
+        uint8_t* out = append(size);
+        if (req_id != 0) {
+            out = coded::WriteVarint32ToArray(req_id_tag, out);
+            out = coded::WriteVarint32ToArray(id, out);
+        }
+        std::memcpy(out, field.data(), field.size());
+        do_write_next();
+    }
+
+    void
+    stream_connection::do_write_next() {
+        if (pending_.size() > max_pending) {
+            std::cerr << "disconnecting slow stream connection: "
+                      << pending_.size() << " bytes waiting" << std::endl;
+            close();
+            return;
+        }
+        if (writing_ || closed_ || pending_.empty()) return;
+        std::swap(pending_, write_buf_);
+        pending_.clear();
+        pending_packets_ = 0;
+        writing_ = true;
+
+        auto shared = shared_from_this();
+        net::async_write(socket_, net::buffer(write_buf_),
+                [shared] (const boost::system::error_code& ec, size_t transferred) {
+                    shared->writing_ = false;
+                    shared->on_written();
+                    if (ec) return;
+                    shared->do_write_next();
+                });
+    }
+
+    void
+    stream_connection::close() {
+        if (closed_) return;
+        closed_ = true;
+        pending_.clear();
+        pending_packets_ = 0;
+        boost::system::error_code ec;
+        socket_.close(ec);
+        closed();
+    }
+
+    void
+    stream_connection::start() {
+        auto s = shared_from_this();
+        io::spawn(get_io_context(), [s] (io::yield_context yield) {
+            io::yield_ctx cyield(yield);
+
+            std::vector<uint8_t> buf(read_size);
+            size_t have = 0; // bytes of buf in use
+            api::Packet packet;
+            while (true) {
+                boost::system::error_code ec;
+                size_t n = s->socket_.async_read_some(
+                        net::buffer(buf.data() + have, buf.size() - have), yield[ec]);
+                if (ec && ec != net::error::eof
+                       && ec != net::error::operation_aborted
+                       && ec != net::error::connection_reset) {
+                    std::cerr << "error: " << ec.message() << " " << ec << std::endl;
+                }
+                if (ec) break;
+                have += n;
+
+                // handle every complete packet
+                size_t pos = 0;
+                size_t needed = 0; // to complete the next one
+                bool bad = false;
+                while (pos < have) {
+                    uint32_t len = 0;
+                    size_t prefix = read_varint(buf.data() + pos, have - pos, &len);
+                    if (prefix == 0) break;
+                    if (len > max_packet_size) {
+                        bad = true;
+                        break;
+                    }
+                    if (have - pos - prefix < len) {
+                        needed = prefix + len;
+                        break;
+                    }
+                    if (!packet.ParseFromArray(buf.data() + pos + prefix, (int) len)) {
+                        bad = true;
+                        break;
+                    }
+                    pos += prefix + len;
+                    s->dispatch(cyield, std::move(packet), s);
+                }
+                if (bad) {
+                    std::cerr << "malformed packet on stream connection" << std::endl;
+                    break;
+                }
+                // keep the partial packet at the front
+                std::memmove(buf.data(), buf.data() + pos, have - pos);
+                have -= pos;
+                buf.resize(std::max(read_size, needed));
+                if (buf.size() - have < read_size / 4) buf.resize(have + read_size);
+            }
+            s->close();
+        });
+    }
+}
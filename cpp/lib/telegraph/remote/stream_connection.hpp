@@ -0,0 +1,74 @@
+#ifndef __TELEGRAPH_STREAM_CONNECTION_HPP__
+#define __TELEGRAPH_STREAM_CONNECTION_HPP__
+
+#include "../utils/io.hpp"
+#include "../utils/signal.hpp"
+
+#include "api.pb.h"
+
+#include "connection.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+
+namespace telegraph {
+    /**
+     * A connection over a plain stream socket, TCP or AF_UNIX. Every
+     * api::Packet is prefixed with its length as a varint. Used for the
+     * clients of a stream_server as well as to connect to one.
+     */
+    class stream_connection :
+            public std::enable_shared_from_this<stream_connection>,
+            public connection {
+    public:
+        using protocol = boost::asio::generic::stream_protocol;
+    private:
+        protocol::socket socket_;
+
+        // packets encoded since the last write started,
+        // swapped with write_buf_ once that is done
+        std::vector<uint8_t> pending_;
+        size_t pending_packets_;
+        std::vector<uint8_t> write_buf_;
+        bool writing_;
+        bool closed_;
+    public:
+        // clients count request ids up, servers down
+        stream_connection(io::io_context& ioc, protocol::socket&& socket,
+                          bool count_down);
+
+        void send(api::Packet&& p) override;
+        void send_update(int32_t req_id, const shared_update_ptr& u) override;
+        // everything in the write in progress counts as one
+        size_t queued() const override { return pending_packets_ + (writing_ ? 1 : 0); }
+
+        // starts reading, the connection stays alive until it is closed
+        void start();
+        void close();
+        bool is_closed() const { return closed_; }
+
+        signal<> closed;
+
+        // large kernel buffers, no delay for tcp
+        static void configure(protocol::socket& socket, bool tcp);
+        // throw io_error if they can't connect
+        static std::shared_ptr<stream_connection> connect(io::yield_ctx& yield,
+                io::io_context& ioc, const boost::asio::ip::tcp::endpoint& ep);
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        static std::shared_ptr<stream_connection> connect(io::yield_ctx& yield,
+                io::io_context& ioc, const std::string& path);
+#endif
+    private:
+        // appends the length prefix, returns
+        // where the size bytes of the packet go
+        uint8_t* append(size_t size);
+        void do_write_next();
+    };
+    using stream_connection_ptr = std::shared_ptr<stream_connection>;
+}
+
+#endif
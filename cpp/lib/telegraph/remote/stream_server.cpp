@@ -0,0 +1,70 @@
+#include "stream_server.hpp"
+
+#include "../utils/errors.hpp"
+
+#include <cstdio>
+
+#include <boost/asio/local/stream_protocol.hpp>
+
+namespace net = boost::asio;
+using tcp = boost::asio::ip::tcp;
+
+namespace telegraph {
+    stream_server::stream_server(io::io_context& ioc, const tcp::endpoint& ep,
+                                 const std::shared_ptr<namespace_>& local)
+        : ioc_(ioc), ep_(ep), unix_path_(), local_(local) {}
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    stream_server::stream_server(io::io_context& ioc, const std::string& path,
+                                 const std::shared_ptr<namespace_>& local)
+        : ioc_(ioc), ep_(net::local::stream_protocol::endpoint(path)),
+          unix_path_(path), local_(local) {}
+#endif
+
+    void
+    stream_server::run(io::yield_ctx& cyield) {
+        io::yield_context yield = cyield.ctx;
+        boost::system::error_code ec;
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        if (!unix_path_.empty()) {
+            // only a socket nobody answers on is stale, a live one
+            // belongs to another server we must not take over
+            net::local::stream_protocol::socket probe(ioc_);
+            probe.connect(net::local::stream_protocol::endpoint(unix_path_), ec);
+            if (!ec) throw io_error("socket " + unix_path_ + " is in use");
+            if (ec == net::error::connection_refused) std::remove(unix_path_.c_str());
+            ec.clear();
+        }
+#endif
+
+        net::basic_socket_acceptor<protocol> acceptor(ioc_);
+        acceptor.open(ep_.protocol(), ec);
+        if (ec) throw io_error("failed to open server socket");
+
+        if (unix_path_.empty()) {
+            acceptor.set_option(net::socket_base::reuse_address(true), ec);
+            if (ec) throw io_error("failed to set server socket options");
+        }
+
+        acceptor.bind(ep_, ec);
+        if (ec) throw io_error("failed to bind to server socket");
+
+        acceptor.listen(net::socket_base::max_listen_connections, ec);
+        if (ec) throw io_error("failed to listen to server socket");
+
+        while (true) {
+            protocol::socket socket(ioc_);
+            acceptor.async_accept(socket, yield[ec]);
+            if (ec) continue;
+            stream_connection::configure(socket, unix_path_.empty());
+
+            auto conn = std::make_shared<remote>(ioc_, std::move(socket), local_);
+            conn->start();
+        }
+    }
+
+    stream_server::remote::remote(io::io_context& ioc, protocol::socket&& socket,
+                                  const std::shared_ptr<namespace_>& local)
+        : stream_connection(ioc, std::move(socket), true), local_fwd_(*this, local) {}
+}
@@ -0,0 +1,59 @@
+#ifndef __TELEGRAPH_STREAM_SERVER_HPP__
+#define __TELEGRAPH_STREAM_SERVER_HPP__
+
+#include "../utils/io.hpp"
+
+#include "api.pb.h"
+
+#include "connection.hpp"
+#include "stream_connection.hpp"
+#include "forwarder.hpp"
+#include "../common/namespace.hpp"
+
+#include <memory>
+#include <string>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/basic_socket_acceptor.hpp>
+
+namespace telegraph {
+    /**
+     * Serves a namespace over plain stream sockets, TCP or AF_UNIX, for
+     * local tools and scripts (or other servers, see remote_namespace)
+     * that have no use for websockets. See stream_connection for the framing.
+     */
+    class stream_server {
+    public:
+        using protocol = stream_connection::protocol;
+    private:
+        io::io_context& ioc_;
+        protocol::endpoint ep_;
+        std::string unix_path_; // empty for TCP
+        std::shared_ptr<namespace_> local_;
+    public:
+        class remote : public stream_connection {
+        private:
+            forwarder local_fwd_;
+        public:
+            remote(io::io_context& ioc, protocol::socket&& socket,
+                   const std::shared_ptr<namespace_>& local);
+        };
+
+        stream_server(io::io_context& ioc,
+            const boost::asio::ip::tcp::endpoint& ep,
+            const std::shared_ptr<namespace_>& local);
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        // a stale socket file at path is replaced, run() throws
+        // if another server is still listening on it
+        stream_server(io::io_context& ioc,
+            const std::string& path,
+            const std::shared_ptr<namespace_>& local);
+#endif
+
+        // throws io_error if it can't listen
+        void run(io::yield_ctx& yield);
+    };
+}
+
+#endif
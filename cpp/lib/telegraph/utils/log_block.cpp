@@ -0,0 +1,91 @@
+#include "log_block.hpp"
+
+#include "errors.hpp"
+#include "../local/crc.hpp"
+
+#include "log.pb.h"
+
+#include "google/protobuf/io/coded_stream.h"
+
+#include <unistd.h>
+
+namespace telegraph {
+    namespace log_block {
+        void
+        write_all(int fd, const uint8_t* buf, size_t len, const char* what) {
+            while (len > 0) {
+                ssize_t n = ::write(fd, buf, len);
+                if (n < 0) throw io_error(what);
+                buf += n;
+                len -= n;
+            }
+        }
+
+        void
+        write_all(int fd, const uint8_t* buf, size_t len,
+                  size_t offset, const char* what) {
+            while (len > 0) {
+                ssize_t n = ::pwrite(fd, buf, len, offset);
+                if (n < 0) throw io_error(what);
+                buf += n;
+                len -= n;
+                offset += n;
+            }
+        }
+
+        void
+        begin(std::string* buf) {
+            buf->clear();
+            buf->resize(header_size);
+        }
+
+        void
+        append(std::string* buf, const log::LogPacket& p) {
+            using google::protobuf::io::CodedOutputStream;
+            size_t len = p.ByteSizeLong();
+            uint8_t prefix[10];
+            uint8_t* prefix_end = CodedOutputStream::WriteVarint64ToArray(len, prefix);
+            buf->append((const char*) prefix, prefix_end - prefix);
+            size_t off = buf->size();
+            buf->resize(off + len);
+            p.SerializeWithCachedSizesToArray((uint8_t*) &(*buf)[off]);
+        }
+
+        void
+        finish(std::string* buf, int64_t base) {
+            uint8_t* header = (uint8_t*) buf->data();
+            put_u32(header, (uint32_t) (buf->size() - 8));
+            put_u64(header + 8, (uint64_t) base);
+            put_u32(header + 4, crc::crc32_buffers(header + 8, header + buf->size()));
+        }
+
+        uint32_t
+        length(const uint8_t* b, size_t avail) {
+            if (avail < header_size) return 0;
+            uint32_t len = get_u32(b);
+            if (len < 8 || (size_t) len + 8 > avail) return 0;
+            return len;
+        }
+
+        bool
+        valid(const uint8_t* b) {
+            uint32_t len = get_u32(b);
+            return crc::crc32_buffers(b + 8, b + 8 + len) == get_u32(b + 4);
+        }
+
+        bool
+        next(const uint8_t* b, size_t* pos, log::LogPacket* p) {
+            size_t payload = get_u32(b) - 8;
+            if (*pos >= payload) return false;
+            google::protobuf::io::CodedInputStream input{
+                b + header_size + *pos, (int) (payload - *pos)};
+            uint32_t len;
+            if (!input.ReadVarint32(&len)) return false;
+            auto limit = input.PushLimit(len);
+            if (!p->ParseFromCodedStream(&input)) return false;
+            input.PopLimit(limit);
+            *pos += input.CurrentPosition();
+            return true;
+        }
+    }
+}
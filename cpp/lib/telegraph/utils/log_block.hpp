@@ -0,0 +1,68 @@
+#ifndef __TELEGRAPH_UTILS_LOG_BLOCK_HPP__
+#define __TELEGRAPH_UTILS_LOG_BLOCK_HPP__
+
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+
+namespace telegraph {
+    namespace log {
+        class LogPacket;
+    }
+
+    /**
+     * The on-disk framing shared by session logs and archive segments.
+     * A block is
+     *   u32 length, u32 crc32 of the following length bytes,
+     *   i64 base time, then length - 8 bytes of
+     *   varint-length-prefixed log::LogPackets
+     * with all integers little endian. Blocks are written with a single
+     * write, so a crash leaves at most the last one incomplete.
+     */
+    namespace log_block {
+        static constexpr size_t header_size = 16;
+
+        inline void put_u32(uint8_t* b, uint32_t v) {
+            for (int i = 0; i < 4; i++) b[i] = (uint8_t) (v >> (8*i));
+        }
+        inline void put_u64(uint8_t* b, uint64_t v) {
+            for (int i = 0; i < 8; i++) b[i] = (uint8_t) (v >> (8*i));
+        }
+        inline uint32_t get_u32(const uint8_t* b) {
+            uint32_t v = 0;
+            for (int i = 0; i < 4; i++) v |= ((uint32_t) b[i]) << (8*i);
+            return v;
+        }
+        inline uint64_t get_u64(const uint8_t* b) {
+            uint64_t v = 0;
+            for (int i = 0; i < 8; i++) v |= ((uint64_t) b[i]) << (8*i);
+            return v;
+        }
+
+        // write all of buf to fd (at offset), throws io_error(what) on failure
+        void write_all(int fd, const uint8_t* buf, size_t len, const char* what);
+        void write_all(int fd, const uint8_t* buf, size_t len,
+                       size_t offset, const char* what);
+
+        // clears buf, leaving room for the header
+        void begin(std::string* buf);
+        // appends a packet to the block in buf
+        void append(std::string* buf, const log::LogPacket& p);
+        // fills in the header of the block in buf
+        void finish(std::string* buf, int64_t base);
+
+        // the length field of the block at b, 0 if the
+        // block doesn't fit in the avail bytes from b on
+        uint32_t length(const uint8_t* b, size_t avail);
+        // whether the payload of the (complete) block at b matches its crc
+        bool valid(const uint8_t* b);
+        inline int64_t base(const uint8_t* b) { return (int64_t) get_u64(b + 8); }
+
+        // parses the packet at pos (from the start of the packets) of the
+        // block at b and moves pos past it. Returns false at the end
+        // of the block or if the rest of it can't be parsed
+        bool next(const uint8_t* b, size_t* pos, log::LogPacket* p);
+    }
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef __TELEGRAPH_UTILS_SPSC_QUEUE_HPP__
+#define __TELEGRAPH_UTILS_SPSC_QUEUE_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace telegraph {
+
+    /**
+     * Bounded lock-free queue between exactly one producer thread
+     * and one consumer thread. It starts out with room for initial
+     * elements and grows, by chaining segments of twice the size,
+     * until capacity elements are queued. Sizes are rounded up to powers of two
+     */
+    template<typename T>
+        class spsc_queue {
+        private:
+            struct segment {
+                std::unique_ptr<T[]> slots;
+                size_t mask;
+                // kept on separate cache lines so producer
+                // and consumer don't keep invalidating each other
+                alignas(64) std::atomic<size_t> head; // next slot to pop
+                alignas(64) std::atomic<size_t> tail; // next slot to push
+                // set by the producer once this one is full,
+                // nothing is pushed here after that
+                std::atomic<segment*> next;
+
+                explicit segment(size_t n) : slots(new T[n]), mask(n - 1),
+                                             head(0), tail(0), next(nullptr) {}
+            };
+
+            static size_t pow2(size_t n) {
+                size_t p = 1;
+                while (p < n) p <<= 1;
+                return p;
+            }
+
+            size_t capacity_;
+            segment* read_; // consumer only
+            segment* write_; // producer only
+            alignas(64) std::atomic<size_t> pushed_;
+            alignas(64) std::atomic<size_t> popped_;
+        public:
+            explicit spsc_queue(size_t capacity, size_t initial = 64)
+                    : capacity_(pow2(capacity)), read_(nullptr), write_(nullptr),
+                      pushed_(0), popped_(0) {
+                read_ = write_ = new segment(std::min(pow2(initial), capacity_));
+            }
+            ~spsc_queue() {
+                while (read_) {
+                    segment* n = read_->next.load(std::memory_order_relaxed);
+                    delete read_;
+                    read_ = n;
+                }
+            }
+            spsc_queue(const spsc_queue&) = delete;
+            spsc_queue& operator=(const spsc_queue&) = delete;
+
+            size_t capacity() const { return capacity_; }
+
+            // approximate if called from neither thread
+            size_t size() const {
+                return pushed_.load(std::memory_order_acquire) -
+                       popped_.load(std::memory_order_acquire);
+            }
+
+            // producer only, returns false (leaving v untouched) if full
+            bool push(T&& v) {
+                size_t n = pushed_.load(std::memory_order_relaxed);
+                if (n - popped_.load(std::memory_order_acquire) >= capacity_) return false;
+                size_t t = write_->tail.load(std::memory_order_relaxed);
+                if (t - write_->head.load(std::memory_order_acquire) > write_->mask) {
+                    // this segment is full, continue in a bigger one
+                    segment* s = new segment(std::min(2*(write_->mask + 1), capacity_));
+                    write_->next.store(s, std::memory_order_release);
+                    write_ = s;
+                    t = 0;
+                }
+                write_->slots[t & write_->mask] = std::move(v);
+                write_->tail.store(t + 1, std::memory_order_release);
+                pushed_.store(n + 1, std::memory_order_release);
+                return true;
+            }
+
+            // consumer only, returns false if empty
+            bool pop(T& v) {
+                while (true) {
+                    size_t h = read_->head.load(std::memory_order_relaxed);
+                    if (h != read_->tail.load(std::memory_order_acquire)) {
+                        v = std::move(read_->slots[h & read_->mask]);
+                        read_->head.store(h + 1, std::memory_order_release);
+                        popped_.fetch_add(1, std::memory_order_release);
+                        return true;
+                    }
+                    segment* n = read_->next.load(std::memory_order_acquire);
+                    if (!n) return false;
+                    // whatever was pushed before next was set is visible now
+                    if (h != read_->tail.load(std::memory_order_acquire)) continue;
+                    delete read_;
+                    read_ = n;
+                }
+            }
+        };
+}
+
+#endif
@@ -0,0 +1,377 @@
+#include <telegraph/common/params.hpp>
+#include <telegraph/common/data.hpp>
+#include <telegraph/utils/io.hpp>
+#include <telegraph/utils/json.hpp>
+
+#include "api.pb.h"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <deque>
+#include <cmath>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+
+using namespace telegraph;
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+using tcp = boost::asio::ip::tcp;
+
+// load [host] [port] [connections] [variables] [rate] [seconds] [threads]
+//
+// Creates a load_device with the given number of variables updated rate
+// times a second on the server, opens the connections and subscribes each
+// to every variable. The values are the time they were published at, so
+// together with the time they arrive they give the end-to-end latency
+// (the clocks of both machines need to be in sync, i.e run it on the server).
+// Prints a single JSON object, so runs can be compared over time.
+struct config {
+    std::string host = "127.0.0.1";
+    unsigned short port = 8081;
+    size_t connections = 32;
+    size_t variables = 64;
+    float rate = 100;
+    double seconds = 10;
+    double warmup = 2;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+// latencies in microseconds, exact below 1024 and with
+// 64 buckets per power of two above that (under 2% error)
+class histogram {
+private:
+    static constexpr int linear = 1024;
+    static constexpr int sub = 64;
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t max_;
+    double sum_;
+
+    static size_t index(uint64_t v) {
+        if (v < linear) return (size_t) v;
+        int exp = 63 - __builtin_clzll(v); // >= 10
+        uint64_t mantissa = (v >> (exp - 6)) & (sub - 1);
+        return linear + (size_t) (exp - 10) * sub + (size_t) mantissa;
+    }
+    static uint64_t value_of(size_t i) {
+        if (i < linear) return i;
+        size_t exp = (i - linear) / sub + 10;
+        uint64_t mantissa = (i - linear) % sub;
+        return ((uint64_t) sub + mantissa) << (exp - 6);
+    }
+public:
+    histogram() : counts_(linear + 54 * sub, 0), total_(0), max_(0), sum_(0) {}
+
+    void add(uint64_t v) {
+        counts_[index(v)]++;
+        total_++;
+        max_ = std::max(max_, v);
+        sum_ += (double) v;
+    }
+    void merge(const histogram& o) {
+        for (size_t i = 0; i < counts_.size(); i++) counts_[i] += o.counts_[i];
+        total_ += o.total_;
+        max_ = std::max(max_, o.max_);
+        sum_ += o.sum_;
+    }
+    uint64_t total() const { return total_; }
+    uint64_t max() const { return max_; }
+    double mean() const { return total_ ? sum_ / (double) total_ : 0; }
+    uint64_t percentile(double p) const {
+        if (total_ == 0) return 0;
+        uint64_t rank = (uint64_t) std::ceil(p / 100 * (double) total_);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= std::max<uint64_t>(rank, 1)) return std::min(value_of(i), max_);
+        }
+        return max_;
+    }
+};
+
+struct client {
+    histogram latency;
+    bool connected = false;
+    bool subscribed = false;
+    std::string error;
+};
+
+static uint64_t
+now_micros() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// cleared by the main thread once the warmup is over
+static std::atomic<bool> warming{true};
+// the clients stop recording when this is cleared
+static std::atomic<bool> recording{true};
+
+static void
+record(client& c, const api::Packet& p, uint64_t now) {
+    if (p.payload_case() == api::Packet::kBatch) {
+        for (const auto& bp : p.batch().packets()) record(c, bp, now);
+        return;
+    }
+    if (p.payload_case() == api::Packet::kSubType) {
+        c.subscribed = true;
+        return;
+    }
+    if (p.payload_case() != api::Packet::kSubUpdate) return;
+    if (warming || !recording) return;
+    uint64_t sent = p.sub_update().value().u64();
+    c.latency.add(now > sent ? now - sent : 0);
+}
+
+static void
+run_client(io::io_context& ioc, const config& cfg, const std::string& ctx_uuid,
+           client& c, io::yield_context yield) {
+    beast::error_code ec;
+    websocket::stream<beast::tcp_stream> ws{ioc};
+    tcp::resolver resolver{ioc};
+    auto eps = resolver.async_resolve(cfg.host, std::to_string(cfg.port), yield[ec]);
+    if (!ec) beast::get_lowest_layer(ws).async_connect(eps, yield[ec]);
+    if (ec) { c.error = "connect: " + ec.message(); return; }
+    ws.binary(true);
+    ws.async_handshake(cfg.host, "/", yield[ec]);
+    if (ec) { c.error = "handshake: " + ec.message(); return; }
+    c.connected = true;
+
+    // all the subscriptions go out in one frame
+    api::Packet batch;
+    for (size_t i = 0; i < cfg.variables; i++) {
+        api::Packet* p = batch.mutable_batch()->add_packets();
+        p->set_req_id((int32_t) i + 1);
+        auto s = p->mutable_sub_change();
+        s->set_uuid(ctx_uuid);
+        s->add_variable("v" + std::to_string(i));
+        s->set_debounce(0);
+        s->set_refresh(subscription::DISABLED);
+        s->set_timeout(1);
+    }
+    std::string out = batch.SerializeAsString();
+    ws.async_write(net::buffer(out), yield[ec]);
+    if (ec) { c.error = "write: " + ec.message(); return; }
+
+    beast::flat_buffer buf;
+    api::Packet p;
+    while (recording) {
+        ws.async_read(buf, yield[ec]);
+        if (ec) {
+            if (recording) c.error = "read: " + ec.message();
+            return;
+        }
+        uint64_t now = now_micros();
+        if (p.ParseFromArray(buf.data().data(), (int) buf.size())) record(c, p, now);
+        buf.consume(buf.size());
+    }
+    ws.async_close(websocket::close_code::normal, yield[ec]);
+}
+
+// the connection used to set up and tear down the load_device
+class control {
+private:
+    websocket::stream<tcp::socket> ws_;
+    int32_t req_id_;
+    std::deque<api::Packet> received_;
+
+    // the next packet, out of a batch if need be
+    api::Packet next() {
+        while (received_.empty()) {
+            beast::flat_buffer buf;
+            ws_.read(buf);
+            api::Packet p;
+            if (!p.ParseFromArray(buf.data().data(), (int) buf.size())) continue;
+            if (p.payload_case() == api::Packet::kBatch) {
+                for (auto& bp : *p.mutable_batch()->mutable_packets())
+                    received_.push_back(std::move(bp));
+            } else {
+                received_.push_back(std::move(p));
+            }
+        }
+        api::Packet p = std::move(received_.front());
+        received_.pop_front();
+        return p;
+    }
+public:
+    control(io::io_context& ioc, const config& cfg) : ws_(ioc), req_id_(0), received_() {
+        tcp::resolver resolver{ioc};
+        net::connect(ws_.next_layer(), resolver.resolve(cfg.host, std::to_string(cfg.port)));
+        ws_.binary(true);
+        ws_.handshake(cfg.host, "/");
+    }
+
+    // sends p and returns the first reply to it
+    api::Packet request(api::Packet&& p) {
+        int32_t id = ++req_id_;
+        p.set_req_id(id);
+        ws_.write(net::buffer(p.SerializeAsString()));
+        while (true) {
+            api::Packet res = next();
+            if (res.req_id() == id) return res;
+        }
+    }
+
+    // the stats of the load_device, {} if it has none
+    params stats(const std::string& ctx_uuid) {
+        api::Packet p;
+        p.mutable_request()->set_uuid(ctx_uuid);
+        params req = params::object();
+        req["type"] = params{std::string{"stats"}};
+        req.pack(p.mutable_request()->mutable_params());
+        int32_t id = req_id_ + 1;
+        api::Packet res = request(std::move(p));
+        if (!res.success()) return params::object();
+        // the stats follow as an update on the same request
+        while (true) {
+            res = next();
+            if (res.req_id() == id && res.has_request_update())
+                return params::unpack(res.request_update());
+        }
+    }
+
+    void close() {
+        beast::error_code ec;
+        ws_.close(websocket::close_code::normal, ec);
+    }
+};
+
+static float
+stat(const params& p, const std::string& key) {
+    auto m = p.to_map();
+    auto it = m.find(key);
+    return it == m.end() ? 0 : it->second.get<float>();
+}
+
+// s as a JSON string, with quotes and escapes
+static std::string
+quoted(const std::string& s) {
+    // invalid utf-8 (say in a host argument) is replaced rather than thrown on
+    return json(s).dump(-1, ' ', false, json::error_handler_t::replace);
+}
+
+static void
+print_latency(const histogram& h) {
+    std::cout << "{\"p50\": " << h.percentile(50)
+              << ", \"p90\": " << h.percentile(90)
+              << ", \"p99\": " << h.percentile(99)
+              << ", \"p999\": " << h.percentile(99.9)
+              << ", \"max\": " << h.max()
+              << ", \"mean\": " << std::fixed << std::setprecision(1) << h.mean()
+              << std::defaultfloat << "}";
+}
+
+int main(int argc, char** argv) {
+    config cfg;
+    if (argc > 1) cfg.host = argv[1];
+    if (argc > 2) cfg.port = (unsigned short) std::stoi(argv[2]);
+    if (argc > 3) cfg.connections = std::max(1, std::stoi(argv[3]));
+    if (argc > 4) cfg.variables = std::max(1, std::stoi(argv[4]));
+    if (argc > 5) cfg.rate = std::stof(argv[5]);
+    if (argc > 6) cfg.seconds = std::stod(argv[6]);
+    if (argc > 7) cfg.threads = std::max(1, std::stoi(argv[7]));
+
+    io::io_context control_ioc;
+    std::unique_ptr<control> ctl;
+    std::string ctx_uuid;
+    try {
+        ctl = std::make_unique<control>(control_ioc, cfg);
+        api::Packet p;
+        auto c = p.mutable_create();
+        c->set_name("load");
+        c->set_type("load_device");
+        params args = params::object();
+        args["variables"] = (float) cfg.variables;
+        args["rate"] = cfg.rate;
+        args.pack(c->mutable_params());
+        api::Packet res = ctl->request(std::move(p));
+        if (!res.has_created()) {
+            std::cerr << "server could not create a load_device" << std::endl;
+            return 1;
+        }
+        ctx_uuid = res.created();
+    } catch (const std::exception& e) {
+        std::cerr << "could not connect: " << e.what() << std::endl;
+        return 1;
+    }
+    params stats_begin = ctl->stats(ctx_uuid);
+
+    // clients are spread over the threads
+    std::vector<std::unique_ptr<io::io_context>> iocs;
+    for (unsigned i = 0; i < cfg.threads; i++) iocs.push_back(std::make_unique<io::io_context>(1));
+    std::vector<client> clients(cfg.connections);
+    for (size_t i = 0; i < cfg.connections; i++) {
+        io::io_context& ioc = *iocs[i % iocs.size()];
+        client& c = clients[i];
+        io::spawn(ioc, [&ioc, &cfg, &ctx_uuid, &c] (io::yield_context yield) {
+            run_client(ioc, cfg, ctx_uuid, c, yield);
+        });
+    }
+    std::vector<std::thread> threads;
+    for (auto& ioc : iocs) threads.emplace_back([&ioc] () { ioc->run(); });
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(cfg.warmup));
+    warming = false;
+    auto begin = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(cfg.seconds));
+    recording = false;
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    params stats_end = ctl->stats(ctx_uuid);
+    for (auto& ioc : iocs) ioc->stop();
+    for (auto& t : threads) t.join();
+    {
+        api::Packet p;
+        p.set_destroy(ctx_uuid);
+        ctl->request(std::move(p));
+        ctl->close();
+    }
+
+    histogram all;
+    size_t connected = 0, subscribed = 0;
+    for (auto& c : clients) {
+        all.merge(c.latency);
+        if (c.connected) connected++;
+        if (c.subscribed) subscribed++;
+    }
+    double expected = (double) cfg.connections * cfg.variables * cfg.rate;
+
+    std::cout << "{\"config\": {\"host\": " << quoted(cfg.host) << ", \"port\": " << cfg.port
+              << ", \"connections\": " << cfg.connections
+              << ", \"variables\": " << cfg.variables
+              << ", \"rate\": " << cfg.rate
+              << ", \"seconds\": " << cfg.seconds
+              << ", \"threads\": " << cfg.threads << "},\n";
+    std::cout << " \"connected\": " << connected << ", \"subscribed\": " << subscribed << ",\n";
+    std::cout << " \"updates_per_sec\": " << (uint64_t) (all.total() / secs)
+              << ", \"expected_per_sec\": " << (uint64_t) expected << ",\n";
+    std::cout << " \"latency_us\": ";
+    print_latency(all);
+    std::cout << ",\n \"server_rss_bytes\": {\"begin\": " << (uint64_t) stat(stats_begin, "rss")
+              << ", \"end\": " << (uint64_t) stat(stats_end, "rss") << "},\n";
+    // lag shows up as a connection getting fewer updates or later ones than the rest
+    std::cout << " \"connections\": [";
+    for (size_t i = 0; i < clients.size(); i++) {
+        const client& c = clients[i];
+        std::cout << (i ? ",\n  " : "\n  ")
+                  << "{\"updates_per_sec\": " << (uint64_t) (c.latency.total() / secs)
+                  << ", \"latency_us\": ";
+        print_latency(c.latency);
+        if (!c.error.empty()) std::cout << ", \"error\": " << quoted(c.error);
+        std::cout << "}";
+    }
+    std::cout << "\n]}" << std::endl;
+    return connected == cfg.connections ? 0 : 1;
+}
@@ -1,13 +1,24 @@
 #include <telegraph/local/namespace.hpp>
 #include <telegraph/local/device.hpp>
 #include <telegraph/local/dummy_device.hpp>
+#include <telegraph/local/load_device.hpp>
 #include <telegraph/local/container.hpp>
+#include <telegraph/local/archive.hpp>
+#include <telegraph/local/replay.hpp>
+#include <telegraph/local/shm_publisher.hpp>
+#include <telegraph/local/multicast_publisher.hpp>
 #include <telegraph/remote/server.hpp>
+#include <telegraph/remote/stream_server.hpp>
+#include <telegraph/remote/relay.hpp>
 
 #include <iostream>
 #include <filesystem>
+#include <thread>
+#include <vector>
+#include <memory>
 
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/executor_work_guard.hpp>
 
 using namespace telegraph;
 
@@ -23,20 +34,91 @@ int main(int argc, char** argv) {
     ns->register_factory("device_scanner", device_scanner::create);
     ns->register_factory("device", device::create);
     ns->register_factory("dummy_device", dummy_device::create);
+    ns->register_factory("load_device", load_device::create);
     ns->register_factory("container", container::create);
+    ns->register_factory("archive", archive::create);
+    ns->register_factory("replay", replay::create);
+    ns->register_factory("shm_publisher", shm_publisher::create);
+    ns->register_factory("multicast_publisher", multicast_publisher::create);
+    ns->register_factory("relay", relay::create);
 
     // start a server on the relay
     // this will enqueue callbacks on the io context
     auto const address = net::ip::make_address("0.0.0.0");
     const unsigned short port = 8081;
 
+    // clients are spread over this many threads, the first one
+    // (running ctx) also runs the namespace and all contexts.
+    // The raw stream listeners for local tools are off unless asked for,
+    // and TCP only listens on loopback unless given an address:
+    //   server [threads] [--stream-port port] [--stream-address addr]
+    //          [--stream-socket path] [--stats]
+    // --stats prints the write rates of every client periodically
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned short stream_port = 0;
+    auto stream_address = net::ip::make_address("127.0.0.1");
+    std::string stream_path;
+    bool log_stats = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--stream-port" && has_value) {
+            stream_port = (unsigned short) std::stoi(argv[++i]);
+        } else if (arg == "--stream-address" && has_value) {
+            stream_address = net::ip::make_address(argv[++i]);
+        } else if (arg == "--stream-socket" && has_value) {
+            stream_path = argv[++i];
+        } else if (arg == "--stats") {
+            log_stats = true;
+        } else if (i == 1) {
+            threads = std::max(1, std::stoi(arg));
+        } else {
+            std::cerr << "unknown argument " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    using work_guard = net::executor_work_guard<net::io_context::executor_type>;
+    std::vector<std::unique_ptr<net::io_context>> shards;
+    std::vector<work_guard> guards;
+    std::vector<std::thread> shard_threads;
+    for (unsigned i = 1; i < threads; i++) {
+        shards.push_back(std::make_unique<net::io_context>(1));
+        guards.push_back(net::make_work_guard(*shards.back()));
+        shard_threads.emplace_back([&shard = *shards.back()] () { shard.run(); });
+    }
+    std::cout << "serving clients on " << threads << " threads" << std::endl;
+
     io::spawn(ctx,
         [&](io::yield_context yield) {
             io::yield_ctx c(yield);
-            server s(ctx, tcp::endpoint{address,port}, ns);
+            server s(ctx, tcp::endpoint{address,port}, ns, 30, 65536, 128, log_stats);
+            for (auto& shard : shards) s.add_shard(*shard);
             s.run(c);
         });
+    if (stream_port) {
+        io::spawn(ctx,
+            [&](io::yield_context yield) {
+                io::yield_ctx c(yield);
+                stream_server s(ctx, tcp::endpoint{stream_address,stream_port}, ns);
+                s.run(c);
+            });
+    }
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    if (!stream_path.empty()) {
+        io::spawn(ctx,
+            [&](io::yield_context yield) {
+                io::yield_ctx c(yield);
+                stream_server s(ctx, stream_path, ns);
+                s.run(c);
+            });
+    }
+#endif
 
     // process requests on the io context
     ctx.run();
+
+    guards.clear();
+    for (auto& shard : shards) shard->stop();
+    for (auto& t : shard_threads) t.join();
 }
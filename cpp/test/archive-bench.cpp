@@ -0,0 +1,103 @@
+#include <telegraph/local/series.hpp>
+#include <telegraph/local/aggregate.hpp>
+#include <telegraph/common/data.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <limits>
+
+using namespace telegraph;
+
+// a 30 minute run at 1khz
+static constexpr size_t samples = 30*60*1000;
+
+template<typename F>
+    static void bench(const std::string& name, value_type::type_class t, F gen) {
+        std::mt19937 rng{42};
+        std::vector<datapoint> input;
+        input.reserve(samples);
+        time_point start = datapoint::now();
+        for (size_t i = 0; i < samples; i++) {
+            // 1ms +/- some jitter
+            auto jitter = std::chrono::microseconds{rng() % 3 == 0 ? (int) (rng() % 50) : 0};
+            time_point tp = start + std::chrono::milliseconds{i} + jitter;
+            input.emplace_back(tp, gen(i, rng));
+        }
+
+        series s{t};
+        auto begin = std::chrono::steady_clock::now();
+        for (const datapoint& d : input) s.append(d);
+        auto end = std::chrono::steady_clock::now();
+        double secs = std::chrono::duration<double>(end - begin).count();
+
+        // check the round trip
+        std::vector<datapoint> output = s.decode();
+        bool ok = output.size() == input.size();
+        for (size_t i = 0; ok && i < input.size(); i++) {
+            auto a = std::chrono::duration_cast<std::chrono::microseconds>(
+                        input[i].get_time().time_since_epoch()).count();
+            auto b = std::chrono::duration_cast<std::chrono::microseconds>(
+                        output[i].get_time().time_since_epoch()).count();
+            value va = input[i].get_value();
+            value vb = output[i].get_value();
+            ok = a == b && va.get_type_class() == vb.get_type_class() &&
+                std::memcmp(&va.get_box(), &vb.get_box(), sizeof(value::box)) == 0;
+        }
+
+        std::cout << name << ": "
+                  << (double) s.memory() / samples << " bytes/sample "
+                  << "(vs " << sizeof(datapoint) << " uncompressed), "
+                  << (size_t) (samples / secs) << " appends/s, "
+                  << "round trip " << (ok ? "ok" : "FAILED") << std::endl;
+
+        // plot the last 10 minutes at 800px
+        time_point qend = input.back().get_time();
+        time_point qstart = qend - std::chrono::minutes{10};
+        for (downsample d : {downsample::min_max, downsample::lttb}) {
+            auto qbegin = std::chrono::steady_clock::now();
+            std::vector<datapoint> points = s.query(qstart, qend, 800, d);
+            auto qfinish = std::chrono::steady_clock::now();
+            std::cout << "    " << (d == downsample::lttb ? "lttb" : "min/max")
+                      << " over 10 minutes: " << points.size() << " points in "
+                      << std::chrono::duration<double, std::milli>(qfinish - qbegin).count()
+                      << " ms" << std::endl;
+        }
+
+        // lap-style summary of the whole run in 1s windows
+        auto abegin = std::chrono::steady_clock::now();
+        std::vector<int64_t> times;
+        std::vector<double> values;
+        s.columns(std::numeric_limits<int64_t>::min(),
+                  std::numeric_limits<int64_t>::max(), &times, &values);
+        auto adecoded = std::chrono::steady_clock::now();
+        window_stats stats = aggregate(times, values, s.begin_time(), 1000000, {50, 95});
+        auto afinish = std::chrono::steady_clock::now();
+        std::cout << "    aggregate in 1s windows: " << stats.start.size() << " windows in "
+                  << std::chrono::duration<double, std::milli>(afinish - abegin).count()
+                  << " ms (" << std::chrono::duration<double, std::milli>(adecoded - abegin).count()
+                  << " ms decoding)" << std::endl;
+    }
+
+int main(int argc, char** argv) {
+    bench("float (sine)", value_type::Float, [](size_t i, std::mt19937&) {
+        return value{(float) std::sin(i / 1000.0)};
+    });
+    bench("float (noisy)", value_type::Float, [](size_t i, std::mt19937& r) {
+        return value{(float) (100 + (r() % 1000) / 100.0)};
+    });
+    bench("double (counter)", value_type::Double, [](size_t i, std::mt19937&) {
+        return value{(double) (i / 10)};
+    });
+    bench("uint16 (adc)", value_type::Uint16, [](size_t i, std::mt19937& r) {
+        return value{(uint16_t) (2048 + r() % 16)};
+    });
+    bench("int64 (counter)", value_type::Int64, [](size_t i, std::mt19937&) {
+        return value{(int64_t) i};
+    });
+    bench("bool (toggle)", value_type::Bool, [](size_t i, std::mt19937&) {
+        return value{(bool) ((i / 500) % 2)};
+    });
+}
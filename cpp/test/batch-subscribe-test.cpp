@@ -0,0 +1,123 @@
+#include <telegraph/local/namespace.hpp>
+#include <telegraph/local/dummy_device.hpp>
+#include <telegraph/remote/stream_server.hpp>
+#include <telegraph/remote/stream_connection.hpp>
+#include <telegraph/common/publisher.hpp>
+#include <telegraph/common/nodes.hpp>
+#include "test_util.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <unistd.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+using namespace telegraph;
+
+static constexpr int variables = 50;
+
+int main(int argc, char** argv) {
+    io::io_context ioc;
+    std::string path = "/tmp/telegraph-batch-test-" + std::to_string(getpid()) + ".sock";
+
+    auto ns = std::make_shared<local_namespace>(ioc);
+    std::vector<node*> children;
+    for (int i = 0; i < variables; i++) {
+        std::string n = "v" + std::to_string(i);
+        children.push_back(new variable(i + 1, n, n, "", value_type::Float));
+    }
+    auto root = std::make_unique<group>(0, "car", "car", "", "", 1, std::move(children));
+    std::vector<variable*> vars;
+    for (node* n : root->nodes()) {
+        auto v = dynamic_cast<variable*>(n);
+        if (v) vars.push_back(v);
+    }
+    auto dev = std::make_shared<dummy_device>(ioc, "car", std::move(root));
+    std::vector<publisher_ptr> pubs;
+    for (auto v : vars) {
+        pubs.push_back(std::make_shared<publisher>(ioc, value_type::Float));
+        dev->add_publisher(v, pubs.back());
+    }
+
+    test::checker check;
+
+    io::spawn(ioc, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        stream_server s(ioc, path, ns);
+        s.run(c);
+    });
+    io::spawn(ioc, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        dev->reg(c, ns);
+        test::sleep(ioc, yield, 10);
+
+        auto conn = stream_connection::connect(c, ioc, path);
+        conn->start();
+
+        // every variable, plus one that doesn't exist
+        api::Packet req;
+        auto batch = req.mutable_sub_change_batch();
+        std::vector<int> received(variables + 1, 0);
+        for (int i = 0; i <= variables; i++) {
+            auto s = batch->add_subs();
+            s->set_uuid(boost::uuids::to_string(dev->get_uuid()));
+            s->add_variable(i < variables ? "v" + std::to_string(i) : "missing");
+            s->set_debounce(0);
+            s->set_refresh(1000);
+            s->set_timeout(1);
+            int32_t stream = 1000 + i;
+            batch->add_streams(stream);
+            conn->set_stream_cb(stream, [&received, i] (io::yield_ctx&, const api::Packet& p) {
+                if (p.payload_case() == api::Packet::kSubUpdate) received[i]++;
+            });
+        }
+        api::Packet res = conn->request_response(c, std::move(req), 1);
+        check(res.payload_case() == api::Packet::kSubTypes, "one reply");
+        int valid = 0;
+        for (const auto& t : res.sub_types().types())
+            if (t.type() == Type::FLOAT) valid++;
+        check(res.sub_types().types_size() == variables + 1 &&
+              valid == variables &&
+              res.sub_types().types(variables).type() == Type::INVALID, "types");
+
+        for (auto& p : pubs) p->update(value{1.0f});
+        test::sleep(ioc, yield, 50);
+        int updated = 0;
+        for (int i = 0; i < variables; i++) if (received[i] == 1) updated++;
+        check(updated == variables && received[variables] == 0, "updates");
+
+        // each one is an ordinary subscription from here on
+        api::Packet cancel;
+        cancel.set_cancel(0);
+        conn->write_back(1000, std::move(cancel));
+        test::sleep(ioc, yield, 50);
+        check(pubs[0]->subscribers() == 0 && pubs[1]->subscribers() == 1, "cancel");
+
+        // a stream id repeated within a batch is only taken once
+        api::Packet dup;
+        auto dup_batch = dup.mutable_sub_change_batch();
+        for (int i = 0; i < 2; i++) {
+            auto s = dup_batch->add_subs();
+            s->set_uuid(boost::uuids::to_string(dev->get_uuid()));
+            s->add_variable("v" + std::to_string(i));
+            s->set_debounce(0);
+            s->set_refresh(1000);
+            s->set_timeout(1);
+            dup_batch->add_streams(2000);
+        }
+        res = conn->request_response(c, std::move(dup), 1);
+        check(res.sub_types().types_size() == 2 &&
+              res.sub_types().types(0).type() == Type::FLOAT &&
+              res.sub_types().types(1).type() == Type::INVALID, "duplicate streams");
+
+        conn->close();
+        ioc.stop();
+    });
+    ioc.run();
+    ::unlink(path.c_str());
+    return check.exit_code();
+}
@@ -0,0 +1,76 @@
+#include <telegraph/local/clock_sync.hpp>
+#include "test_util.hpp"
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace telegraph;
+
+static time_point
+at(int64_t us) {
+    return time_point(std::chrono::duration_cast<time_point::duration>(
+                std::chrono::microseconds(us)));
+}
+
+static int64_t
+micros(time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                t.time_since_epoch()).count();
+}
+
+// a device that booted at host time boot, with a clock
+// that runs drift parts per million fast
+struct board {
+    int64_t boot;
+    double drift;
+    uint64_t device(int64_t host) const {
+        return (uint64_t) std::llround((host - boot) * (1 + drift*1e-6));
+    }
+};
+
+// pings every interval us with one way delays of about a ms,
+// some of which sit behind other traffic
+static void
+exchange(clock_sync& c, const board& b, int64_t* host, int64_t interval,
+         int count, std::mt19937& rng) {
+    std::uniform_int_distribution<int64_t> jitter(0, 200);
+    std::uniform_int_distribution<int64_t> queued(0, 20000);
+    std::bernoulli_distribution busy(0.3);
+    for (int i = 0; i < count; i++) {
+        int64_t out = 1000 + jitter(rng) + (busy(rng) ? queued(rng) : 0);
+        int64_t back = 1000 + jitter(rng) + (busy(rng) ? queued(rng) : 0);
+        c.sample(at(*host), at(*host + out + back), b.device(*host + out));
+        *host += interval;
+    }
+}
+
+int main(int argc, char** argv) {
+    test::checker check;
+    std::mt19937 rng{42};
+    int64_t host = 1600000000LL * 1000000;
+
+    clock_sync c;
+    check(!c.valid(), "empty");
+
+    board b{host - 3600LL*1000000, 40};
+    exchange(c, b, &host, 1000000, 60, rng);
+    check(c.valid(), "valid");
+    std::cout << "drift " << c.drift_ppm() << " ppm, rtt " << c.min_rtt() << " us" << std::endl;
+    check(std::abs(c.drift_ppm() - 40) < 5, "drift");
+    // a sample from half a second ago
+    int64_t taken = host - 500000;
+    int64_t err = micros(c.to_host(b.device(taken))) - taken;
+    std::cout << "error " << err << " us" << std::endl;
+    check(std::abs(err) < 300, "maps samples");
+
+    // the board restarts, so its clock starts over
+    board r{host, -25};
+    host += 2000000;
+    exchange(c, r, &host, 1000000, 1, rng);
+    taken = host - 200000;
+    err = micros(c.to_host(r.device(taken))) - taken;
+    check(std::abs(err) < 300, "restart");
+    return check.exit_code();
+}
@@ -0,0 +1,250 @@
+#include <telegraph/local/device.hpp>
+#include <telegraph/local/crc.hpp>
+#include <telegraph/common/nodes.hpp>
+#include <telegraph/common/value.hpp>
+#include <telegraph/utils/io.hpp>
+
+#include "stream.pb.h"
+#include "test_util.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+using namespace telegraph;
+
+static constexpr int variables = 41;
+// rejected by the board
+static constexpr node::id broken = 7;
+
+// what wire::uart_interface does with a tree of float variables,
+// on the other end of a pty
+struct board {
+    io::posix::stream_descriptor port;
+    // older firmware ignores change_subs
+    bool change_subs;
+    int single_frames;
+    int many_frames;
+    size_t largest_frame;
+    std::set<uint32_t> subscribed;
+
+    board(io::io_context& ioc, int fd, bool change_subs)
+        : port(ioc, fd), change_subs(change_subs),
+          single_frames(0), many_frames(0), largest_frame(0), subscribed() {}
+
+    void run(io::yield_context yield) {
+        std::vector<uint8_t> frame;
+        bool in_frame = false, escaped = false;
+        uint8_t prev = 0;
+        while (true) {
+            uint8_t buf[256];
+            boost::system::error_code ec;
+            size_t n = port.async_read_some(io::buffer(buf), yield[ec]);
+            if (ec) return;
+            for (size_t i = 0; i < n; i++) {
+                uint8_t c = buf[i];
+                if (!in_frame) {
+                    in_frame = prev == 'S' && c == 'S';
+                    prev = in_frame ? 0 : c;
+                    frame.clear();
+                } else if (escaped) {
+                    frame.push_back(c);
+                    escaped = false;
+                } else if (c == '@') {
+                    escaped = true;
+                } else if (c == 'E') {
+                    in_frame = false;
+                    received(frame);
+                } else {
+                    frame.push_back(c);
+                }
+            }
+        }
+    }
+
+    void received(const std::vector<uint8_t>& frame) {
+        largest_frame = std::max(largest_frame, frame.size());
+        if (frame.size() < 4) return;
+        size_t len = frame.size() - 4;
+        uint32_t crc;
+        crc::crc32_start(crc);
+        for (size_t i = 0; i < len; i++) crc::crc32_next(crc, frame[i]);
+        uint32_t expected = 0;
+        for (int i = 0; i < 4; i++) expected |= (uint32_t) frame[len + i] << (8*i);
+        if ((crc ^ ~0U) != expected) return;
+
+        stream::Packet req;
+        if (!req.ParseFromArray(frame.data(), (int) len)) return;
+        stream::Packet res;
+        res.set_req_id(req.req_id());
+        switch (req.event_case()) {
+        case stream::Packet::kPing:
+            res.set_pong((int32_t) subscribed.size());
+            break;
+        case stream::Packet::kFetchNode: {
+            uint32_t id = req.fetch_node();
+            if (id == 0) {
+                Group* g = res.mutable_node()->mutable_group();
+                g->set_id(0);
+                g->set_name("board");
+                for (int i = 1; i <= variables; i++)
+                    g->add_children()->set_placeholder(i);
+            } else {
+                Variable* v = res.mutable_node()->mutable_var();
+                v->set_id(id);
+                v->set_name("v" + std::to_string(id));
+                v->mutable_data_type()->set_type(Type::FLOAT);
+            }
+        } break;
+        case stream::Packet::kChangeSub:
+            single_frames++;
+            res.set_success(change(req.change_sub()));
+            break;
+        case stream::Packet::kChangeSubs: {
+            many_frames++;
+            if (!change_subs) return;
+            uint32_t succeeded = 0;
+            for (int i = 0; i < req.change_subs().subs_size(); i++)
+                if (change(req.change_subs().subs(i))) succeeded |= 1u << i;
+            res.set_changed_subs(succeeded);
+        } break;
+        case stream::Packet::kCancelSub:
+            subscribed.erase(req.cancel_sub().var_id());
+            res.set_success(true);
+            break;
+        default: return;
+        }
+        write(res);
+    }
+
+    bool change(const stream::Subscribe& s) {
+        if (s.var_id() == 0 || s.var_id() > variables || s.var_id() == broken) return false;
+        subscribed.insert(s.var_id());
+        return true;
+    }
+
+    void update(node::id var_id, float f) {
+        stream::Packet p;
+        p.set_req_id(var_id);
+        value{f}.pack(p.mutable_update());
+        write(p);
+    }
+
+    void write(const stream::Packet& p) {
+        std::string payload = p.SerializeAsString();
+        uint32_t crc;
+        crc::crc32_start(crc);
+        std::string out = "SS";
+        for (char c : payload) {
+            crc::crc32_next(crc, (uint8_t) c);
+            if (c == 'S' || c == 'E' || c == '@') out.push_back('@');
+            out.push_back(c);
+        }
+        crc ^= ~0U;
+        for (int i = 0; i < 4; i++) {
+            char c = (char) ((crc >> (8*i)) & 0xFF);
+            if (c == 'S' || c == 'E' || c == '@') out.push_back('@');
+            out.push_back(c);
+        }
+        out.push_back('E');
+        io::write(port, io::buffer(out));
+    }
+};
+
+static std::vector<const variable*>
+variables_of(const std::shared_ptr<node>& tree) {
+    std::vector<const variable*> vars;
+    for (node* n : tree->nodes()) {
+        auto v = dynamic_cast<variable*>(n);
+        if (v) vars.push_back(v);
+    }
+    return vars;
+}
+
+static std::string
+open_pty(int* master) {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) || unlockpt(fd)) return "";
+    *master = fd;
+    return ptsname(fd);
+}
+
+int main(int argc, char** argv) {
+    io::io_context ioc;
+    test::checker check;
+
+    int fd = -1, legacy_fd = -1;
+    std::string path = open_pty(&fd);
+    std::string legacy_path = open_pty(&legacy_fd);
+    if (path.empty() || legacy_path.empty()) {
+        std::cout << "no pty" << std::endl;
+        return 1;
+    }
+    board b(ioc, fd, true);
+    board legacy(ioc, legacy_fd, false);
+    io::spawn(ioc, [&] (io::yield_context yield) { b.run(yield); });
+    io::spawn(ioc, [&] (io::yield_context yield) { legacy.run(yield); });
+
+    io::spawn(ioc, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        auto dev = std::make_shared<device>(ioc, "board", path, 115200);
+        dev->init(c, 500);
+        auto tree = dev->fetch(c);
+        auto vars = variables_of(tree);
+        check(vars.size() == variables, "tree");
+
+        // all but the last together
+        std::vector<const variable*> many(vars.begin(), vars.end() - 1);
+        auto subs = dev->subscribe_many(c, many, 0, 1, 1);
+        int valid = 0;
+        for (auto& s : subs) if (s) valid++;
+        std::cout << b.many_frames << " change_subs frames, largest "
+                  << b.largest_frame << " bytes" << std::endl;
+        check(b.single_frames == 0 && b.many_frames == 3, "batched");
+        check(b.largest_frame <= 255, "fits the board");
+        check(valid == variables - 2 && !subs[broken - 1], "bitmap");
+
+        float latest = 0;
+        subs[0]->data.add([&latest] (const datapoint& dp) {
+            latest = dp.get_value().get<float>();
+        });
+        b.update(1, 2.0f);
+        test::sleep(ioc, yield, 20);
+        check(latest == 2.0f, "updates");
+
+        // nothing to batch with
+        auto s = dev->subscribe(c, vars.back(), 0, 1, 1);
+        check(s && b.single_frames == 1 && b.many_frames == 3, "single");
+
+        // one change_subs goes unanswered, then one by one
+        auto ldev = std::make_shared<device>(ioc, "legacy", legacy_path, 115200);
+        ldev->init(c, 500);
+        auto ltree = ldev->fetch(c);
+        auto lvars = variables_of(ltree);
+        std::vector<const variable*> first(lvars.begin(), lvars.begin() + 4);
+        std::vector<const variable*> second(lvars.begin() + 10, lvars.begin() + 14);
+        auto lsubs = ldev->subscribe_many(c, first, 0, 1, 1);
+        valid = 0;
+        for (auto& s : lsubs) if (s) valid++;
+        check(valid == 4 && legacy.many_frames == 1 && legacy.single_frames == 4, "fallback");
+        lsubs = ldev->subscribe_many(c, second, 0, 1, 1);
+        valid = 0;
+        for (auto& s : lsubs) if (s) valid++;
+        check(valid == 4 && legacy.many_frames == 1 && legacy.single_frames == 8, "stays unbatched");
+
+        ioc.stop();
+    });
+    ioc.run();
+    return check.exit_code();
+}
@@ -0,0 +1,118 @@
+#include <telegraph/local/namespace.hpp>
+#include <telegraph/local/dummy_device.hpp>
+#include <telegraph/remote/connection.hpp>
+#include <telegraph/remote/forwarder.hpp>
+#include <telegraph/common/publisher.hpp>
+#include <telegraph/common/nodes.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+using namespace telegraph;
+
+using wire = google::protobuf::internal::WireFormatLite;
+using coded = google::protobuf::io::CodedOutputStream;
+
+static constexpr size_t updates = 200000;
+
+// stands in for a websocket client, encoding what
+// would go out but without the socket
+class sink : public connection {
+private:
+    forwarder fwd_;
+    bool splice_;
+    std::string frame_;
+public:
+    size_t bytes;
+
+    sink(io::io_context& ioc, const std::shared_ptr<namespace_>& ns, bool splice)
+        : connection(ioc, true), fwd_(*this, ns), splice_(splice), frame_(), bytes(0) {}
+
+    void send(api::Packet&& p) override {
+        frame_.clear();
+        p.SerializeToString(&frame_);
+        bytes += frame_.size();
+    }
+
+    void send_update(int32_t req_id, const shared_update_ptr& u) override {
+        // otherwise every client builds and encodes a packet of its own
+        if (!splice_) {
+            connection::send_update(req_id, u);
+            return;
+        }
+        uint8_t prefix[16];
+        uint8_t* end = prefix;
+        if (req_id != 0) {
+            end = coded::WriteVarint32ToArray(
+                    wire::MakeTag(api::Packet::kReqIdFieldNumber, wire::WIRETYPE_VARINT), end);
+            end = coded::WriteVarint32ToArray(wire::ZigZagEncode32(req_id), end);
+        }
+        frame_.assign((const char*) prefix, end - prefix);
+        frame_ += u->field();
+        bytes += frame_.size();
+    }
+};
+
+static void
+bench(size_t clients, bool splice) {
+    io::io_context ioc;
+    auto ns = std::make_shared<local_namespace>(ioc);
+
+    auto v = new variable(2, "v", "V", "", value_type::Float);
+    std::vector<node*> children{v};
+    auto root = std::make_unique<group>(1, "bench", "Bench", "", "", 1, std::move(children));
+    auto dev = std::make_shared<dummy_device>(ioc, "bench", std::move(root));
+    auto pub = std::make_shared<publisher>(ioc, value_type::Float);
+    dev->add_publisher(v, pub);
+    std::string ctx_uuid = boost::lexical_cast<std::string>(dev->get_uuid());
+
+    std::vector<std::unique_ptr<sink>> sinks;
+    for (size_t i = 0; i < clients; i++)
+        sinks.push_back(std::make_unique<sink>(ioc, ns, splice));
+
+    io::spawn(ioc, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        dev->reg(c, ns);
+        for (size_t i = 0; i < clients; i++) {
+            api::Packet p;
+            p.set_req_id((int32_t) i);
+            auto s = p.mutable_sub_change();
+            s->set_uuid(ctx_uuid);
+            s->add_variable("v");
+            s->set_debounce(0);
+            s->set_refresh(subscription::DISABLED);
+            s->set_timeout(1);
+            sinks[i]->received(c, p);
+        }
+    });
+    ioc.run();
+
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < updates; i++) pub->update(value{(float) i});
+    double secs = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - begin).count();
+
+    size_t bytes = 0;
+    for (auto& s : sinks) bytes += s->bytes;
+    std::cout << clients << " clients, " << (splice ? "spliced: " : "per client: ")
+              << (size_t) (updates / secs) << " updates/s, "
+              << secs / updates / clients * 1e9 << " ns per client update, "
+              << (double) bytes / updates / clients << " bytes" << std::endl;
+    sinks.clear();
+}
+
+int main(int argc, char** argv) {
+    for (size_t clients : {1, 10, 100}) {
+        bench(clients, false);
+        bench(clients, true);
+    }
+}
@@ -0,0 +1,125 @@
+#include <telegraph/local/namespace.hpp>
+#include <telegraph/local/dummy_device.hpp>
+#include <telegraph/local/multicast_publisher.hpp>
+#include <telegraph/remote/multicast_receiver.hpp>
+#include <telegraph/common/publisher.hpp>
+#include <telegraph/common/nodes.hpp>
+#include "test_util.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+using namespace telegraph;
+
+namespace net = boost::asio;
+using udp = boost::asio::ip::udp;
+
+static constexpr size_t variables = 200;
+static constexpr int rounds = 50;
+static const char* mcast_group = "239.255.70.2";
+static constexpr unsigned short port = 15007;
+
+int main(int argc, char** argv) {
+    io::io_context ioc;
+    auto ns = std::make_shared<local_namespace>(ioc);
+
+    std::vector<node*> children;
+    for (size_t i = 0; i < variables; i++) {
+        std::string name = "v" + std::to_string(i);
+        children.push_back(new variable(i + 2, name, name, "", value_type::Float));
+    }
+    auto root = std::make_unique<group>(1, "test", "Test", "", "", 1, std::move(children));
+    std::vector<variable*> vars;
+    for (node* n : root->nodes()) {
+        auto v = dynamic_cast<variable*>(n);
+        if (v) vars.push_back(v);
+    }
+    auto dev = std::make_shared<dummy_device>(ioc, "test", std::move(root));
+    std::vector<publisher_ptr> pubs;
+    for (variable* v : vars) {
+        pubs.push_back(std::make_shared<publisher>(ioc, value_type::Float));
+        dev->add_publisher(v, pubs.back());
+    }
+    std::string ctx_uuid = boost::lexical_cast<std::string>(dev->get_uuid());
+
+    udp::endpoint ep{net::ip::make_address(mcast_group), port};
+    auto loopback = net::ip::make_address("127.0.0.1");
+    // one that sees everything, one that loses datagrams
+    // and one that joins late
+    std::vector<multicast_receiver_ptr> receivers;
+    for (int i = 0; i < 3; i++)
+        receivers.push_back(std::make_shared<multicast_receiver>(ioc, ep, loopback));
+
+    test::checker check;
+    io::spawn(ioc, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        dev->reg(c, ns);
+
+        params args = params::object();
+        args["group"] = params{std::string{mcast_group}};
+        args["port"] = (float) port;
+        args["interface"] = params{std::string{"127.0.0.1"}};
+        args["flush_interval"] = 0.002f;
+        args["heartbeat_interval"] = 0.05f;
+        auto pub = multicast_publisher::create(c, ioc, "mcast", "multicast_publisher", args);
+        check(pub != nullptr, "create publisher");
+        if (!pub) return;
+        pub->reg(c, ns);
+        for (variable* v : vars) {
+            params req = params::object();
+            req["type"] = params{std::string{"publish"}};
+            req["uuid"] = params{ctx_uuid};
+            req["var"] = params{std::vector<std::string>{v->get_name()}};
+            req["min_interval"] = 0.0f;
+            req["max_interval"] = subscription::DISABLED;
+            pub->request(c, req);
+        }
+
+        receivers[0]->start();
+        receivers[1]->start();
+        for (int r = 1; r <= rounds; r++) {
+            if (r == 10) receivers[2]->start();
+            if (r == 20) receivers[1]->drop_next(3);
+            // lose the tail of a burst, only a heartbeat can reveal that
+            if (r == rounds) receivers[1]->drop_next(1000);
+            for (auto& p : pubs) p->update(value{(float) r});
+            test::sleep(ioc, yield, 10);
+        }
+        test::sleep(ioc, yield, 20);
+        receivers[1]->drop_next(0);
+        // heartbeats and snapshots
+        test::sleep(ioc, yield, 500);
+
+        const char* names[] = {"lossless", "lossy", "late"};
+        for (size_t i = 0; i < receivers.size(); i++) {
+            auto& rc = receivers[i];
+            size_t current = 0;
+            for (const auto& ch : rc->get_channels()) {
+                if (ch.second.has_latest &&
+                        ch.second.latest.get_value().get<float>() == (float) rounds) current++;
+            }
+            bool ok = rc->synced() && rc->get_channels().size() == variables &&
+                      current == variables;
+            if (i == 0) ok = ok && rc->gaps() == 0;
+            if (i == 1) ok = ok && rc->gaps() >= 2 && rc->snapshots() >= 3;
+            std::ostringstream what;
+            what << names[i] << ": " << rc->received() << " datagrams, "
+                 << rc->gaps() << " gaps, " << rc->missed() << " missed, "
+                 << rc->snapshots() << " snapshots, " << current << "/" << variables
+                 << " current";
+            check(ok, what.str());
+            rc->stop();
+        }
+        pub->destroy(c);
+        ioc.stop();
+    });
+    ioc.run();
+    return check.exit_code();
+}
@@ -0,0 +1,143 @@
+#include <telegraph/local/namespace.hpp>
+#include <telegraph/local/dummy_device.hpp>
+#include <telegraph/remote/stream_server.hpp>
+#include <telegraph/remote/relay.hpp>
+#include <telegraph/common/publisher.hpp>
+#include <telegraph/common/nodes.hpp>
+#include "test_util.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <unistd.h>
+
+#include <boost/asio/io_context.hpp>
+
+using namespace telegraph;
+
+// downstream subscribers of the same variable
+static constexpr int viewers = 20;
+
+static std::shared_ptr<dummy_device>
+make_device(io::io_context& ioc, const std::string& name, publisher_ptr* pub) {
+    std::vector<node*> children;
+    auto v = new variable(2, "v", "V", "", value_type::Float);
+    auto a = new action(3, "twice", "Twice", "", value_type::Float, value_type::Float);
+    children.push_back(v);
+    children.push_back(a);
+    auto root = std::make_unique<group>(1, name, name, "", "", 1, std::move(children));
+    auto dev = std::make_shared<dummy_device>(ioc, name, std::move(root));
+    *pub = std::make_shared<publisher>(ioc, value_type::Float);
+    dev->add_publisher(v, *pub);
+    dev->add_handler(a, [] (io::yield_ctx&, value val) -> value {
+        return value{2*val.get<float>()};
+    });
+    return dev;
+}
+
+int main(int argc, char** argv) {
+    io::io_context ioc;
+    std::string path = "/tmp/telegraph-relay-test-" + std::to_string(getpid()) + ".sock";
+
+    // trackside
+    auto upstream = std::make_shared<local_namespace>(ioc);
+    publisher_ptr pub;
+    auto dev = make_device(ioc, "car", &pub);
+    // garage
+    auto downstream = std::make_shared<local_namespace>(ioc);
+    downstream->register_factory("relay", relay::create);
+
+    test::checker check;
+
+    io::spawn(ioc, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        stream_server s(ioc, path, upstream);
+        s.run(c);
+    });
+    io::spawn(ioc, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        dev->reg(c, upstream);
+        test::sleep(ioc, yield, 10);
+
+        params args = params::object();
+        args["path"] = params{path};
+        auto r = downstream->create(c, "trackside", "relay", args);
+        check(r != nullptr, "connect");
+        if (!r) {
+            ioc.stop();
+            return;
+        }
+        // the relay and the device
+        check(downstream->contexts->size() == 2, "mounted");
+        auto ctx = downstream->contexts->get(dev->get_uuid());
+        check(ctx != nullptr, "context");
+        if (!ctx) {
+            ioc.stop();
+            return;
+        }
+        auto tree = ctx->fetch(c);
+        auto v = tree ? dynamic_cast<variable*>(tree->from_path({"v"})) : nullptr;
+        check(v != nullptr, "fetch");
+        if (!v) {
+            ioc.stop();
+            return;
+        }
+
+        pub->update(value{1.0f});
+        std::vector<subscription_ptr> subs;
+        std::vector<float> latest(viewers, 0);
+        for (int i = 0; i < viewers; i++) {
+            auto s = i % 2 ? ctx->subscribe(c, v, 0, subscription::DISABLED, 1) :
+                             ctx->subscribe(c, {"v"}, 0, subscription::DISABLED, 1);
+            if (!s) continue;
+            s->data.add([&latest, i] (const datapoint& dp) {
+                latest[i] = dp.get_value().get<float>();
+            });
+            subs.push_back(s);
+        }
+        check(subs.size() == viewers, "subscribe");
+        check(pub->subscribers() == 1, "one upstream subscription");
+        test::sleep(ioc, yield, 50);
+        size_t current = 0;
+        for (float f : latest) if (f == 1.0f) current++;
+        check(current == viewers, "latest value on subscribe");
+
+        pub->update(value{2.0f});
+        test::sleep(ioc, yield, 50);
+        current = 0;
+        for (float f : latest) if (f == 2.0f) current++;
+        check(current == viewers, "updates");
+
+        auto a = dynamic_cast<action*>(tree->from_path({"twice"}));
+        value ret = a ? ctx->call(c, a, value{21.0f}, 1) : value::invalid();
+        check(ret.is_valid() && ret.get<float>() == 42.0f, "call");
+
+        auto many = ctx->subscribe_many(c, std::vector<std::vector<std::string_view>>{
+                            {"v"}, {"missing"}}, 0, subscription::DISABLED, 1);
+        check(many.size() == 2 && many[0] && !many[1], "subscribe many");
+        many.clear();
+
+        subs.clear();
+        test::sleep(ioc, yield, 50);
+        check(pub->subscribers() == 0, "cancelled upstream");
+
+        // contexts added upstream show up downstream
+        publisher_ptr pub2;
+        auto dev2 = make_device(ioc, "car2", &pub2);
+        dev2->reg(c, upstream);
+        test::sleep(ioc, yield, 50);
+        check(downstream->contexts->has(dev2->get_uuid()), "added");
+        dev2->destroy(c);
+        test::sleep(ioc, yield, 50);
+        check(!downstream->contexts->has(dev2->get_uuid()), "removed");
+
+        r->destroy(c);
+        check(downstream->contexts->size() == 0, "unmounted");
+        ioc.stop();
+    });
+    ioc.run();
+    ::unlink(path.c_str());
+    return check.exit_code();
+}
@@ -0,0 +1,171 @@
+#include <telegraph/local/namespace.hpp>
+#include <telegraph/local/dummy_device.hpp>
+#include <telegraph/remote/server.hpp>
+#include <telegraph/common/publisher.hpp>
+#include <telegraph/common/nodes.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+using namespace telegraph;
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+using tcp = boost::asio::ip::tcp;
+using work_guard = net::executor_work_guard<net::io_context::executor_type>;
+
+// every client subscribes to every variable
+static constexpr size_t variables = 64;
+static constexpr size_t clients = 32;
+static constexpr double warmup = 1;
+static constexpr double duration = 3;
+static constexpr unsigned short port = 18081;
+
+// connects a websocket client that subscribes to all variables
+// and counts the updates it gets
+static void
+run_client(io::io_context& ioc, const std::string& ctx_uuid,
+           std::atomic<size_t>& updates, io::yield_context yield) {
+    beast::error_code ec;
+    websocket::stream<beast::tcp_stream> ws{ioc};
+    beast::get_lowest_layer(ws).async_connect(
+        tcp::endpoint{net::ip::make_address("127.0.0.1"), port}, yield[ec]);
+    if (ec) { std::cerr << "connect failed: " << ec.message() << std::endl; return; }
+    ws.binary(true);
+    ws.async_handshake("127.0.0.1", "/", yield[ec]);
+    if (ec) { std::cerr << "handshake failed: " << ec.message() << std::endl; return; }
+
+    for (size_t i = 0; i < variables; i++) {
+        api::Packet p;
+        p.set_req_id((int32_t) i);
+        auto s = p.mutable_sub_change();
+        s->set_uuid(ctx_uuid);
+        s->add_variable("v" + std::to_string(i));
+        s->set_debounce(0);
+        s->set_refresh(subscription::DISABLED);
+        s->set_timeout(1);
+        std::string buf = p.SerializeAsString();
+        ws.async_write(net::buffer(buf), yield[ec]);
+        if (ec) return;
+    }
+
+    beast::flat_buffer buf;
+    api::Packet p;
+    while (true) {
+        ws.async_read(buf, yield[ec]);
+        if (ec) return;
+        p.ParseFromArray(buf.data().data(), (int) buf.size());
+        buf.consume(buf.size());
+        if (p.payload_case() == api::Packet::kBatch) {
+            size_t n = 0;
+            for (const auto& bp : p.batch().packets())
+                if (bp.payload_case() == api::Packet::kSubUpdate) n++;
+            updates += n;
+        } else if (p.payload_case() == api::Packet::kSubUpdate) {
+            updates++;
+        }
+    }
+}
+
+static void
+bench(unsigned threads) {
+    io::io_context ctx;
+    auto ns = std::make_shared<local_namespace>(ctx);
+
+    std::vector<node*> children;
+    for (size_t i = 0; i < variables; i++) {
+        std::string name = "v" + std::to_string(i);
+        children.push_back(new variable(i + 2, name, name, "", value_type::Float));
+    }
+    auto root = std::make_unique<group>(1, "bench", "Bench", "", "", 1, std::move(children));
+    std::vector<variable*> vars;
+    for (node* n : root->nodes()) {
+        auto v = dynamic_cast<variable*>(n);
+        if (v) vars.push_back(v);
+    }
+    auto dev = std::make_shared<dummy_device>(ctx, "bench", std::move(root));
+    std::vector<publisher_ptr> pubs;
+    for (variable* v : vars) {
+        pubs.push_back(std::make_shared<publisher>(ctx, value_type::Float));
+        dev->add_publisher(v, pubs.back());
+    }
+    std::string ctx_uuid = boost::lexical_cast<std::string>(dev->get_uuid());
+
+    std::vector<std::unique_ptr<io::io_context>> shards;
+    std::vector<work_guard> guards;
+    std::vector<std::thread> shard_threads;
+    for (unsigned i = 1; i < threads; i++) {
+        shards.push_back(std::make_unique<io::io_context>(1));
+        guards.push_back(net::make_work_guard(*shards.back()));
+        shard_threads.emplace_back([&shard = *shards.back()] () { shard.run(); });
+    }
+
+    io::spawn(ctx, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        dev->reg(c, ns);
+        server s(ctx, tcp::endpoint{net::ip::make_address("127.0.0.1"), port}, ns);
+        for (auto& shard : shards) s.add_shard(*shard);
+        try {
+            s.run(c);
+        } catch (const std::exception& e) {
+            std::cerr << "server: " << e.what() << std::endl;
+        }
+    });
+    // publish as fast as the server's thread allows
+    io::spawn(ctx, [&] (io::yield_context yield) {
+        io::deadline_timer timer{ctx};
+        boost::system::error_code ec;
+        for (float x = 0; !ctx.stopped(); x++) {
+            for (auto& p : pubs) p->update(value{x});
+            timer.expires_from_now(boost::posix_time::microseconds(0));
+            timer.async_wait(yield[ec]);
+        }
+    });
+    std::thread server_thread([&ctx] () { ctx.run(); });
+
+    // the clients get a thread of their own
+    io::io_context client_ioc;
+    std::atomic<size_t> updates{0};
+    for (size_t i = 0; i < clients; i++) {
+        io::spawn(client_ioc, [&] (io::yield_context yield) {
+            run_client(client_ioc, ctx_uuid, updates, yield);
+        });
+    }
+    std::thread client_thread([&client_ioc] () { client_ioc.run(); });
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(warmup));
+    size_t start = updates;
+    auto begin = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+    size_t received = updates - start;
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::cout << threads << " threads: " << (size_t) (received / secs) << " updates/s to "
+              << clients << " clients" << std::endl;
+
+    client_ioc.stop();
+    client_thread.join();
+    ctx.stop();
+    server_thread.join();
+    guards.clear();
+    for (auto& shard : shards) shard->stop();
+    for (auto& t : shard_threads) t.join();
+}
+
+int main(int argc, char** argv) {
+    unsigned max_threads = std::max(2u, std::thread::hardware_concurrency());
+    if (argc > 1) max_threads = std::max(1, std::stoi(argv[1]));
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) bench(threads);
+}
@@ -0,0 +1,52 @@
+#include <telegraph/local/session_logger.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+
+using namespace telegraph;
+
+// 10 minutes of 20 variables at 1khz
+static constexpr size_t samples = 10*60*1000*20;
+
+int main(int argc, char** argv) {
+    std::filesystem::path p = std::filesystem::temp_directory_path() / "session-bench.tlog";
+    size_t read = 0;
+    {
+        session_logger logger{p, 0};
+        // time batches of calls, the clock is too coarse for single ones
+        constexpr size_t batch = 100;
+        std::vector<double> batch_ns;
+        batch_ns.reserve(samples / batch);
+
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < samples; i += batch) {
+            auto b = std::chrono::steady_clock::now();
+            for (size_t j = i; j < i + batch; j++) {
+                logger.update((int64_t) (j / 20) * 1000, (int32_t) (j % 20), value{(float) j});
+            }
+            auto e = std::chrono::steady_clock::now();
+            batch_ns.push_back(std::chrono::duration<double, std::nano>(e - b).count() / batch);
+        }
+        auto end = std::chrono::steady_clock::now();
+        logger.flush();
+        auto flushed = std::chrono::steady_clock::now();
+
+        std::sort(batch_ns.begin(), batch_ns.end());
+        double total = std::chrono::duration<double, std::nano>(end - begin).count();
+        std::cout << "update: " << total / samples << " ns mean, "
+                  << batch_ns[batch_ns.size() / 2] << " ns p50, "
+                  << batch_ns[(size_t) (batch_ns.size() * 0.999)] << " ns p99.9" << std::endl;
+        std::cout << "drain: " << std::chrono::duration<double, std::milli>(flushed - end).count()
+                  << " ms after the last update" << std::endl;
+        std::cout << "written: " << logger.written() << "/" << samples << " events, "
+                  << (double) std::filesystem::file_size(p) / samples << " bytes/event" << std::endl;
+    }
+    session_logger::read(p, [&read](int64_t, const log::LogPacket& packet) {
+        read += packet.events_size();
+    });
+    std::cout << "read back: " << read << " events" << std::endl;
+    std::filesystem::remove(p);
+    return read == samples ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+#include <telegraph/local/session_logger.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <chrono>
+
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace telegraph;
+
+// checks that the log holds updates 0..n-1 in order,
+// i.e. that nothing after a crash is corrupt or out of order
+static bool check(const std::filesystem::path& p, size_t* n) {
+    *n = 0;
+    bool ok = true;
+    int64_t last_time = 0;
+    bool valid = session_logger::read(p, [&](int64_t t, const log::LogPacket& packet) {
+        for (const log::LogEvent& e : packet.events()) {
+            if (!e.has_update()) continue;
+            int32_t expected = (int32_t) *n;
+            ok = ok && e.update().val().i32() == expected && t >= last_time;
+            (*n)++;
+        }
+        last_time = t;
+    });
+    return valid && ok;
+}
+
+int main(int argc, char** argv) {
+    std::filesystem::path p = std::filesystem::temp_directory_path() / "session-crash-test.tlog";
+    int failures = 0;
+    for (int run = 0; run < 5; run++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // the child logs until it is killed
+            session_logger logger{p, 0, 256, 0.01f};
+            for (int32_t i = 0;; i++) {
+                logger.update(i, 1, value{i});
+                if (i % 1000 == 0) std::this_thread::sleep_for(std::chrono::microseconds{100});
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds{100 + 50 * run});
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+
+        size_t n = 0;
+        bool ok = check(p, &n);
+        std::cout << "killed: " << n << " updates recovered " << (ok ? "ok" : "FAILED") << std::endl;
+        if (!ok || n == 0) failures++;
+
+        // tear the last block as a partial write would
+        auto size = std::filesystem::file_size(p);
+        std::filesystem::resize_file(p, size - 3);
+        {
+            std::fstream f(p, std::ios::in | std::ios::out | std::ios::binary);
+            f.seekp(size - 64);
+            f.put('\xff');
+        }
+        size_t torn = 0;
+        ok = check(p, &torn);
+        std::cout << "torn: " << torn << " updates recovered " << (ok ? "ok" : "FAILED") << std::endl;
+        if (!ok || torn > n) failures++;
+    }
+    std::filesystem::remove(p);
+    return failures == 0 ? 0 : 1;
+}
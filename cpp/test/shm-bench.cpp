@@ -0,0 +1,92 @@
+#include <telegraph/common/shm_ring.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+using namespace telegraph;
+
+static constexpr size_t capacity = 65536;
+static constexpr size_t records = 4000000;
+// for the latency test
+static constexpr size_t samples = 100000;
+static const char* shm_name = "/telegraph-shm-bench";
+
+static int64_t
+now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char** argv) {
+    shm_writer writer{shm_name, capacity, true};
+    if (!writer.valid()) {
+        std::cerr << "failed to create shared memory segment" << std::endl;
+        return 1;
+    }
+    shm_reader reader{shm_name};
+    if (!reader.valid()) {
+        std::cerr << "failed to open shared memory segment" << std::endl;
+        return 1;
+    }
+
+    // raw write and read cost, the reader falls
+    // behind so it only sees the last capacity records
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < records; i++) writer.write((uint16_t) (i % 256), (int64_t) i, value{(float) i});
+    double wsecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    shm_sample s;
+    size_t read = 0;
+    begin = std::chrono::steady_clock::now();
+    while (reader.next(&s)) read++;
+    double rsecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    bool ok = read == capacity && reader.dropped() == records - capacity &&
+              s.time == (int64_t) records - 1 && s.get_value().get<float>() == (float) (records - 1);
+
+    begin = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (size_t i = 0; i < records; i++) found += reader.latest((uint16_t) (i % 256), &s);
+    double lsecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    ok = ok && found == records;
+
+    std::cout << "write: " << wsecs / records * 1e9 << " ns/record" << std::endl;
+    std::cout << "read: " << rsecs / read * 1e9 << " ns/record, "
+              << reader.dropped() << " dropped, " << (ok ? "ok" : "FAILED") << std::endl;
+    std::cout << "latest: " << lsecs / records * 1e9 << " ns/lookup" << std::endl;
+
+    // latency from write to read, with the write time in the value
+    std::vector<int64_t> latencies;
+    latencies.reserve(samples);
+    std::atomic<bool> ready{false};
+    std::atomic<bool> done{false};
+    uint64_t lost = 0;
+    std::thread consumer([&] () {
+        shm_reader r{shm_name};
+        ready = true;
+        shm_sample cs;
+        while (true) {
+            if (r.next(&cs)) latencies.push_back(now_ns() - cs.get_value().get<int64_t>());
+            else if (done) break;
+        }
+        lost = r.dropped();
+    });
+    while (!ready) std::this_thread::yield();
+    for (size_t i = 0; i < samples; i++) {
+        writer.write(0, (int64_t) i, value{now_ns()});
+        // spaced out so the reader can keep up
+        int64_t until = now_ns() + 2000;
+        while (now_ns() < until) {}
+    }
+    done = true;
+    consumer.join();
+    if (latencies.empty()) return 1;
+    std::sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    std::cout << "latency: median " << latencies[n / 2] << " ns, "
+              << "p99 " << latencies[n * 99 / 100] << " ns, "
+              << lost << " dropped" << std::endl;
+}
@@ -0,0 +1,37 @@
+#ifndef __TELEGRAPH_TEST_UTIL_HPP__
+#define __TELEGRAPH_TEST_UTIL_HPP__
+
+#include <telegraph/utils/io.hpp>
+
+#include <iostream>
+#include <string>
+
+#include <boost/asio/deadline_timer.hpp>
+
+namespace telegraph {
+    namespace test {
+        // suspends the calling coroutine for ms milliseconds
+        inline void
+        sleep(io::io_context& ioc, io::yield_context yield, long ms) {
+            io::deadline_timer timer{ioc};
+            timer.expires_from_now(boost::posix_time::milliseconds(ms));
+            timer.async_wait(yield);
+        }
+
+        // prints the outcome of each check and counts the failures,
+        // main() returns exit_code()
+        class checker {
+        public:
+            void operator()(bool ok, const std::string& what) {
+                std::cout << what << ": " << (ok ? "ok" : "FAILED") << std::endl;
+                if (!ok) failures_++;
+            }
+            int failures() const { return failures_; }
+            int exit_code() const { return failures_ ? 1 : 0; }
+        private:
+            int failures_ = 0;
+        };
+    }
+}
+
+#endif
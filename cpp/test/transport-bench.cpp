@@ -0,0 +1,236 @@
+#include <telegraph/local/namespace.hpp>
+#include <telegraph/local/dummy_device.hpp>
+#include <telegraph/remote/server.hpp>
+#include <telegraph/remote/stream_server.hpp>
+#include <telegraph/common/nodes.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <google/protobuf/io/coded_stream.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#endif
+
+using namespace telegraph;
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+using tcp = boost::asio::ip::tcp;
+using coded = google::protobuf::io::CodedOutputStream;
+
+// calls in flight at any time
+static constexpr size_t window = 64;
+static constexpr size_t calls = 200000;
+static constexpr unsigned short ws_port = 18082;
+static constexpr unsigned short tcp_port = 18083;
+static const char* unix_path = "/tmp/telegraph-transport-bench.sock";
+
+// cpu time used by the server's thread, in ns
+static std::function<int64_t()> server_cpu = [] () { return (int64_t) 0; };
+
+static api::Packet
+make_call(const std::string& ctx_uuid, int32_t req_id) {
+    api::Packet p;
+    p.set_req_id(req_id);
+    auto c = p.mutable_call_action();
+    c->set_uuid(ctx_uuid);
+    c->add_action("echo");
+    value{(float) req_id}.pack(c->mutable_value());
+    c->set_timeout(1);
+    return p;
+}
+
+// keeps window calls in flight until all calls have returned.
+// write_packets sends a set of packets, read_packets
+// returns the next packets received (empty once closed)
+static void
+run_calls(const std::string& ctx_uuid, const std::string& name,
+        const std::function<void(std::vector<api::Packet>&)>& write_packets,
+        const std::function<std::vector<api::Packet>()>& read_packets) {
+    auto begin = std::chrono::steady_clock::now();
+    int64_t cpu_begin = server_cpu();
+    size_t sent = 0;
+    size_t returned = 0;
+    std::vector<api::Packet> out;
+    for (; sent < window; sent++) out.push_back(make_call(ctx_uuid, (int32_t) sent));
+    write_packets(out);
+    while (returned < calls) {
+        std::vector<api::Packet> in = read_packets();
+        if (in.empty()) {
+            std::cerr << name << ": connection closed" << std::endl;
+            return;
+        }
+        out.clear();
+        for (const api::Packet& p : in) {
+            if (p.payload_case() != api::Packet::kCallReturn) continue;
+            returned++;
+            if (sent < calls) out.push_back(make_call(ctx_uuid, (int32_t) sent++));
+        }
+        if (!out.empty()) write_packets(out);
+    }
+    double secs = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - begin).count();
+    double cpu = (double) (server_cpu() - cpu_begin) / calls;
+    std::cout << name << ": " << (size_t) (calls / secs) << " calls/s, "
+              << (size_t) cpu << " ns server cpu/call" << std::endl;
+}
+
+static void
+bench_websocket(const std::string& ctx_uuid) {
+    net::io_context ioc;
+    websocket::stream<tcp::socket> ws{ioc};
+    ws.next_layer().connect(tcp::endpoint{net::ip::make_address("127.0.0.1"), ws_port});
+    ws.binary(true);
+    ws.handshake("127.0.0.1", "/");
+    beast::flat_buffer buf;
+    run_calls(ctx_uuid, "websocket",
+        [&] (std::vector<api::Packet>& out) {
+            // the server unpacks batches, so send one frame
+            api::Packet batch;
+            for (auto& p : out) batch.mutable_batch()->add_packets()->Swap(&p);
+            ws.write(net::buffer(batch.SerializeAsString()));
+        },
+        [&] () {
+            std::vector<api::Packet> in;
+            beast::error_code ec;
+            ws.read(buf, ec);
+            if (ec) return in;
+            api::Packet p;
+            p.ParseFromArray(buf.data().data(), (int) buf.size());
+            buf.consume(buf.size());
+            if (p.payload_case() == api::Packet::kBatch) {
+                for (auto& bp : *p.mutable_batch()->mutable_packets())
+                    in.push_back(std::move(bp));
+            } else {
+                in.push_back(std::move(p));
+            }
+            return in;
+        });
+    ws.close(websocket::close_code::normal);
+}
+
+template<typename Socket>
+    static void
+    bench_stream(const std::string& ctx_uuid, const std::string& name, Socket& socket) {
+        std::vector<uint8_t> rbuf;
+        std::string wbuf;
+        run_calls(ctx_uuid, name,
+            [&] (std::vector<api::Packet>& out) {
+                wbuf.clear();
+                for (auto& p : out) {
+                    uint8_t prefix[5];
+                    size_t size = p.ByteSizeLong();
+                    uint8_t* end = coded::WriteVarint32ToArray((uint32_t) size, prefix);
+                    wbuf.append((const char*) prefix, end - prefix);
+                    p.AppendToString(&wbuf);
+                }
+                net::write(socket, net::buffer(wbuf));
+            },
+            [&] () {
+                std::vector<api::Packet> in;
+                while (in.empty()) {
+                    uint8_t chunk[64*1024];
+                    boost::system::error_code ec;
+                    size_t n = socket.read_some(net::buffer(chunk), ec);
+                    if (ec) return in;
+                    rbuf.insert(rbuf.end(), chunk, chunk + n);
+                    size_t pos = 0;
+                    while (pos < rbuf.size()) {
+                        google::protobuf::io::CodedInputStream cis(
+                                rbuf.data() + pos, (int) (rbuf.size() - pos));
+                        uint32_t len;
+                        if (!cis.ReadVarint32(&len)) break;
+                        size_t prefix = (size_t) cis.CurrentPosition();
+                        if (rbuf.size() - pos - prefix < len) break;
+                        api::Packet p;
+                        p.ParseFromArray(rbuf.data() + pos + prefix, (int) len);
+                        in.push_back(std::move(p));
+                        pos += prefix + len;
+                    }
+                    rbuf.erase(rbuf.begin(), rbuf.begin() + pos);
+                }
+                return in;
+            });
+    }
+
+int main(int argc, char** argv) {
+    io::io_context ctx;
+    auto ns = std::make_shared<local_namespace>(ctx);
+
+    auto echo = new action(2, "echo", "Echo", "", value_type::Float, value_type::Float);
+    std::vector<node*> children{echo};
+    auto root = std::make_unique<group>(1, "bench", "Bench", "", "", 1, std::move(children));
+    auto dev = std::make_shared<dummy_device>(ctx, "bench", std::move(root));
+    dev->add_handler(echo, [] (io::yield_ctx&, value v) { return v; });
+    std::string ctx_uuid = boost::lexical_cast<std::string>(dev->get_uuid());
+
+    io::spawn(ctx, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        dev->reg(c, ns);
+    });
+    io::spawn(ctx, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        server s(ctx, tcp::endpoint{net::ip::make_address("127.0.0.1"), ws_port}, ns);
+        s.run(c);
+    });
+    io::spawn(ctx, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        stream_server s(ctx, tcp::endpoint{net::ip::make_address("127.0.0.1"), tcp_port}, ns);
+        s.run(c);
+    });
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    io::spawn(ctx, [&] (io::yield_context yield) {
+        io::yield_ctx c(yield);
+        stream_server s(ctx, unix_path, ns);
+        s.run(c);
+    });
+#endif
+    std::thread server_thread([&ctx] () { ctx.run(); });
+#ifndef _WIN32
+    clockid_t server_clock;
+    if (pthread_getcpuclockid(server_thread.native_handle(), &server_clock) == 0) {
+        server_cpu = [server_clock] () {
+            timespec ts;
+            clock_gettime(server_clock, &ts);
+            return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+        };
+    }
+#endif
+    // let the servers start listening
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    bench_websocket(ctx_uuid);
+    {
+        net::io_context ioc;
+        tcp::socket socket{ioc};
+        socket.connect(tcp::endpoint{net::ip::make_address("127.0.0.1"), tcp_port});
+        socket.set_option(tcp::no_delay(true));
+        bench_stream(ctx_uuid, "tcp", socket);
+    }
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    {
+        net::io_context ioc;
+        net::local::stream_protocol::socket socket{ioc};
+        socket.connect(net::local::stream_protocol::endpoint(unix_path));
+        bench_stream(ctx_uuid, "unix", socket);
+    }
+#endif
+
+    ctx.stop();
+    server_thread.join();
+}
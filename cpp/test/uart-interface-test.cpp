@@ -0,0 +1,95 @@
+// Compiles wire::uart_interface against the nanopb stream protocol and
+// runs a change_subs through it over a loopback uart. The tree is empty,
+// so every change fails and the reply is an all-zero bitmap
+#include <wire/uart_interface.hpp>
+#include "test_util.hpp"
+
+#include <deque>
+#include <vector>
+#include <iostream>
+#include <string>
+
+struct loopback_uart {
+    std::deque<uint8_t> rx;
+    std::deque<uint8_t> tx;
+
+    size_t try_write(const uint8_t* buf, size_t len) {
+        tx.insert(tx.end(), buf, buf + len);
+        return len;
+    }
+    size_t try_read(uint8_t* buf, size_t len) {
+        size_t n = 0;
+        for (; n < len && !rx.empty(); n++) {
+            buf[n] = rx.front();
+            rx.pop_front();
+        }
+        return n;
+    }
+    bool has_data() const { return !rx.empty(); }
+    void flush() {}
+};
+
+struct fixed_clock {
+    uint32_t millis() const { return 1; }
+};
+
+// every member is compiled, not just the ones used below
+template class wire::uart_interface<loopback_uart, fixed_clock>;
+
+// undoes the framing of write_packet(), false if there is no whole frame
+static bool
+read_frame(std::deque<uint8_t>* in, telegraph_stream_Packet* p) {
+    std::vector<uint8_t> payload;
+    bool started = false, escaped = false;
+    uint8_t prev = 0;
+    while (!in->empty()) {
+        uint8_t b = in->front();
+        in->pop_front();
+        if (!started) {
+            started = b == 0x53 && prev == 0x53;
+            prev = b;
+            continue;
+        }
+        if (escaped) {
+            payload.push_back(b);
+            escaped = false;
+        } else if (b == 0x40) {
+            escaped = true;
+        } else if (b == 0x45) {
+            if (payload.size() < 4) return false;
+            pb_istream_t s = pb_istream_from_buffer(payload.data(), payload.size() - 4);
+            return pb_decode(&s, telegraph_stream_Packet_fields, p);
+        } else {
+            payload.push_back(b);
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    loopback_uart uart;
+    fixed_clock clock;
+    wire::uart_interface<loopback_uart, fixed_clock> iface{&uart, &clock, nullptr, nullptr, 0};
+
+    telegraph::test::checker check;
+
+    telegraph_stream_Packet req = telegraph_stream_Packet_init_default;
+    req.req_id = 7;
+    req.which_event = telegraph_stream_Packet_change_subs_tag;
+    req.event.change_subs.subs_count = 3;
+    for (pb_size_t i = 0; i < 3; i++) {
+        req.event.change_subs.subs[i].var_id = i + 1;
+        req.event.change_subs.subs[i].refresh = 1000;
+    }
+    // the host's frame, written with the same framing
+    iface.write_packet(req);
+    uart.rx.swap(uart.tx);
+    while (uart.has_data()) iface.resume();
+
+    telegraph_stream_Packet res = telegraph_stream_Packet_init_default;
+    check(read_frame(&uart.tx, &res), "one reply");
+    check(res.req_id == 7 &&
+          res.which_event == telegraph_stream_Packet_changed_subs_tag &&
+          res.event.changed_subs == 0, "changed_subs");
+    return check.exit_code();
+}
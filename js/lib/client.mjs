@@ -149,6 +149,73 @@ class RemoteContext extends Context {
 		this.params = params;
 		this.headless = headless;
 		this._adapters = new Map();
+		this._handles = new Map();
+		this._pendingSubs = null;
+	}
+
+	// subscriptions started around the same time (like by a dashboard
+	// being opened) go out as a single sub_change_batch, resolves to
+	// the response and stream just like requestStream()
+	_subStream(subChange) {
+		return new Promise((res, rej) => {
+			if (!this._pendingSubs) {
+				this._pendingSubs = [];
+				setTimeout(() => this._flushSubs(), 0);
+			}
+			this._pendingSubs.push({ subChange: subChange, res: res, rej: rej });
+		});
+	}
+
+	async _flushSubs() {
+		var pending = this._pendingSubs;
+		this._pendingSubs = null;
+		var conn = this.ns._conn;
+		if (pending.length == 1) {
+			conn.requestStream({ subChange: pending[0].subChange })
+				.then(pending[0].res, pending[0].rej);
+			return;
+		}
+		var streams = pending.map(() => conn.openStream());
+		var response = null;
+		try {
+			response = await conn.requestResponse({
+				subChangeBatch: {
+					subs: pending.map((p) => p.subChange),
+					streams: streams.map((s) => s.reqId),
+				},
+			});
+		} catch (e) {
+			for (let s of streams) s.close();
+			for (let p of pending) p.rej(e);
+			return;
+		}
+		pending.forEach((p, i) => {
+			var type = response.payload == "subTypes" ? response.subTypes.types[i] : null;
+			// INVALID (0) where that one failed
+			if (type && type.type) {
+				p.res([{ payload: "subType", subType: type }, streams[i]]);
+			} else {
+				streams[i].close();
+				p.res([response.payload == "error" ? response :
+						{ payload: "success", success: false }, streams[i]]);
+			}
+		});
+	}
+
+	// looks up a path once on the server, later requests for it
+	// only carry the integer handle returned. Resolves to null if
+	// the path can't be resolved (or the server has no handles)
+	resolve(path) {
+		var key = path.join("/");
+		var handle = this._handles.get(key);
+		if (handle === undefined) {
+			handle = this.ns._conn
+				.requestResponse({ resolve: { uuid: this.uuid, path: path } })
+				.then((res) => (res.payload == "resolved" ? res.resolved : null))
+				.catch(() => null);
+			this._handles.set(key, handle);
+		}
+		return handle;
 	}
 
 	// will use locally-cached copy, re-fetch otherwise
@@ -210,17 +277,18 @@ class RemoteContext extends Context {
 					// if we need a new stream, get one
 					if (adapter_response == null) {
 						adapter_response = (async () => {
+							let handle = await this.resolve(path);
 							let req = {
 								subChange: {
-									uuid: this.uuid,
-									variable: path,
 									debounce: debounce,
 									refresh: refresh,
 									timeout: timeout,
 									placeholderOnFail: true,
 								},
 							};
-							let [response, s] = await this.ns._conn.requestStream(req);
+							if (handle) req.subChange.handle = handle;
+							else Object.assign(req.subChange, { uuid: this.uuid, variable: path });
+							let [response, s] = await this._subStream(req.subChange);
 							checkError(response);
 							if (response.payload != "subType") {
 								s.close();
@@ -287,14 +355,16 @@ class RemoteContext extends Context {
 
 	async call(action, value, timeout = 1) {
 		if (!this.ns || !this.ns._conn) throw new Error("Not connected!");
+		var path = action.path();
+		var handle = await this.resolve(path);
 		var msg = {
 			callAction: {
-				uuid: this.uuid,
-				action: action.path(),
 				value: Value.pack(value, action.getArgType()),
 				timeout: timeout,
 			},
 		};
+		if (handle) msg.callAction.handle = handle;
+		else Object.assign(msg.callAction, { uuid: this.uuid, action: path });
 		var response = await this.ns._conn.requestResponse(msg);
 		if (response.payload != "callReturn") return null;
 		var dp = response.callReturn;
@@ -304,33 +374,69 @@ class RemoteContext extends Context {
 		};
 	}
 
-	async query(variable) {
+	// start/end are in milliseconds, if given the initial
+	// response contains the datapoints in that range (downsampled to
+	// roughly the given number of points). Use query.range() to zoom.
+	async query(variable, start = 0, end = 0, points = 0, downsample = "MIN_MAX") {
 		if (!this.ns || !this.ns._conn) throw new Error("Not connected!");
+		var type = variable.getType();
+		var unpack = (packet) =>
+			packet.data.map((dp) => {
+				return { t: parseInt(dp.timestamp), v: Value.unpack(dp.value, type) };
+			});
+		var path = variable.path();
+		var handle = await this.resolve(path);
 		var msg = {
 			dataQuery: {
-				uuid: this.uuid,
-				path: variable.path(),
+				start: start,
+				end: end,
+				points: points,
+				downsample: downsample,
 			},
 		};
+		if (handle) msg.dataQuery.handle = handle;
+		else Object.assign(msg.dataQuery, { uuid: this.uuid, path: path });
 		var [res, stream] = await this.ns._conn.requestStream(msg);
 		checkError(res);
 		if (res.payload == "success" && !res.success) {
+			stream.close();
 			return null;
 		}
 		var valid = res.payload == "archiveData";
 		var query = new DataQuery(valid);
 		if (valid) {
-			console.log(res.archiveData);
+			query.process(unpack(res.archiveData));
 		}
+		// fetch a new range without re-sending the raw data,
+		// returns the (downsampled) points in the range
+		query.range = async (start, end, points = 0, downsample = "MIN_MAX") => {
+			// live updates keep coming in on the same reqId
+			var r = await stream.request({
+				dataQuery: {
+					start: start,
+					end: end,
+					points: points,
+					downsample: downsample,
+				},
+			}, (packet) => packet.payload == "archiveData" || packet.payload == "error");
+			checkError(r);
+			return r.archiveData ? unpack(r.archiveData) : [];
+		};
 		stream.received.add((packet) => {
 			if (packet.payload == "archiveUpdate") {
-				console.log(packet.archiveUpdate);
-				query.process([]);
+				query.process(unpack(packet.archiveUpdate));
 			} else if (packet.payload == "cancel") {
 				stream.close();
 				query.close();
 			}
 		});
+		query.closed.add(() => {
+			if (!stream.isClosed) {
+				stream.send({ cancel: 0 });
+				stream.close();
+			}
+		});
+		stream.start();
 		return query;
 	}
 
@@ -82,8 +82,10 @@ export class Stream {
   send(msg) {
     this.conn.writeBack(this.reqId, msg);
   }
-  request(msg) {
-    return this.conn.requestResponse(msg, this.reqId);
+  // the stream's own packets share the reqId with the reply,
+  // accepts(packet) tells the reply apart
+  request(msg, accepts=null) {
+    return this.conn.requestResponse(msg, this.reqId, accepts);
   }
 }
 
@@ -158,6 +160,11 @@ export class Connection {
   }
 
   received(packet) {
+    // the server combines queued packets into a single message
+    if (packet.payload == 'batch') {
+      for (let p of packet.batch.packets) this.received(p);
+      return;
+    }
     console.log('received:', packet);
     var reqId = packet.reqId;
     var payloadType = packet.payload;
@@ -165,8 +172,9 @@ export class Connection {
     if (this._handlers.has(payloadType)) {
       this._handlers.get(payloadType)(packet);
     }
-    if (this._openRequests.has(reqId)) {
-      this._openRequests.get(reqId)(packet);
+    // a request callback returns false if the packet isn't its reply
+    if (this._openRequests.has(reqId) &&
+        this._openRequests.get(reqId)(packet) !== false) {
       this._openRequests.delete(reqId);
       return;
     }
@@ -175,17 +183,31 @@ export class Connection {
     }
   }
 
-  async requestResponse(req, customId=null) {
+  async requestResponse(req, customId=null, accepts=null) {
     var send = new Promise((res, rej) => {
-      var reqId = customId ? customId : 
+      var reqId = customId !== null && customId !== undefined ? customId :
           this._countUp ? this._counter++ : this._counter--;
-      this._openRequests.set(reqId, (packet) => packet == null ? rej('Connection closed') : res(packet));
+      this._openRequests.set(reqId, (packet) => {
+        if (packet == null) return rej('Connection closed');
+        if (accepts && !accepts(packet)) return false;
+        res(packet);
+      });
       req.reqId = reqId;
       this.send(req);
     });
     return await send;
   }
 
+  // a stream whose request is sent some other way,
+  // like the subscriptions of a sub_change_batch
+  openStream() {
+    var reqId = this._countUp ? this._counter++ : this._counter--;
+    var stream = new Stream(reqId, this);
+    stream.closed.add(() => this._openStreams.delete(reqId));
+    this._openStreams.set(reqId, stream);
+    return stream;
+  }
+
   async requestStream(req) {
     var stream = new Stream(-1, this);
     var send = new Promise((res, rej) => {